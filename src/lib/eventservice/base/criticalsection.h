@@ -28,6 +28,7 @@
 #ifndef EVENTSERVICES_BASE_CRITICALSECTION_H__
 #define EVENTSERVICES_BASE_CRITICALSECTION_H__
 
+#include "eventservice/base/basictypes.h"
 #include "eventservice/base/constructormagic.h"
 
 #ifdef WIN32
@@ -189,6 +190,74 @@ class AtomicOps {
   static int Decrement(int* i) {
     return ::InterlockedDecrement(reinterpret_cast<LONG*>(i));
   }
+  // Load, Store and Exchange are full barriers
+  static int Load(int* i) {
+    return ::InterlockedCompareExchange(reinterpret_cast<LONG*>(i), 0, 0);
+  }
+  static void Store(int* i, int value) {
+    ::InterlockedExchange(reinterpret_cast<LONG*>(i), value);
+  }
+  static int Exchange(int* i, int value) {
+    return ::InterlockedExchange(reinterpret_cast<LONG*>(i), value);
+  }
+  // LoadPtr, StorePtr, ExchangePtr, Load64 and CompareAndSwap64 are full
+  // barriers
+  template <class T> static T* LoadPtr(T** p) {
+    return static_cast<T*>(::InterlockedCompareExchangePointer(
+                             reinterpret_cast<PVOID volatile*>(p), NULL, NULL));
+  }
+  template <class T> static void StorePtr(T** p, T* value) {
+    ExchangePtr(p, value);
+  }
+  template <class T> static T* ExchangePtr(T** p, T* value) {
+    return static_cast<T*>(::InterlockedExchangePointer(
+                             reinterpret_cast<PVOID volatile*>(p), value));
+  }
+  static uint64 Load64(uint64* i) {
+    return ::InterlockedCompareExchange64(
+             reinterpret_cast<LONGLONG volatile*>(i), 0, 0);
+  }
+  static bool CompareAndSwap64(uint64* i, uint64 old_value, uint64 new_value) {
+    return ::InterlockedCompareExchange64(
+             reinterpret_cast<LONGLONG volatile*>(i), new_value, old_value)
+           == static_cast<LONGLONG>(old_value);
+  }
+#elif defined(__GNUC__)
+  static int Increment(int* i) {
+    return __sync_add_and_fetch(i, 1);
+  }
+  static int Decrement(int* i) {
+    return __sync_sub_and_fetch(i, 1);
+  }
+  // Load, Store and Exchange are full barriers
+  static int Load(int* i) {
+    return __sync_fetch_and_add(i, 0);
+  }
+  static void Store(int* i, int value) {
+    Exchange(i, value);
+  }
+  static int Exchange(int* i, int value) {
+    // __sync_lock_test_and_set is only an acquire barrier
+    __sync_synchronize();
+    return __sync_lock_test_and_set(i, value);
+  }
+  // LoadPtr and Load64 are acquire barriers, StorePtr is a release barrier,
+  // ExchangePtr and CompareAndSwap64 are full barriers
+  template <class T> static T* LoadPtr(T** p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+  template <class T> static void StorePtr(T** p, T* value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+  }
+  template <class T> static T* ExchangePtr(T** p, T* value) {
+    return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+  }
+  static uint64 Load64(uint64* i) {
+    return __atomic_load_n(i, __ATOMIC_ACQUIRE);
+  }
+  static bool CompareAndSwap64(uint64* i, uint64 old_value, uint64 new_value) {
+    return __sync_bool_compare_and_swap(i, old_value, new_value);
+  }
 #else
   static int Increment(int* i) {
     // Could be faster, and less readable:
@@ -197,7 +266,6 @@ class AtomicOps {
     CritScope scope(StaticCrit());
     return ++(*i);
   }
-
   static int Decrement(int* i) {
     // Could be faster, and less readable:
     // static CriticalSection* crit = StaticCrit();
@@ -205,6 +273,46 @@ class AtomicOps {
     CritScope scope(StaticCrit());
     return --(*i);
   }
+  static int Load(int* i) {
+    CritScope scope(StaticCrit());
+    return *i;
+  }
+  static void Store(int* i, int value) {
+    CritScope scope(StaticCrit());
+    *i = value;
+  }
+  static int Exchange(int* i, int value) {
+    CritScope scope(StaticCrit());
+    int old = *i;
+    *i = value;
+    return old;
+  }
+  template <class T> static T* LoadPtr(T** p) {
+    CritScope scope(StaticCrit());
+    return *p;
+  }
+  template <class T> static void StorePtr(T** p, T* value) {
+    CritScope scope(StaticCrit());
+    *p = value;
+  }
+  template <class T> static T* ExchangePtr(T** p, T* value) {
+    CritScope scope(StaticCrit());
+    T* old = *p;
+    *p = value;
+    return old;
+  }
+  static uint64 Load64(uint64* i) {
+    CritScope scope(StaticCrit());
+    return *i;
+  }
+  static bool CompareAndSwap64(uint64* i, uint64 old_value, uint64 new_value) {
+    CritScope scope(StaticCrit());
+    if (*i != old_value) {
+      return false;
+    }
+    *i = new_value;
+    return true;
+  }
 
  private:
   static CriticalSection* StaticCrit() {
@@ -30,6 +30,7 @@
 #define EVENTSERVICES_BASE_SOCKET_H__
 
 #include <errno.h>
+#include <vector>
 
 #ifdef POSIX
 #include <sys/types.h>
@@ -152,9 +153,18 @@ enum Option {
   OPT_SNDBUF,      // send buffer size
   OPT_NODELAY,     // whether Nagle algorithm is enabled
   OPT_IPV6_V6ONLY,  // Whether the socket is IPv6 only.
-  OPT_MULTICAST_MEMBERSHIP
+  OPT_MULTICAST_MEMBERSHIP,
+  OPT_REUSEADDR,   // SO_REUSEADDR
+  OPT_REUSEPORT    // SO_REUSEPORT, the kernel balances the connections
 };
 
+// 一个UDP数据报和它的对端地址
+struct Datagram {
+  MemBuffer::Ptr buffer;
+  SocketAddress  addr;
+};
+typedef std::vector<Datagram> Datagrams;
+
 // General interface for the socket implementations of various networks.  The
 // methods match those of normal UNIX sockets very closely.
 class Socket : public boost::noncopyable,
@@ -184,11 +194,36 @@ class Socket : public boost::noncopyable,
   virtual int Connect(const SocketAddress& addr) = 0;
   virtual int Send(const void *pv, size_t cb) = 0;
   virtual int Send(MemBuffer::Ptr buffer) = 0;
+  // 把blocks中的数据用一次gather write发出去，第一个Block从offset开始，
+  // 不修改blocks，返回实际发送的字节数，由调用者根据返回值消费数据。
+  // max_size不为0时最多发送max_size个字节
+  virtual int SendBlocks(const BlocksPtr &blocks, size_t offset,
+                         size_t max_size) = 0;
+  // SendBlocks一次发送不少于threshold字节时使用MSG_ZEROCOPY，0表示关闭。
+  // 系统不支持时返回false
+  virtual bool SetZeroCopy(size_t threshold) = 0;
   virtual int SendTo(const void *pv, size_t cb, const SocketAddress& addr) = 0;
+  // 把整个MemBuffer作为一个数据报用一次gather write发出去
+  virtual int SendTo(MemBuffer::Ptr buffer, const SocketAddress& addr) = 0;
+  // 用一次系统调用发送datagrams中从offset开始的数据报(sendmmsg)，
+  // 返回发送的数据报个数，一个都没有发出去时返回-1
+  virtual int SendToBatch(const Datagrams &datagrams, size_t offset) = 0;
   virtual int Recv(void *pv, size_t cb) = 0;
   virtual int Recv(MemBuffer::Ptr buffer) = 0;
+  // 查看可读的数据但不读出来(MSG_PEEK)，不影响读事件
+  virtual int Peek(void *pv, size_t cb) = 0;
+  // Recv(MemBuffer)每次读取的字节数，0表示通过FIONREAD查询可读的字节数
+  virtual void SetRecvSize(size_t size) = 0;
+  // Recv(MemBuffer)每次最多读取的字节数，0表示不限制。和SetRecvSize不同，
+  // 可读的数据不够时只读可读的部分
+  virtual void SetRecvBudget(size_t budget) = 0;
   virtual int RecvFrom(void *pv, size_t cb, SocketAddress *paddr) = 0;
   virtual int RecvFrom(MemBuffer::Ptr buffer, SocketAddress *out_addr) = 0;
+  // 用一次系统调用最多接收count个数据报(recvmmsg)，数据直接读到Block中，
+  // 追加到datagrams后面。返回接收的数据报个数，一个都没有时返回-1
+  virtual int RecvFromBatch(Datagrams *datagrams, size_t count) = 0;
+  // 接收时每个数据报的最大长度，超过的数据报会被丢弃
+  virtual void SetMaxDatagramSize(size_t size) = 0;
   virtual int Listen(int backlog) = 0;
   // virtual Socket *Accept(SocketAddress *paddr) = 0;
   virtual int Close() = 0;
@@ -54,6 +54,9 @@ class SocketServer : public SocketFactory {
 
   // Causes the current wait (if one is in progress) to wake up.
   virtual void WakeUp() = 0;
+
+  // Thread每处理完一个消息后调用，可以在这里执行处理消息时推迟的工作
+  virtual void OnMessageDispatched() {}
 };
 
 }  // namespace vzes
@@ -0,0 +1,214 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "eventservice/event/future.h"
+
+#ifdef POSIX
+#include <errno.h>
+#include <time.h>
+#endif
+
+namespace vzes {
+
+FutureStateBase::FutureStateBase()
+  : state_(STATE_PENDING),
+    promises_(0),
+    waiters_(0),
+    queue_(NULL) {
+#ifdef WIN32
+  InitializeCriticalSection(&crit_);
+  InitializeConditionVariable(&cond_);
+#else
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+#if defined(__linux__)
+  // Not affected by the wall clock changes
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+  pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+#endif
+}
+
+FutureStateBase::~FutureStateBase() {
+#ifdef WIN32
+  DeleteCriticalSection(&crit_);
+#else
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+#endif
+}
+
+void FutureStateBase::Lock() {
+#ifdef WIN32
+  EnterCriticalSection(&crit_);
+#else
+  pthread_mutex_lock(&mutex_);
+#endif
+}
+
+void FutureStateBase::Unlock() {
+#ifdef WIN32
+  LeaveCriticalSection(&crit_);
+#else
+  pthread_mutex_unlock(&mutex_);
+#endif
+}
+
+bool FutureStateBase::IsReady() {
+  Lock();
+  bool ready = (state_ == STATE_READY);
+  Unlock();
+  return ready;
+}
+
+bool FutureStateBase::IsBroken() {
+  Lock();
+  bool broken = (state_ == STATE_BROKEN);
+  Unlock();
+  return broken;
+}
+
+bool FutureStateBase::Wait(int cms) {
+  Lock();
+  if (state_ == STATE_PENDING && cms != 0) {
+    waiters_++;
+#ifdef WIN32
+    uint32 start = Time();
+    while (state_ == STATE_PENDING) {
+      DWORD wait = INFINITE;
+      if (cms != kForever) {
+        int left = cms - TimeSince(start);
+        if (left <= 0) {
+          break;
+        }
+        wait = left;
+      }
+      SleepConditionVariableCS(&cond_, &crit_, wait);
+    }
+#else
+    struct timespec deadline;
+    if (cms != kForever) {
+#if defined(__linux__)
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+#else
+      clock_gettime(CLOCK_REALTIME, &deadline);
+#endif
+      deadline.tv_sec += cms / 1000;
+      deadline.tv_nsec += (cms % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+    }
+    while (state_ == STATE_PENDING) {
+      if (cms == kForever) {
+        pthread_cond_wait(&cond_, &mutex_);
+      } else if (pthread_cond_timedwait(&cond_, &mutex_, &deadline)
+                 == ETIMEDOUT) {
+        break;
+      }
+    }
+#endif
+    waiters_--;
+  }
+  bool ready = (state_ == STATE_READY);
+  Unlock();
+  return ready;
+}
+
+void FutureStateBase::AddPromise() {
+  AtomicOps::Increment(&promises_);
+}
+
+void FutureStateBase::ReleasePromise() {
+  if (AtomicOps::Decrement(&promises_) != 0) {
+    return;
+  }
+  Lock();
+  if (state_ != STATE_PENDING) {
+    Unlock();
+    return;
+  }
+  Finish(STATE_BROKEN);
+}
+
+bool FutureStateBase::LockIfPending() {
+  Lock();
+  if (state_ != STATE_PENDING) {
+    Unlock();
+    return false;
+  }
+  return true;
+}
+
+void FutureStateBase::CompleteAndUnlock() {
+  Finish(STATE_READY);
+}
+
+void FutureStateBase::Finish(State state) {
+  // Called locked, the continuation is posted and released out of the lock
+  state_ = state;
+  MessageTask continuation;
+  continuation.MoveFrom(&continuation_);
+  MessageQueue *queue = queue_;
+  queue_ = NULL;
+  bool wake = (waiters_ > 0);
+  Unlock();
+  // Woken out of the lock, or the waiter runs only to block on the lock.
+  // The Promise calling here keeps this alive.
+  if (wake) {
+#ifdef WIN32
+    WakeAllConditionVariable(&cond_);
+#else
+    pthread_cond_broadcast(&cond_);
+#endif
+  }
+  if (state == STATE_READY && !continuation.empty()) {
+    queue->PostMessageTask(&continuation);
+  }
+}
+
+void FutureStateBase::SetContinuation(MessageQueue *queue, MessageTask *task) {
+  Lock();
+  if (state_ == STATE_PENDING) {
+    queue_ = queue;
+    continuation_.MoveFrom(task);
+    Unlock();
+    return;
+  }
+  bool ready = (state_ == STATE_READY);
+  Unlock();
+  if (ready) {
+    queue->PostMessageTask(task);
+  }
+}
+
+}  // namespace vzes
@@ -0,0 +1,230 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef EVENTSERVICE_EVENT_FUTURE_H_
+#define EVENTSERVICE_EVENT_FUTURE_H_
+
+#ifdef POSIX
+#include <pthread.h>
+#endif
+
+#include "eventservice/base/basictypes.h"
+#include "eventservice/base/criticalsection.h"
+#include "eventservice/event/messagequeue.h"
+#include "boost/boost_settings.hpp"
+
+namespace vzes {
+
+// Promise和Future共享的状态，模板无关的部分：完成状态、阻塞等待和
+// continuation。阻塞等待用条件变量，不需要pipe和select。
+class FutureStateBase : public boost::noncopyable {
+ public:
+  FutureStateBase();
+  virtual ~FutureStateBase();
+
+  bool IsReady();
+  // 所有的Promise都释放了也没有设置值
+  bool IsBroken();
+  // 等到设置了值返回true，超时或者broken返回false
+  bool Wait(int cms);
+
+  // Promise的引用计数，最后一个Promise释放时还没有值就变成broken
+  void AddPromise();
+  void ReleasePromise();
+  // 完成以后把task投递到queue，已经完成时直接投递，broken时丢弃
+  void SetContinuation(MessageQueue *queue, MessageTask *task);
+
+ protected:
+  // 还没完成时返回true并保持加锁，调用者设置完值以后调用CompleteAndUnlock
+  bool LockIfPending();
+  void CompleteAndUnlock();
+
+ private:
+  enum State {
+    STATE_PENDING,
+    STATE_READY,
+    STATE_BROKEN
+  };
+
+  void Lock();
+  void Unlock();
+  void Finish(State state);
+
+  State         state_;
+  int           promises_;
+  int           waiters_;
+  MessageQueue *queue_;
+  MessageTask   continuation_;
+#ifdef WIN32
+  CRITICAL_SECTION   crit_;
+  CONDITION_VARIABLE cond_;
+#else
+  pthread_mutex_t    mutex_;
+  pthread_cond_t     cond_;
+#endif
+};
+
+template <class T>
+class FutureState : public FutureStateBase {
+ public:
+  typedef boost::shared_ptr< FutureState<T> > Ptr;
+
+  // 只有第一次设置有效
+  bool SetValue(const T &value) {
+    if (!LockIfPending()) {
+      return false;
+    }
+    value_ = value;
+    CompleteAndUnlock();
+    return true;
+  }
+  // Only valid once IsReady() or Wait() returns true, never changes then
+  const T &value() const {
+    return value_;
+  }
+
+ private:
+  T value_;
+};
+
+// 异步调用的结果，可以阻塞等待，也可以用Then在指定线程上处理结果。
+// Future可以复制，所有副本共享同一个结果。
+template <class T>
+class Future {
+ public:
+  Future() {
+  }
+  explicit Future(typename FutureState<T>::Ptr state)
+    : state_(state) {
+  }
+
+  bool valid() const {
+    return state_.get() != NULL;
+  }
+  bool IsReady() const {
+    return state_ && state_->IsReady();
+  }
+  // 调用方没有设置结果就被丢弃了，例如目标线程已经退出
+  bool IsBroken() const {
+    return !state_ || state_->IsBroken();
+  }
+
+  // 阻塞等待结果，超时或者broken返回false
+  bool Get(T *value, int cms = kForever) const {
+    if (!state_ || !state_->Wait(cms)) {
+      return false;
+    }
+    *value = state_->value();
+    return true;
+  }
+
+  // 结果就绪以后在queue的线程调用callback(const T &)，不阻塞当前线程。
+  // broken时不会调用。只保留最后一次设置的callback，queue要比结果活得长。
+  template <class F> void Then(MessageQueue *queue, const F &callback) {
+    if (!state_) {
+      return;
+    }
+    ThenTask<F> then = {callback, state_};
+    MessageTask task;
+    task.Assign(then);
+    state_->SetContinuation(queue, &task);
+  }
+
+ private:
+  template <class F> struct ThenTask {
+    F                              callback;
+    typename FutureState<T>::Ptr   state;
+    void operator()() {
+      callback(state->value());
+    }
+  };
+
+  typename FutureState<T>::Ptr state_;
+};
+
+// 设置Future的结果，可以复制，所有副本都释放了还没有设置值时Future变成
+// broken，等待的线程会返回。
+template <class T>
+class Promise {
+ public:
+  Promise()
+    : state_(new FutureState<T>()) {
+    state_->AddPromise();
+  }
+  Promise(const Promise &other)
+    : state_(other.state_) {
+    state_->AddPromise();
+  }
+  ~Promise() {
+    state_->ReleasePromise();
+  }
+  Promise &operator=(const Promise &other) {
+    if (state_ != other.state_) {
+      other.state_->AddPromise();
+      state_->ReleasePromise();
+      state_ = other.state_;
+    }
+    return *this;
+  }
+
+  // 只有第一次设置有效
+  bool SetValue(const T &value) {
+    return state_->SetValue(value);
+  }
+  Future<T> GetFuture() const {
+    return Future<T>(state_);
+  }
+
+ private:
+  typename FutureState<T>::Ptr state_;
+};
+
+template <class F>
+struct InvokeTask {
+  F                                   func;
+  Promise<typename F::result_type>    promise;
+  void operator()() {
+    promise.SetValue(func());
+  }
+};
+
+// 在queue的线程调用func()，返回结果的Future，不阻塞当前线程。
+// F要定义result_type，就是func()的返回值类型。queue已经停止或者消息
+// 被Clear时Future变成broken。
+template <class F>
+Future<typename F::result_type> Invoke(MessageQueue *queue, const F &func) {
+  InvokeTask<F> task = {func, Promise<typename F::result_type>()};
+  Future<typename F::result_type> future = task.promise.GetFuture();
+  queue->PostTask(task);
+  return future;
+}
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_EVENT_FUTURE_H_
@@ -40,6 +40,15 @@ namespace vzes {
 
 const uint32 kMaxMsgLatency = 150;  // 150 ms
 
+// 把from挪到to，pdata交换指针不动引用计数，task也不再复制一次
+static void MoveMessage(Message *from, Message *to) {
+  to->phandler = from->phandler;
+  to->message_id = from->message_id;
+  to->pdata.swap(from->pdata);
+  to->ts_sensitive = from->ts_sensitive;
+  to->task.MoveFrom(&from->task);
+}
+
 //------------------------------------------------------------------
 // MessageQueueManager
 
@@ -118,12 +127,39 @@ void MessageQueueManager::ClearInternal(MessageHandler *handler) {
     (*iter)->Clear(handler);
 }
 
+//------------------------------------------------------------------
+// Timer
+
+Timer::Timer(MessageQueue *queue, uint32 period)
+  : queue_(queue),
+    period_(period) {
+}
+
+void Timer::Cancel() {
+  // 持有crit_时MessageQueue的析构会等在这里，queue_不会被删除
+  CritScope cs(&crit_);
+  if (queue_) {
+    queue_->CancelTimer(this);
+    queue_ = NULL;
+  }
+}
+
+bool Timer::IsActive() {
+  CritScope cs(&crit_);
+  if (!queue_) {
+    return false;
+  }
+  CritScope queue_cs(&queue_->crit_);
+  return linked();
+}
+
 //------------------------------------------------------------------
 // MessageQueue
 
 MessageQueue::MessageQueue(SocketServer* ss)
   : ss_(ss), fStop_(false), fPeekKeep_(false), active_(false),
-    dmsgq_next_num_(0) {
+    msgq_head_(NULL), msgq_tail_(NULL), msgq_size_(0),
+    timers_(Time()) {
   if (!ss_) {
     // Currently, MessageQueue holds a socket server, and is the base class for
     // Thread.  It seems like it makes more sense for Thread to hold the socket
@@ -137,6 +173,20 @@ MessageQueue::MessageQueue(SocketServer* ss)
 }
 
 MessageQueue::~MessageQueue() {
+  // Detach the timers still held by the users
+  std::vector<Timer::Ptr> cancelled;
+  {
+    CritScope cs(&crit_);
+    std::vector<TimerNode *> nodes;
+    timers_.GetAll(&nodes);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      Timer *timer = static_cast<Timer *>(nodes[i]);
+      timers_.Remove(timer);
+      cancelled.push_back(timer->self_);
+      timer->self_.reset();
+    }
+  }
+  DetachTimers(&cancelled);
   // The signal is done from here to ensure
   // that it always gets called when the queue
   // is going away.
@@ -204,6 +254,8 @@ bool MessageQueue::Get(Message *pmsg, int cmsWait, bool process_io) {
     // Check for posted events
     int cmsDelayNext = kForever;
     bool first_pass = true;
+    // The one shot timers fired are released out of crit_
+    std::vector<Timer::Ptr> fired;
     while (true) {
       // All queue operations need to be locked, but nothing else in this loop
       // (specifically handling disposed message) can happen inside the crit.
@@ -212,25 +264,29 @@ bool MessageQueue::Get(Message *pmsg, int cmsWait, bool process_io) {
         CritScope cs(&crit_);
         // On the first pass, check for delayed messages that have been
         // triggered and calculate the next trigger time.
+        // Take all the posted messages at once, before the timers fired
+        // to keep the order they come in.
+        DrainPosted();
         if (first_pass) {
           first_pass = false;
-          while (!dmsgq_.empty()) {
-            if (TimeIsLater(msCurrent, dmsgq_.top().msTrigger_)) {
-              cmsDelayNext = TimeDiff(dmsgq_.top().msTrigger_, msCurrent);
-              break;
-            }
-            msgq_.push_back(dmsgq_.top().msg_);
-            dmsgq_.pop();
-          }
+          ExpireTimers(msCurrent, &fired);
+          cmsDelayNext = timers_.GetDelay(msCurrent);
         }
         // Pull a message off the message queue, if available.
-        if (msgq_.empty()) {
+        if (msgq_head_ == NULL) {
           break;
         } else {
-          *pmsg = msgq_.front();
-          msgq_.pop_front();
+          PostedMessage *node = msgq_head_;
+          msgq_head_ = static_cast<PostedMessage *>(node->next_);
+          if (msgq_head_ == NULL) {
+            msgq_tail_ = NULL;
+          }
+          msgq_size_--;
+          MoveMessage(&node->msg, pmsg);
+          FreeMessage(node);
         }
       }  // crit_ is released here.
+      DetachTimers(&fired);
 
       // Log a warning for time-sensitive messages that we're late to deliver.
       if (pmsg->ts_sensitive) {
@@ -289,71 +345,159 @@ void MessageQueue::Post(MessageHandler *phandler,
                         uint32 id,
                         MessageData::Ptr pdata,
                         bool time_sensitive) {
-  if (fStop_)
+  PostedMessage *node = BeginPost();
+  if (node == NULL)
     return;
+  node->msg.phandler = phandler;
+  node->msg.message_id = id;
+  node->msg.pdata = pdata;
+  if (time_sensitive) {
+    node->msg.ts_sensitive = Time() + kMaxMsgLatency;
+  }
+  EndPost(node);
+}
+
+void MessageQueue::PostMessageTask(MessageTask *task, MessageHandler *owner) {
+  PostedMessage *node = BeginPost();
+  if (node == NULL)
+    return;
+  node->msg.phandler = owner;
+  node->msg.message_id = MQID_TASK;
+  node->msg.task.MoveFrom(task);
+  EndPost(node);
+}
+
+PostedMessage *MessageQueue::BeginPost() {
+  if (fStop_)
+    return NULL;
 
   // Keep thread safe
-  // Add the message to the end of the queue
+  // Add the message to the end of the queue without lock
   // Signal for the multiplexer to return
 
-  CritScope cs(&crit_);
-  EnsureActive();
-  Message msg;
-  msg.phandler = phandler;
-  msg.message_id = id;
-  msg.pdata = pdata;
-  if (time_sensitive) {
-    msg.ts_sensitive = Time() + kMaxMsgLatency;
+  if (!active_) {
+    CritScope cs(&crit_);
+    EnsureActive();
   }
-  msgq_.push_back(msg);
+  return posted_pool_.Alloc();
+}
+
+void MessageQueue::EndPost(PostedMessage *node) {
+  posted_.Push(node);
   ss_->WakeUp();
 }
 
-void MessageQueue::DoDelayPost(int cmsDelay,
-                               uint32 tstamp,
-                               MessageHandler *phandler,
-                               uint32 id,
-                               MessageData::Ptr pdata) {
+Timer::Ptr MessageQueue::DoDelayPost(uint32 tstamp,
+                                     uint32 period,
+                                     MessageHandler *phandler,
+                                     uint32 id,
+                                     MessageData::Ptr pdata) {
   if (fStop_)
-    return;
+    return Timer::Ptr();
+
+  Timer::Ptr timer(new Timer(this, period));
+  timer->msg_.phandler = phandler;
+  timer->msg_.message_id = id;
+  timer->msg_.pdata = pdata;
+  return AddTimer(timer, tstamp);
+}
 
+Timer::Ptr MessageQueue::AddTimer(Timer::Ptr timer, uint32 tstamp) {
   // Keep thread safe
-  // Add to the priority queue. Gets sorted soonest first.
+  // Add to the timer wheel, O(1).
   // Signal for the multiplexer to return.
 
   CritScope cs(&crit_);
   EnsureActive();
-  Message msg;
-  msg.phandler = phandler;
-  msg.message_id = id;
-  msg.pdata = pdata;
-  DelayedMessage dmsg(cmsDelay, tstamp, dmsgq_next_num_, msg);
-  dmsgq_.push(dmsg);
-  // If this message queue processes 1 message every millisecond for 50 days,
-  // we will wrap this number.  Even then, only messages with identical times
-  // will be misordered, and then only briefly.  This is probably ok.
-  VZ_VERIFY(0 != ++dmsgq_next_num_);
+  timer->self_ = timer;
+  timers_.Add(timer.get(), tstamp, Time());
   ss_->WakeUp();
+  return timer;
 }
 
-int MessageQueue::GetDelay() {
+void MessageQueue::CancelTimer(Timer *timer) {
+  // Release the timer out of crit_, the message data may do anything in its
+  // destructor.
+  Timer::Ptr cancelled;
   CritScope cs(&crit_);
+  if (timer->linked()) {
+    timers_.Remove(timer);
+    cancelled.swap(timer->self_);
+  }
+}
 
-  if (!msgq_.empty())
-    return 0;
+void MessageQueue::ExpireTimers(uint32 now, std::vector<Timer::Ptr> *fired) {
+  ASSERT(crit_.CurrentThreadIsOwner());
+  expired_.clear();
+  timers_.Expire(now, &expired_);
+  for (size_t i = 0; i < expired_.size(); i++) {
+    Timer *timer = static_cast<Timer *>(expired_[i]);
+    PostedMessage *node = posted_pool_.Alloc();
+    if (timer->period_ == 0) {
+      // A one shot timer never uses msg_ again
+      MoveMessage(&timer->msg_, &node->msg);
+      AppendMessage(node);
+      fired->push_back(timer->self_);
+      timer->self_.reset();
+      continue;
+    }
+    node->msg = timer->msg_;
+    AppendMessage(node);
+    // 处理不过来时跳过错过的周期，不连续触发。正好晚了整数个周期时
+    // 下一次就是now，不能再跳过一个周期
+    uint32 trigger = timer->trigger() + timer->period_;
+    if (TimeIsLaterOrEqual(trigger, now)) {
+      uint32 late = TimeDiff(now, timer->trigger()) % timer->period_;
+      trigger = (late == 0) ? now : now + timer->period_ - late;
+    }
+    timers_.Add(timer, trigger, now);
+  }
+}
 
-  if (!dmsgq_.empty()) {
-    int delay = TimeUntil(dmsgq_.top().msTrigger_);
-    if (delay < 0)
-      delay = 0;
-    return delay;
+void MessageQueue::DrainPosted() {
+  ASSERT(crit_.CurrentThreadIsOwner());
+  MpscNode *node;
+  while ((node = posted_.Pop()) != NULL) {
+    AppendMessage(static_cast<PostedMessage *>(node));
   }
+}
+
+void MessageQueue::AppendMessage(PostedMessage *node) {
+  node->next_ = NULL;
+  if (msgq_tail_ == NULL) {
+    msgq_head_ = node;
+  } else {
+    msgq_tail_->next_ = node;
+  }
+  msgq_tail_ = node;
+  msgq_size_++;
+}
+
+void MessageQueue::FreeMessage(PostedMessage *node) {
+  node->msg = Message();
+  posted_pool_.Free(node);
+}
 
-  return kForever;
+int MessageQueue::GetDelay() {
+  CritScope cs(&crit_);
+
+  DrainPosted();
+  if (msgq_head_ != NULL)
+    return 0;
+
+  return timers_.GetDelay(Time());
 }
 
 void MessageQueue::Clear(MessageHandler *phandler, uint32 id,
                          MessageList* removed) {
+  std::vector<Timer::Ptr> cancelled;
+  RemoveMessages(phandler, id, removed, &cancelled);
+  DetachTimers(&cancelled);
+}
+
+void MessageQueue::RemoveMessages(MessageHandler *phandler, uint32 id,
+                                  MessageList *removed,
+                                  std::vector<Timer::Ptr> *cancelled) {
   CritScope cs(&crit_);
 
   // Remove messages with phandler
@@ -369,39 +513,66 @@ void MessageQueue::Clear(MessageHandler *phandler, uint32 id,
 
   // Remove from ordered message queue
 
-  for (MessageList::iterator it = msgq_.begin(); it != msgq_.end();) {
-    if (it->Match(phandler, id)) {
+  DrainPosted();
+  PostedMessage *prev = NULL;
+  PostedMessage *node = msgq_head_;
+  while (node != NULL) {
+    PostedMessage *next = static_cast<PostedMessage *>(node->next_);
+    if (node->msg.Match(phandler, id)) {
       if (removed) {
-        removed->push_back(*it);
+        removed->push_back(node->msg);
       } else {
         // delete it->pdata;
       }
-      it = msgq_.erase(it);
+      if (prev == NULL) {
+        msgq_head_ = next;
+      } else {
+        prev->next_ = next;
+      }
+      if (msgq_tail_ == node) {
+        msgq_tail_ = prev;
+      }
+      msgq_size_--;
+      FreeMessage(node);
     } else {
-      ++it;
+      prev = node;
     }
+    node = next;
   }
 
-  // Remove from priority queue. Not directly iterable, so use this approach
+  // Remove from the timer wheel, the timers can be cancelled one by one
+  // in O(1) with the Timer handle instead.
 
-  PriorityQueue::container_type::iterator new_end = dmsgq_.container().begin();
-  for (PriorityQueue::container_type::iterator it = new_end;
-       it != dmsgq_.container().end(); ++it) {
-    if (it->msg_.Match(phandler, id)) {
+  std::vector<TimerNode *> nodes;
+  timers_.GetAll(&nodes);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    Timer *timer = static_cast<Timer *>(nodes[i]);
+    if (timer->msg_.Match(phandler, id)) {
       if (removed) {
-        removed->push_back(it->msg_);
-      } else {
-        //delete it->msg_.pdata;
+        removed->push_back(timer->msg_);
       }
-    } else {
-      *new_end++ = *it;
+      timers_.Remove(timer);
+      cancelled->push_back(timer->self_);
+      timer->self_.reset();
     }
   }
-  dmsgq_.container().erase(new_end, dmsgq_.container().end());
-  dmsgq_.reheap();
+}
+
+void MessageQueue::DetachTimers(std::vector<Timer::Ptr> *timers) {
+  // Timer::Cancel() locks the timer before crit_, so the timers are locked
+  // after crit_ is released. A Cancel() in progress finishes first.
+  for (size_t i = 0; i < timers->size(); i++) {
+    CritScope cs(&(*timers)[i]->crit_);
+    (*timers)[i]->queue_ = NULL;
+  }
+  timers->clear();
 }
 
 void MessageQueue::Dispatch(Message *pmsg) {
+  if (!pmsg->task.empty()) {
+    pmsg->task.Run();
+    return;
+  }
   pmsg->phandler->OnMessage(pmsg);
 }
 
@@ -39,6 +39,9 @@
 #include "eventservice/base/constructormagic.h"
 #include "eventservice/base/criticalsection.h"
 #include "eventservice/event/messagehandler.h"
+#include "eventservice/event/messagetask.h"
+#include "eventservice/event/mpscqueue.h"
+#include "eventservice/event/timerwheel.h"
 #include "eventservice/base/scoped_ptr.h"
 #include "eventservice/base/scoped_ref_ptr.h"
 #include "eventservice/base/sigslot.h"
@@ -163,6 +166,8 @@ class DisposeData : public MessageData {
 
 const uint32 MQID_ANY = static_cast<uint32>(-1);
 const uint32 MQID_DISPOSE = static_cast<uint32>(-2);
+// PostTask/PostDelayedTask投递的消息
+const uint32 MQID_TASK = static_cast<uint32>(-3);
 
 // No destructor
 
@@ -179,27 +184,42 @@ struct Message {
   uint32 message_id;
   MessageData::Ptr pdata;
   uint32 ts_sensitive;
+  // Not empty for PostTask, Dispatch runs it instead of phandler->OnMessage
+  MessageTask task;
 };
 
 typedef std::list<Message> MessageList;
 
-// DelayedMessage goes into a priority queue, sorted by trigger time.  Messages
-// with the same trigger time are processed in num_ (FIFO) order.
+// Post进来的消息，先放进无锁的MpscQueue，Get的时候再挪到按顺序处理的链表
+struct PostedMessage : public MpscNode {
+  Message msg;
+};
 
-class DelayedMessage {
+// PostDelayed/PostAt/PostPeriodic返回的定时器句柄。定时器挂在MessageQueue的
+// 时间轮上，触发时time相同的消息按Post的顺序处理。
+class Timer : public TimerNode {
  public:
-  DelayedMessage(int delay, uint32 trigger, uint32 num, const Message& msg)
-    : cmsDelay_(delay), msTrigger_(trigger), num_(num), msg_(msg) { }
+  typedef boost::shared_ptr<Timer> Ptr;
+  // 取消还没触发的定时器，O(1)，可以在任何线程调用，和MessageQueue的
+  // 析构同时调用也是安全的。已经放进消息队列的消息还是会被处理。
+  void Cancel();
+  // 还在等待触发，周期定时器在Cancel之前一直返回true
+  bool IsActive();
 
-  bool operator< (const DelayedMessage& dmsg) const {
-    return (dmsg.msTrigger_ < msTrigger_)
-           || ((dmsg.msTrigger_ == msTrigger_) && (dmsg.num_ < num_));
-  }
+ private:
+  friend class MessageQueue;
+  Timer(MessageQueue *queue, uint32 period);
 
-  int cmsDelay_;  // for debugging
-  uint32 msTrigger_;
-  uint32 num_;
-  Message msg_;
+  // MessageQueue析构时置为NULL，由crit_保护。先锁crit_再锁queue_->crit_
+  MessageQueue *queue_;
+  CriticalSection crit_;
+  Message       msg_;
+  // 0 means one shot
+  uint32        period_;
+  // 挂在时间轮上时持有自己，触发或者取消后释放
+  Timer::Ptr    self_;
+
+  DISALLOW_COPY_AND_ASSIGN(Timer);
 };
 
 class MessageQueue {
@@ -233,17 +253,50 @@ class MessageQueue {
                     uint32 id = 0,
                     MessageData::Ptr pdata = MessageData::Ptr(),
                     bool time_sensitive = false);
-  virtual void PostDelayed(int cmsDelay,
-                           MessageHandler *phandler,
-                           uint32 id = 0,
-                           MessageData::Ptr pdata = MessageData::Ptr()) {
-    return DoDelayPost(cmsDelay, TimeAfter(cmsDelay), phandler, id, pdata);
+  // 投递一个可调用对象(有void operator()()的可复制对象)，在本线程调用。
+  // 小的对象直接存在队列节点里，不需要分配内存。owner不为空时，
+  // Clear(owner)或者owner析构会一起删掉这个任务。
+  template <class F> void PostTask(const F &task,
+                                   MessageHandler *owner = NULL) {
+    PostedMessage *node = BeginPost();
+    if (node) {
+      node->msg.phandler = owner;
+      node->msg.message_id = MQID_TASK;
+      node->msg.task.Assign(task);
+      EndPost(node);
+    }
   }
-  virtual void PostAt(uint32 tstamp,
-                      MessageHandler *phandler,
-                      uint32 id = 0,
-                      MessageData::Ptr pdata = MessageData::Ptr()) {
-    return DoDelayPost(TimeUntil(tstamp), tstamp, phandler, id, pdata);
+  // 把task挪进队列，task变成空的
+  void PostMessageTask(MessageTask *task, MessageHandler *owner = NULL);
+  template <class F> Timer::Ptr PostDelayedTask(int cmsDelay,
+                                                const F &task,
+                                                MessageHandler *owner = NULL) {
+    if (fStop_)
+      return Timer::Ptr();
+    Timer::Ptr timer(new Timer(this, 0));
+    timer->msg_.phandler = owner;
+    timer->msg_.message_id = MQID_TASK;
+    timer->msg_.task.Assign(task);
+    return AddTimer(timer, TimeAfter(cmsDelay));
+  }
+  virtual Timer::Ptr PostDelayed(int cmsDelay,
+                                  MessageHandler *phandler,
+                                  uint32 id = 0,
+                                  MessageData::Ptr pdata = MessageData::Ptr()) {
+    return DoDelayPost(TimeAfter(cmsDelay), 0, phandler, id, pdata);
+  }
+  virtual Timer::Ptr PostAt(uint32 tstamp,
+                             MessageHandler *phandler,
+                             uint32 id = 0,
+                             MessageData::Ptr pdata = MessageData::Ptr()) {
+    return DoDelayPost(tstamp, 0, phandler, id, pdata);
+  }
+  // 每隔cmsPeriod毫秒Post一次，直到Cancel()或者Clear()
+  virtual Timer::Ptr PostPeriodic(int cmsPeriod,
+                                   MessageHandler *phandler,
+                                   uint32 id = 0,
+                                   MessageData::Ptr pdata = MessageData::Ptr()) {
+    return DoDelayPost(TimeAfter(cmsPeriod), cmsPeriod, phandler, id, pdata);
   }
   virtual void Clear(MessageHandler *phandler,
                      uint32 id = MQID_ANY,
@@ -258,8 +311,10 @@ class MessageQueue {
     return size() == 0u;
   }
   size_t size() const {
-    CritScope cs(&crit_);  // msgq_.size() is not thread safe.
-    return msgq_.size() + dmsgq_.size() + (fPeekKeep_ ? 1u : 0u);
+    CritScope cs(&crit_);  // msgq_size_ is not thread safe.
+    // Only moves the posted messages over, the content stays the same
+    const_cast<MessageQueue *>(this)->DrainPosted();
+    return msgq_size_ + timers_.size() + (fPeekKeep_ ? 1u : 0u);
   }
 
   // Internally posts a message which causes the doomed object to be deleted
@@ -274,19 +329,32 @@ class MessageQueue {
   sigslot::signal0<> SignalQueueDestroyed;
 
  protected:
-  class PriorityQueue : public std::priority_queue<DelayedMessage> {
-   public:
-    container_type& container() {
-      return c;
-    }
-    void reheap() {
-      make_heap(c.begin(), c.end(), comp);
-    }
-  };
+  friend class Timer;
 
   void EnsureActive();
-  void DoDelayPost(int cmsDelay, uint32 tstamp, MessageHandler *phandler,
-                   uint32 id, MessageData::Ptr pdata);
+  // Post分成两步，中间由调用者填写node->msg。BeginPost在fStop_时返回NULL
+  PostedMessage *BeginPost();
+  void EndPost(PostedMessage *node);
+  Timer::Ptr AddTimer(Timer::Ptr timer, uint32 tstamp);
+  Timer::Ptr DoDelayPost(uint32 tstamp, uint32 period,
+                         MessageHandler *phandler,
+                         uint32 id, MessageData::Ptr pdata);
+  void CancelTimer(Timer *timer);
+  // The timers taken off the wheel for good stop pointing at this queue, so
+  // Timer::Cancel() is safe after the queue is gone. Called out of crit_.
+  static void DetachTimers(std::vector<Timer::Ptr> *timers);
+  // Clear() without detaching the timers removed
+  void RemoveMessages(MessageHandler *phandler, uint32 id,
+                      MessageList *removed,
+                      std::vector<Timer::Ptr> *cancelled);
+  // Move the due timers to msgq_, the one shot timers done are returned in
+  // fired to be released out of crit_.
+  void ExpireTimers(uint32 now, std::vector<Timer::Ptr> *fired);
+  // 把posted_里的消息一次全部挪到msgq_的末尾，持有crit_的线程就是
+  // posted_唯一的消费者
+  void DrainPosted();
+  void AppendMessage(PostedMessage *node);
+  void FreeMessage(PostedMessage *node);
 
   // The SocketServer is not owned by MessageQueue.
   SocketServer* ss_;
@@ -298,9 +366,16 @@ class MessageQueue {
   // A message queue is active if it has ever had a message posted to it.
   // This also corresponds to being in MessageQueueManager's global list.
   bool active_;
-  MessageList msgq_;
-  PriorityQueue dmsgq_;
-  uint32 dmsgq_next_num_;
+  // Post不加锁，放进posted_；msgq_head_/msgq_tail_是crit_保护的按顺序
+  // 处理的链表，节点复用MpscNode::next_
+  MpscQueue posted_;
+  MpscNodePool<PostedMessage> posted_pool_;
+  PostedMessage *msgq_head_;
+  PostedMessage *msgq_tail_;
+  size_t msgq_size_;
+  TimerWheel timers_;
+  // Reused by ExpireTimers
+  std::vector<TimerNode *> expired_;
   mutable CriticalSection crit_;
 
  private:
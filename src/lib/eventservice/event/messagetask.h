@@ -0,0 +1,195 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef EVENTSERVICE_EVENT_MESSAGETASK_H_
+#define EVENTSERVICE_EVENT_MESSAGETASK_H_
+
+#include <new>
+
+#include "eventservice/base/basictypes.h"
+#include "boost/type_traits/alignment_of.hpp"
+
+namespace vzes {
+
+// PostTask投递的可调用对象，F是任何可以复制、有void operator()()的类型。
+// 不超过INLINE_SIZE的对象直接放在MessageTask里面，不需要分配内存，也没有
+// 引用计数；大的对象才在堆上分配。
+class MessageTask {
+ public:
+  enum {
+    INLINE_SIZE = 4 * sizeof(void *)
+  };
+
+  MessageTask() : ops_(NULL) {
+  }
+  MessageTask(const MessageTask &other) : ops_(NULL) {
+    *this = other;
+  }
+  ~MessageTask() {
+    Reset();
+  }
+  MessageTask &operator=(const MessageTask &other) {
+    if (this != &other) {
+      Reset();
+      if (other.ops_) {
+        other.ops_->copy(this, &other);
+        ops_ = other.ops_;
+      }
+    }
+    return *this;
+  }
+
+  template <class F> void Assign(const F &task) {
+    Reset();
+    Ops<F, IsInline<F>::value>::Construct(this, task);
+    ops_ = &Ops<F, IsInline<F>::value>::table;
+  }
+  // 把other的任务挪过来，other变成空的，大的对象不用再复制一次
+  void MoveFrom(MessageTask *other) {
+    if (this == other) {
+      return;
+    }
+    Reset();
+    if (other->ops_) {
+      other->ops_->move(this, other);
+      ops_ = other->ops_;
+      other->ops_ = NULL;
+    }
+  }
+  void Reset() {
+    if (ops_) {
+      ops_->destroy(this);
+      ops_ = NULL;
+    }
+  }
+  bool empty() const {
+    return ops_ == NULL;
+  }
+  void Run() {
+    ops_->run(this);
+  }
+
+ private:
+  union Storage {
+    void   *ptr_;
+    uint64  align_u64_;
+    double  align_double_;
+    char    buffer_[INLINE_SIZE];
+  };
+
+  template <class F> struct IsInline {
+    static const bool value =
+      sizeof(F) <= sizeof(Storage)
+      && boost::alignment_of<Storage>::value % boost::alignment_of<F>::value
+      == 0;
+  };
+
+  struct OpsTable {
+    void (*run)(MessageTask *task);
+    void (*copy)(MessageTask *dst, const MessageTask *src);
+    // Construct dst from src and destroy src
+    void (*move)(MessageTask *dst, MessageTask *src);
+    void (*destroy)(MessageTask *task);
+  };
+
+  template <class F, bool inline_storage> struct Ops;
+
+  // Stored in storage_.buffer_
+  template <class F> struct Ops<F, true> {
+    static F *Get(MessageTask *task) {
+      return reinterpret_cast<F *>(task->storage_.buffer_);
+    }
+    static const F *Get(const MessageTask *task) {
+      return reinterpret_cast<const F *>(task->storage_.buffer_);
+    }
+    static void Construct(MessageTask *task, const F &f) {
+      new (task->storage_.buffer_) F(f);
+    }
+    static void Run(MessageTask *task) {
+      (*Get(task))();
+    }
+    static void Copy(MessageTask *dst, const MessageTask *src) {
+      Construct(dst, *Get(src));
+    }
+    static void Move(MessageTask *dst, MessageTask *src) {
+      Construct(dst, *Get(src));
+      Destroy(src);
+    }
+    static void Destroy(MessageTask *task) {
+      Get(task)->~F();
+    }
+    static const OpsTable table;
+  };
+
+  // Allocated on the heap, storage_.ptr_ points to it
+  template <class F> struct Ops<F, false> {
+    static F *Get(const MessageTask *task) {
+      return static_cast<F *>(task->storage_.ptr_);
+    }
+    static void Construct(MessageTask *task, const F &f) {
+      task->storage_.ptr_ = new F(f);
+    }
+    static void Run(MessageTask *task) {
+      (*Get(task))();
+    }
+    static void Copy(MessageTask *dst, const MessageTask *src) {
+      Construct(dst, *Get(src));
+    }
+    static void Move(MessageTask *dst, MessageTask *src) {
+      dst->storage_.ptr_ = src->storage_.ptr_;
+    }
+    static void Destroy(MessageTask *task) {
+      delete Get(task);
+    }
+    static const OpsTable table;
+  };
+
+  Storage         storage_;
+  const OpsTable *ops_;
+};
+
+template <class F>
+const MessageTask::OpsTable MessageTask::Ops<F, true>::table = {
+  &Ops<F, true>::Run,
+  &Ops<F, true>::Copy,
+  &Ops<F, true>::Move,
+  &Ops<F, true>::Destroy
+};
+
+template <class F>
+const MessageTask::OpsTable MessageTask::Ops<F, false>::table = {
+  &Ops<F, false>::Run,
+  &Ops<F, false>::Copy,
+  &Ops<F, false>::Move,
+  &Ops<F, false>::Destroy
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_EVENT_MESSAGETASK_H_
@@ -0,0 +1,76 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "eventservice/event/mpscqueue.h"
+
+namespace vzes {
+
+MpscQueue::MpscQueue()
+  : head_(&stub_),
+    tail_(&stub_) {
+  stub_.next_ = NULL;
+}
+
+void MpscQueue::Push(MpscNode *node) {
+  node->next_ = NULL;
+  MpscNode *prev = AtomicOps::ExchangePtr(&head_, node);
+  // 从这里到下一行之间，Pop看不到node和它后面的节点
+  AtomicOps::StorePtr(&prev->next_, node);
+}
+
+MpscNode *MpscQueue::Pop() {
+  MpscNode *tail = tail_;
+  MpscNode *next = AtomicOps::LoadPtr(&tail->next_);
+  if (tail == &stub_) {
+    if (next == NULL) {
+      return NULL;
+    }
+    tail_ = next;
+    tail = next;
+    next = AtomicOps::LoadPtr(&next->next_);
+  }
+  if (next != NULL) {
+    tail_ = next;
+    return tail;
+  }
+  if (tail != AtomicOps::LoadPtr(&head_)) {
+    // A producer is between the two steps of Push
+    return NULL;
+  }
+  // tail is the last node, put the stub behind it so that it can be taken
+  Push(&stub_);
+  next = AtomicOps::LoadPtr(&tail->next_);
+  if (next != NULL) {
+    tail_ = next;
+    return tail;
+  }
+  return NULL;
+}
+
+}  // namespace vzes
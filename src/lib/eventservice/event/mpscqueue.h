@@ -0,0 +1,187 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef EVENTSERVICE_EVENT_MPSCQUEUE_H_
+#define EVENTSERVICE_EVENT_MPSCQUEUE_H_
+
+#include <string.h>
+
+#include "eventservice/base/basictypes.h"
+#include "eventservice/base/constructormagic.h"
+#include "eventservice/base/criticalsection.h"
+
+namespace vzes {
+
+// 侵入式节点，next_给队列用，pool_next_和pool_index_给MpscNodePool用
+struct MpscNode {
+  MpscNode *next_;
+  int       pool_next_;
+  int       pool_index_;
+};
+
+// 多生产者单消费者的无锁队列(Vyukov)，Push可以在任何线程调用，Pop和empty
+// 同一时间只能有一个线程调用。
+// Push先交换head_再连上前一个节点，中间被打断时Pop会暂时看不到后面的节点
+// 而返回NULL，这时生产者Push完以后的唤醒保证消费者会再来取。
+class MpscQueue {
+ public:
+  MpscQueue();
+
+  void Push(MpscNode *node);
+  // 按Push的顺序返回，队列为空或者有Push还没完成时返回NULL
+  MpscNode *Pop();
+  bool empty() const {
+    return tail_ == &stub_ && stub_.next_ == NULL;
+  }
+
+ private:
+  // Producers append to head_, the consumer takes from tail_
+  MpscNode *head_;
+  MpscNode *tail_;
+  MpscNode  stub_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+// MpscQueue节点的对象池，Alloc和Free都是无锁的，可以在任何线程调用。
+// 节点按块分配，空闲链表用下标加版本号做CAS，避免ABA问题；池子用满后
+// 退回到new/delete。T必须从MpscNode派生，还给池子的节点不会析构，
+// 使用者要先清掉里面持有的资源。
+template <class T>
+class MpscNodePool {
+ public:
+  enum {
+    CHUNK_SIZE = 256,
+    MAX_CHUNKS = 64,
+    NIL_INDEX = -1
+  };
+
+  MpscNodePool()
+    : free_head_(MakeHead(0, NIL_INDEX)),
+      chunk_count_(0) {
+    memset(chunks_, 0, sizeof(chunks_));
+  }
+  ~MpscNodePool() {
+    for (int i = 0; i < chunk_count_; i++) {
+      delete[] chunks_[i];
+    }
+  }
+
+  T *Alloc() {
+    while (true) {
+      uint64 head = AtomicOps::Load64(&free_head_);
+      int index = HeadIndex(head);
+      if (index == NIL_INDEX) {
+        if (!Grow()) {
+          T *node = new T();
+          node->pool_index_ = NIL_INDEX;
+          return node;
+        }
+        continue;
+      }
+      // The node may be taken and freed again in the meantime, the tag of
+      // free_head_ is bumped then and the CAS fails.
+      T *node = At(index);
+      int next = AtomicOps::Load(&node->pool_next_);
+      if (AtomicOps::CompareAndSwap64(&free_head_, head,
+                                      MakeHead(HeadTag(head) + 1, next))) {
+        return node;
+      }
+    }
+  }
+
+  void Free(T *node) {
+    if (node->pool_index_ == NIL_INDEX) {
+      delete node;
+      return;
+    }
+    PushChain(node, node);
+  }
+
+ private:
+  static uint64 MakeHead(uint32 tag, int index) {
+    return (static_cast<uint64>(tag) << 32) | static_cast<uint32>(index);
+  }
+  static uint32 HeadTag(uint64 head) {
+    return static_cast<uint32>(head >> 32);
+  }
+  static int HeadIndex(uint64 head) {
+    return static_cast<int>(static_cast<uint32>(head));
+  }
+  T *At(int index) {
+    return &chunks_[index / CHUNK_SIZE][index % CHUNK_SIZE];
+  }
+
+  // first到last已经通过pool_next_连好
+  void PushChain(T *first, T *last) {
+    while (true) {
+      uint64 head = AtomicOps::Load64(&free_head_);
+      AtomicOps::Store(&last->pool_next_, HeadIndex(head));
+      if (AtomicOps::CompareAndSwap64(&free_head_, head,
+                                      MakeHead(HeadTag(head) + 1,
+                                               first->pool_index_))) {
+        return;
+      }
+    }
+  }
+
+  bool Grow() {
+    CritScope cs(&grow_crit_);
+    if (HeadIndex(AtomicOps::Load64(&free_head_)) != NIL_INDEX) {
+      // Refilled by another thread
+      return true;
+    }
+    if (chunk_count_ >= MAX_CHUNKS) {
+      return false;
+    }
+    T *chunk = new T[CHUNK_SIZE];
+    int base = chunk_count_ * CHUNK_SIZE;
+    for (int i = 0; i < CHUNK_SIZE; i++) {
+      chunk[i].pool_index_ = base + i;
+      chunk[i].pool_next_ = base + i + 1;
+    }
+    // Published by the CAS in PushChain
+    chunks_[chunk_count_++] = chunk;
+    PushChain(&chunk[0], &chunk[CHUNK_SIZE - 1]);
+    return true;
+  }
+
+ private:
+  // 高32位是版本号，低32位是第一个空闲节点的下标
+  uint64          free_head_;
+  T              *chunks_[MAX_CHUNKS];
+  int             chunk_count_;
+  CriticalSection grow_crit_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscNodePool);
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_EVENT_MPSCQUEUE_H_
@@ -37,6 +37,11 @@
 #include <signal.h>
 #endif
 
+#if defined(POSIX) && defined(__linux__) && !defined(LITEOS)
+#include <sys/eventfd.h>
+#define VZ_HAVE_EVENTFD
+#endif
+
 #ifdef LITEOS
 
 #if __cplusplus
@@ -172,6 +177,46 @@ class PosixSignal : public Signal {
 };
 
 int PosixSignal::pipe_count_ = 0;
+#elif defined(VZ_HAVE_EVENTFD)
+
+// eventfd的计数可以累加，一次read就清零，不需要signaled_标志和锁，
+// 一个fd就够了
+class PosixSignal : public Signal {
+ public:
+  PosixSignal() {
+    fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd_ < 0) {
+      LOG_E(LS_ERROR, EN, errno) << "eventfd failed";
+    }
+  }
+  virtual ~PosixSignal() {
+    if (fd_ != -1) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+  virtual void ResetWakeEvent() {
+    uint64 val = 0;
+    // EAGAIN means there is nothing to reset
+    if (read(fd_, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+      LOG_E(LS_ERROR, EN, errno) << "read eventfd";
+    }
+  }
+  virtual void SignalWakeup() {
+    uint64 val = 1;
+    VZ_VERIFY(static_cast<ssize_t>(sizeof(val))
+              == write(fd_, &val, sizeof(val)));
+  }
+  virtual uint32 GetEvents() const {
+    return DE_READ;
+  }
+  virtual SOCKET GetSocket() {
+    return fd_;
+  }
+ private:
+  int fd_;
+};
+
 #elif POSIX
 
 class PosixSignal : public Signal {
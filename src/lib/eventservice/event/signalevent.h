@@ -62,6 +62,7 @@ class SignalEvent {
 class Signal {
  public:
   static Signal *CreateSignal();
+  virtual ~Signal() {}
   virtual void ResetWakeEvent() = 0;
   virtual void SignalWakeup() = 0;
   virtual SOCKET GetSocket() = 0;
@@ -37,6 +37,7 @@
 #elif defined(POSIX)
 #include <time.h>
 #include <sys/prctl.h>
+#include <unistd.h>
 #endif
 
 #include "eventservice/base/common.h"
@@ -243,6 +244,42 @@ bool Thread::SetPriority(ThreadPriority priority) {
 #endif
 }
 
+bool Thread::SetAffinity(int cpu) {
+  ASSERT_RETURN_FAILURE(!started_, false);
+#ifdef WIN32
+  if (!::SetThreadAffinityMask(thread_, DWORD_PTR(1) << cpu)) {
+    LOG(LS_ERROR) << "SetThreadAffinityMask, error " << ::GetLastError();
+    return false;
+  }
+  return true;
+#elif defined(POSIX) && !defined(LITEOS) && !defined(OSX) && !defined(IOS)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  int error_code = pthread_setaffinity_np(thread_, sizeof(cpu_set), &cpu_set);
+  if (error_code != 0) {
+    LOG(LS_ERROR) << "pthread_setaffinity_np, error " << error_code;
+    return false;
+  }
+  return true;
+#else
+  LOG(LS_WARNING) << "Thread affinity is not supported";
+  return false;
+#endif
+}
+
+int Thread::NumberOfProcessors() {
+#ifdef WIN32
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return _max(1, static_cast<int>(info.dwNumberOfProcessors));
+#elif defined(POSIX)
+  return _max(1, static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN)));
+#else
+  return 1;
+#endif
+}
+
 bool Thread::Start(Runnable* runnable) {
   ASSERT(owned_);
   if (!owned_) return false;
@@ -519,6 +556,7 @@ bool Thread::ProcessMessages(int cmsLoop) {
         return !IsQuitting();
       }
       Dispatch(&msg);
+      socketserver()->OnMessageDispatched();
 
       if (cmsLoop != kForever) {
         cmsNext = TimeUntil(msEnd);
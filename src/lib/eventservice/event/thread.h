@@ -155,6 +155,13 @@ class Thread : public MessageQueue {
   }
   bool SetPriority(ThreadPriority priority);
 
+  // Pins the started thread to the cpu core, returns false if the platform
+  // doesn't support it.
+  bool SetAffinity(int cpu);
+
+  // Number of the online cpu cores, at least 1.
+  static int NumberOfProcessors();
+
   // Starts the execution of the thread.
   bool started() const {
     return started_;
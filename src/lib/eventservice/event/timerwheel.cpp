@@ -0,0 +1,269 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "eventservice/event/timerwheel.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace vzes {
+
+TimerNode::TimerNode()
+  : trigger_(0),
+    num_(0),
+    slot_(-1) {
+  prev_ = NULL;
+  next_ = NULL;
+}
+
+TimerWheel::TimerWheel(uint32 now)
+  : current_(now),
+    next_num_(0),
+    size_(0) {
+  for (int i = 0; i <= DUE_SLOT; i++) {
+    slots_[i].prev_ = &slots_[i];
+    slots_[i].next_ = &slots_[i];
+  }
+  memset(occupied_, 0, sizeof(occupied_));
+}
+
+TimerWheel::~TimerWheel() {
+  for (int i = 0; i <= DUE_SLOT; i++) {
+    while (slots_[i].next_ != &slots_[i]) {
+      Unlink(ToNode(slots_[i].next_));
+    }
+  }
+}
+
+void TimerWheel::Add(TimerNode *node, uint32 trigger, uint32 now) {
+  if (node->linked()) {
+    Remove(node);
+  }
+  if (size_ == 0) {
+    // Nothing to expire, skip the time passed while the wheel was empty
+    current_ = now;
+  }
+  node->trigger_ = trigger;
+  node->num_ = next_num_++;
+  Link(node);
+  size_++;
+}
+
+void TimerWheel::Remove(TimerNode *node) {
+  if (!node->linked()) {
+    return;
+  }
+  Unlink(node);
+  size_--;
+}
+
+void TimerWheel::Link(TimerNode *node) {
+  uint32 delta = node->trigger_ - current_;
+  int slot = 0;
+  if (static_cast<int32>(delta) < 0) {
+    // The slot of its time has been processed
+    slot = DUE_SLOT;
+  } else if (delta < ROOT_SLOTS) {
+    slot = node->trigger_ & (ROOT_SLOTS - 1);
+  } else {
+    int level = 1;
+    while (level < LEVELS - 1
+           && delta >= (1u << (SlotShift(level) + LEVEL_BITS))) {
+      level++;
+    }
+    slot = SlotBase(level)
+           + ((node->trigger_ >> SlotShift(level)) & (LEVEL_SLOTS - 1));
+  }
+  // Append to the tail to keep the FIFO order in the slot
+  TimerLink *head = &slots_[slot];
+  node->prev_ = head->prev_;
+  node->next_ = head;
+  head->prev_->next_ = node;
+  head->prev_ = node;
+  node->slot_ = slot;
+  occupied_[slot >> 5] |= 1u << (slot & 31);
+}
+
+void TimerWheel::Unlink(TimerNode *node) {
+  node->prev_->next_ = node->next_;
+  node->next_->prev_ = node->prev_;
+  TimerLink *head = &slots_[node->slot_];
+  if (head->next_ == head) {
+    occupied_[node->slot_ >> 5] &= ~(1u << (node->slot_ & 31));
+  }
+  node->prev_ = NULL;
+  node->next_ = NULL;
+  node->slot_ = -1;
+}
+
+void TimerWheel::Cascade(int level, uint32 index) {
+  int slot = SlotBase(level) + index;
+  TimerLink *head = &slots_[slot];
+  if (head->next_ == head) {
+    return;
+  }
+  TimerLink *link = head->next_;
+  head->prev_->next_ = NULL;
+  head->prev_ = head;
+  head->next_ = head;
+  occupied_[slot >> 5] &= ~(1u << (slot & 31));
+  while (link != NULL) {
+    TimerLink *next = link->next_;
+    Link(ToNode(link));
+    link = next;
+  }
+}
+
+int TimerWheel::FindSlot(int level, uint32 start) const {
+  uint32 base = SlotBase(level);
+  uint32 count = (level == 0) ? ROOT_SLOTS : LEVEL_SLOTS;
+  for (uint32 i = 0; i < count;) {
+    uint32 slot = (start + i) & (count - 1);
+    uint32 bit = base + slot;
+    uint32 word = occupied_[bit >> 5] >> (bit & 31);
+    if (word == 0) {
+      // Skip the rest of this word, the levels are aligned to 32 slots
+      i += 32 - (bit & 31);
+      continue;
+    }
+    while ((word & 1) == 0) {
+      word >>= 1;
+      slot++;
+    }
+    return slot;
+  }
+  return -1;
+}
+
+uint32 TimerWheel::NextEventDelta() const {
+  uint32 best = 0xFFFFFFFF;
+  uint32 index = current_ & (ROOT_SLOTS - 1);
+  int slot = FindSlot(0, index);
+  if (slot >= 0) {
+    best = (slot - index) & (ROOT_SLOTS - 1);
+  }
+  // 高层的槽在迁移时才知道准确的触发时间，用迁移的时间作为下界
+  for (int level = 1; level < LEVELS; level++) {
+    int shift = SlotShift(level);
+    uint32 low = current_ & ((1u << shift) - 1);
+    uint32 cur = (current_ >> shift) & (LEVEL_SLOTS - 1);
+    uint32 bit = SlotBase(level) + cur;
+    uint32 delta = 0;
+    if (low == 0 && (occupied_[bit >> 5] & (1u << (bit & 31)))) {
+      // The slot of this round has not been moved down yet
+      delta = 0;
+    } else {
+      slot = FindSlot(level, (cur + 1) & (LEVEL_SLOTS - 1));
+      if (slot < 0) {
+        continue;
+      }
+      uint32 steps = (slot - cur) & (LEVEL_SLOTS - 1);
+      if (steps == 0) {
+        steps = LEVEL_SLOTS;
+      }
+      // Wraps to the right value even for the last level
+      delta = (steps << shift) - low;
+    }
+    best = _min(best, delta);
+  }
+  return best;
+}
+
+void TimerWheel::TakeSlot(int slot, std::vector<TimerNode *> *expired) {
+  TimerLink *head = &slots_[slot];
+  while (head->next_ != head) {
+    TimerNode *node = ToNode(head->next_);
+    Unlink(node);
+    size_--;
+    expired->push_back(node);
+  }
+}
+
+bool TimerWheel::ExpireOrder(const TimerNode *a, const TimerNode *b) {
+  int32 diff = static_cast<int32>(a->trigger_ - b->trigger_);
+  if (diff != 0) {
+    return diff < 0;
+  }
+  return static_cast<int32>(a->num_ - b->num_) < 0;
+}
+
+void TimerWheel::Expire(uint32 now, std::vector<TimerNode *> *expired) {
+  size_t first = expired->size();
+  TakeSlot(DUE_SLOT, expired);
+  while (size_ > 0) {
+    // Jump over the empty slots
+    uint32 next = current_ + NextEventDelta();
+    if (static_cast<int32>(now - next) < 0) {
+      break;
+    }
+    current_ = next;
+    uint32 index = current_ & (ROOT_SLOTS - 1);
+    if (index == 0) {
+      // A round of level 0 is done, move the next slot of level 1 down,
+      // and so on when the upper level has finished a round as well.
+      for (int level = 1; level < LEVELS; level++) {
+        uint32 i = (current_ >> SlotShift(level)) & (LEVEL_SLOTS - 1);
+        Cascade(level, i);
+        if (i != 0) {
+          break;
+        }
+      }
+    }
+    TakeSlot(index, expired);
+    current_++;
+  }
+  if (static_cast<int32>(now - current_) >= 0) {
+    current_ = now + 1;
+  }
+  // The nodes moved down or added late may share a slot with later ones
+  if (expired->size() - first > 1) {
+    std::sort(expired->begin() + first, expired->end(), ExpireOrder);
+  }
+}
+
+int TimerWheel::GetDelay(uint32 now) const {
+  if (size_ == 0) {
+    return kForever;
+  }
+  if (slots_[DUE_SLOT].next_ != &slots_[DUE_SLOT]) {
+    return 0;
+  }
+  int32 delay = static_cast<int32>(current_ + NextEventDelta() - now);
+  return delay < 0 ? 0 : delay;
+}
+
+void TimerWheel::GetAll(std::vector<TimerNode *> *nodes) const {
+  for (int i = 0; i <= DUE_SLOT; i++) {
+    const TimerLink *head = &slots_[i];
+    for (TimerLink *link = head->next_; link != head; link = link->next_) {
+      nodes->push_back(ToNode(link));
+    }
+  }
+}
+
+}  // namespace vzes
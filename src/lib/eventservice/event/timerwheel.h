@@ -0,0 +1,143 @@
+/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef EVENTSERVICE_EVENT_TIMERWHEEL_H_
+#define EVENTSERVICE_EVENT_TIMERWHEEL_H_
+
+#include <vector>
+
+#include "eventservice/base/basictypes.h"
+#include "eventservice/base/constructormagic.h"
+
+namespace vzes {
+
+// 槽的链表头和节点共用的双向链表指针
+struct TimerLink {
+  TimerLink *prev_;
+  TimerLink *next_;
+};
+
+// 挂在时间轮槽上的节点，通过双向链表连接，插入和删除都是O(1)
+class TimerNode : private TimerLink {
+ public:
+  TimerNode();
+
+  uint32 trigger() const {
+    return trigger_;
+  }
+  // 还在时间轮上，没有触发或者被删除
+  bool linked() const {
+    return next_ != NULL;
+  }
+
+ private:
+  friend class TimerWheel;
+  uint32     trigger_;
+  // Nodes triggered at the same time are expired in FIFO order
+  uint32     num_;
+  int        slot_;
+};
+
+// 分层时间轮，毫秒精度，和Time()一样使用会回绕的uint32时间。
+// 第0层256个槽，每个槽1ms；第1到4层各64个槽，每个槽是下一层的一圈，
+// 合起来覆盖整个32位时间。节点到了下一层的范围时再往下一层迁移。
+// Not thread safe, MessageQueue guards it with its own lock.
+class TimerWheel {
+ public:
+  explicit TimerWheel(uint32 now);
+  ~TimerWheel();
+
+  // now is only used to catch up the wheel when it is empty
+  void Add(TimerNode *node, uint32 trigger, uint32 now);
+  void Remove(TimerNode *node);
+  // Unlink the nodes due at now and append them to expired, ordered by
+  // trigger time.
+  void Expire(uint32 now, std::vector<TimerNode *> *expired);
+  // Milliseconds until Expire() has something to do, kForever when empty.
+  // It may be earlier than the first trigger time when the nodes are moved
+  // down a level.
+  int GetDelay(uint32 now) const;
+  // 所有还在时间轮上的节点，顺序不定
+  void GetAll(std::vector<TimerNode *> *nodes) const;
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+ private:
+  enum {
+    ROOT_BITS   = 8,
+    ROOT_SLOTS  = 1 << ROOT_BITS,
+    LEVEL_BITS  = 6,
+    LEVEL_SLOTS = 1 << LEVEL_BITS,
+    LEVELS      = 5,
+    TOTAL_SLOTS = ROOT_SLOTS + (LEVELS - 1) * LEVEL_SLOTS,
+    // 加入时已经过期的节点，下一次Expire()就触发
+    DUE_SLOT    = TOTAL_SLOTS
+  };
+  void Link(TimerNode *node);
+  void Unlink(TimerNode *node);
+  // Unlink all the nodes of slot and append them to expired
+  void TakeSlot(int slot, std::vector<TimerNode *> *expired);
+  // Move the nodes of slot index in level down
+  void Cascade(int level, uint32 index);
+  // Milliseconds from current_ to the next slot to process
+  uint32 NextEventDelta() const;
+  // First non empty slot of level, searching circularly from start
+  int FindSlot(int level, uint32 start) const;
+  static bool ExpireOrder(const TimerNode *a, const TimerNode *b);
+  static TimerNode *ToNode(TimerLink *link) {
+    return static_cast<TimerNode *>(link);
+  }
+
+  static int SlotBase(int level) {
+    return level == 0 ? 0 : ROOT_SLOTS + (level - 1) * LEVEL_SLOTS;
+  }
+  static int SlotShift(int level) {
+    return level == 0 ? 0 : ROOT_BITS + (level - 1) * LEVEL_BITS;
+  }
+
+ private:
+  // 下一个要处理的时间，之前的槽都已经处理过
+  uint32    current_;
+  uint32    next_num_;
+  size_t    size_;
+  // 每个槽的链表头，环形链表
+  TimerLink slots_[TOTAL_SLOTS + 1];
+  // 非空槽的位图
+  uint32    occupied_[TOTAL_SLOTS / 32 + 1];
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_EVENT_TIMERWHEEL_H_
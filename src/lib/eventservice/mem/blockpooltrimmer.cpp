@@ -0,0 +1,53 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+
+#include "eventservice/mem/blockpooltrimmer.h"
+#include "eventservice/base/logging.h"
+
+namespace vzes {
+
+#define MSG_BLOCK_POOL_TRIM (1)
+
+BlockPoolTrimmer::Ptr BlockPoolTrimmer::Create(EventService::Ptr event_service,
+    uint32 interval) {
+  ASSERT_RETURN_FAILURE(!event_service, BlockPoolTrimmer::Ptr());
+  BlockPoolTrimmer::Ptr trimmer(new BlockPoolTrimmer(event_service));
+  trimmer->trim_timer_ = event_service->PostPeriodic(interval ? interval : 1,
+                         trimmer.get(), MSG_BLOCK_POOL_TRIM);
+  return trimmer;
+}
+
+BlockPoolTrimmer::BlockPoolTrimmer(EventService::Ptr event_service)
+  : event_service_(event_service) {
+}
+
+BlockPoolTrimmer::~BlockPoolTrimmer() {
+  Stop();
+}
+
+void BlockPoolTrimmer::Stop() {
+  if (trim_timer_) {
+    trim_timer_->Cancel();
+    trim_timer_.reset();
+  }
+}
+
+void BlockPoolTrimmer::OnMessage(Message *msg) {
+  if (msg->message_id != MSG_BLOCK_POOL_TRIM) {
+    return;
+  }
+  size_t released = BlockPool::Trim();
+  if (released > 0) {
+    LOG(L_INFO) << "Release " << released << " bytes of free blocks";
+  }
+}
+
+}  // namespace vzes
@@ -0,0 +1,47 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+
+#ifndef EVENTSERVICE_MEM_BLOCKPOOLTRIMMER_H_
+#define EVENTSERVICE_MEM_BLOCKPOOLTRIMMER_H_
+
+#include "eventservice/base/basicincludes.h"
+#include "eventservice/mem/membuffer.h"
+#include "eventservice/net/eventservice.h"
+
+namespace vzes {
+
+// 在EventService线程上定时调用BlockPool::Trim()，把突发流量之后
+// 留在全局池中的空闲Block逐步还给系统，同时更新分配速率的统计。
+// 整个进程创建一个就够了
+class BlockPoolTrimmer : public MessageHandler,
+  public boost::noncopyable {
+ public:
+  typedef boost::shared_ptr<BlockPoolTrimmer> Ptr;
+
+  // 每隔interval毫秒整理一次，默认10秒
+  static BlockPoolTrimmer::Ptr Create(EventService::Ptr event_service,
+                                      uint32 interval = 10000);
+  virtual ~BlockPoolTrimmer();
+
+  void Stop();
+
+ private:
+  explicit BlockPoolTrimmer(EventService::Ptr event_service);
+  virtual void OnMessage(Message *msg);
+
+ private:
+  EventService::Ptr event_service_;
+  Timer::Ptr        trim_timer_;
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_MEM_BLOCKPOOLTRIMMER_H_
@@ -26,43 +26,431 @@
 */
 
 #include "eventservice/mem/membuffer.h"
+#include "eventservice/tls/tls.h"
+#include "eventservice/base/timeutils.h"
 #include <string.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 namespace vzes {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static const size_t BLOCK_CLASS_SIZES[BLOCK_CLASS_COUNT] = {
+  BLOCK_SIZE_256B, BLOCK_SIZE_1KB, BLOCK_SIZE_4KB, BLOCK_SIZE_16KB,
+  BLOCK_SIZE_64KB
+};
+
+// 能装下size字节的最小规格，超过最大规格时返回最大规格
+static size_t BlockClassIndex(size_t size) {
+  for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+    if (size <= BLOCK_CLASS_SIZES[i]) {
+      return i;
+    }
+  }
+  return BLOCK_CLASS_COUNT - 1;
+}
+
+// 每个线程的空闲Block缓存最多占用的内存，每种规格至少2个、最多64个
+#define MAGAZINE_BYTES      (64 * 1024)
+#define MAGAZINE_MIN_BLOCKS 2
+#define MAGAZINE_MAX_BLOCKS 64
+
+static size_t MagazineLimit(size_t index) {
+  size_t limit = MAGAZINE_BYTES / BLOCK_CLASS_SIZES[index];
+  return _max(_min(limit, static_cast<size_t>(MAGAZINE_MAX_BLOCKS)),
+              static_cast<size_t>(MAGAZINE_MIN_BLOCKS));
+}
+
+// 全局池中空闲数据的默认上限和整理的目标
+#define DEFAULT_MAX_FREE_BYTES  (8 * 1024 * 1024)
+#define DEFAULT_LOW_FREE_BYTES  (1024 * 1024)
+// 多出低水位不到这么多时一次整理完，否则每次整理一半
+#define TRIM_STEP_BYTES         (64 * 1024)
+// 两次整理之间释放的内存超过这么多时调用malloc_trim还给系统
+#define MALLOC_TRIM_BYTES       (1024 * 1024)
+
+// 线程退出时由TLS的destructor把magazine还给全局池。Windows和LiteOS上
+// Tls不调用destructor，退出的线程的magazine会一直留着，这两个平台上不用
+// magazine，每次取和还都直接访问全局池
+#if !defined(WIN32) && !defined(LITEOS)
+#define VZ_BLOCK_MAGAZINE 1
+#endif
+
+// 线程自己的空闲Block，取和还都不加锁。空了从全局池中一次取半个
+// magazine，满了一次还回去一半。网络线程收到、工作线程释放的Block
+// 先进工作线程的magazine，再成批回到全局池，不会每个Block加一次锁
+struct BlockMagazine {
+  BlockMagazine() {
+    memset(counts, 0, sizeof(counts));
+    memset(takes, 0, sizeof(takes));
+    memset(frees, 0, sizeof(frees));
+    trim_ops = 0;
+    flush    = 0;
+  }
+  size_t counts[BLOCK_CLASS_COUNT];
+  // 本线程取出和还回的Block个数，只有本线程修改，统计时由别的线程读，
+  // 读到的值可能稍微滞后
+  size_t takes[BLOCK_CLASS_COUNT];
+  size_t frees[BLOCK_CLASS_COUNT];
+  // 上次Trim()时的取出和还回总数，只在持锁时读写
+  size_t trim_ops;
+  // 两次Trim()之间没有取也没有还的magazine由Trim()置位，本线程下次取或还
+  // 时看到就把缓存的Block都还给全局池。不加内存屏障，晚看到一次没有关系
+  volatile int flush;
+  Block *blocks[BLOCK_CLASS_COUNT][MAGAZINE_MAX_BLOCKS];
+};
+
+// 每种规格一个全局空闲链表，Block头和数据区一次分配在一起。
+// 全局池中空闲的数据超过上限时直接释放，Trim()再慢慢释放到低水位
 class BlockManager : public boost::noncopyable {
  public:
   static BlockManager *Instance();
-  Block::Ptr TakeBlock() {
-    vzes::CritScope cr(&crit_);
-    Block *block = NULL;
-    if (blocks_.size() != 0) {
-      block = blocks_.front();
-      blocks_.pop_front();
-    } else {
-      block = new Block();
+  Block::Ptr TakeBlock(size_t size) {
+    return Block::Ptr(InternalTakeBlock(BlockClassIndex(size)),
+                      BlockManager::RecyleBlock);
+  }
+  void TakeBlocks(size_t count, BlocksPtr *blocks) {
+    size_t index = BlockClassIndex(DEFAULT_BLOCK_SIZE);
+    for (size_t i = 0; i < count; i++) {
+      blocks->push_back(Block::Ptr(InternalTakeBlock(index),
+                                   BlockManager::RecyleBlock));
+    }
+  }
+  void TakeBlocksFor(size_t size, size_t max_count, BlocksPtr *blocks) {
+    for (size_t i = 0; i < max_count && size > 0; i++) {
+      Block *block = InternalTakeBlock(BlockClassIndex(Block::ChunkSize(size)));
+      size -= _min(size, block->capacity);
+      blocks->push_back(Block::Ptr(block, BlockManager::RecyleBlock));
     }
-    return Block::Ptr(block, BlockManager::RecyleBlock);
   }
   static void RecyleBlock(void *block);
  public:
   void InternalRecyleBlock(Block *block) {
-    vzes::CritScope cr(&crit_);
     block->buffer[0]    = 0;
-    block->buffer_size  = 0;
+    block->head         = 0;
+    block->tail         = 0;
     block->encode_flag_ = false;
-    blocks_.push_back(block);
+    size_t index = BlockClassIndex(block->capacity);
+#ifndef VZ_BLOCK_MAGAZINE
+    std::vector<Block *> released;
+    {
+      vzes::CritScope cr(&crit_);
+      retired_frees_[index]++;
+      blocks_[index].push_back(block);
+      free_bytes_ += BlockBytes(index);
+      ReleaseFreeBlocks(max_free_bytes_, &released);
+    }
+    FreeBlocks(released);
+#else
+    BlockMagazine *magazine = CurrentMagazine();
+    if (magazine->flush) {
+      FlushMagazine(magazine);
+    }
+    if (magazine->counts[index] == MagazineLimit(index)) {
+      SpillMagazine(magazine, index, MagazineLimit(index) / 2);
+    }
+    magazine->blocks[index][magazine->counts[index]++] = block;
+    magazine->frees[index]++;
+#endif
+  }
+  void SetFreeLimits(size_t max_free_bytes, size_t low_free_bytes) {
+    std::vector<Block *> released;
+    {
+      vzes::CritScope cr(&crit_);
+      max_free_bytes_ = max_free_bytes;
+      low_free_bytes_ = _min(low_free_bytes, max_free_bytes);
+      ReleaseFreeBlocks(max_free_bytes_, &released);
+    }
+    FreeBlocks(released);
+  }
+  size_t Trim() {
+    std::vector<Block *> released;
+    size_t trim_bytes = 0;
+    {
+      vzes::CritScope cr(&crit_);
+      UpdateTakeRate();
+      MarkIdleMagazines();
+      if (free_bytes_ > low_free_bytes_) {
+        size_t excess = free_bytes_ - low_free_bytes_;
+        if (excess > TRIM_STEP_BYTES) {
+          excess /= 2;
+        }
+        ReleaseFreeBlocks(free_bytes_ - excess, &released);
+      }
+      // 超过上限时直接释放的Block也算在内
+      if (released_bytes_ >= MALLOC_TRIM_BYTES) {
+        trim_bytes = released_bytes_;
+        released_bytes_ = 0;
+      }
+    }
+    size_t bytes = FreeBlocks(released);
+#ifdef __GLIBC__
+    if (trim_bytes > 0) {
+      malloc_trim(0);
+    }
+#endif
+    return bytes;
+  }
+  void GetStats(BlockPoolStats *stats) {
+    vzes::CritScope cr(&crit_);
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+      size_t takes = retired_takes_[i];
+      size_t frees = retired_frees_[i];
+      size_t cached = blocks_[i].size();
+      for (std::list<BlockMagazine *>::iterator iter = magazines_.begin();
+           iter != magazines_.end(); ++iter) {
+        takes  += (*iter)->takes[i];
+        frees  += (*iter)->frees[i];
+        cached += (*iter)->counts[i];
+      }
+      stats->blocks_in_use += takes - frees;
+      stats->bytes_in_use  += (takes - frees) * BLOCK_CLASS_SIZES[i];
+      stats->blocks_free   += cached;
+      stats->bytes_free    += cached * BLOCK_CLASS_SIZES[i];
+      stats->total_takes   += takes;
+    }
+    stats->bytes_allocated      = allocated_bytes_;
+    stats->peak_bytes_allocated = peak_allocated_bytes_;
+    stats->heap_allocations     = heap_allocations_;
+    stats->heap_releases        = heap_releases_;
+    stats->takes_per_second     = takes_per_second_;
   }
-  BlockManager() {
+  BlockManager()
+    : free_bytes_(0),
+      allocated_bytes_(0),
+      peak_allocated_bytes_(0),
+      heap_allocations_(0),
+      heap_releases_(0),
+      released_bytes_(0),
+      max_free_bytes_(DEFAULT_MAX_FREE_BYTES),
+      low_free_bytes_(DEFAULT_LOW_FREE_BYTES),
+      last_total_takes_(0),
+      last_rate_time_(Time()),
+      takes_per_second_(0) {
+    memset(retired_takes_, 0, sizeof(retired_takes_));
+    memset(retired_frees_, 0, sizeof(retired_frees_));
+#ifdef VZ_BLOCK_MAGAZINE
+    tls_instance_ = new Tls();
+    tls_instance_->CreateKey(&magazine_key_, BlockManager::ReleaseMagazine);
+#endif
   }
   virtual ~BlockManager() {
+#ifdef VZ_BLOCK_MAGAZINE
+    tls_instance_->DeleteKey(magazine_key_);
+    delete tls_instance_;
+#endif
+  }
+ private:
+  static size_t BlockBytes(size_t index) {
+    return sizeof(Block) + BLOCK_CLASS_SIZES[index];
+  }
+  Block *InternalTakeBlock(size_t index) {
+#ifndef VZ_BLOCK_MAGAZINE
+    {
+      vzes::CritScope cr(&crit_);
+      retired_takes_[index]++;
+      Blocks &blocks = blocks_[index];
+      if (blocks.size() != 0) {
+        Block *block = blocks.back();
+        blocks.pop_back();
+        free_bytes_ -= BlockBytes(index);
+        return block;
+      }
+      allocated_bytes_ += BlockBytes(index);
+      peak_allocated_bytes_ = _max(peak_allocated_bytes_, allocated_bytes_);
+      heap_allocations_++;
+    }
+    return NewBlock(index);
+#else
+    BlockMagazine *magazine = CurrentMagazine();
+    if (magazine->flush) {
+      FlushMagazine(magazine);
+    }
+    magazine->takes[index]++;
+    if (magazine->counts[index] == 0 && !RefillMagazine(magazine, index)) {
+      return NewBlock(index);
+    }
+    return magazine->blocks[index][--magazine->counts[index]];
+#endif
+  }
+  static Block *NewBlock(size_t index) {
+    size_t capacity = BLOCK_CLASS_SIZES[index];
+    uint8 *memory = new uint8[sizeof(Block) + capacity];
+    return new (memory) Block(memory + sizeof(Block), capacity);
+  }
+#ifdef VZ_BLOCK_MAGAZINE
+  BlockMagazine *CurrentMagazine() {
+    BlockMagazine *magazine =
+      static_cast<BlockMagazine *>(tls_instance_->GetKey(magazine_key_));
+    if (magazine == NULL) {
+      magazine = new BlockMagazine();
+      tls_instance_->SetKey(magazine_key_, magazine);
+      vzes::CritScope cr(&crit_);
+      magazines_.push_back(magazine);
+    }
+    return magazine;
+  }
+  // 从全局池中取一批最近还回来的Block放到magazine中。全局池也空了时
+  // 记下要从堆上分配一个新的Block，返回false
+  bool RefillMagazine(BlockMagazine *magazine, size_t index) {
+    vzes::CritScope cr(&crit_);
+    Blocks &blocks = blocks_[index];
+    size_t count = MagazineLimit(index) / 2;
+    while (count-- > 0 && blocks.size() != 0) {
+      magazine->blocks[index][magazine->counts[index]++] = blocks.back();
+      blocks.pop_back();
+      free_bytes_ -= BlockBytes(index);
+    }
+    if (magazine->counts[index] != 0) {
+      return true;
+    }
+    allocated_bytes_ += BlockBytes(index);
+    peak_allocated_bytes_ = _max(peak_allocated_bytes_, allocated_bytes_);
+    heap_allocations_++;
+    return false;
+  }
+  void SpillMagazine(BlockMagazine *magazine, size_t index, size_t count) {
+    std::vector<Block *> released;
+    {
+      vzes::CritScope cr(&crit_);
+      Blocks &blocks = blocks_[index];
+      while (count-- > 0 && magazine->counts[index] > 0) {
+        blocks.push_back(magazine->blocks[index][--magazine->counts[index]]);
+        free_bytes_ += BlockBytes(index);
+      }
+      ReleaseFreeBlocks(max_free_bytes_, &released);
+    }
+    FreeBlocks(released);
+  }
+  // 把magazine中所有的Block都还给全局池，由以后的Trim()释放
+  void FlushMagazine(BlockMagazine *magazine) {
+    magazine->flush = 0;
+    std::vector<Block *> released;
+    {
+      vzes::CritScope cr(&crit_);
+      for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+        while (magazine->counts[i] > 0) {
+          blocks_[i].push_back(magazine->blocks[i][--magazine->counts[i]]);
+          free_bytes_ += BlockBytes(i);
+        }
+      }
+      ReleaseFreeBlocks(max_free_bytes_, &released);
+    }
+    FreeBlocks(released);
+  }
+#endif
+  // 标记上次Trim()以来没有取也没有还、但还缓存着Block的magazine。
+  // 一直空闲的线程要等它下次取或还Block时才会把缓存还回来
+  void MarkIdleMagazines() {
+    for (std::list<BlockMagazine *>::iterator iter = magazines_.begin();
+         iter != magazines_.end(); ++iter) {
+      BlockMagazine *magazine = *iter;
+      size_t ops = 0;
+      size_t cached = 0;
+      for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+        ops    += magazine->takes[i] + magazine->frees[i];
+        cached += magazine->counts[i];
+      }
+      if (ops == magazine->trim_ops && cached != 0) {
+        magazine->flush = 1;
+      }
+      magazine->trim_ops = ops;
+    }
+  }
+  // 从大规格开始，取出最早还回来的Block，直到空闲的数据不超过limit，
+  // 取出的Block在锁外释放
+  void ReleaseFreeBlocks(size_t limit, std::vector<Block *> *released) {
+    for (size_t i = BLOCK_CLASS_COUNT; i > 0 && free_bytes_ > limit; i--) {
+      Blocks &blocks = blocks_[i - 1];
+      while (free_bytes_ > limit && blocks.size() != 0) {
+        released->push_back(blocks.front());
+        blocks.pop_front();
+        free_bytes_      -= BlockBytes(i - 1);
+        allocated_bytes_ -= BlockBytes(i - 1);
+        released_bytes_  += BlockBytes(i - 1);
+        heap_releases_++;
+      }
+    }
+  }
+  // 返回释放的字节数
+  static size_t FreeBlocks(const std::vector<Block *> &blocks) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      bytes += sizeof(Block) + blocks[i]->capacity;
+      blocks[i]->~Block();
+      delete[] reinterpret_cast<uint8 *>(blocks[i]);
+    }
+    return bytes;
+  }
+  void UpdateTakeRate() {
+    size_t total_takes = 0;
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+      total_takes += retired_takes_[i];
+      for (std::list<BlockMagazine *>::iterator iter = magazines_.begin();
+           iter != magazines_.end(); ++iter) {
+        total_takes += (*iter)->takes[i];
+      }
+    }
+    uint32 now = Time();
+    uint32 elapsed = TimeDiff(now, last_rate_time_);
+    if (elapsed > 0) {
+      takes_per_second_ = static_cast<uint32>(
+                            (uint64)(total_takes - last_total_takes_) * 1000
+                            / elapsed);
+    }
+    last_total_takes_ = total_takes;
+    last_rate_time_   = now;
+  }
+#ifdef VZ_BLOCK_MAGAZINE
+  // 线程退出时把magazine中的Block都还给全局池，计数合并到retired中
+  static void ReleaseMagazine(void *magazine) {
+    BlockManager *manager = Instance();
+    BlockMagazine *thread_magazine = static_cast<BlockMagazine *>(magazine);
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+      manager->SpillMagazine(thread_magazine, i, thread_magazine->counts[i]);
+    }
+    {
+      vzes::CritScope cr(&manager->crit_);
+      for (size_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+        manager->retired_takes_[i] += thread_magazine->takes[i];
+        manager->retired_frees_[i] += thread_magazine->frees[i];
+      }
+      manager->magazines_.remove(thread_magazine);
+    }
+    delete thread_magazine;
   }
+#endif
  private:
-  Blocks               blocks_;
-  static BlockManager   *instance_;
-  vzes::CriticalSection crit_;
+  Blocks                     blocks_[BLOCK_CLASS_COUNT];
+  std::list<BlockMagazine *> magazines_;
+  // 已经退出的线程的magazine的计数，没有magazine时是所有的计数
+  size_t                     retired_takes_[BLOCK_CLASS_COUNT];
+  size_t                     retired_frees_[BLOCK_CLASS_COUNT];
+  // 全局池中空闲Block和从堆上分配的Block占用的内存，包括Block头
+  size_t                     free_bytes_;
+  size_t                     allocated_bytes_;
+  size_t                     peak_allocated_bytes_;
+  size_t                     heap_allocations_;
+  size_t                     heap_releases_;
+  // 上次malloc_trim之后还给堆的内存
+  size_t                     released_bytes_;
+  size_t                     max_free_bytes_;
+  size_t                     low_free_bytes_;
+  size_t                     last_total_takes_;
+  uint32                     last_rate_time_;
+  uint32                     takes_per_second_;
+  static BlockManager        *instance_;
+  vzes::CriticalSection      crit_;
+#ifdef VZ_BLOCK_MAGAZINE
+  Tls                        *tls_instance_;
+  TLS_KEY                    magazine_key_;
+#endif
 };
 
 BlockManager *BlockManager::instance_ = NULL;
@@ -83,12 +471,27 @@ void BlockManager::RecyleBlock(void *block) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void BlockPool::SetFreeLimits(size_t max_free_bytes, size_t low_free_bytes) {
+  BlockManager::Instance()->SetFreeLimits(max_free_bytes, low_free_bytes);
+}
+
+size_t BlockPool::Trim() {
+  return BlockManager::Instance()->Trim();
+}
+
+void BlockPool::GetStats(BlockPoolStats *stats) {
+  ASSERT_RETURN_VOID(stats == NULL);
+  BlockManager::Instance()->GetStats(stats);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 
 MemBuffer::Ptr MemBuffer::CreateMemBuffer() {
   return MemBuffer::Ptr(new MemBuffer());
 }
 
-MemBuffer::MemBuffer() : size_(0) {
+MemBuffer::MemBuffer() : size_(0), front_offset_(0), index_valid_(true) {
 }
 
 MemBuffer::~MemBuffer() {
@@ -125,24 +528,22 @@ bool MemBuffer::ReadBytes(char* val, size_t len) {
     return false;
   }
   size_t read_size = 0;
-  for (BlocksPtr::iterator iter = blocks_.begin(); iter != blocks_.end();) {
-    size_t rs = 0;
+  size_t popped = 0;
+  while (read_size < len && !blocks_.empty()) {
+    Block *block = blocks_.front().get();
     if (val == NULL) {
-      rs = (*iter)->ReadBytes(NULL, len - read_size);
-    } else {
-      rs = (*iter)->ReadBytes(val + read_size, len - read_size);
-    }
-    read_size += rs;
-    if ((*iter)->buffer_size == 0) {
-      iter = blocks_.erase(iter) ;
+      read_size += block->ReadBytes(NULL, len - read_size);
     } else {
-      iter ++;
+      read_size += block->ReadBytes(val + read_size, len - read_size);
     }
-    if (read_size == len) {
+    if (block->size() != 0) {
       break;
     }
+    blocks_.pop_front();
+    popped++;
   }
   size_ = size_ - len;
+  PopIndex(len, popped);
   return true;
 }
 
@@ -151,25 +552,23 @@ bool MemBuffer::ReadBuffer(MemBuffer::Ptr buffer, size_t len) {
     return false;
   }
   size_t read_size = 0;
-  for (BlocksPtr::iterator iter = blocks_.begin(); iter != blocks_.end();) {
-    size_t rs = 0;
-    if (len - read_size > (*iter)->buffer_size) {
-      rs = (*iter)->buffer_size;
-      buffer->WriteBytes((const char *)((*iter)->buffer), rs);
+  size_t popped = 0;
+  while (read_size < len && !blocks_.empty()) {
+    Block::Ptr &block = blocks_.front();
+    size_t rs = block->size();
+    if (rs <= len - read_size) {
+      buffer->AppendBlock(block);
+      blocks_.pop_front();
+      popped++;
     } else {
       rs = len - read_size;
-      buffer->WriteBytes((const char *)((*iter)->buffer), rs);
+      buffer->WriteBytes((const char *)block->data(), rs);
+      block->Consume(rs);
     }
     read_size += rs;
-    if (rs == (*iter)->buffer_size) {
-      iter = blocks_.erase(iter) ;
-    } else {
-      iter ++;
-    }
-    if (read_size == len) {
-      break;
-    }
   }
+  size_ = size_ - len;
+  PopIndex(len, popped);
   return true;
 }
 
@@ -180,19 +579,18 @@ bool MemBuffer::ReadString(std::string* val, size_t len) {
     return false;
   }
   size_t read_size = 0;
-  for (BlocksPtr::iterator iter = blocks_.begin(); iter != blocks_.end();) {
-    size_t rs = (*iter)->ReadString(val, len - read_size);
-    read_size += rs;
-    if (rs == 0) {
-      iter = blocks_.erase(iter) ;
-    } else {
-      iter ++;
-    }
-    if (read_size == len) {
+  size_t popped = 0;
+  while (read_size < len && !blocks_.empty()) {
+    Block *block = blocks_.front().get();
+    read_size += block->ReadString(val, len - read_size);
+    if (block->size() != 0) {
       break;
     }
+    blocks_.pop_front();
+    popped++;
   }
   size_ = size_ - len;
+  PopIndex(len, popped);
   return true;
 }
 
@@ -201,7 +599,7 @@ std::string MemBuffer::ToString() {
   std::string result;
   for (BlocksPtr::iterator iter = blocks_.begin();
        iter != blocks_.end(); iter++) {
-    result.append((const char *)((*iter)->buffer), (*iter)->buffer_size);
+    result.append((const char *)((*iter)->data()), (*iter)->size());
   }
   return result;
 }
@@ -210,25 +608,49 @@ std::string MemBuffer::ToString() {
 void MemBuffer::DumpData() {
   for (BlocksPtr::iterator iter = blocks_.begin();
        iter != blocks_.end(); iter++) {
-    LOG(L_INFO).write((const char *)((*iter)->buffer), (*iter)->buffer_size);
+    LOG(L_INFO).write((const char *)((*iter)->data()), (*iter)->size());
   }
 }
 
 // -----------------------------------------------------------------------------
 
 void MemBuffer::AppendBuffer(MemBuffer::Ptr buffer) {
-  BlocksPtr &blocks = buffer->blocks();
+  // 只读对方的Block，不需要作废对方的位置索引
+  const BlocksPtr &blocks = buffer->blocks_;
   blocks_.insert(blocks_.end(), blocks.begin(), blocks.end());
+  for (BlocksPtr::const_iterator iter = blocks.begin();
+       iter != blocks.end(); iter++) {
+    AppendIndex((*iter)->size());
+  }
   size_ = size_ + buffer->size();
 }
 
 void MemBuffer::AppendBlock(Block::Ptr block) {
   blocks_.push_back(block);
-  size_ = size_ + block->buffer_size;
+  AppendIndex(block->size());
+  size_ = size_ + block->size();
+}
+
+void MemBuffer::PrependBlock(Block::Ptr block) {
+  blocks_.push_front(block);
+  size_ = size_ + block->size();
+  if (!index_valid_) {
+    return;
+  }
+  // 前面读出过足够的数据时直接往前接，否则下一次CopyXXX时重建索引
+  if (front_offset_ >= block->size()) {
+    block_ends_.push_front(front_offset_);
+    front_offset_ -= block->size();
+  } else {
+    index_valid_ = false;
+  }
 }
 
 void MemBuffer::Clear() {
   blocks_.clear();
+  block_ends_.clear();
+  front_offset_ = 0;
+  index_valid_  = true;
   size_ = 0;
 }
 
@@ -302,22 +724,59 @@ bool MemBuffer::CopyString(size_t pos, std::string* val, size_t len) {
   return true;
 }
 
+// 二分查找第一个结束位置大于pos的Block，pos正好在两个Block中间时
+// 返回后一个Block。pos == size_时返回blocks_.end()，以前返回的是最后一个
+// Block，*block_pos是它的长度；CopyXXX这时len只能是0，两种都不复制数据
 BlocksPtr::iterator MemBuffer::GetPostion(size_t pos, size_t *block_pos) {
   if (pos > size_) {
     return blocks_.end();
   }
-  size_t remain_pos = pos;
+  // 通过blocks()的引用增删Block、读出数据后忘了InvalidateIndex()时，
+  // Block个数或者总长度对不上，也重建索引
+  if (!index_valid_ || block_ends_.size() != blocks_.size() ||
+      (block_ends_.empty() ? 0 : block_ends_.back() - front_offset_) != size_) {
+    RebuildIndex();
+  }
+  size_t offset = front_offset_ + pos;
+  std::deque<size_t>::iterator end =
+    std::upper_bound(block_ends_.begin(), block_ends_.end(), offset);
+  if (end == block_ends_.end()) {
+    return blocks_.end();
+  }
+  size_t index = end - block_ends_.begin();
+  *block_pos = offset - (index == 0 ? front_offset_ : block_ends_[index - 1]);
+  return blocks_.begin() + index;
+}
+
+void MemBuffer::AppendIndex(size_t block_size) {
+  if (!index_valid_) {
+    return;
+  }
+  size_t start = block_ends_.empty() ? front_offset_ : block_ends_.back();
+  block_ends_.push_back(start + block_size);
+}
+
+// 从前面读出了len个字节，其中count个Block已经读完删除
+void MemBuffer::PopIndex(size_t len, size_t count) {
+  if (!index_valid_) {
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    block_ends_.pop_front();
+  }
+  front_offset_ += len;
+}
+
+void MemBuffer::RebuildIndex() {
+  block_ends_.clear();
+  front_offset_ = 0;
+  size_t end = 0;
   for (BlocksPtr::iterator iter = blocks_.begin();
        iter != blocks_.end(); iter++) {
-    int rs = (*iter)->buffer_size - remain_pos;
-    if (rs >= 0) {
-      *block_pos = remain_pos;
-      return iter;
-    } else {
-      remain_pos = remain_pos - (*iter)->buffer_size;
-    }
+    end += (*iter)->size();
+    block_ends_.push_back(end);
   }
-  return blocks_.end();
+  index_valid_ = true;
 }
 
 // -----------------------------------------------------------------------------
@@ -353,6 +812,9 @@ void MemBuffer::WriteBytes(const char* val, size_t len) {
     if (last_block->RemainSize() != 0) {
       ws = last_block->WriteBytes(val, len);
     }
+    if (ws > 0 && index_valid_) {
+      block_ends_.back() += ws;
+    }
     // 2. 如果数据没有写完，就直接写新的Block
     if (len > ws) {
       WriteNewBytes(val + ws, len - ws);
@@ -364,9 +826,12 @@ void MemBuffer::WriteBytes(const char* val, size_t len) {
 void MemBuffer::WriteNewBytes(const char* val, size_t len) {
   size_t pos = 0;
   while(true) {
-    Block::Ptr block = BlockManager::Instance()->TakeBlock();
+    // 按这次要写的数据和已有的数据量选规格，数据越多Block越大
+    Block::Ptr block = BlockManager::Instance()->TakeBlock(
+                         Block::ChunkSize(_max(len - pos, size_)));
     blocks_.push_back(block);
     size_t ws = block->WriteBytes(val + pos, len - pos);
+    AppendIndex(ws);
     pos += ws;
     if (pos == len) {
       return ;
@@ -377,68 +842,81 @@ void MemBuffer::WriteNewBytes(const char* val, size_t len) {
 ////////////////////////////////////////////////////////////////////////////////
 
 
-Block::Ptr Block::TakeBlock() {
-  return BlockManager::Instance()->TakeBlock();
+Block::Ptr Block::TakeBlock(size_t size) {
+  return BlockManager::Instance()->TakeBlock(size);
+}
+
+void Block::TakeBlocks(size_t count, BlocksPtr *blocks) {
+  BlockManager::Instance()->TakeBlocks(count, blocks);
+}
+
+void Block::TakeBlocksFor(size_t size, size_t max_count, BlocksPtr *blocks) {
+  BlockManager::Instance()->TakeBlocksFor(size, max_count, blocks);
+}
+
+size_t Block::ChunkSize(size_t size) {
+  size_t index = BlockClassIndex(size);
+  if (index > 0 && size < BLOCK_CLASS_SIZES[index]
+      && BLOCK_CLASS_SIZES[index] - size > size) {
+    return BLOCK_CLASS_SIZES[index - 1];
+  }
+  return BLOCK_CLASS_SIZES[index];
 }
 
 size_t Block::WriteBytes(const char* val, size_t len) {
-  if (DEFAULT_BLOCK_SIZE == buffer_size || len == 0) {
+  if (capacity == tail || len == 0) {
     return 0;
   }
-  size_t remain_size = DEFAULT_BLOCK_SIZE - buffer_size;
+  size_t remain_size = capacity - tail;
   size_t write_size  = remain_size > len ? len : remain_size;
-  memcpy(buffer + buffer_size, val, write_size);
-  buffer_size += write_size;
+  memcpy(buffer + tail, val, write_size);
+  tail += write_size;
   return write_size;
 }
 
 size_t Block::ReadBytes(char* val, size_t len) {
-  if (0 == buffer_size || len == 0) {
+  if (head == tail || len == 0) {
     return 0;
   }
-  size_t remain_size = buffer_size;
+  size_t remain_size = tail - head;
   size_t read_size   = remain_size > len ? len : remain_size;
   if (val != NULL) {
-    memcpy(val, buffer, read_size);
+    memcpy(val, buffer + head, read_size);
   }
-  remain_size = buffer_size - read_size;
-  memmove(buffer, buffer + read_size, remain_size);
-  buffer_size = remain_size;
+  Consume(read_size);
   return read_size;
 }
 
 
 size_t Block::ReadString(std::string* val, size_t len) {
-  if (0 == buffer_size || len == 0) {
+  if (head == tail || len == 0) {
     return 0;
   }
-  size_t remain_size = buffer_size;
+  size_t remain_size = tail - head;
   size_t read_size   = remain_size > len ? len : remain_size;
-  val->append((const char *)buffer, read_size);
-  remain_size = buffer_size - read_size;
-  memmove(buffer, buffer + read_size, remain_size);
-  buffer_size = remain_size;
+  val->append((const char *)(buffer + head), read_size);
+  Consume(read_size);
   return read_size;
 }
 
 
 size_t Block::CopyBytes(size_t pos, char* val, size_t len) {
-  if (pos > buffer_size || len == 0) {
+  if (pos > size() || len == 0) {
     return 0;
   }
-  size_t remain_size = buffer_size - pos;
+  size_t remain_size = size() - pos;
   size_t copy_size   = remain_size > len ? len : remain_size;
-  memcpy(val, buffer + pos, copy_size);
+  memcpy(val, buffer + head + pos, copy_size);
   return copy_size;
 }
 
 size_t Block::CopyString(size_t pos, std::string* val, size_t len) {
-  if (pos > buffer_size || len == 0) {
+  if (pos > size() || len == 0) {
     return 0;
   }
-  size_t remain_size = buffer_size - pos;
+  size_t remain_size = size() - pos;
   size_t copy_size   = remain_size > len ? len : remain_size;
-  val->append((const char *)(buffer + pos), copy_size);
+  val->append((const char *)(buffer + head + pos), copy_size);
   return copy_size;
 }
 
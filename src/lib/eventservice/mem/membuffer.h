@@ -29,23 +29,73 @@
 #define EVENTSERVICE_MEM_MEMBUFFER_H_
 
 #include "eventservice/base/basicincludes.h"
+#include <deque>
 
 namespace vzes {
 
-#define DEFAULT_BLOCK_SIZE 768
+// Block按容量分成几种规格，控制包用小Block，图片等大数据用大Block，
+// 减少Block个数和浪费的空间
+#define BLOCK_SIZE_256B     256
+#define BLOCK_SIZE_1KB      1024
+#define BLOCK_SIZE_4KB      (4 * 1024)
+#define BLOCK_SIZE_16KB     (16 * 1024)
+#define BLOCK_SIZE_64KB     (64 * 1024)
+#define BLOCK_CLASS_COUNT   5
+// 不知道数据大小时使用的规格
+#define DEFAULT_BLOCK_SIZE  BLOCK_SIZE_1KB
+
+struct Block;
+typedef std::list<Block *> Blocks;
+// Block指针连续存放，两端增删都是O(1)，还可以按下标访问
+typedef std::deque<boost::shared_ptr<Block> > BlocksPtr;
 
+// 有效数据是buffer[head, tail)，读出数据只移动head，不搬移剩下的数据
 struct Block : public boost::noncopyable {
   typedef boost::shared_ptr<Block> Ptr;
-  Block() {
-    buffer_size  = 0;
+  Block(uint8 *data_buffer, size_t buffer_capacity) {
+    buffer       = data_buffer;
+    capacity     = buffer_capacity;
+    head         = 0;
+    tail         = 0;
     buffer[0]    = 0;
     encode_flag_ = false;
   }
+  uint8 *data() {
+    return buffer + head;
+  }
+  const uint8 *data() const {
+    return buffer + head;
+  }
+  size_t  size() const {
+    return tail - head;
+  }
   size_t  RemainSize() const {
-    return DEFAULT_BLOCK_SIZE - buffer_size;
+    return capacity - tail;
+  }
+  // 丢掉前面len个字节，全部读完时回到buffer开头，可以重新写满
+  void    Consume(size_t len) {
+    head += len;
+    if (head >= tail) {
+      head = 0;
+      tail = 0;
+    }
+  }
+  // 数据从buffer开头直接读入(例如readv)之后设置数据长度
+  void    SetSize(size_t size) {
+    head = 0;
+    tail = size;
   }
 
-  static Block::Ptr TakeBlock();
+  // 取一个能装下size字节的最小规格的Block，超过最大规格时返回最大规格
+  static Block::Ptr TakeBlock(size_t size = DEFAULT_BLOCK_SIZE);
+  // Block先从当前线程的缓存中取，缓存空了再成批从全局池中取
+  // 一次从池中取count个默认规格的Block追加到blocks后面
+  static void TakeBlocks(size_t count, BlocksPtr *blocks);
+  // 取一组Block用来存放size字节的数据，最多max_count个
+  static void TakeBlocksFor(size_t size, size_t max_count, BlocksPtr *blocks);
+  // 把size字节的数据分到多个Block时下一个Block应该使用的规格，
+  // 装不满的部分超过一半时改用小一级的规格，剩下的数据再取Block
+  static size_t ChunkSize(size_t size);
 
   size_t  WriteBytes(const char* val, size_t len);
   size_t  ReadBytes(char* val, size_t len);
@@ -53,18 +103,49 @@ struct Block : public boost::noncopyable {
   size_t  CopyBytes(size_t pos, char* val, size_t len);
   size_t  CopyString(size_t pos, std::string* val, size_t len);
 
-  uint8   buffer[DEFAULT_BLOCK_SIZE];
-  size_t  buffer_size;
+  uint8  *buffer;
+  size_t  capacity;
+  size_t  head;
+  size_t  tail;
   bool    encode_flag_;
 };
 
-typedef std::list<Block *> Blocks;
-typedef std::list<Block::Ptr> BlocksPtr;
+// Block池的统计，字节数都只算数据区，bytes_allocated包括Block头
+struct BlockPoolStats {
+  size_t blocks_in_use;         // 取出还没有释放的Block
+  size_t bytes_in_use;
+  size_t blocks_free;           // 全局池和各线程缓存中空闲的Block
+  size_t bytes_free;
+  size_t bytes_allocated;       // 当前从堆上分配的内存
+  size_t peak_bytes_allocated;
+  size_t total_takes;           // 累计取出的Block数
+  size_t heap_allocations;      // 累计从堆上分配和还给堆的Block数
+  size_t heap_releases;
+  uint32 takes_per_second;      // 最近两次Trim()之间每秒取出的Block数
+};
+
+// Block池的配置和统计，可以在任何线程调用
+class BlockPool {
+ public:
+  // 全局池中空闲的内存超过max_free_bytes时，还回来的Block直接释放；
+  // Trim()逐步释放到low_free_bytes为止。默认是8MB和1MB
+  static void SetFreeLimits(size_t max_free_bytes, size_t low_free_bytes);
+  // 释放全局池中多出低水位的一部分空闲Block，多出不到64KB时全部释放，
+  // 返回释放的字节数。一般由BlockPoolTrimmer定时调用。
+  // 线程缓存(只在Linux等TLS支持destructor的平台上有)在线程退出时还给全局池；
+  // 两次Trim()之间没有取也没有还的线程缓存会被标记，等这个线程下次取或还
+  // Block时整个还给全局池，再由以后的Trim()释放。
+  // 只有glibc上释放的内存多时会调用malloc_trim把堆的空闲页还给系统，
+  // 其他平台只还给堆，进程占用的内存是否减少取决于C库
+  static size_t Trim();
+  static void GetStats(BlockPoolStats *stats);
+};
 
 // 这个类一般适用于在大数据量传输通过种使用，目前只在两个地方使用
 // 1. Filecahe存放图片的大数据应用
 // 2. 网络数据传输
 // 使用注意，多次写入少量数据的速度是非常慢的，尽量一次写入大量数据
+// 内部为每个Block记录结束位置，CopyXXX按位置二分查找Block，不需要从头遍历
 class MemBuffer : public boost::noncopyable {
  public:
   typedef boost::shared_ptr<MemBuffer> Ptr;
@@ -81,12 +162,24 @@ class MemBuffer : public boost::noncopyable {
 
   void DumpData();
 
+  // 调用者可能通过返回的引用增删Block或者修改Block中的数据，
+  // 所以位置索引先作废，下一次CopyXXX时重建。拿着引用在CopyXXX之后
+  // 又修改了Block的，要调用InvalidateIndex()
   BlocksPtr &blocks() {
+    index_valid_ = false;
+    return blocks_;
+  };
+  void InvalidateIndex() {
+    index_valid_ = false;
+  }
+  const BlocksPtr &blocks() const {
     return blocks_;
   };
 
   void AppendBuffer(MemBuffer::Ptr buffer);
   void AppendBlock(Block::Ptr block);
+  // 把block放到最前面，比如在已有的数据前加一个包头
+  void PrependBlock(Block::Ptr block);
   void ReduceSize(size_t size) {
     size_ = size_ - size;
   }
@@ -112,11 +205,13 @@ class MemBuffer : public boost::noncopyable {
 
   // Read a next value from the buffer. Return false if there isn't
   // enough data left for the specified type.
+  // 读出的数据只移动Block的head，读完的Block放回池中
   bool ReadUInt8(uint8* val);
   bool ReadUInt16(uint16* val);
   bool ReadUInt32(uint32* val);
   bool ReadUInt64(uint64* val);
   bool ReadBytes(char* val, size_t len);
+  // 整个Block直接移到buffer中，不复制数据
   bool ReadBuffer(MemBuffer::Ptr buffer, size_t len);
 
   // Appends next |len| bytes from the buffer to |val|. Returns false
@@ -136,9 +231,17 @@ class MemBuffer : public boost::noncopyable {
  private:
   void WriteNewBytes(const char* val, size_t len);
   BlocksPtr::iterator GetPostion(size_t pos, size_t *block_pos);
+  void AppendIndex(size_t block_size);
+  void PopIndex(size_t len, size_t count);
+  void RebuildIndex();
  private:
   size_t    size_;
   BlocksPtr blocks_;
+  // block_ends_[i]是第i个Block数据结束的位置，第一个Block从front_offset_
+  // 开始。从前面读出数据时只移动front_offset_，不用改后面的值
+  std::deque<size_t> block_ends_;
+  size_t    front_offset_;
+  bool      index_valid_;
 };
 
 }
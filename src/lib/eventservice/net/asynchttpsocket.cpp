@@ -92,6 +92,10 @@ AsyncHttpSocket::AsyncHttpSocket(AsyncSocket::Ptr socket,
     this, &AsyncHttpSocket::OnAsyncSocketReadEvent);
   async_socket_->SignalSocketWriteEvent.connect(
     this, &AsyncHttpSocket::OnAsyncSocketWriteEvent);
+  async_socket_->SignalWriteBlocked.connect(
+    this, &AsyncHttpSocket::OnAsyncSocketWriteBlocked);
+  async_socket_->SignalWriteDrained.connect(
+    this, &AsyncHttpSocket::OnAsyncSocketWriteDrained);
   //////////////////////////////////////////////////////////////////////////////
   // Init http settings
   http_settings_.on_message_begin     = vzes::CBHttpMessageBegin;
@@ -164,7 +168,7 @@ bool AsyncHttpSocket::AsyncWritePacket(const char *data, uint32 size) {
     LOG(L_ERROR) << "Socket is closed";
     return false;
   }
-  return async_socket_->AsyncWrite(data, size) == 0;
+  return async_socket_->AsyncWrite(data, size);
 }
 
 bool AsyncHttpSocket::AsyncWriteRepMessage(reply &reply) {
@@ -186,6 +190,12 @@ bool AsyncHttpSocket::StartReadNextPacket() {
   return async_socket_->AsyncRead();
 }
 
+void AsyncHttpSocket::SetWriteWatermarks(size_t high, size_t low,
+    AsyncSocket::OverflowPolicy policy) {
+  ASSERT_RETURN_VOID(!async_socket_);
+  async_socket_->SetWriteWatermarks(high, low, policy);
+}
+
 bool AsyncHttpSocket::AnalisysPacket(MemBuffer::Ptr buffer) {
   std::string packet = buffer->ToString();
   int res = http_parser_execute(&http_parser_,
@@ -219,6 +229,12 @@ void AsyncHttpSocket::SignalClose(int error_code, bool is_signal) {
   if (!SignalHttpPacketWrite.is_empty()) {
     SignalHttpPacketWrite.disconnect_all();
   }
+  if (!SignalHttpWriteBlocked.is_empty()) {
+    SignalHttpWriteBlocked.disconnect_all();
+  }
+  if (!SignalHttpWriteDrained.is_empty()) {
+    SignalHttpWriteDrained.disconnect_all();
+  }
   recv_size_ = 0;
 }
 
@@ -227,6 +243,14 @@ void AsyncHttpSocket::OnAsyncSocketWriteEvent(AsyncSocket::Ptr socket) {
   SignalHttpPacketWrite(shared_from_this());
 }
 
+void AsyncHttpSocket::OnAsyncSocketWriteBlocked(AsyncSocket::Ptr socket) {
+  SignalHttpWriteBlocked(shared_from_this());
+}
+
+void AsyncHttpSocket::OnAsyncSocketWriteDrained(AsyncSocket::Ptr socket) {
+  SignalHttpWriteDrained(shared_from_this());
+}
+
 void AsyncHttpSocket::OnAsyncSocketReadEvent(AsyncSocket::Ptr socket,
     MemBuffer::Ptr data_buffer) {
   LOG(L_INFO) << "Read data size = " << data_buffer->size();
@@ -30,6 +30,9 @@ class AsyncHttpSocket : public boost::noncopyable,
   sigslot::signal2<AsyncHttpSocket::Ptr, HttpReqMessage&> SignalHttpPacketEvent;
   sigslot::signal2<AsyncHttpSocket::Ptr, int> SignalHttpPacketError;
   sigslot::signal1<AsyncHttpSocket::Ptr>      SignalHttpPacketWrite;
+  // 转发AsyncSocket的SignalWriteBlocked/SignalWriteDrained
+  sigslot::signal1<AsyncHttpSocket::Ptr>      SignalHttpWriteBlocked;
+  sigslot::signal1<AsyncHttpSocket::Ptr>      SignalHttpWriteDrained;
  public:
   AsyncHttpSocket(AsyncSocket::Ptr async_socket,
                   SocketAddress &remote_addr);
@@ -39,6 +42,9 @@ class AsyncHttpSocket : public boost::noncopyable,
   bool AsyncWritePacket(const char *data, uint32 size);
   bool AsyncWriteRepMessage(reply &reply);
   bool StartReadNextPacket();
+  // 见AsyncSocket::SetWriteWatermarks
+  void SetWriteWatermarks(size_t high, size_t low,
+                          AsyncSocket::OverflowPolicy policy);
 
   virtual void            Close();
   const SocketAddress     remote_addr();
@@ -58,6 +64,8 @@ class AsyncHttpSocket : public boost::noncopyable,
   void SignalClose(int error_code, bool is_signal);
 
   void OnAsyncSocketWriteEvent(AsyncSocket::Ptr socket);
+  void OnAsyncSocketWriteBlocked(AsyncSocket::Ptr socket);
+  void OnAsyncSocketWriteDrained(AsyncSocket::Ptr socket);
 
   void OnAsyncSocketReadEvent(AsyncSocket::Ptr socket,
                               MemBuffer::Ptr data_buffer);
@@ -14,13 +14,20 @@ namespace vzes {
 
 AsyncPacketSocket::AsyncPacketSocket(EventService::Ptr event_service,
                                      AsyncSocket::Ptr socket)
-  : async_socket_(socket) {
+  : async_socket_(socket),
+    heartbeat_(false) {
   async_socket_->SignalSocketErrorEvent.connect(
     this, &AsyncPacketSocket::OnAsyncSocketErrorEvent);
   async_socket_->SignalSocketReadEvent.connect(
     this, &AsyncPacketSocket::OnAsyncSocketReadEvent);
   async_socket_->SignalSocketWriteEvent.connect(
     this, &AsyncPacketSocket::OnAsyncSocketWriteEvent);
+  async_socket_->SignalWriteBlocked.connect(
+    this, &AsyncPacketSocket::OnAsyncSocketWriteBlocked);
+  async_socket_->SignalWriteDrained.connect(
+    this, &AsyncPacketSocket::OnAsyncSocketWriteDrained);
+  async_socket_->SignalWriteIdle.connect(
+    this, &AsyncPacketSocket::OnAsyncSocketWriteIdle);
   //////////////////////////////////////////////////////////////////////////////
   recv_buff_ = MemBuffer::CreateMemBuffer();
 }
@@ -92,8 +99,8 @@ bool AsyncPacketSocket::AsyncWritePacket(const char *data,
   if (size) {
     data_buffer->WriteBytes(data, size);
   }
-  async_socket_->AsyncWrite(data_buffer);
-  return true;
+  // 超过高水位被拒绝时返回false
+  return async_socket_->AsyncWrite(data_buffer);
 }
 
 bool AsyncPacketSocket::AsyncWritePacket(MemBuffer::Ptr buffer,
@@ -105,12 +112,11 @@ bool AsyncPacketSocket::AsyncWritePacket(MemBuffer::Ptr buffer,
   packet_header.data_size = htonl(buffer->size());
 
   MemBuffer::Ptr send_buffer = MemBuffer::CreateMemBuffer();
-  vzes::Block::Ptr block = vzes::Block::TakeBlock();
+  vzes::Block::Ptr block = vzes::Block::TakeBlock(sizeof(PacketHeader));
   block->WriteBytes((char*)&packet_header, sizeof(PacketHeader));
   send_buffer->AppendBlock(block);
   send_buffer->AppendBuffer(buffer);
-  async_socket_->AsyncWrite(send_buffer);
-  return true;
+  return async_socket_->AsyncWrite(send_buffer);
 }
 
 bool AsyncPacketSocket::AsyncRead() {
@@ -121,6 +127,18 @@ bool AsyncPacketSocket::AsyncRead() {
   return async_socket_->AsyncRead();
 }
 
+void AsyncPacketSocket::SetWriteWatermarks(size_t high, size_t low,
+    AsyncSocket::OverflowPolicy policy) {
+  ASSERT_RETURN_VOID(!async_socket_);
+  async_socket_->SetWriteWatermarks(high, low, policy);
+}
+
+void AsyncPacketSocket::SetHeartbeat(uint32 interval, uint32 timeout) {
+  ASSERT_RETURN_VOID(!async_socket_);
+  heartbeat_ = (interval != 0 || timeout != 0);
+  async_socket_->SetIdleTimeout(timeout, interval);
+}
+
 bool AsyncPacketSocket::AnalysisPacket(MemBuffer::Ptr buffer) {
   while (true) {
     uint32 recv_size = recv_buff_->size() + buffer->size();
@@ -170,12 +188,12 @@ bool AsyncPacketSocket::AnalysisPacket(MemBuffer::Ptr buffer) {
       while (true) {
         // 遍历本次接收数据MemBuffer，组包
         Block::Ptr block = blocks.front();
-        length += block->buffer_size;
+        length += block->size();
         if ((length - PACKET_HEADER_SIZE) < packet_header.data_size) {
           // 当前Packet不完整，继续查找下一个Block
           usr_buff->AppendBlock(block);
           blocks.pop_front();
-          buffer->ReduceSize(block->buffer_size);
+          buffer->ReduceSize(block->size());
           continue;
         } else {
           // 当前Packet完整，解析当前Block
@@ -183,20 +201,24 @@ bool AsyncPacketSocket::AnalysisPacket(MemBuffer::Ptr buffer) {
             // 当前Block中所有数据属于当前的Packet
             usr_buff->AppendBlock(block);
             blocks.pop_front();
-            buffer->ReduceSize(block->buffer_size);
+            buffer->ReduceSize(block->size());
           } else {
             // 当前Block中只有部分数据属于当前的Packet
             int tail_len = packet_header.data_size -
-                           (length - PACKET_HEADER_SIZE - block->buffer_size);
-            vzes::Block::Ptr tail_block = vzes::Block::TakeBlock();
+                           (length - PACKET_HEADER_SIZE - block->size());
+            vzes::Block::Ptr tail_block = vzes::Block::TakeBlock(tail_len);
             block->ReadBytes((char*)tail_block->buffer, tail_len);
-            tail_block->buffer_size = tail_len;
+            tail_block->SetSize(tail_len);
             usr_buff->AppendBlock(tail_block);
             buffer->ReduceSize(tail_len);
           }
 
           // 当前Packet组包完成，去除“VZ”头部，通知用户
           usr_buff->ReadBytes(NULL, sizeof(PacketHeader));
+          if (heartbeat_ && packet_header.flag == PACKET_FLAG_HEARTBEAT) {
+            // 心跳包只用来刷新读空闲时间
+            break;
+          }
           SignalPacketEvent(shared_from_this(), usr_buff, packet_header.flag);
           // SignalPacketEvent 有可能会关闭整个AsyncPacketSocket
           if (!async_socket_) {
@@ -228,6 +250,12 @@ void AsyncPacketSocket::SignalClose(int error_code, bool is_signal) {
   if (!SignalPacketWrite.is_empty()) {
     SignalPacketWrite.disconnect_all();
   }
+  if (!SignalPacketWriteBlocked.is_empty()) {
+    SignalPacketWriteBlocked.disconnect_all();
+  }
+  if (!SignalPacketWriteDrained.is_empty()) {
+    SignalPacketWriteDrained.disconnect_all();
+  }
 }
 
 void AsyncPacketSocket::LiveSignalClose(int error_code, bool is_signal) {
@@ -239,6 +267,18 @@ void AsyncPacketSocket::OnAsyncSocketWriteEvent(AsyncSocket::Ptr socket) {
   SignalPacketWrite(shared_from_this());
 }
 
+void AsyncPacketSocket::OnAsyncSocketWriteBlocked(AsyncSocket::Ptr socket) {
+  SignalPacketWriteBlocked(shared_from_this());
+}
+
+void AsyncPacketSocket::OnAsyncSocketWriteDrained(AsyncSocket::Ptr socket) {
+  SignalPacketWriteDrained(shared_from_this());
+}
+
+void AsyncPacketSocket::OnAsyncSocketWriteIdle(AsyncSocket::Ptr socket) {
+  AsyncWritePacket(NULL, 0, PACKET_FLAG_HEARTBEAT);
+}
+
 void AsyncPacketSocket::OnAsyncSocketReadEvent(AsyncSocket::Ptr socket,
     MemBuffer::Ptr data_buffer) {
   AsyncPacketSocket::Ptr live_this = shared_from_this();
@@ -20,6 +20,9 @@ namespace vzes {
 #define PACKET_HEADER_SIZE     (8)
 #define PACKET_RECV_BUFF_SIZE  (64 * 1024)
 #define PACKET_BODY_SIZE       (PACKET_RECV_BUFF_SIZE - PACKET_HEADER_SIZE)
+// 心跳包的flag，没有数据。调用了SetHeartbeat的socket收到时不通知用户，
+// 其他socket上依然是普通的包
+#define PACKET_FLAG_HEARTBEAT  (0xFFFF)
 
 struct PacketHeader {
   uint8   v;
@@ -37,6 +40,9 @@ class AsyncPacketSocket : public boost::noncopyable,
           MemBuffer::Ptr, uint16>               SignalPacketEvent;
   sigslot::signal2<AsyncPacketSocket::Ptr, int> SignalPacketError;
   sigslot::signal1<AsyncPacketSocket::Ptr>      SignalPacketWrite;
+  // 转发AsyncSocket的SignalWriteBlocked/SignalWriteDrained
+  sigslot::signal1<AsyncPacketSocket::Ptr>      SignalPacketWriteBlocked;
+  sigslot::signal1<AsyncPacketSocket::Ptr>      SignalPacketWriteDrained;
  public:
   AsyncPacketSocket(EventService::Ptr event_service,
                     AsyncSocket::Ptr socket);
@@ -46,6 +52,13 @@ class AsyncPacketSocket : public boost::noncopyable,
   bool AsyncWritePacket(const char *data, uint32 size, uint16 flag);
   bool AsyncWritePacket(MemBuffer::Ptr buffer, uint16 flag);
   bool AsyncRead();
+  // 见AsyncSocket::SetWriteWatermarks，水位按包含包头的字节数计算
+  void SetWriteWatermarks(size_t high, size_t low,
+                          AsyncSocket::OverflowPolicy policy);
+  // 超过interval毫秒没有发送数据时发一个心跳包，超过timeout毫秒没有收到
+  // 任何数据(包括对方的心跳包)时以ETIMEDOUT发出SignalPacketError并关闭。
+  // 0表示不发心跳或者不检查超时，timeout应该比对方的interval大几倍
+  void SetHeartbeat(uint32 interval, uint32 timeout);
 
   virtual void            Close();
   const SocketAddress     local_addr();
@@ -61,6 +74,9 @@ class AsyncPacketSocket : public boost::noncopyable,
   void LiveSignalClose(int error_code, bool is_signal);
 
   void OnAsyncSocketWriteEvent(AsyncSocket::Ptr socket);
+  void OnAsyncSocketWriteBlocked(AsyncSocket::Ptr socket);
+  void OnAsyncSocketWriteDrained(AsyncSocket::Ptr socket);
+  void OnAsyncSocketWriteIdle(AsyncSocket::Ptr socket);
 
   void OnAsyncSocketReadEvent(AsyncSocket::Ptr socket,
                               MemBuffer::Ptr data_buffer);
@@ -69,6 +85,8 @@ class AsyncPacketSocket : public boost::noncopyable,
  private:
   AsyncSocket::Ptr async_socket_;
   MemBuffer::Ptr   recv_buff_;
+  // SetHeartbeat开启了心跳，PACKET_FLAG_HEARTBEAT的包不交给用户
+  bool             heartbeat_;
 };
 
 
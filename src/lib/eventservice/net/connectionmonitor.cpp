@@ -0,0 +1,103 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "eventservice/net/connectionmonitor.h"
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/timeutils.h"
+
+namespace vzes {
+
+#define MSG_MONITOR_TICK            (1)
+#define DEFAULT_MONITOR_GRANULARITY 100
+
+ConnectionMonitor::ConnectionMonitor(EventService *es)
+  : event_service_(es),
+    wheel_(Time()),
+    granularity_(DEFAULT_MONITOR_GRANULARITY),
+    tick_time_(0) {
+}
+
+ConnectionMonitor::~ConnectionMonitor() {
+  if (tick_timer_) {
+    tick_timer_->Cancel();
+    tick_timer_.reset();
+  }
+}
+
+void ConnectionMonitor::SetGranularity(uint32 granularity) {
+  granularity_ = granularity ? granularity : 1;
+}
+
+void ConnectionMonitor::Schedule(MonitorEntry *entry, uint32 delay) {
+  ASSERT_RETURN_VOID(entry == NULL);
+  uint32 now = Time();
+  if (entry->linked()) {
+    wheel_.Remove(entry);
+  }
+  wheel_.Add(entry, now + delay, now);
+  ScheduleTick(now);
+}
+
+void ConnectionMonitor::Remove(MonitorEntry *entry) {
+  ASSERT_RETURN_VOID(entry == NULL);
+  if (entry->linked()) {
+    wheel_.Remove(entry);
+  }
+  // 可能在同一批到期的节点中，还没有检查到
+  for (size_t i = 0; i < expired_.size(); i++) {
+    if (expired_[i] == entry) {
+      expired_[i] = NULL;
+    }
+  }
+}
+
+void ConnectionMonitor::OnMessage(Message *msg) {
+  if (msg->message_id != MSG_MONITOR_TICK) {
+    return;
+  }
+  tick_timer_.reset();
+  uint32 now = Time();
+  wheel_.Expire(now, &expired_);
+  for (size_t i = 0; i < expired_.size(); i++) {
+    MonitorEntry *entry = static_cast<MonitorEntry *>(expired_[i]);
+    // 被Remove了，或者被重新Schedule了
+    if (entry == NULL || entry->linked()) {
+      continue;
+    }
+    expired_[i] = NULL;
+    entry->OnMonitorCheck(now);
+  }
+  expired_.clear();
+  ScheduleTick(Time());
+}
+
+void ConnectionMonitor::ScheduleTick(uint32 now) {
+  if (wheel_.empty()) {
+    // 已经发出去的tick到时候什么都不做
+    return;
+  }
+  int delay = wheel_.GetDelay(now);
+  if (delay < static_cast<int>(granularity_)) {
+    delay = granularity_;
+  }
+  uint32 tick_time = now + delay;
+  if (tick_timer_) {
+    // 已经有一个不晚于这次(允许误差一个粒度)的tick了
+    if (TimeDiff(tick_time, tick_time_) + static_cast<int32>(granularity_)
+        >= 0) {
+      return;
+    }
+    tick_timer_->Cancel();
+  }
+  tick_timer_ = event_service_->PostDelayed(delay, this, MSG_MONITOR_TICK);
+  tick_time_ = tick_time;
+}
+
+}  // namespace vzes
@@ -0,0 +1,72 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef EVENTSERVICE_NET_CONNECTIONMONITOR_H_
+#define EVENTSERVICE_NET_CONNECTIONMONITOR_H_
+
+#include <vector>
+
+#include "eventservice/base/basicincludes.h"
+#include "eventservice/event/messagequeue.h"
+#include "eventservice/event/timerwheel.h"
+
+namespace vzes {
+
+class EventService;
+
+// 被ConnectionMonitor管理的对象，例如连接超时、读写空闲超时。
+// 到期时在EventService线程中调用OnMonitorCheck，要继续检查就再Schedule
+class MonitorEntry : public TimerNode {
+ public:
+  virtual ~MonitorEntry() {}
+  virtual void OnMonitorCheck(uint32 now) = 0;
+};
+
+// 连接的超时管理，所有的连接共用一个时间轮和一个粗粒度的定时器，
+// 而不是每个连接(或者每个数据包)一个PostDelayed。
+// 连接有读写活动时只记录时间，不需要动时间轮，到期检查时再根据最后
+// 活动的时间重新Schedule，所以每次活动的开销是O(1)的一次赋值。
+// 到期时间会晚最多一个granularity。只能在EventService线程中使用
+class ConnectionMonitor : public MessageHandler,
+  public boost::noncopyable {
+ public:
+  typedef boost::shared_ptr<ConnectionMonitor> Ptr;
+
+  explicit ConnectionMonitor(EventService *es);
+  virtual ~ConnectionMonitor();
+
+  // 检查的粒度，默认100毫秒
+  void SetGranularity(uint32 granularity);
+  // delay毫秒之后检查entry，entry已经在等待时重新设置时间
+  void Schedule(MonitorEntry *entry, uint32 delay);
+  // entry析构之前必须Remove
+  void Remove(MonitorEntry *entry);
+
+  size_t size() const {
+    return wheel_.size();
+  }
+
+ private:
+  virtual void OnMessage(Message *msg);
+  void ScheduleTick(uint32 now);
+
+ private:
+  EventService              *event_service_;
+  TimerWheel                 wheel_;
+  uint32                     granularity_;
+  Timer::Ptr                 tick_timer_;
+  uint32                     tick_time_;
+  // 正在检查的到期节点，检查过程中被Remove的节点置为NULL
+  std::vector<TimerNode *>   expired_;
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_NET_CONNECTIONMONITOR_H_
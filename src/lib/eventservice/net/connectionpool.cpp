@@ -0,0 +1,331 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "eventservice/net/connectionpool.h"
+#include "eventservice/base/timeutils.h"
+
+namespace vzes {
+
+#define MSG_POOL_RESULT             (1)
+#define DEFAULT_MAX_PER_HOST        8
+#define DEFAULT_MAX_IDLE_TIME       (60 * 1000)
+#define DEFAULT_CONNECT_TIMEOUT     (3 * 1000)
+
+ConnectionPool::ConnectionPool(EventService::Ptr event_service)
+  : event_service_(event_service),
+    next_id_(0),
+    max_per_host_(DEFAULT_MAX_PER_HOST),
+    max_idle_time_(DEFAULT_MAX_IDLE_TIME),
+    connect_timeout_(DEFAULT_CONNECT_TIMEOUT) {
+  monitor_ = event_service_->connection_monitor();
+}
+
+ConnectionPool::~ConnectionPool() {
+  Close();
+  for (Hosts::iterator iter = hosts_.begin(); iter != hosts_.end(); ++iter) {
+    delete iter->second;
+  }
+  hosts_.clear();
+}
+
+void ConnectionPool::SetMaxPerHost(size_t max_per_host) {
+  max_per_host_ = max_per_host ? max_per_host : 1;
+}
+
+void ConnectionPool::SetMaxIdleTime(uint32 max_idle_time) {
+  max_idle_time_ = max_idle_time;
+}
+
+void ConnectionPool::SetConnectTimeout(uint32 connect_timeout) {
+  connect_timeout_ = connect_timeout;
+}
+
+uint32 ConnectionPool::Checkout(const SocketAddress &addr, uint32 time_out) {
+  ASSERT_RETURN_FAILURE(addr.IsNil(), 0);
+  ASSERT_RETURN_FAILURE(!monitor_, 0);
+  Host *host = GetHost(addr);
+  Waiter waiter;
+  if (++next_id_ == 0) {
+    ++next_id_;
+  }
+  waiter.id = next_id_;
+  waiter.deadline = Time() + time_out;
+  waiter.forever = (time_out == 0);
+  host->waiters.push_back(waiter);
+  ServeHost(host);
+  if (!host->waiters.empty()) {
+    ScheduleHost(host, Time());
+  }
+  return waiter.id;
+}
+
+AsyncSocket::Ptr ConnectionPool::TryCheckout(const SocketAddress &addr) {
+  Host *host = FindHost(addr);
+  if (host == NULL) {
+    return AsyncSocket::Ptr();
+  }
+  AsyncSocket::Ptr socket = TakeIdle(host);
+  if (socket) {
+    host->busy++;
+    lent_[socket.get()] = host;
+  }
+  ScheduleHost(host, Time());
+  return socket;
+}
+
+void ConnectionPool::Cancel(uint32 id) {
+  for (Hosts::iterator iter = hosts_.begin(); iter != hosts_.end(); ++iter) {
+    std::deque<Waiter> &waiters = iter->second->waiters;
+    for (size_t i = 0; i < waiters.size(); i++) {
+      if (waiters[i].id == id) {
+        waiters.erase(waiters.begin() + i);
+        return;
+      }
+    }
+  }
+  // 已经分到了连接，还没有发出去
+  for (size_t i = 0; i < results_.size(); i++) {
+    if (results_[i].id == id) {
+      AsyncSocket::Ptr socket = results_[i].socket;
+      results_.erase(results_.begin() + i);
+      if (socket) {
+        Checkin(socket);
+      }
+      return;
+    }
+  }
+}
+
+void ConnectionPool::Checkin(AsyncSocket::Ptr socket, bool reusable) {
+  ASSERT_RETURN_VOID(!socket);
+  std::map<AsyncSocket *, Host *>::iterator iter = lent_.find(socket.get());
+  if (iter == lent_.end()) {
+    LOG(L_WARNING) << "Checkin a connection not from this pool";
+    socket->Close();
+    return;
+  }
+  Host *host = iter->second;
+  lent_.erase(iter);
+  host->busy--;
+  socket->RemoveAllSignal();
+  if (!reusable || !socket->CheckConnection()) {
+    socket->Close();
+  } else {
+    IdleConnection idle = {socket, Time()};
+    host->idle.push_back(idle);
+  }
+  ServeHost(host);
+  ScheduleHost(host, Time());
+}
+
+void ConnectionPool::Close() {
+  for (Hosts::iterator iter = hosts_.begin(); iter != hosts_.end(); ++iter) {
+    Host *host = iter->second;
+    if (monitor_) {
+      monitor_->Remove(host);
+    }
+    for (size_t i = 0; i < host->idle.size(); i++) {
+      host->idle[i].socket->Close();
+    }
+    host->idle.clear();
+    for (size_t i = 0; i < host->connecters.size(); i++) {
+      host->connecters[i]->Close();
+    }
+    host->connecters.clear();
+    for (size_t i = 0; i < host->waiters.size(); i++) {
+      AddResult(host->waiters[i].id, AsyncSocket::Ptr(), ECONNABORTED);
+    }
+    host->waiters.clear();
+  }
+}
+
+size_t ConnectionPool::IdleConnections(const SocketAddress &addr) const {
+  Host *host = FindHost(addr);
+  return host ? host->idle.size() : 0;
+}
+
+size_t ConnectionPool::WaitingRequests(const SocketAddress &addr) const {
+  Host *host = FindHost(addr);
+  return host ? host->waiters.size() : 0;
+}
+
+void ConnectionPool::OnMessage(Message *msg) {
+  if (msg->message_id != MSG_POOL_RESULT) {
+    return;
+  }
+  ConnectionPool::Ptr live_this = shared_from_this();
+  std::vector<Result> results;
+  results.swap(results_);
+  for (size_t i = 0; i < results.size(); i++) {
+    SignalConnection(live_this, results[i].id, results[i].socket,
+                     results[i].err);
+  }
+}
+
+ConnectionPool::Host *ConnectionPool::GetHost(const SocketAddress &addr) {
+  Host *host = FindHost(addr);
+  if (host == NULL) {
+    host = new Host();
+    host->pool = this;
+    host->addr = addr;
+    host->busy = 0;
+    hosts_[addr] = host;
+  }
+  return host;
+}
+
+ConnectionPool::Host *ConnectionPool::FindHost(
+  const SocketAddress &addr) const {
+  Hosts::const_iterator iter = hosts_.find(addr);
+  return iter == hosts_.end() ? NULL : iter->second;
+}
+
+AsyncSocket::Ptr ConnectionPool::TakeIdle(Host *host) {
+  // 后进先出，最近用过的连接最可能还活着
+  while (!host->idle.empty()) {
+    AsyncSocket::Ptr socket = host->idle.back().socket;
+    host->idle.pop_back();
+    if (socket->CheckConnection()) {
+      return socket;
+    }
+    LOG(L_INFO) << "Drop a dead pooled connection to "
+                << host->addr.ToString();
+    socket->Close();
+  }
+  return AsyncSocket::Ptr();
+}
+
+void ConnectionPool::ServeHost(Host *host) {
+  while (!host->waiters.empty()) {
+    AsyncSocket::Ptr socket = TakeIdle(host);
+    if (!socket) {
+      break;
+    }
+    uint32 id = host->waiters.front().id;
+    host->waiters.pop_front();
+    Lend(host, id, socket);
+  }
+  // 正在建立的连接不够分给排队的请求，在上限以内新建连接
+  while (host->waiters.size() > host->connecters.size()
+         && host->idle.size() + host->busy + host->connecters.size()
+         < max_per_host_) {
+    AsyncConnecter::Ptr connecter = event_service_->CreateAsyncConnect();
+    ASSERT_RETURN_VOID(!connecter);
+    connecter->SignalServerConnected.connect(
+      this, &ConnectionPool::OnConnected);
+    if (!connecter->Connect(host->addr, connect_timeout_)) {
+      // 这个请求直接失败，避免一直重试
+      connecter->Close();
+      uint32 id = host->waiters.front().id;
+      host->waiters.pop_front();
+      AddResult(id, AsyncSocket::Ptr(), ECONNREFUSED);
+      continue;
+    }
+    host->connecters.push_back(connecter);
+  }
+}
+
+void ConnectionPool::AddResult(uint32 id, AsyncSocket::Ptr socket, int err) {
+  if (results_.empty()) {
+    event_service_->Post(this, MSG_POOL_RESULT);
+  }
+  Result result = {id, socket, err};
+  results_.push_back(result);
+}
+
+void ConnectionPool::Lend(Host *host, uint32 id, AsyncSocket::Ptr socket) {
+  host->busy++;
+  lent_[socket.get()] = host;
+  AddResult(id, socket, 0);
+}
+
+void ConnectionPool::CheckHost(Host *host, uint32 now) {
+  // 最早放回的连接在前面
+  while (!host->idle.empty()
+         && TimeDiff(now, host->idle.front().idle_time)
+         >= static_cast<int32>(max_idle_time_)) {
+    host->idle.front().socket->Close();
+    host->idle.pop_front();
+  }
+  for (size_t i = 0; i < host->waiters.size();) {
+    Waiter &waiter = host->waiters[i];
+    if (!waiter.forever && TimeDiff(now, waiter.deadline) >= 0) {
+      AddResult(waiter.id, AsyncSocket::Ptr(), ETIMEDOUT);
+      host->waiters.erase(host->waiters.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  ScheduleHost(host, now);
+}
+
+void ConnectionPool::ScheduleHost(Host *host, uint32 now) {
+  int32 delay = -1;
+  if (!host->idle.empty()) {
+    delay = max_idle_time_ - TimeDiff(now, host->idle.front().idle_time);
+  }
+  for (size_t i = 0; i < host->waiters.size(); i++) {
+    if (host->waiters[i].forever) {
+      continue;
+    }
+    int32 waiter_delay = TimeDiff(host->waiters[i].deadline, now);
+    if (delay < 0 || waiter_delay < delay) {
+      delay = waiter_delay;
+    }
+  }
+  if (host->idle.empty() && delay < 0) {
+    // 没有要检查的
+    monitor_->Remove(host);
+    return;
+  }
+  monitor_->Schedule(host, delay > 0 ? delay : 0);
+}
+
+void ConnectionPool::OnConnected(AsyncConnecter::Ptr connecter,
+                                 Socket::Ptr socket,
+                                 int err) {
+  Host *host = FindHost(connecter->ConnectAddress());
+  ASSERT_RETURN_VOID(host == NULL);
+  std::vector<AsyncConnecter::Ptr> &connecters = host->connecters;
+  for (size_t i = 0; i < connecters.size(); i++) {
+    if (connecters[i] == connecter) {
+      connecters.erase(connecters.begin() + i);
+      break;
+    }
+  }
+  connecter->Close();
+
+  AsyncSocket::Ptr async_socket;
+  if (socket && !err) {
+    async_socket = event_service_->CreateAsyncSocket(socket);
+  }
+  if (!async_socket) {
+    LOG(L_WARNING) << "Failure to connect " << host->addr.ToString()
+                   << ", err = " << err;
+    // 每个失败的连接让最早的一个请求失败，地址不通时不会一直排队
+    if (!host->waiters.empty()) {
+      uint32 id = host->waiters.front().id;
+      host->waiters.pop_front();
+      AddResult(id, AsyncSocket::Ptr(), err ? err : ECONNREFUSED);
+    }
+  } else if (!host->waiters.empty()) {
+    uint32 id = host->waiters.front().id;
+    host->waiters.pop_front();
+    Lend(host, id, async_socket);
+  } else {
+    // 请求被取消了，留着给下一个
+    IdleConnection idle = {async_socket, Time()};
+    host->idle.push_back(idle);
+  }
+  ServeHost(host);
+  ScheduleHost(host, Time());
+}
+
+}  // namespace vzes
@@ -0,0 +1,126 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef EVENTSERVICE_NET_CONNECTIONPOOL_H_
+#define EVENTSERVICE_NET_CONNECTIONPOOL_H_
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "eventservice/base/basicincludes.h"
+#include "eventservice/net/eventservice.h"
+#include "eventservice/net/networktinterface.h"
+
+namespace vzes {
+
+// 按地址分组的TCP连接池，省掉每个请求的连接建立时间。
+// Checkout申请一个连接，通过SignalConnection交给调用者：有空闲的连接时
+// 检查连接还能用就直接交出，否则在不超过每个地址的最大连接数时新建连接，
+// 超过时排队等待别的连接Checkin。用完的连接Checkin放回池中，空闲超过
+// max_idle_time就关闭。所有方法都要在EventService线程中调用
+class ConnectionPool : public MessageHandler,
+  public boost::noncopyable,
+  public sigslot::has_slots<>,
+  public boost::enable_shared_from_this<ConnectionPool> {
+ public:
+  typedef boost::shared_ptr<ConnectionPool> Ptr;
+  // Checkout的结果，成功时err为0；失败时socket为空，排队超时是ETIMEDOUT
+  sigslot::signal4<ConnectionPool::Ptr, uint32,
+          AsyncSocket::Ptr, int>                SignalConnection;
+
+ public:
+  explicit ConnectionPool(EventService::Ptr event_service);
+  virtual ~ConnectionPool();
+
+  // 每个地址最多的连接数，包括空闲的、借出的和正在建立的，默认为8
+  void SetMaxPerHost(size_t max_per_host);
+  // 空闲连接的最长保留时间(毫秒)，默认为60秒
+  void SetMaxIdleTime(uint32 max_idle_time);
+  // 新建连接的超时时间(毫秒)，默认为3秒
+  void SetConnectTimeout(uint32 connect_timeout);
+
+  // 申请一个到addr的连接，返回请求的id，失败返回0。结果在之后的
+  // SignalConnection中返回，不会在Checkout里面直接回调。
+  // time_out为排队等待的最长时间，0表示一直等待
+  uint32 Checkout(const SocketAddress &addr, uint32 time_out);
+  // 立即拿一个可用的空闲连接，没有时返回空，不排队也不新建连接
+  AsyncSocket::Ptr TryCheckout(const SocketAddress &addr);
+  // 取消还没有结果的请求
+  void Cancel(uint32 id);
+  // 还回借出的连接，reusable为false或者连接已经不能用时关闭。
+  // 连接上所有的信号都会断开，不能有没读完的应答
+  void Checkin(AsyncSocket::Ptr socket, bool reusable = true);
+  // 关闭所有空闲的连接和正在建立的连接，排队的请求以ECONNABORTED返回，
+  // 已经借出的连接不受影响
+  void Close();
+
+  size_t IdleConnections(const SocketAddress &addr) const;
+  size_t WaitingRequests(const SocketAddress &addr) const;
+
+ private:
+  struct IdleConnection {
+    AsyncSocket::Ptr socket;
+    uint32           idle_time;  // 放回池中的时间
+  };
+  struct Waiter {
+    uint32 id;
+    uint32 deadline;
+    bool   forever;
+  };
+  // 一个地址的所有连接，通过ConnectionMonitor检查空闲和排队超时
+  struct Host : public MonitorEntry {
+    ConnectionPool                     *pool;
+    SocketAddress                       addr;
+    std::deque<IdleConnection>          idle;        // 后面的是最近放回的
+    std::deque<Waiter>                  waiters;
+    std::vector<AsyncConnecter::Ptr>    connecters;
+    size_t                              busy;        // 借出的连接数
+    virtual void OnMonitorCheck(uint32 now) {
+      pool->CheckHost(this, now);
+    }
+  };
+  struct Result {
+    uint32           id;
+    AsyncSocket::Ptr socket;
+    int              err;
+  };
+  typedef std::map<SocketAddress, Host *> Hosts;
+
+  virtual void OnMessage(Message *msg);
+  Host *GetHost(const SocketAddress &addr);
+  Host *FindHost(const SocketAddress &addr) const;
+  // 从空闲连接中拿一个能用的，不能用的直接关闭
+  AsyncSocket::Ptr TakeIdle(Host *host);
+  // 把空闲连接交给排队的请求，还不够时新建连接
+  void ServeHost(Host *host);
+  void AddResult(uint32 id, AsyncSocket::Ptr socket, int err);
+  void Lend(Host *host, uint32 id, AsyncSocket::Ptr socket);
+  void CheckHost(Host *host, uint32 now);
+  void ScheduleHost(Host *host, uint32 now);
+  void OnConnected(AsyncConnecter::Ptr connecter,
+                   Socket::Ptr socket,
+                   int err);
+
+ private:
+  EventService::Ptr                    event_service_;
+  ConnectionMonitor::Ptr               monitor_;
+  Hosts                                hosts_;
+  std::map<AsyncSocket *, Host *>      lent_;
+  std::vector<Result>                  results_;    // 等待发出的结果
+  uint32                               next_id_;
+  size_t                               max_per_host_;
+  uint32                               max_idle_time_;
+  uint32                               connect_timeout_;
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_NET_CONNECTIONPOOL_H_
@@ -11,6 +11,7 @@
 #include "eventservice/net/eventservice.h"
 #include "eventservice/net/networktinterfaceimpl.h"
 #include "eventservice/net/networkudpimpl.h"
+#include "eventservice/net/tcprelayimpl.h"
 
 namespace vzes {
 
@@ -42,6 +43,10 @@ bool EventService::SetThreadPriority(ThreadPriority priority) {
   return thread_->SetPriority(priority);
 }
 
+bool EventService::SetThreadAffinity(int cpu) {
+  return thread_->SetAffinity(cpu);
+}
+
 bool EventService::InitEventService(const std::string &thread_name) {
   if (thread_ == NULL) {
     thread_.reset(new Thread(NULL, thread_name));
@@ -67,11 +72,18 @@ void EventService::Post(MessageHandler *phandler,
                         bool time_sensitive) {
   thread_->Post(phandler, id, pdata, time_sensitive);
 }
-void EventService::PostDelayed(int cmsDelay,
-                               MessageHandler *phandler,
-                               uint32 id,
-                               MessageData::Ptr pdata) {
-  thread_->PostDelayed(cmsDelay, phandler, id, pdata);
+Timer::Ptr EventService::PostDelayed(int cmsDelay,
+                                     MessageHandler *phandler,
+                                     uint32 id,
+                                     MessageData::Ptr pdata) {
+  return thread_->PostDelayed(cmsDelay, phandler, id, pdata);
+}
+
+Timer::Ptr EventService::PostPeriodic(int cmsPeriod,
+                                      MessageHandler *phandler,
+                                      uint32 id,
+                                      MessageData::Ptr pdata) {
+  return thread_->PostPeriodic(cmsPeriod, phandler, id, pdata);
 }
 
 void EventService::Send(MessageHandler *phandler,
@@ -102,6 +114,23 @@ Socket::Ptr EventService::CreateSocket(int family, int type) {
   return Socket::Ptr(ss->CreateSocket(family, type));
 }
 
+void EventService::PostFlush(Flushable::Ptr flushable) {
+  ASSERT_RETURN_VOID(!thread_);
+  ASSERT_RETURN_VOID(!thread_->IsCurrent());
+  NetworkService *ss =
+    dynamic_cast<NetworkService *>(thread_->socketserver());
+  ASSERT_RETURN_VOID(ss == NULL);
+  ss->PostFlush(flushable);
+}
+
+ConnectionMonitor::Ptr EventService::connection_monitor() {
+  ASSERT_RETURN_FAILURE(!thread_, ConnectionMonitor::Ptr());
+  if (!connection_monitor_) {
+    connection_monitor_.reset(new ConnectionMonitor(this));
+  }
+  return connection_monitor_;
+}
+
 EventDispatcher::Ptr EventService::CreateDispEvent(Socket::Ptr socket,
     uint32 enabled_events) {
   ASSERT_RETURN_FAILURE(!thread_, EventDispatcher::Ptr());
@@ -141,6 +170,28 @@ AsyncSocket::Ptr EventService::CreateAsyncSocket(Socket::Ptr socket) {
   return AsyncSocket::Ptr();
 }
 
+TcpRelay::Ptr EventService::CreateTcpRelay(Socket::Ptr a, Socket::Ptr b) {
+  ASSERT_RETURN_FAILURE(!thread_, TcpRelay::Ptr());
+  ASSERT_RETURN_FAILURE(!a || !b, TcpRelay::Ptr());
+  TcpRelayImpl::Ptr relay(new TcpRelayImpl(shared_from_this(), a, b));
+  if (relay->Init()) {
+    return relay;
+  }
+  return TcpRelay::Ptr();
+}
+
+TcpRelay::Ptr EventService::CreateTcpRelay(AsyncSocket::Ptr a,
+    AsyncSocket::Ptr b) {
+  AsyncSocketImpl::Ptr impl_a = boost::dynamic_pointer_cast<AsyncSocketImpl>(a);
+  AsyncSocketImpl::Ptr impl_b = boost::dynamic_pointer_cast<AsyncSocketImpl>(b);
+  ASSERT_RETURN_FAILURE(!impl_a || !impl_b, TcpRelay::Ptr());
+  if (!impl_a->CanDetachSocket() || !impl_b->CanDetachSocket()) {
+    LOG(L_ERROR) << "Can't relay a socket with data not sent";
+    return TcpRelay::Ptr();
+  }
+  return CreateTcpRelay(impl_a->DetachSocket(), impl_b->DetachSocket());
+}
+
 AsyncUdpSocket::Ptr EventService::CreateUdpServer(
   const SocketAddress &bind_addr) {
   ASSERT_RETURN_FAILURE(!thread_, AsyncUdpSocket::Ptr());
@@ -12,8 +12,10 @@
 #define EVENTSERVICES_EVENTSERVICE_H_
 
 #include "eventservice/base/basicincludes.h"
+#include "eventservice/event/future.h"
 #include "eventservice/event/thread.h"
 #include "eventservice/net/networkservice.h"
+#include "eventservice/net/connectionmonitor.h"
 #include "eventservice/net/networktinterface.h"
 
 namespace vzes {
@@ -34,6 +36,7 @@ class EventService: public boost::noncopyable,
 
   bool IsThisThread(Thread *thread);
   bool SetThreadPriority(ThreadPriority priority);
+  bool SetThreadAffinity(int cpu);
 
   // Common function
   bool InitEventService(const std::string &thread_name = "thread");
@@ -46,11 +49,37 @@ class EventService: public boost::noncopyable,
             MessageData::Ptr pdata = MessageData::Ptr(),
             bool time_sensitive = false);
 
-  // 发送定时器消息
-  void PostDelayed(int cmsDelay,
-                   MessageHandler *phandler,
-                   uint32 id = 0,
-                   MessageData::Ptr pdata = MessageData::Ptr());
+  // 发送定时器消息，返回的Timer可以用来取消
+  Timer::Ptr PostDelayed(int cmsDelay,
+                         MessageHandler *phandler,
+                         uint32 id = 0,
+                         MessageData::Ptr pdata = MessageData::Ptr());
+
+  // 周期定时器，每隔cmsPeriod毫秒发送一次，直到Timer::Cancel()或者Clear()
+  Timer::Ptr PostPeriodic(int cmsPeriod,
+                          MessageHandler *phandler,
+                          uint32 id = 0,
+                          MessageData::Ptr pdata = MessageData::Ptr());
+
+  // 投递一个可调用对象到本线程执行，见MessageQueue::PostTask。
+  // 小的对象不需要分配内存，也不需要MessageHandler和MessageData
+  template <class F> void PostTask(const F &task,
+                                   MessageHandler *owner = NULL) {
+    thread_->PostTask(task, owner);
+  }
+  template <class F> Timer::Ptr PostDelayedTask(int cmsDelay,
+                                                const F &task,
+                                                MessageHandler *owner = NULL) {
+    return thread_->PostDelayedTask(cmsDelay, task, owner);
+  }
+
+  // 在本线程调用func()，不阻塞调用者，返回的Future可以Get(timeout)阻塞
+  // 等待，也可以Then(Thread::Current(), callback)在调用者自己的线程上处理
+  // 结果。
+  // F要定义result_type
+  template <class F> Future<typename F::result_type> Invoke(const F &func) {
+    return vzes::Invoke(thread_.get(), func);
+  }
 
   // 发送同步消息
   void Send(MessageHandler *phandler,
@@ -74,11 +103,22 @@ class EventService: public boost::noncopyable,
   AsyncListener::Ptr    CreateAsyncListener();
   AsyncConnecter::Ptr   CreateAsyncConnect();
   AsyncSocket::Ptr      CreateAsyncSocket(Socket::Ptr socket);
+  // 接管两个连接，在它们之间转发数据。AsyncSocket版本会交出两个AsyncSocket
+  // 的Socket，它们都不能有没发送完的数据，之后这两个AsyncSocket不再可用
+  TcpRelay::Ptr         CreateTcpRelay(Socket::Ptr a, Socket::Ptr b);
+  TcpRelay::Ptr         CreateTcpRelay(AsyncSocket::Ptr a, AsyncSocket::Ptr b);
   AsyncUdpSocket::Ptr   CreateUdpServer(const SocketAddress &bind_addr);
   AsyncUdpSocket::Ptr   CreateUdpClient();
   AsyncUdpSocket::Ptr   CreateMulticastSocket(
     const SocketAddress &multicast_addr);
 
+  // 这一轮网络事件或者当前的消息处理完之后调用flushable->Flush()，
+  // 只能在本线程调用
+  void PostFlush(Flushable::Ptr flushable);
+
+  // 连接超时管理，第一次调用时创建，只能在本线程使用
+  ConnectionMonitor::Ptr connection_monitor();
+
   // Socket::Ptr WrapSocket(SOCKET s);
   virtual bool Add(EventDispatcher::Ptr socket);
   virtual bool Remove(EventDispatcher::Ptr socket);
@@ -86,6 +126,7 @@ class EventService: public boost::noncopyable,
   void WakeUp();
  private:
   Thread::Ptr thread_;
+  ConnectionMonitor::Ptr connection_monitor_;
 };
 
 }  // namespace vzes
@@ -0,0 +1,257 @@
+/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "eventservice/net/eventservicepool.h"
+
+#include <stdio.h>
+#include "eventservice/net/networktinterfaceimpl.h"
+
+namespace vzes {
+
+// 在池中每个EventService上监听同一个地址，或者只在第一个EventService上
+// accept，然后把连接交给其他EventService。
+class ShardedListener : public AsyncListener,
+  public boost::noncopyable,
+  public sigslot::has_slots<>,
+  public boost::enable_shared_from_this<ShardedListener> {
+ public:
+  typedef boost::shared_ptr<ShardedListener> Ptr;
+  ShardedListener(EventServicePool::Ptr pool,
+                  EventServicePool::ShardMode mode);
+  virtual ~ShardedListener();
+
+  // Inherit with AsyncLisener
+  virtual bool Start(const SocketAddress addr, bool addr_reused);
+  virtual void Close();
+  virtual const SocketAddress BindAddress();
+  virtual void SetBacklog(int backlog);
+  virtual void SetAcceptBudget(int budget);
+  virtual void SetDeferAccept(int seconds);
+ private:
+  // 交给其他EventService的连接。任务里拿着listener的引用，投递出去的
+  // 连接还没送到时listener不会被释放
+  struct HandOverTask {
+    ShardedListener::Ptr listener;
+    Socket::Ptr          socket;
+    void operator()() {
+      listener->HandOver(socket);
+    }
+  };
+  void HandOver(Socket::Ptr socket);
+  bool StartShard(EventService::Ptr es,
+                  const SocketAddress &addr,
+                  bool addr_reused,
+                  bool reuse_port);
+  void OnShardConnected(AsyncListener::Ptr listener,
+                        Socket::Ptr socket,
+                        int err);
+ private:
+  EventServicePool::Ptr           pool_;
+  EventServicePool::ShardMode     mode_;
+  std::vector<AsyncListener::Ptr> listeners_;
+  SocketAddress                   listen_address_;
+  // 传给每个分片的设置，-1表示使用默认值
+  int                             backlog_;
+  int                             accept_budget_;
+  int                             defer_accept_;
+  // Close()之后才送到的连接直接关闭，各个线程都会读
+  int                             closed_;
+};
+
+ShardedListener::ShardedListener(EventServicePool::Ptr pool,
+                                 EventServicePool::ShardMode mode)
+  : pool_(pool),
+    mode_(mode),
+    backlog_(-1),
+    accept_budget_(-1),
+    defer_accept_(-1),
+    closed_(0) {
+}
+
+ShardedListener::~ShardedListener() {
+  Close();
+}
+
+bool ShardedListener::Start(const SocketAddress addr, bool addr_reused) {
+  ASSERT_RETURN_FAILURE(addr.IsNil(), false);
+  ASSERT_RETURN_FAILURE(pool_->size() == 0, false);
+  ASSERT_RETURN_FAILURE(!listeners_.empty(), false);
+
+  listen_address_ = addr;
+  AtomicOps::Store(&closed_, 0);
+  if (mode_ == EventServicePool::SHARD_REUSE_PORT && pool_->size() > 1) {
+    bool res = true;
+    for (size_t i = 0; res && i < pool_->size(); i++) {
+      res = StartShard(pool_->GetEventService(i), addr, addr_reused, true);
+    }
+    if (res) {
+      return true;
+    }
+    LOG(L_WARNING) << "Failure to listen with SO_REUSEPORT, "
+                   << "fall back to round robin";
+    Close();
+  }
+  mode_ = EventServicePool::SHARD_ROUND_ROBIN;
+  return StartShard(pool_->GetEventService(0), addr, addr_reused, false);
+}
+
+bool ShardedListener::StartShard(EventService::Ptr es,
+                                 const SocketAddress &addr,
+                                 bool addr_reused,
+                                 bool reuse_port) {
+  AsyncListenerImpl::Ptr listener =
+    boost::dynamic_pointer_cast<AsyncListenerImpl>(es->CreateAsyncListener());
+  ASSERT_RETURN_FAILURE(!listener, false);
+  listener->SetReusePort(reuse_port);
+  if (backlog_ != -1) {
+    listener->SetBacklog(backlog_);
+  }
+  if (accept_budget_ != -1) {
+    listener->SetAcceptBudget(accept_budget_);
+  }
+  if (defer_accept_ != -1) {
+    listener->SetDeferAccept(defer_accept_);
+  }
+  listener->SignalNewConnected.connect(this,
+                                       &ShardedListener::OnShardConnected);
+  listeners_.push_back(listener);
+  if (!listener->Start(addr, addr_reused)) {
+    return false;
+  }
+  // The select loop only picks up the new socket after a wake up
+  es->WakeUp();
+  return true;
+}
+
+void ShardedListener::Close() {
+  // Drop the connections not handed over yet
+  AtomicOps::Store(&closed_, 1);
+  for (size_t i = 0; i < listeners_.size(); i++) {
+    listeners_[i]->SignalNewConnected.disconnect(this);
+    listeners_[i]->Close();
+  }
+  listeners_.clear();
+}
+
+const SocketAddress ShardedListener::BindAddress() {
+  return listen_address_;
+}
+
+void ShardedListener::SetBacklog(int backlog) {
+  backlog_ = backlog;
+}
+
+void ShardedListener::SetAcceptBudget(int budget) {
+  accept_budget_ = budget;
+}
+
+void ShardedListener::SetDeferAccept(int seconds) {
+  defer_accept_ = seconds;
+}
+
+void ShardedListener::OnShardConnected(AsyncListener::Ptr listener,
+                                       Socket::Ptr socket,
+                                       int err) {
+  if (mode_ == EventServicePool::SHARD_ROUND_ROBIN && socket) {
+    EventService::Ptr es = pool_->NextEventService();
+    if (!es->IsThisThread(Thread::Current())) {
+      HandOverTask task = {shared_from_this(), socket};
+      es->PostTask(task);
+      return;
+    }
+  }
+  SignalNewConnected(shared_from_this(), socket, err);
+}
+
+void ShardedListener::HandOver(Socket::Ptr socket) {
+  if (AtomicOps::Load(&closed_)) {
+    return;
+  }
+  SignalNewConnected(shared_from_this(), socket, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+EventServicePool::EventServicePool()
+  : next_index_(0) {
+}
+
+EventServicePool::~EventServicePool() {
+  UninitEventServicePool();
+}
+
+EventServicePool::Ptr EventServicePool::CreateEventServicePool(
+  size_t count,
+  const std::string &thread_name,
+  bool pin_threads) {
+  EventServicePool::Ptr pool(new EventServicePool());
+  if (!pool->InitEventServicePool(count, thread_name, pin_threads)) {
+    return EventServicePool::Ptr();
+  }
+  return pool;
+}
+
+bool EventServicePool::InitEventServicePool(size_t count,
+    const std::string &thread_name,
+    bool pin_threads) {
+  int cpu_count = Thread::NumberOfProcessors();
+  if (count == 0) {
+    count = cpu_count;
+  }
+  for (size_t i = 0; i < count; i++) {
+    char index[16];
+    snprintf(index, sizeof(index), "_%u", static_cast<unsigned int>(i));
+    EventService::Ptr es =
+      EventService::CreateEventService(NULL, thread_name + index);
+    ASSERT_RETURN_FAILURE(!es, false);
+    if (pin_threads && !es->SetThreadAffinity(i % cpu_count)) {
+      LOG(L_WARNING) << "Failure to pin " << thread_name << index
+                     << " to cpu " << (i % cpu_count);
+    }
+    event_services_.push_back(es);
+  }
+  return true;
+}
+
+void EventServicePool::UninitEventServicePool() {
+  for (size_t i = 0; i < event_services_.size(); i++) {
+    event_services_[i]->UninitEventService();
+  }
+  event_services_.clear();
+}
+
+EventService::Ptr EventServicePool::GetEventService(size_t index) {
+  ASSERT_RETURN_FAILURE(index >= event_services_.size(), EventService::Ptr());
+  return event_services_[index];
+}
+
+EventService::Ptr EventServicePool::NextEventService() {
+  ASSERT_RETURN_FAILURE(event_services_.empty(), EventService::Ptr());
+  CritScope cs(&crit_);
+  size_t index = next_index_++ % event_services_.size();
+  return event_services_[index];
+}
+
+EventService::Ptr EventServicePool::CurrentEventService() {
+  Thread *current = Thread::Current();
+  for (size_t i = 0; i < event_services_.size(); i++) {
+    if (event_services_[i]->IsThisThread(current)) {
+      return event_services_[i];
+    }
+  }
+  return EventService::Ptr();
+}
+
+AsyncListener::Ptr EventServicePool::CreateShardedListener(ShardMode mode) {
+  ASSERT_RETURN_FAILURE(event_services_.empty(), AsyncListener::Ptr());
+  return AsyncListener::Ptr(new ShardedListener(shared_from_this(), mode));
+}
+
+}  // namespace vzes
@@ -0,0 +1,71 @@
+/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef EVENTSERVICES_NET_EVENTSERVICEPOOL_H_
+#define EVENTSERVICES_NET_EVENTSERVICEPOOL_H_
+
+#include <vector>
+#include "eventservice/net/eventservice.h"
+
+namespace vzes {
+
+// 一组EventService线程，每个线程绑定到一个CPU核上，连接分散到各个线程处理。
+class EventServicePool : public boost::noncopyable,
+  public boost::enable_shared_from_this<EventServicePool> {
+ public:
+  typedef boost::shared_ptr<EventServicePool> Ptr;
+
+  // 连接分配到各个EventService的方式
+  enum ShardMode {
+    // 每个EventService监听一个SO_REUSEPORT的Socket，由内核分配连接，
+    // 不支持时退回到SHARD_ROUND_ROBIN
+    SHARD_REUSE_PORT,
+    // 第一个EventService负责accept，然后轮流交给各个EventService
+    SHARD_ROUND_ROBIN
+  };
+ private:
+  EventServicePool();
+ public:
+  virtual ~EventServicePool();
+
+  // count == 0 means one EventService per cpu core
+  static EventServicePool::Ptr CreateEventServicePool(
+    size_t count = 0,
+    const std::string &thread_name = "pool",
+    bool pin_threads = true);
+
+  void UninitEventServicePool();
+
+  size_t size() const {
+    return event_services_.size();
+  }
+  EventService::Ptr GetEventService(size_t index);
+  // 轮流返回各个EventService
+  EventService::Ptr NextEventService();
+  // 返回当前线程的EventService，不是池中的线程时返回空
+  EventService::Ptr CurrentEventService();
+
+  // SignalNewConnected is emitted on the thread of the EventService which
+  // should own the connection, create the AsyncSocket with
+  // CurrentEventService() in the slot.
+  AsyncListener::Ptr CreateShardedListener(ShardMode mode = SHARD_REUSE_PORT);
+ private:
+  bool InitEventServicePool(size_t count,
+                            const std::string &thread_name,
+                            bool pin_threads);
+ private:
+  std::vector<EventService::Ptr> event_services_;
+  CriticalSection                crit_;
+  size_t                         next_index_;
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICES_NET_EVENTSERVICEPOOL_H_
@@ -0,0 +1,402 @@
+﻿/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "eventservice/net/iouring.h"
+
+#ifdef VZ_HAVE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "eventservice/base/logging.h"
+
+// Headers older than linux 5.11 don't know the timeout argument of enter
+#ifndef IORING_FEAT_EXT_ARG
+#define IORING_FEAT_EXT_ARG   (1U << 8)
+#define IORING_ENTER_EXT_ARG  (1U << 3)
+struct io_uring_getevents_arg {
+  __u64 sigmask;
+  __u32 sigmask_sz;
+  __u32 pad;
+  __u64 ts;
+};
+#endif
+
+// Headers older than linux 6.0 don't know the multishot receive, the
+// sockets are only polled then
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT)
+#define VZ_URING_MULTISHOT 1
+#endif
+
+namespace vzes {
+
+IoUring::IoUring()
+  : ring_fd_(-1),
+    sq_ring_(MAP_FAILED),
+    sq_ring_size_(0),
+    cq_ring_(MAP_FAILED),
+    cq_ring_size_(0),
+    sqes_(NULL),
+    sqes_size_(0),
+    sq_head_(NULL),
+    sq_tail_(NULL),
+    sq_array_(NULL),
+    sq_mask_(0),
+    sq_entries_(0),
+    sqe_tail_(0),
+    cq_head_(NULL),
+    cq_tail_(NULL),
+    cq_mask_(0),
+    cqes_(NULL),
+    buf_ring_(MAP_FAILED),
+    buf_ring_size_(0),
+    buf_mask_(0),
+    buf_tail_(0) {
+}
+
+IoUring::~IoUring() {
+  Release();
+}
+
+bool IoUring::Init(uint32 entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd_ < 0) {
+    LOG_E(LS_WARNING, EN, errno) << "io_uring_setup";
+    ring_fd_ = -1;
+    return false;
+  }
+  // NODROP keeps completions of a busy loop, EXT_ARG gives enter a timeout
+  uint32 required = IORING_FEAT_SINGLE_MMAP
+                    | IORING_FEAT_NODROP
+                    | IORING_FEAT_EXT_ARG;
+  if ((params.features & required) != required) {
+    LOG(LS_WARNING) << "io_uring features " << params.features
+                    << " are too old";
+    Release();
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32);
+  cq_ring_size_ = params.cq_off.cqes
+                  + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_ring_size_ > sq_ring_size_) {
+    sq_ring_size_ = cq_ring_size_;
+  }
+  cq_ring_size_ = sq_ring_size_;
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    LOG_E(LS_ERROR, EN, errno) << "mmap io_uring";
+    Release();
+    return false;
+  }
+  // With IORING_FEAT_SINGLE_MMAP both rings share one mapping
+  cq_ring_ = sq_ring_;
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    LOG_E(LS_ERROR, EN, errno) << "mmap io_uring sqes";
+    Release();
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+  uint8 *sq = static_cast<uint8 *>(sq_ring_);
+  sq_head_    = reinterpret_cast<uint32 *>(sq + params.sq_off.head);
+  sq_tail_    = reinterpret_cast<uint32 *>(sq + params.sq_off.tail);
+  sq_array_   = reinterpret_cast<uint32 *>(sq + params.sq_off.array);
+  sq_mask_    = *reinterpret_cast<uint32 *>(sq + params.sq_off.ring_mask);
+  sq_entries_ = *reinterpret_cast<uint32 *>(sq + params.sq_off.ring_entries);
+  sqe_tail_   = *sq_tail_;
+
+  uint8 *cq = static_cast<uint8 *>(cq_ring_);
+  cq_head_ = reinterpret_cast<uint32 *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<uint32 *>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<uint32 *>(cq + params.cq_off.ring_mask);
+  cqes_    = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+  return true;
+}
+
+void IoUring::Release() {
+  if (sqes_ != NULL) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = NULL;
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = MAP_FAILED;
+    cq_ring_ = MAP_FAILED;
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+    ring_fd_ = -1;
+  }
+  // Closing the ring unregisters the buffer ring as well
+  if (buf_ring_ != MAP_FAILED) {
+    munmap(buf_ring_, buf_ring_size_);
+    buf_ring_ = MAP_FAILED;
+  }
+}
+
+int IoUring::Enter(uint32 to_submit, uint32 min_complete, uint32 flags,
+                   const void *arg, size_t arg_size) {
+  return syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                 flags, arg, arg_size);
+}
+
+struct io_uring_sqe *IoUring::GetSqe() {
+  uint32 head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    // The submission queue is full, hand the queued requests over first
+    if (Submit() < 0) {
+      return NULL;
+    }
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[sqe_tail_ & sq_mask_] = sqe_tail_ & sq_mask_;
+  sqe_tail_++;
+  return sqe;
+}
+
+bool IoUring::PollAdd(int fd, uint32 poll_mask, uint64 user_data) {
+  struct io_uring_sqe *sqe = GetSqe();
+  if (sqe == NULL) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  // The kernel reads poll32_events and swaps the halves on big endian,
+  // writing the low 16 bits works on both.
+  sqe->poll_events = static_cast<__u16>(poll_mask);
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUring::PollRemove(uint64 target, uint64 user_data) {
+  struct io_uring_sqe *sqe = GetSqe();
+  if (sqe == NULL) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUring::Cancel(uint64 target, uint64 user_data) {
+  struct io_uring_sqe *sqe = GetSqe();
+  if (sqe == NULL) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUring::AcceptMultishot(int fd, uint64 user_data) {
+#ifdef VZ_URING_MULTISHOT
+  struct io_uring_sqe *sqe = GetSqe();
+  if (sqe == NULL) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool IoUring::RecvMultishot(int fd, uint16 group, uint64 user_data) {
+#ifdef VZ_URING_MULTISHOT
+  struct io_uring_sqe *sqe = GetSqe();
+  if (sqe == NULL) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  sqe->user_data = user_data;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool IoUring::SendMsg(int fd, const struct msghdr *msg, uint32 flags,
+                      uint64 user_data) {
+  struct io_uring_sqe *sqe = GetSqe();
+  if (sqe == NULL) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = flags;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUring::SetupBufferRing(uint16 group, uint32 entries) {
+#ifdef VZ_URING_MULTISHOT
+  size_t size = entries * sizeof(struct io_uring_buf);
+  void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    LOG_E(LS_ERROR, EN, errno) << "mmap io_uring buffer ring";
+    return false;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64>(ring);
+  reg.ring_entries = entries;
+  reg.bgid = group;
+  if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+              &reg, 1) != 0) {
+    LOG_E(LS_WARNING, EN, errno) << "io_uring register buffer ring";
+    munmap(ring, size);
+    return false;
+  }
+  buf_ring_ = ring;
+  buf_ring_size_ = size;
+  buf_mask_ = entries - 1;
+  buf_tail_ = 0;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void IoUring::AddBuffer(void *addr, uint32 length, uint16 bid) {
+#ifdef VZ_URING_MULTISHOT
+  // The tail shares the memory with the first buffer, leave it untouched.
+  // Index the ring as a plain array, in C++ __DECLARE_FLEX_ARRAY puts
+  // io_uring_buf_ring::bufs after an empty struct which is not zero sized
+  struct io_uring_buf *buf =
+    static_cast<struct io_uring_buf *>(buf_ring_) + (buf_tail_ & buf_mask_);
+  buf->addr = reinterpret_cast<uint64>(addr);
+  buf->len = length;
+  buf->bid = bid;
+  buf_tail_++;
+#endif
+}
+
+void IoUring::CommitBuffers() {
+#ifdef VZ_URING_MULTISHOT
+  // io_uring_buf_ring::tail is the resv field of the first buffer
+  struct io_uring_buf *bufs = static_cast<struct io_uring_buf *>(buf_ring_);
+  __atomic_store_n(&bufs[0].resv, buf_tail_, __ATOMIC_RELEASE);
+#endif
+}
+
+uint32 IoUring::Flush() {
+  if (*sq_tail_ != sqe_tail_) {
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  }
+  // Without SQPOLL the kernel only consumes the queue inside enter, what is
+  // left between head and tail has not been submitted yet.
+  return sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::Submit() {
+  uint32 to_submit = Flush();
+  if (to_submit == 0) {
+    return 0;
+  }
+  int ret = Enter(to_submit, 0, 0, NULL, 0);
+  if (ret < 0) {
+    LOG_E(LS_ERROR, EN, errno) << "io_uring_enter";
+  }
+  return ret;
+}
+
+int IoUring::Wait(uint32 to_submit, int cms) {
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (cms != kForever) {
+    ts.tv_sec = cms / 1000;
+    ts.tv_nsec = (cms % 1000) * 1000000LL;
+    arg.ts = reinterpret_cast<uint64>(&ts);
+  }
+  int ret = Enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                  &arg, sizeof(arg));
+  if (ret < 0 && errno == ETIME) {
+    return 0;
+  }
+  return ret;
+}
+
+bool IoUring::PopCompletion(uint64 *user_data, int32 *res, bool *more,
+                            int32 *buffer) {
+  uint32 head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  struct io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+  *user_data = cqe->user_data;
+  *res = cqe->res;
+  *more = false;
+  *buffer = -1;
+#ifdef VZ_URING_MULTISHOT
+  *more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    *buffer = static_cast<int32>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+  }
+#endif
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+}  // namespace vzes
+
+#endif  // VZ_HAVE_IO_URING
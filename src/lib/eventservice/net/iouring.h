@@ -0,0 +1,147 @@
+﻿/*
+ * vzes
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EVENTSERVICES_NET_IOURING_H__
+#define EVENTSERVICES_NET_IOURING_H__
+
+#include "eventservice/base/basictypes.h"
+#include "eventservice/base/constructormagic.h"
+
+// io_uring needs the kernel uapi header, old toolchains simply go without it
+#if defined(POSIX) && !defined(LITEOS) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define VZ_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef VZ_HAVE_IO_URING
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct msghdr;
+struct iovec;
+
+namespace vzes {
+
+// A minimal io_uring wrapper for NetworkService. Besides the one shot polls
+// it issues the multishot accept and receive requests, the latter pick their
+// buffers from a provided buffer ring, and the sendmsg requests.
+// Submissions are queued in user space and go to the kernel together with
+// the wait, so a whole loop costs one syscall.
+// Not thread safe, the caller serializes the access.
+class IoUring {
+ public:
+  IoUring();
+  ~IoUring();
+
+  // Returns false when the kernel lacks io_uring or the features we need,
+  // the caller should fall back to epoll in this case.
+  bool Init(uint32 entries);
+
+  // Queue a one shot poll of fd, user_data comes back in the completion.
+  bool PollAdd(int fd, uint32 poll_mask, uint64 user_data);
+  // Queue a cancel request of the poll identified by target.
+  bool PollRemove(uint64 target, uint64 user_data);
+  // Queue a cancel request of any other request identified by target.
+  bool Cancel(uint64 target, uint64 user_data);
+  // Queue a multishot accept of the listening fd, every new connection
+  // comes back as a completion whose result is the non-blocking fd.
+  bool AcceptMultishot(int fd, uint64 user_data);
+  // Queue a multishot receive, every completion carries the data in a
+  // buffer taken from the provided buffer ring of group.
+  bool RecvMultishot(int fd, uint16 group, uint64 user_data);
+  // Queue a sendmsg, msg and the memory it refers to must stay valid until
+  // the completion.
+  bool SendMsg(int fd, const struct msghdr *msg, uint32 flags,
+               uint64 user_data);
+
+  // Register a ring of entries provided buffers as group, entries must be
+  // a power of 2. Returns false when the kernel (linux 6.0 is needed for
+  // the multishot receive) or the headers don't support it.
+  bool SetupBufferRing(uint16 group, uint32 entries);
+  // Give the buffer bid to the ring, the kernel sees it after
+  // CommitBuffers().
+  void AddBuffer(void *addr, uint32 length, uint16 bid);
+  void CommitBuffers();
+
+  // Publish the queued requests, returns how many of them are not submitted
+  // yet. Wait() must be told this number.
+  uint32 Flush();
+  // Submit the requests right now without waiting.
+  int Submit();
+  // Submit to_submit requests and wait at most cms milliseconds for one
+  // completion. Returns -1 with errno on error.
+  int Wait(uint32 to_submit, int cms);
+
+  // Pop one completion, returns false when the completion queue is empty.
+  // more tells a multishot request will post more completions, buffer is
+  // the id of the provided buffer holding the data or -1.
+  bool PopCompletion(uint64 *user_data, int32 *res, bool *more,
+                     int32 *buffer);
+
+ private:
+  struct io_uring_sqe *GetSqe();
+  int Enter(uint32 to_submit, uint32 min_complete, uint32 flags,
+            const void *arg, size_t arg_size);
+  void Release();
+
+ private:
+  int     ring_fd_;
+  void   *sq_ring_;
+  size_t  sq_ring_size_;
+  void   *cq_ring_;
+  size_t  cq_ring_size_;
+  struct io_uring_sqe *sqes_;
+  size_t  sqes_size_;
+
+  uint32 *sq_head_;
+  uint32 *sq_tail_;
+  uint32 *sq_array_;
+  uint32  sq_mask_;
+  uint32  sq_entries_;
+  // Requests queued but not published to the kernel yet
+  uint32  sqe_tail_;
+
+  uint32 *cq_head_;
+  uint32 *cq_tail_;
+  uint32  cq_mask_;
+  struct io_uring_cqe *cqes_;
+
+  // Provided buffer ring shared with the kernel
+  void   *buf_ring_;
+  size_t  buf_ring_size_;
+  uint32  buf_mask_;
+  uint16  buf_tail_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+}  // namespace vzes
+
+#endif  // VZ_HAVE_IO_URING
+
+#endif  // EVENTSERVICES_NET_IOURING_H__
@@ -41,7 +41,11 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <signal.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #ifndef LITEOS
+#include <poll.h>
 #include <sys/epoll.h>
 #endif
 #endif
@@ -60,6 +64,26 @@
 typedef void* SockOptArg;
 #endif  // POSIX
 
+#if defined(__linux__) && !defined(LITEOS)
+#include <linux/errqueue.h>
+#define VZ_HAVE_ZEROCOPY 1
+// Headers older than linux 4.14 don't know MSG_ZEROCOPY
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY                 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY                0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+#endif
+// 一次系统调用收发多个UDP数据报
+#define VZ_HAVE_MMSG 1
+#endif
+
 #include <algorithm>
 #include <map>
 
@@ -78,6 +102,33 @@ typedef void* SockOptArg;
 typedef char* SockOptArg;
 #endif
 
+// 一次gather write/scatter read最多使用的Block数，接收时按数据量选用
+// 不同规格的Block，256个Block足够填满或者读空socket缓存
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define MAX_IOV_BLOCKS IOV_MAX
+#else
+#define MAX_IOV_BLOCKS 256
+#endif
+
+// UDP数据报默认的最大接收长度
+#ifdef LITEOS
+#define MAX_DATAGRAM_SIZE  (4*1024)
+#else
+#define MAX_DATAGRAM_SIZE  (64*1024)
+#endif
+// 一次recvmmsg/sendmmsg最多处理的数据报个数
+#define MAX_BATCH_DATAGRAMS 64
+
+#ifdef VZ_HAVE_IO_URING
+// io_uring完成模式下每个NetworkService提供给内核的接收Block个数和规格，
+// multishot recv收到的每一段数据占用一个Block，共占用1MB
+#define URING_RECV_BUFFERS      256
+#define URING_RECV_BUFFER_SIZE  BLOCK_SIZE_4KB
+#define URING_BUFFER_GROUP      0
+// 一个连接收进来还没有被读走的数据超过这个量时暂停接收
+#define URING_RECV_QUEUE_LIMIT  (256 * 1024)
+#endif
+
 namespace vzes {
 
 // Standard MTUs, from RFC 1191
@@ -110,7 +161,14 @@ static const int ICMP_PING_TIMEOUT_MILLIS = 10000u;
 
 PhysicalSocket::PhysicalSocket(SOCKET s)
   : s_(s), enabled_events_(0), error_(0),
-    state_((s == INVALID_SOCKET) ? CS_CLOSED : CS_CONNECTED) {
+    state_((s == INVALID_SOCKET) ? CS_CLOSED : CS_CONNECTED),
+    recv_size_(0),
+    recv_budget_(0),
+    zerocopy_threshold_(0),
+    zerocopy_next_id_(0),
+    max_datagram_size_(MAX_DATAGRAM_SIZE),
+    slot_blocks_((MAX_DATAGRAM_SIZE + DEFAULT_BLOCK_SIZE - 1) /
+                 DEFAULT_BLOCK_SIZE) {
 #ifdef WIN32
   // EnsureWinsockInit() ensures that winsock is initialized. The default
   // version of this function doesn't do anything because winsock is
@@ -281,6 +339,15 @@ int PhysicalSocket::SetOption(int level,
 }
 
 int PhysicalSocket::Send(const void *pv, size_t cb) {
+#ifdef VZ_HAVE_IO_URING
+  if (UringIoActive() || (uring_io_ && uring_io_->send_op)) {
+    // 完成模式下没有可写通知，和SendBlocks一样交给SENDMSG请求
+    Block::Ptr block = Block::TakeBlock(cb);
+    block->WriteBytes(static_cast<const char *>(pv), cb);
+    BlocksPtr blocks(1, block);
+    return SendBlocks(blocks, 0, 0);
+  }
+#endif
   int sent = ::send(s_, reinterpret_cast<const char *>(pv), (int)cb,
 #ifdef LINUX
                     // Suppress SIGPIPE. Without this, attempting to send on a socket whose
@@ -303,36 +370,214 @@ int PhysicalSocket::Send(const void *pv, size_t cb) {
 }
 
 int PhysicalSocket::Send(MemBuffer::Ptr buffer) {
-  int res = 0;
   BlocksPtr &blocks = buffer->blocks();
-  BlocksPtr::iterator iter = blocks.begin();
-  while (iter != blocks.end()) {
-    Block::Ptr block = *iter;
-    int sent = Send(block->buffer, block->buffer_size);
-    if (sent == block->buffer_size) {
-      // 把Block的size清空
-      block->buffer_size = 0;
-      // 删除这个Blocks
-      iter = blocks.erase(iter);
-      // 更新发送长度
-      res += sent;
-      continue;
-    } else if (sent > 0 && sent < block->buffer_size) {
-      // 证明发送了一部分数据
-      block->ReadBytes(NULL, sent);
-      res += sent;
-      break;
-    } else if (sent == SOCKET_ERROR) {
-      break;
-    } else if (sent == 0) {
+  int sent = SendBlocks(blocks, 0, 0);
+  if (sent <= 0) {
+    return 0;
+  }
+  // 删除已经发送完的Block，只发送了一部分的Block去掉已经发送的数据
+  size_t remain = sent;
+  while (!blocks.empty() && remain > 0) {
+    Block::Ptr &block = blocks.front();
+    if (block->size() > remain) {
+      if (block.use_count() == 1) {
+        block->Consume(remain);
+        break;
+      }
+      // Block和别的MemBuffer共享或者还被零拷贝引用，复制剩下的数据
+      Block::Ptr rest = Block::TakeBlock(block->size() - remain);
+      rest->WriteBytes(reinterpret_cast<char *>(block->data()) + remain,
+                       block->size() - remain);
+      rest->encode_flag_ = block->encode_flag_;
+      block = rest;
       break;
     }
+    remain -= block->size();
+    blocks.pop_front();
   }
+  buffer->ReduceSize(sent);
+  return sent;
+}
 
-  if (res) {
-    buffer->ReduceSize(res);
+int PhysicalSocket::SendBlocks(const BlocksPtr &blocks, size_t offset,
+                               size_t max_size) {
+#ifdef VZ_HAVE_IO_URING
+  if (uring_io_ && uring_io_->send_op) {
+    // 同时只有一个SENDMSG请求，它完成之后才通知可写
+    error_ = EWOULDBLOCK;
+    return SOCKET_ERROR;
   }
-  return res;
+#endif
+#ifdef WIN32
+  WSABUF iov[MAX_IOV_BLOCKS];
+#else
+  struct iovec iov[MAX_IOV_BLOCKS];
+#endif
+  size_t count = 0;
+  size_t total = 0;
+  size_t first_offset = offset;
+  for (BlocksPtr::const_iterator iter = blocks.begin();
+       iter != blocks.end() && count < MAX_IOV_BLOCKS; ++iter) {
+    Block *block = iter->get();
+    if (block->size() > offset) {
+      size_t length = block->size() - offset;
+      if (max_size && total + length > max_size) {
+        length = max_size - total;
+      }
+#ifdef WIN32
+      iov[count].buf = reinterpret_cast<char *>(block->data() + offset);
+      iov[count].len = static_cast<ULONG>(length);
+#else
+      iov[count].iov_base = block->data() + offset;
+      iov[count].iov_len = length;
+#endif
+      total += length;
+      count++;
+      if (max_size && total == max_size) {
+        break;
+      }
+    }
+    offset = 0;
+  }
+  if (count == 0) {
+    return 0;
+  }
+#ifdef VZ_HAVE_IO_URING
+  if (UringIoActive()) {
+    return uring_io_->service->SubmitUringSend(this, blocks, first_offset,
+           iov, count, total);
+  }
+#endif
+
+#ifdef WIN32
+  DWORD bytes = 0;
+  int sent = ::WSASend(s_, iov, static_cast<DWORD>(count), &bytes, 0,
+                       NULL, NULL);
+  if (sent == 0) {
+    sent = static_cast<int>(bytes);
+  }
+#else
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  int flags =
+#ifdef LINUX
+    // Suppress SIGPIPE. See above for explanation.
+    MSG_NOSIGNAL;
+#else
+    0;
+#endif
+#ifdef VZ_HAVE_ZEROCOPY
+  if (!zerocopy_sends_.empty()) {
+    ReapZeroCopy();
+  }
+  bool zerocopy = zerocopy_threshold_ != 0 && total >= zerocopy_threshold_;
+  int sent = ::sendmsg(s_, &msg, zerocopy ? (flags | MSG_ZEROCOPY) : flags);
+  if (sent < 0 && zerocopy && errno == ENOBUFS) {
+    // 超出了optmem的限制，这次用普通方式发送
+    zerocopy = false;
+    sent = ::sendmsg(s_, &msg, flags);
+  }
+#else
+  int sent = ::sendmsg(s_, &msg, flags);
+#endif
+#endif
+  UpdateLastError();
+  ASSERT(sent <= static_cast<int>(total));
+#ifdef VZ_HAVE_ZEROCOPY
+  if (zerocopy && sent > 0) {
+    PinZeroCopyBlocks(blocks, first_offset, sent);
+  }
+#endif
+  enabled_events_ |= DE_WRITE;
+  return sent;
+}
+
+bool PhysicalSocket::SetZeroCopy(size_t threshold) {
+#ifdef VZ_HAVE_IO_URING
+  if (threshold != 0 && UringIoActive()) {
+    // SENDMSG请求完成时数据已经复制进了内核，用不上MSG_ZEROCOPY
+    LOG(LS_WARNING) << "MSG_ZEROCOPY is not used by the io_uring sends";
+    return false;
+  }
+#endif
+#ifdef VZ_HAVE_ZEROCOPY
+  if (threshold != 0 && zerocopy_threshold_ == 0) {
+    int value = 1;
+    if (::setsockopt(s_, SOL_SOCKET, SO_ZEROCOPY,
+                     &value, sizeof(value)) != 0) {
+      LOG_E(LS_WARNING, EN, errno) << "setsockopt SO_ZEROCOPY";
+      return false;
+    }
+  }
+  zerocopy_threshold_ = threshold;
+  return true;
+#else
+  return threshold == 0;
+#endif
+}
+
+// 每次成功的MSG_ZEROCOPY发送由内核按顺序编号，记住这次发送用到的Block
+void PhysicalSocket::PinZeroCopyBlocks(const BlocksPtr &blocks,
+                                       size_t offset,
+                                       size_t size) {
+  ZeroCopySend pinned;
+  pinned.id = zerocopy_next_id_++;
+  for (BlocksPtr::const_iterator iter = blocks.begin();
+       iter != blocks.end() && size > 0; ++iter) {
+    if ((*iter)->size() > offset) {
+      pinned.blocks.push_back(*iter);
+      size -= _min(size, (*iter)->size() - offset);
+    }
+    offset = 0;
+  }
+  zerocopy_sends_.push_back(pinned);
+}
+
+// 从错误队列中读取零拷贝的完成通知，释放内核已经发送完的Block
+void PhysicalSocket::ReapZeroCopy() {
+#ifdef VZ_HAVE_ZEROCOPY
+  while (!zerocopy_sends_.empty()) {
+    char control[128];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(s_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      break;
+    }
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+          && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      struct sock_extended_err *err =
+        reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cm));
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      if ((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+          && zerocopy_threshold_ != 0) {
+        // 这条路由不能零拷贝(例如发往本机)，内核延迟复制反而更慢，不再使用
+        LOG(LS_INFO) << "MSG_ZEROCOPY fell back to copy, disable it";
+        zerocopy_threshold_ = 0;
+      }
+      // 完成通知是一段连续的编号[ee_info, ee_data]
+      uint32 first = err->ee_info;
+      uint32 range = err->ee_data - first;
+      std::list<ZeroCopySend>::iterator iter = zerocopy_sends_.begin();
+      while (iter != zerocopy_sends_.end()) {
+        if (iter->id - first <= range) {
+          iter = zerocopy_sends_.erase(iter);
+        } else {
+          ++iter;
+        }
+      }
+    }
+  }
+#endif
 }
 
 int PhysicalSocket::SendTo(const void* buffer,
@@ -358,9 +603,136 @@ int PhysicalSocket::SendTo(const void* buffer,
   return sent;
 }
 
+int PhysicalSocket::SendTo(MemBuffer::Ptr buffer, const SocketAddress& addr) {
+  sockaddr_storage saddr;
+  size_t len = addr.ToSockAddrStorage(&saddr);
+#ifdef WIN32
+  WSABUF iov[MAX_IOV_BLOCKS];
+#else
+  struct iovec iov[MAX_IOV_BLOCKS];
+#endif
+  size_t count = 0;
+  const BlocksPtr &blocks = buffer->blocks();
+  for (BlocksPtr::const_iterator iter = blocks.begin();
+       iter != blocks.end(); ++iter) {
+    if ((*iter)->size() == 0) {
+      continue;
+    }
+    if (count == MAX_IOV_BLOCKS) {
+      // 远远超过了UDP数据报的最大长度
+      error_ = EMSGSIZE;
+      return SOCKET_ERROR;
+    }
+#ifdef WIN32
+    iov[count].buf = reinterpret_cast<char *>((*iter)->data());
+    iov[count].len = static_cast<ULONG>((*iter)->size());
+#else
+    iov[count].iov_base = (*iter)->data();
+    iov[count].iov_len = (*iter)->size();
+#endif
+    count++;
+  }
+
+#ifdef WIN32
+  DWORD bytes = 0;
+  int sent = ::WSASendTo(s_, iov, static_cast<DWORD>(count), &bytes, 0,
+                         reinterpret_cast<sockaddr*>(&saddr),
+                         static_cast<int>(len), NULL, NULL);
+  if (sent == 0) {
+    sent = static_cast<int>(bytes);
+  }
+#else
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &saddr;
+  msg.msg_namelen = len;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  int sent = ::sendmsg(s_, &msg, 0);
+#endif
+  UpdateLastError();
+  if ((sent < 0) && IsBlockingError(error_)) {
+    enabled_events_ |= DE_WRITE;
+  }
+  return sent;
+}
+
+int PhysicalSocket::SendToBatch(const Datagrams &datagrams, size_t offset) {
+  if (offset >= datagrams.size()) {
+    return 0;
+  }
+#ifdef VZ_HAVE_MMSG
+  size_t count = _min(datagrams.size() - offset,
+                      static_cast<size_t>(MAX_BATCH_DATAGRAMS));
+  struct mmsghdr msgs[MAX_BATCH_DATAGRAMS];
+  sockaddr_storage addrs[MAX_BATCH_DATAGRAMS];
+  std::vector<struct iovec> iov;
+  // 先确定每个数据报的iovec数，iov不再扩容之后才能取地址
+  size_t iov_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    iov_count += datagrams[offset + i].buffer->BlocksSize();
+  }
+  iov.resize(iov_count);
+  size_t index = 0;
+  for (size_t i = 0; i < count; i++) {
+    const Datagram &datagram = datagrams[offset + i];
+    struct msghdr &msg = msgs[i].msg_hdr;
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msg.msg_name = &addrs[i];
+    msg.msg_namelen = datagram.addr.ToSockAddrStorage(&addrs[i]);
+    msg.msg_iov = iov.empty() ? NULL : &iov[0] + index;
+    const BlocksPtr &blocks = datagram.buffer->blocks();
+    for (BlocksPtr::const_iterator iter = blocks.begin();
+         iter != blocks.end(); ++iter) {
+      iov[index].iov_base = (*iter)->data();
+      iov[index].iov_len = (*iter)->size();
+      index++;
+      msg.msg_iovlen++;
+    }
+  }
+  int sent = ::sendmmsg(s_, msgs, static_cast<unsigned int>(count), 0);
+  UpdateLastError();
+  if ((sent < 0) && IsBlockingError(error_)) {
+    enabled_events_ |= DE_WRITE;
+  }
+  return sent;
+#else
+  // 不支持sendmmsg时逐个发送，直到发不出去为止
+  int sent = 0;
+  for (size_t i = offset; i < datagrams.size(); i++) {
+    if (SendTo(datagrams[i].buffer, datagrams[i].addr) < 0) {
+      break;
+    }
+    sent++;
+  }
+  return (sent > 0) ? sent : SOCKET_ERROR;
+#endif
+}
+
 int PhysicalSocket::Recv(void* buffer, size_t length) {
+#ifdef VZ_HAVE_IO_URING
+  if (UringRecvQueued()) {
+    return RecvUring(buffer, length, false);
+  }
+#endif
   int received = ::recv(s_, static_cast<char*>(buffer),
                         static_cast<int>(length), 0);
+  return RecvResult(received);
+}
+
+int PhysicalSocket::Peek(void* buffer, size_t length) {
+#ifdef VZ_HAVE_IO_URING
+  if (UringRecvQueued()) {
+    return RecvUring(buffer, length, true);
+  }
+#endif
+  int received = ::recv(s_, static_cast<char*>(buffer),
+                        static_cast<int>(length), MSG_PEEK);
+  UpdateLastError();
+  return received;
+}
+
+int PhysicalSocket::RecvResult(int received) {
   bool success = false;
   UpdateLastError();
   if (received == 0) {
@@ -387,42 +759,92 @@ int PhysicalSocket::Recv(void* buffer, size_t length) {
 }
 
 int PhysicalSocket::Recv(MemBuffer::Ptr buffer) {
-  int res = 0;
-  int size = 0;
-  while (true) {
-    Block::Ptr block = Block::TakeBlock();
-    res = Recv(block->buffer, DEFAULT_BLOCK_SIZE);
-    if (res == DEFAULT_BLOCK_SIZE) {
-      block->buffer_size = res;
-      buffer->AppendBlock(block);
-      size += res;
-      continue;
-    } else if (res > 0) {
-      block->buffer_size = res;
-      buffer->AppendBlock(block);
-      size += res;
-      break;
-    } else if (res == 0) {
-      // Connection reset by peer
-      size = 0;
-      break;
-    } else {
-      if (IsBlockingError(error_)) {
-        // No messages are available
-        if (size == 0) {
-          // Read none
-          size = -1;
-        }
-      } else {
-        LOG(L_ERROR) << "recv error occured";
-        // An error occurred
-        size = -1;
-      }
-      break;
+#ifdef VZ_HAVE_IO_URING
+  if (UringRecvQueued()) {
+    return RecvUring(buffer);
+  }
+#endif
+  // 先确定要读多少数据，再一次取够Block，用一次readv读进来
+  size_t size = recv_size_;
+  if (size == 0) {
+#ifdef WIN32
+    u_long available = 0;
+    if (::ioctlsocket(s_, FIONREAD, &available) != 0) {
+      available = 0;
+    }
+#else
+    int available = 0;
+    if (::ioctl(s_, FIONREAD, &available) != 0) {
+      available = 0;
+    }
+#endif
+    // 没有可读数据时也要读一次，得到连接关闭或者出错的结果
+    size = (available > 0) ? available : DEFAULT_BLOCK_SIZE;
+  }
+  // 受预算限制时只读到预算为止，否则每个Block都读满
+  bool limited = false;
+  if (recv_budget_ && size > recv_budget_) {
+    size = recv_budget_;
+    limited = true;
+  }
+  // 按要读的数据量选Block的规格，小包不会占用大Block
+  BlocksPtr blocks;
+  Block::TakeBlocksFor(size, MAX_IOV_BLOCKS, &blocks);
+  size_t count = blocks.size();
+
+#ifdef WIN32
+  WSABUF iov[MAX_IOV_BLOCKS];
+#else
+  struct iovec iov[MAX_IOV_BLOCKS];
+#endif
+  size_t index = 0;
+  for (BlocksPtr::iterator iter = blocks.begin();
+       iter != blocks.end(); ++iter, ++index) {
+    size_t length = (*iter)->capacity;
+    if (limited) {
+      length = _min(length, size);
+      size -= length;
+    }
+#ifdef WIN32
+    iov[index].buf = reinterpret_cast<char *>((*iter)->buffer);
+    iov[index].len = static_cast<ULONG>(length);
+#else
+    iov[index].iov_base = (*iter)->buffer;
+    iov[index].iov_len = length;
+#endif
+  }
+
+#ifdef WIN32
+  DWORD bytes = 0;
+  DWORD flags = 0;
+  int received = ::WSARecv(s_, iov, static_cast<DWORD>(count), &bytes,
+                           &flags, NULL, NULL);
+  if (received == 0) {
+    received = static_cast<int>(bytes);
+  }
+#else
+  int received = ::readv(s_, iov, static_cast<int>(count));
+#endif
+  received = RecvResult(received);
+  if (received == 0) {
+    // Connection reset by peer
+    return 0;
+  } else if (received < 0) {
+    if (!IsBlockingError(error_)) {
+      LOG(L_ERROR) << "recv error occured";
     }
+    return -1;
   }
 
-  return size;
+  // 把读到的数据分给各个Block，多取的Block放回池中
+  size_t remain = received;
+  for (BlocksPtr::iterator iter = blocks.begin();
+       iter != blocks.end() && remain > 0; ++iter) {
+    (*iter)->SetSize(_min(remain, (*iter)->capacity));
+    remain -= (*iter)->size();
+    buffer->AppendBlock(*iter);
+  }
+  return received;
 }
 
 int PhysicalSocket::RecvFrom(void* buffer, size_t length, SocketAddress *out_addr) {
@@ -445,17 +867,177 @@ int PhysicalSocket::RecvFrom(void* buffer, size_t length, SocketAddress *out_add
 }
 
 int PhysicalSocket::RecvFrom(MemBuffer::Ptr buffer, SocketAddress *out_addr) {
-#ifdef LITEOS
-#define RECV_BUFF_LEN  (4*1024)
+  Datagrams datagrams;
+  if (RecvFromBatch(&datagrams, 1) <= 0) {
+    return SOCKET_ERROR;
+  }
+  if (datagrams.empty()) {
+    // 收到的数据报被截断丢弃了
+    error_ = EWOULDBLOCK;
+    return SOCKET_ERROR;
+  }
+  buffer->AppendBuffer(datagrams[0].buffer);
+  if (out_addr != NULL) {
+    *out_addr = datagrams[0].addr;
+  }
+  return static_cast<int>(datagrams[0].buffer->size());
+}
+
+void PhysicalSocket::SetMaxDatagramSize(size_t size) {
+  size = _max(_min(size, static_cast<size_t>(64 * 1024)),
+              static_cast<size_t>(1));
+  if (size == max_datagram_size_) {
+    return;
+  }
+  max_datagram_size_ = size;
+  slot_blocks_ = (size + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+  // 每个数据报占的Block数变了，接收区重新分配
+  recv_slots_.clear();
+}
+
+// 补齐接收区中上次交出去的Block，返回实际可以接收的数据报个数
+size_t PhysicalSocket::PrepareRecvSlots(size_t count) {
+  count = _max(_min(count, static_cast<size_t>(MAX_BATCH_DATAGRAMS)),
+               static_cast<size_t>(1));
+  size_t total = count * slot_blocks_;
+  if (recv_slots_.size() < total) {
+    recv_slots_.resize(total);
+  }
+  size_t missing = 0;
+  for (size_t i = 0; i < total; i++) {
+    if (!recv_slots_[i]) {
+      missing++;
+    }
+  }
+  if (missing > 0) {
+    BlocksPtr blocks;
+    Block::TakeBlocks(missing, &blocks);
+    BlocksPtr::iterator iter = blocks.begin();
+    for (size_t i = 0; i < total; i++) {
+      if (!recv_slots_[i]) {
+        recv_slots_[i] = *iter++;
+      }
+    }
+  }
+  return count;
+}
+
+// 把接收区中slot收到的数据交给buffer，被截断的数据报丢弃
+bool PhysicalSocket::TakeDatagram(size_t slot,
+                                  size_t length,
+                                  bool truncated,
+                                  MemBuffer::Ptr buffer) {
+  if (truncated) {
+    LOG(L_WARNING) << "Drop a datagram larger than " << max_datagram_size_
+                   << " bytes";
+    return false;
+  }
+  Block::Ptr *blocks = &recv_slots_[slot * slot_blocks_];
+  for (size_t i = 0; length > 0; i++) {
+    blocks[i]->SetSize(_min(length, static_cast<size_t>(DEFAULT_BLOCK_SIZE)));
+    length -= blocks[i]->size();
+    buffer->AppendBlock(blocks[i]);
+    blocks[i].reset();
+  }
+  return true;
+}
+
+int PhysicalSocket::RecvFromBatch(Datagrams *datagrams, size_t count) {
+  count = PrepareRecvSlots(count);
+  // 每个数据报最后一个Block只用到max_datagram_size_为止
+  size_t last_size = max_datagram_size_ -
+                     (slot_blocks_ - 1) * DEFAULT_BLOCK_SIZE;
+#ifdef WIN32
+  std::vector<WSABUF> iov(count * slot_blocks_);
+  for (size_t i = 0; i < iov.size(); i++) {
+    iov[i].buf = reinterpret_cast<char *>(recv_slots_[i]->buffer);
+    iov[i].len = ((i + 1) % slot_blocks_ == 0) ?
+                 static_cast<ULONG>(last_size) : DEFAULT_BLOCK_SIZE;
+  }
 #else
-#define RECV_BUFF_LEN  (64*1024)
+  std::vector<struct iovec> iov(count * slot_blocks_);
+  for (size_t i = 0; i < iov.size(); i++) {
+    iov[i].iov_base = recv_slots_[i]->buffer;
+    iov[i].iov_len = ((i + 1) % slot_blocks_ == 0) ?
+                     last_size : DEFAULT_BLOCK_SIZE;
+  }
 #endif
-  char temp_buffer[RECV_BUFF_LEN] = {0};
-  int res = RecvFrom(temp_buffer, RECV_BUFF_LEN, out_addr);
-  if (res > 0) {
-    buffer->WriteBytes(temp_buffer, res);
+  sockaddr_storage addrs[MAX_BATCH_DATAGRAMS];
+  int received = 0;
+
+#ifdef VZ_HAVE_MMSG
+  struct mmsghdr msgs[MAX_BATCH_DATAGRAMS];
+  memset(msgs, 0, sizeof(msgs[0]) * count);
+  for (size_t i = 0; i < count; i++) {
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    msgs[i].msg_hdr.msg_iov = &iov[i * slot_blocks_];
+    msgs[i].msg_hdr.msg_iovlen = slot_blocks_;
   }
-  return res;
+  int res = ::recvmmsg(s_, msgs, static_cast<unsigned int>(count), 0, NULL);
+  UpdateLastError();
+  for (int i = 0; i < res; i++) {
+    Datagram datagram;
+    datagram.buffer = MemBuffer::CreateMemBuffer();
+    if (TakeDatagram(i, msgs[i].msg_len,
+                     (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0,
+                     datagram.buffer)) {
+      SocketAddressFromSockAddrStorage(addrs[i], &datagram.addr);
+      datagrams->push_back(datagram);
+    }
+    received++;
+  }
+#else
+  // 不支持recvmmsg时逐个接收，直到没有数据为止
+  for (size_t i = 0; i < count; i++) {
+    bool truncated = false;
+#ifdef WIN32
+    DWORD bytes = 0;
+    DWORD flags = 0;
+    int addr_len = sizeof(addrs[i]);
+    int res = ::WSARecvFrom(s_, &iov[i * slot_blocks_],
+                            static_cast<DWORD>(slot_blocks_), &bytes, &flags,
+                            reinterpret_cast<sockaddr*>(&addrs[i]), &addr_len,
+                            NULL, NULL);
+    UpdateLastError();
+    if (res != 0 && error_ == WSAEMSGSIZE) {
+      truncated = true;
+    } else if (res != 0) {
+      break;
+    }
+    size_t length = bytes;
+#else
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addrs[i];
+    msg.msg_namelen = sizeof(addrs[i]);
+    msg.msg_iov = &iov[i * slot_blocks_];
+    msg.msg_iovlen = slot_blocks_;
+    int res = ::recvmsg(s_, &msg, 0);
+    UpdateLastError();
+    if (res < 0) {
+      break;
+    }
+    truncated = (msg.msg_flags & MSG_TRUNC) != 0;
+    size_t length = res;
+#endif
+    Datagram datagram;
+    datagram.buffer = MemBuffer::CreateMemBuffer();
+    if (TakeDatagram(i, length, truncated, datagram.buffer)) {
+      SocketAddressFromSockAddrStorage(addrs[i], &datagram.addr);
+      datagrams->push_back(datagram);
+    }
+    received++;
+  }
+#endif
+  bool success = (received > 0) || IsBlockingError(error_);
+  if (udp_ || success) {
+    enabled_events_ |= DE_READ;
+  }
+  if (!success) {
+    LOG_F(LS_VERBOSE) << "Error = " << error_;
+  }
+  return (received > 0) ? received : SOCKET_ERROR;
 }
 
 int PhysicalSocket::Listen(int backlog) {
@@ -473,10 +1055,22 @@ int PhysicalSocket::Listen(int backlog) {
 }
 
 Socket::Ptr PhysicalSocket::Accept(SocketAddress *out_addr) {
+#ifdef VZ_HAVE_IO_URING
+  if (uring_io_ && (uring_io_->accept_op
+                    || !uring_io_->accepted.empty()
+                    || uring_io_->error)) {
+    return AcceptUring(out_addr);
+  }
+#endif
   sockaddr_storage addr_storage;
   socklen_t addr_len = sizeof(addr_storage);
   sockaddr* addr = reinterpret_cast<sockaddr*>(&addr_storage);
+#if defined(POSIX) && !defined(LITEOS)
+  // The new socket comes out non-blocking, no fcntl() needed
+  SOCKET s = ::accept4(s_, addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
   SOCKET s = ::accept(s_, addr, &addr_len);
+#endif
   UpdateLastError();
   if (s == INVALID_SOCKET) {
     return Socket::Ptr();
@@ -487,18 +1081,36 @@ Socket::Ptr PhysicalSocket::Accept(SocketAddress *out_addr) {
   }
 
   PhysicalSocket::Ptr dispatcher(new PhysicalSocket(s));
+#if !defined(POSIX) || defined(LITEOS)
   dispatcher->SetSocketNonblock();
+#endif
   return dispatcher;
 }
 
 int PhysicalSocket::Close() {
   if (s_ == INVALID_SOCKET)
     return 0;
+#ifdef VZ_HAVE_IO_URING
+  if (uring_io_) {
+    // 请求持有socket文件的引用，不取消的话连接不会真正关闭
+    if (uring_io_->service) {
+      uring_io_->service->CancelUringIo(this, false);
+    }
+    for (size_t i = 0; i < uring_io_->accepted.size(); i++) {
+      ::closesocket(uring_io_->accepted[i]);
+    }
+    uring_io_.reset();
+  }
+#endif
   int err = ::closesocket(s_);
   UpdateLastError();
   s_ = INVALID_SOCKET;
   state_ = CS_CLOSED;
   enabled_events_ = 0;
+  // 关闭后收不到完成通知了，内核中还没发出去的数据不再保证不被修改
+  zerocopy_sends_.clear();
+  zerocopy_threshold_ = 0;
+  recv_slots_.clear();
   //if (resolver_) {
   //  resolver_->Destroy(false);
   //  resolver_ = NULL;
@@ -510,27 +1122,191 @@ void PhysicalSocket::UpdateLastError() {
   error_ = LAST_SYSTEM_ERROR;
 }
 
-int PhysicalSocket::TranslateOption(Option opt, int* slevel, int* sopt) {
-  switch (opt) {
-  case OPT_DONTFRAGMENT:
-#ifdef WIN32
-    *slevel = IPPROTO_IP;
-    *sopt = IP_DONTFRAGMENT;
-    break;
-#elif defined(IOS) || defined(OSX) || defined(BSD)
-    LOG(LS_WARNING) << "Socket::OPT_DONTFRAGMENT not supported.";
-    return -1;
-#elif defined(POSIX)
-    *slevel = IPPROTO_IP;
-    *sopt = IP_MTU_DISCOVER;
-    break;
+size_t PhysicalSocket::QueuedRecvSize() const {
+#ifdef VZ_HAVE_IO_URING
+  if (uring_io_) {
+    return uring_io_->recv_size;
+  }
 #endif
-  case OPT_RCVBUF:
-    *slevel = SOL_SOCKET;
-    *sopt = SO_RCVBUF;
-    break;
-  case OPT_SNDBUF:
-    *slevel = SOL_SOCKET;
+  return 0;
+}
+
+bool PhysicalSocket::SendPending() const {
+#ifdef VZ_HAVE_IO_URING
+  return uring_io_ && uring_io_->send_op != 0;
+#else
+  return false;
+#endif
+}
+
+void PhysicalSocket::StopUringIo() {
+#ifdef VZ_HAVE_IO_URING
+  if (UringIoActive()) {
+    uring_io_->service->CancelUringIo(this, true);
+  }
+#endif
+}
+
+#ifdef VZ_HAVE_IO_URING
+// 有收进来的数据、连接的结果或者进行中的接收请求时，不能直接读socket
+bool PhysicalSocket::UringRecvQueued() const {
+  return uring_io_ && (uring_io_->recv_size
+                       || uring_io_->recv_op
+                       || uring_io_->recv_eof
+                       || uring_io_->error);
+}
+
+uint32 PhysicalSocket::UringReadyEvents() const {
+  uint32 ff = 0;
+  if (!uring_io_->accepted.empty() || uring_io_->error) {
+    ff |= DE_ACCEPT;
+  }
+  if (uring_io_->recv_size || uring_io_->recv_eof || uring_io_->error) {
+    ff |= DE_READ;
+  }
+  if (!uring_io_->send_op) {
+    ff |= DE_WRITE;
+  }
+  return ff;
+}
+
+// 收进来的数据都取完了，返回连接的结果
+int PhysicalSocket::RecvUringEnd() {
+  if (uring_io_->error) {
+    error_ = uring_io_->error;
+    LOG_F(LS_VERBOSE) << "Error = " << error_;
+    return SOCKET_ERROR;
+  }
+  if (uring_io_->recv_eof) {
+    error_ = 0;
+    LOG(LS_WARNING) << "EOF from socket; deferring close event";
+    return 0;
+  }
+  error_ = EWOULDBLOCK;
+  return SOCKET_ERROR;
+}
+
+int PhysicalSocket::RecvUring(MemBuffer::Ptr buffer) {
+  UringIo *io = uring_io_.get();
+  if (io->recv_size == 0) {
+    return RecvUringEnd();
+  }
+  // 收到的Block直接交出去，受SetRecvSize和预算限制时最后一个Block只交出
+  // 一部分
+  size_t size = io->recv_size;
+  if (recv_size_ && size > recv_size_) {
+    size = recv_size_;
+  }
+  if (recv_budget_ && size > recv_budget_) {
+    size = recv_budget_;
+  }
+  size_t remain = size;
+  while (remain > 0) {
+    Block::Ptr &block = io->recv_blocks.front();
+    if (block->size() > remain) {
+      Block::Ptr part = Block::TakeBlock(remain);
+      part->WriteBytes(reinterpret_cast<char *>(block->data()), remain);
+      block->Consume(remain);
+      buffer->AppendBlock(part);
+      break;
+    }
+    remain -= block->size();
+    buffer->AppendBlock(block);
+    io->recv_blocks.pop_front();
+  }
+  io->recv_size -= size;
+  error_ = 0;
+  ResumeUringRecv();
+  return static_cast<int>(size);
+}
+
+int PhysicalSocket::RecvUring(void *buffer, size_t length, bool peek) {
+  UringIo *io = uring_io_.get();
+  if (io->recv_size == 0) {
+    return RecvUringEnd();
+  }
+  size_t size = _min(length, io->recv_size);
+  uint8 *dst = static_cast<uint8 *>(buffer);
+  size_t copied = 0;
+  for (BlocksPtr::iterator iter = io->recv_blocks.begin();
+       copied < size; ++iter) {
+    size_t n = _min(size - copied, (*iter)->size());
+    memcpy(dst + copied, (*iter)->data(), n);
+    copied += n;
+  }
+  error_ = 0;
+  if (peek) {
+    return static_cast<int>(size);
+  }
+  size_t remain = size;
+  while (remain > 0) {
+    Block::Ptr &block = io->recv_blocks.front();
+    if (block->size() > remain) {
+      block->Consume(remain);
+      break;
+    }
+    remain -= block->size();
+    io->recv_blocks.pop_front();
+  }
+  io->recv_size -= size;
+  ResumeUringRecv();
+  return static_cast<int>(size);
+}
+
+void PhysicalSocket::ResumeUringRecv() {
+  if (uring_io_->recv_paused && uring_io_->service
+      && uring_io_->recv_size <= URING_RECV_QUEUE_LIMIT / 2) {
+    uring_io_->service->ResumeUringRecv(this);
+  }
+}
+
+Socket::Ptr PhysicalSocket::AcceptUring(SocketAddress *out_addr) {
+  UringIo *io = uring_io_.get();
+  if (io->accepted.empty()) {
+    // 出错时multishot accept已经结束，错误只报告一次，下次Add()重新开始
+    error_ = io->error ? io->error : EWOULDBLOCK;
+    io->error = 0;
+    return Socket::Ptr();
+  }
+  SOCKET s = io->accepted.front();
+  io->accepted.pop_front();
+  error_ = 0;
+  enabled_events_ |= DE_ACCEPT;
+  if (out_addr != NULL) {
+    sockaddr_storage addr_storage;
+    socklen_t addr_len = sizeof(addr_storage);
+    if (::getpeername(s, reinterpret_cast<sockaddr*>(&addr_storage),
+                      &addr_len) == 0) {
+      SocketAddressFromSockAddrStorage(addr_storage, out_addr);
+    }
+  }
+  // 内核accept时已经设置了SOCK_NONBLOCK
+  PhysicalSocket::Ptr dispatcher(new PhysicalSocket(s));
+  return dispatcher;
+}
+#endif  // VZ_HAVE_IO_URING
+
+int PhysicalSocket::TranslateOption(Option opt, int* slevel, int* sopt) {
+  switch (opt) {
+  case OPT_DONTFRAGMENT:
+#ifdef WIN32
+    *slevel = IPPROTO_IP;
+    *sopt = IP_DONTFRAGMENT;
+    break;
+#elif defined(IOS) || defined(OSX) || defined(BSD)
+    LOG(LS_WARNING) << "Socket::OPT_DONTFRAGMENT not supported.";
+    return -1;
+#elif defined(POSIX)
+    *slevel = IPPROTO_IP;
+    *sopt = IP_MTU_DISCOVER;
+    break;
+#endif
+  case OPT_RCVBUF:
+    *slevel = SOL_SOCKET;
+    *sopt = SO_RCVBUF;
+    break;
+  case OPT_SNDBUF:
+    *slevel = SOL_SOCKET;
     *sopt = SO_SNDBUF;
     break;
   case OPT_NODELAY:
@@ -541,6 +1317,19 @@ int PhysicalSocket::TranslateOption(Option opt, int* slevel, int* sopt) {
     *slevel = IPPROTO_IP;
     *sopt = IP_ADD_MEMBERSHIP;
     break;
+  case OPT_REUSEADDR:
+    *slevel = SOL_SOCKET;
+    *sopt = SO_REUSEADDR;
+    break;
+  case OPT_REUSEPORT:
+#ifdef SO_REUSEPORT
+    *slevel = SOL_SOCKET;
+    *sopt = SO_REUSEPORT;
+    break;
+#else
+    LOG(LS_WARNING) << "Socket::OPT_REUSEPORT not supported.";
+    return -1;
+#endif
   default:
     ASSERT(false);
     return -1;
@@ -567,6 +1356,10 @@ bool PhysicalSocket::CheckSignalClose() {
 }
 
 void PhysicalSocket::OnEvent(uint32 ff) {
+  // 零拷贝的完成通知会一直让Socket处于POLLERR状态，每次事件都要取走
+  if (!zerocopy_sends_.empty()) {
+    ReapZeroCopy();
+  }
 
   if (((ff & DE_CONNECT) != 0)) {
     if (ff != DE_CONNECT)
@@ -614,7 +1407,14 @@ static uint32 FlagsToEvents(uint32 events) {
 EventDispatcher::EventDispatcher(Dispatcher::Ptr dispatcher, uint32 events)
   : disp_(dispatcher),
     event_close_(false),
-    enabled_events_(events) {
+    enabled_events_(events),
+    service_(NULL),
+    armed_(false),
+    table_fd_(INVALID_SOCKET),
+    update_pending_(false),
+    pending_events_(0),
+    ready_queued_(false),
+    completion_io_(false) {
 }
 
 EventDispatcher::~EventDispatcher() {
@@ -632,10 +1432,20 @@ void EventDispatcher::Close() {
 
 void EventDispatcher::RemoveEvent(uint32 event_type) {
   enabled_events_ &= ~event_type;
+  if (service_) {
+    service_->UpdateDispatcher(shared_from_this());
+  }
 }
 
 void EventDispatcher::AddEvent(uint32 event_type) {
   enabled_events_ |= event_type;
+  if (service_) {
+    service_->UpdateDispatcher(shared_from_this());
+  }
+}
+
+void EventDispatcher::SetPendingEvents(uint32 event_type) {
+  pending_events_ |= event_type;
 }
 
 bool EventDispatcher::CheckEventClose() {
@@ -662,6 +1472,7 @@ void EventDispatcher::OnEvent(uint32 ff, int err) {
   // something like a READ followed by a CONNECT, which would be odd.
   //LOG(L_INFO) << "socket "<< (uint32)disp_->GetSocket()
   //            << ", received event type = " << ff;
+  pending_events_ &= ~ff;
   SignalEvent(shared_from_this(),
               boost::dynamic_pointer_cast<Socket>(disp_),
               ff,
@@ -681,128 +1492,972 @@ void EventDispatcher::OnEvent(uint32 ff, int err) {
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
+#ifdef VZ_HAVE_IO_URING
+#define URING_ENTRIES 1024
+// 唤醒和取消请求的user_data。poll请求为(序号 << 32) | fd，序号小于
+// 0x80000000；完成模式的请求为URING_OP_FLAG | id
+#define URING_WAKEUP_DATA 0xFFFFFFFFFFFFFFFFULL
+#define URING_CANCEL_DATA 0xFFFFFFFFFFFFFFFEULL
+#define URING_OP_FLAG     0x8000000000000000ULL
+// 流式socket上内核自己接着发送没发完的部分
+#define URING_SEND_FLAGS  (MSG_NOSIGNAL | MSG_WAITALL)
+
+namespace {
+enum UringOpType {
+  URING_OP_ACCEPT,
+  URING_OP_RECV,
+  URING_OP_SEND
+};
+}
+
+// 完成模式的一个请求
+struct NetworkService::UringOp {
+  int    type;
+  SOCKET fd;
+  // socket关闭之后置为NULL，之后的完成事件直接丢弃
+  PhysicalSocket *socket;
+  // SENDMSG: 请求完成之前Block不能回收，只发送了一部分时iov向前推进
+  BlocksPtr blocks;
+  std::vector<struct iovec> iov;
+  struct msghdr msg;
+  size_t length;
+};
+#endif
+
+NetworkService::BackendType NetworkService::default_backend_ =
+  NetworkService::BACKEND_EPOLL;
+
+void NetworkService::SetDefaultBackend(BackendType backend) {
+  default_backend_ = backend;
+}
+
+NetworkService::BackendType NetworkService::DefaultBackend() {
+  return default_backend_;
+}
+
 NetworkService::NetworkService()
-  : fWait_(false) {
+  : backend_(BACKEND_SELECT),
+    fWait_(false),
+    elided_wakeups_(0) {
+  SetupBackend(default_backend_);
+}
+
+NetworkService::NetworkService(BackendType backend)
+  : backend_(BACKEND_SELECT),
+    fWait_(false),
+    elided_wakeups_(0) {
+  SetupBackend(backend);
+}
+
+void NetworkService::SetupBackend(BackendType backend) {
 #ifdef WIN32
   socket_ev_ = WSACreateEvent();
   signal_wakeup_ = WSACreateEvent();
   ASSERT(signal_wakeup_ != NULL);
   ASSERT(socket_ev_ != NULL);
 #else
+  dispatcher_count_ = 0;
   signal_wakeup_ = Signal::CreateSignal();
-#if 0 //defined(POSIX) && !defined(LITEOS)
-  epoll_ = epoll_create1(0);
-  ASSERT(epoll_ >= 0);
+  sleeping_ = 0;
+  wakeup_pending_ = 0;
+#ifdef VZ_HAVE_EPOLL
+  dispatching_ = false;
+  epoll_ = -1;
+#ifdef VZ_HAVE_IO_URING
+  uring_serial_ = 0;
+  uring_waiting_ = false;
+  uring_completion_ = false;
+  if (backend == BACKEND_IO_URING) {
+    uring_.reset(new IoUring());
+    if (uring_->Init(URING_ENTRIES)) {
+      backend_ = BACKEND_IO_URING;
+      ArmUringWakeup();
+      SetupUringBuffers();
+      return;
+    }
+    LOG(LS_WARNING) << "io_uring is not available, fall back to epoll";
+    uring_.reset();
+    backend = BACKEND_EPOLL;
+  }
+#endif
+  if (backend != BACKEND_EPOLL) {
+    return;
+  }
+  epoll_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_ != -1) {
+    struct epoll_event listen_event = {0};
+    SOCKET s = signal_wakeup_->GetSocket();
+    listen_event.events = EPOLLIN;
+    listen_event.data.fd = s;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, s, &listen_event) != 0) {
+      LOG_E(LS_ERROR, EN, errno) << "epoll add wakeup signal";
+      close(epoll_);
+      epoll_ = -1;
+      return;
+    }
+    backend_ = BACKEND_EPOLL;
+  } else {
+    LOG_E(LS_WARNING, EN, errno) << "epoll_create1, fall back to select";
+  }
+#endif
+#endif
+}
+
+NetworkService::~NetworkService() {
+#ifdef WIN32
+  WSACloseEvent(socket_ev_);
+  WSACloseEvent(signal_wakeup_);
+  ASSERT(dispatchers_.empty());
+#else
+  delete signal_wakeup_;
+#ifdef VZ_HAVE_IO_URING
+  // 关闭io_uring之后内核不再使用请求中的内存，socket也不再关联这些请求
+  uring_.reset();
+  for (size_t i = 0; i < uring_ops_.size(); i++) {
+    PhysicalSocket *socket = uring_ops_[i]->socket;
+    if (socket != NULL && socket->uring_io_) {
+      socket->uring_io_->service = NULL;
+      socket->uring_io_->accept_op = 0;
+      socket->uring_io_->recv_op = 0;
+      socket->uring_io_->send_op = 0;
+    }
+    delete uring_ops_[i];
+  }
+  uring_ops_.clear();
+#endif
+#ifdef VZ_HAVE_EPOLL
+  if (epoll_ != -1) {
+    close(epoll_);
+  }
+  pending_updates_.clear();
+#endif
+  // Dispatchers closed without Remove() are still referenced here
+  dispatchers_.clear();
+#endif
+}
+
+bool NetworkService::InitNetworkService() {
+  return true;
+}
+
+Socket::Ptr NetworkService::CreateSocket(int type) {
+  return CreateSocket(AF_INET, type);
+}
+
+Socket::Ptr NetworkService::CreateSocket(int family, int type) {
+  PhysicalSocket::Ptr dispatcher(new PhysicalSocket());
+  if (dispatcher->Create(family, type)) {
+    //SOCKET sock = dispatcher->GetSocket();
+    //LOG(L_INFO) << "create socket \t" << (uint32)sock;
+    return dispatcher;
+  }
+  return Socket::Ptr();
+}
+
+Socket::Ptr NetworkService::WrapSocket(SOCKET s) {
+  PhysicalSocket::Ptr dispatcher(new PhysicalSocket(s));
+  if (dispatcher->SetSocketNonblock()) {
+    return dispatcher;
+  }
+  return Socket::Ptr();
+}
+
+void NetworkService::Add(EventDispatcher::Ptr pdispatcher) {
+  CritScope cs(&crit_);
+#ifdef WIN32
+  // Prevent duplicates. This can cause dead dispatchers to stick around.
+  DispatcherList::iterator pos = std::find(dispatchers_.begin(),
+                                 dispatchers_.end(),
+                                 pdispatcher);
+  if (pos != dispatchers_.end()) {
+    //LOG(L_ERROR) << "socket already exist can't add \t" << (uint32)sock;
+    return;
+  }
+  //LOG(L_INFO) << "Add socket \t" << (uint32)sock;
+  dispatchers_.push_back(pdispatcher);
+#else
+  // A dispatcher keeps its slot after an event, re-arming it is O(1)
+  pdispatcher->armed_ = true;
+  AttachDispatcher(pdispatcher);
+  if ((pdispatcher->pending_events_ & pdispatcher->enabled_events_)
+      && !pdispatcher->ready_queued_) {
+    // 还有没处理完的就绪事件，下一轮直接分发，不需要再向内核登记
+    pdispatcher->ready_queued_ = true;
+    ready_.push_back(pdispatcher);
+    // 其他线程Add的，循环可能正阻塞着，或者已经检查过ready_正要阻塞。
+    // 不能只在sleeping_时唤醒，WakeUp会设置wakeup_pending_让EnterSleep
+    // 不阻塞，循环没睡时也不会写唤醒fd
+    WakeUp();
+    return;
+  }
+  UpdateDispatcher(pdispatcher);
+#endif
+}
+
+void NetworkService::Remove(EventDispatcher::Ptr pdispatcher) {
+  CritScope cs(&crit_);
+#ifdef WIN32
+  DispatcherList::iterator pos = std::find(dispatchers_.begin(),
+                                 dispatchers_.end(),
+                                 pdispatcher);
+  if (pos != dispatchers_.end()) {
+    pdispatcher->DisableEvent();
+  }
+#else
+  if (pdispatcher->table_fd_ != INVALID_SOCKET) {
+    pdispatcher->DisableEvent();
+    DetachDispatcher(pdispatcher);
+  }
+  pdispatcher->armed_ = false;
+  pdispatcher->pending_events_ = 0;
+#endif
+}
+
+void NetworkService::UpdateDispatcher(EventDispatcher::Ptr pdispatcher) {
+#ifdef VZ_HAVE_EPOLL
+  CritScope cs(&crit_);
+  // The select loop rebuilds its fd_set from the masks on every turn, and a
+  // disarmed dispatcher is synchronized on its next Add().
+  if (backend_ == BACKEND_SELECT
+      || !pdispatcher->armed_
+      || pdispatcher->ready_queued_
+      || pdispatcher->table_fd_ == INVALID_SOCKET) {
+    return;
+  }
+  if (dispatching_) {
+    // OnSocketEvent usually removes an event and adds it back right away,
+    // merge these changes and commit them once the dispatch loop is done.
+    if (!pdispatcher->update_pending_) {
+      pdispatcher->update_pending_ = true;
+      pending_updates_.push_back(pdispatcher);
+    }
+    return;
+  }
+  SyncDispatcher(pdispatcher);
+#endif
+}
+
+#ifndef WIN32
+void NetworkService::AttachDispatcher(EventDispatcher::Ptr pdispatcher) {
+  SOCKET sock = pdispatcher->GetSocket();
+  if (sock == INVALID_SOCKET || pdispatcher->CheckEventClose()) {
+    return;
+  }
+  if (pdispatcher->table_fd_ == sock) {
+    return;
+  }
+  if (pdispatcher->table_fd_ != INVALID_SOCKET) {
+    DetachDispatcher(pdispatcher);
+  }
+  if (static_cast<size_t>(sock) >= dispatchers_.size()) {
+    dispatchers_.resize(_max(static_cast<size_t>(sock) + 1,
+                             dispatchers_.size() * 2));
+  }
+  DispatcherSlot &slot = dispatchers_[sock];
+  if (slot.dispatcher) {
+    // The fd is still owned by another dispatcher, such as the connecter
+    // which hands over its socket to an AsyncSocket.
+    slot.dispatcher->armed_ = false;
+    slot.dispatcher->table_fd_ = INVALID_SOCKET;
+#ifdef VZ_HAVE_IO_URING
+    if (backend_ == BACKEND_IO_URING) {
+      CancelUringPoll(sock);
+    }
+#endif
+  } else {
+    dispatcher_count_++;
+  }
+  slot.dispatcher = pdispatcher;
+  slot.generation++;
+  pdispatcher->table_fd_ = sock;
+}
+
+void NetworkService::DetachDispatcher(EventDispatcher::Ptr pdispatcher) {
+  SOCKET sock = pdispatcher->table_fd_;
+  if (sock == INVALID_SOCKET) {
+    return;
+  }
+  pdispatcher->table_fd_ = INVALID_SOCKET;
+  DispatcherSlot &slot = dispatchers_[sock];
+  ASSERT(slot.dispatcher == pdispatcher);
+  slot.dispatcher.reset();
+  dispatcher_count_--;
+#ifdef VZ_HAVE_IO_URING
+  if (backend_ == BACKEND_IO_URING) {
+    // The poll request holds a reference of the file, the socket isn't
+    // really closed until it is gone.
+    CancelUringPoll(sock);
+    return;
+  }
+#endif
+#ifdef VZ_HAVE_EPOLL
+  if (slot.poll_registered) {
+    slot.poll_registered = false;
+    // The socket may be closed already, the kernel has dropped it then
+    struct epoll_event listen_event = {0};
+    if (epoll_ctl(epoll_, EPOLL_CTL_DEL, sock, &listen_event)
+        && errno != EBADF && errno != ENOENT) {
+      LOG_E(LS_ERROR, EN, errno) << "epoll del, socket = " << sock;
+    }
+  }
+#endif
+}
+#endif  // WIN32
+
+#ifdef VZ_HAVE_EPOLL
+// epoll和poll的事件值在Linux上是相同的
+static uint32 FlagsToPollEvents(uint32 events) {
+  uint32 poll_events = 0;
+  if (events & (DE_READ | DE_ACCEPT)) {
+    poll_events |= POLLIN;
+  }
+  if (events & (DE_WRITE | DE_CONNECT)) {
+    poll_events |= POLLOUT;
+  }
+  return poll_events;
+}
+
+// Translate the poll events reported by epoll or io_uring to DE_XXX
+static uint32 TranslatePollEvents(EventDispatcher::Ptr disp,
+                                  SOCKET fd,
+                                  uint32 revents,
+                                  int *errcode) {
+  uint32 enable_event = disp->get_enable_events();
+  uint32 ff = 0;
+  bool readable = (revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+  bool writable = (revents & (POLLOUT | POLLHUP | POLLERR)) != 0;
+
+  // Only reap the error code when the kernel reports one, or when a
+  // pending connect has to be told success from failure.
+  if ((revents & POLLERR)
+      || (writable && (enable_event & DE_CONNECT))) {
+    socklen_t len = sizeof(*errcode);
+    ::getsockopt(fd, SOL_SOCKET, SO_ERROR, errcode, &len);
+  }
+
+  // Check readable descriptors. If we're waiting on an accept, signal
+  // that. Otherwise we're waiting for data, check to see if we're
+  // readable or really closed.
+  if (readable && (enable_event & (DE_READ | DE_ACCEPT))) {
+    if (enable_event & DE_ACCEPT) {
+      ff |= DE_ACCEPT;
+    } else if (*errcode) {
+      ff |= DE_CLOSE;
+    } else {
+      ff |= DE_READ;
+    }
+  }
+
+  // Check writable descriptors. If we're waiting on a connect, detect
+  // success versus failure by the reaped error code.
+  if (writable && (enable_event & (DE_WRITE | DE_CONNECT))) {
+    if (enable_event & DE_CONNECT) {
+      if (!*errcode) {
+        ff |= DE_CONNECT;
+      } else {
+        ff |= DE_CLOSE;
+      }
+    } else {
+      ff |= DE_WRITE;
+    }
+  }
+  return ff;
+}
+
+void NetworkService::SyncDispatcher(EventDispatcher::Ptr pdispatcher) {
+  if (pdispatcher->CheckEventClose()) {
+    return;
+  }
+#ifdef VZ_HAVE_IO_URING
+  if (backend_ == BACKEND_IO_URING) {
+    SyncUringDispatcher(pdispatcher);
+    return;
+  }
+#endif
+  SOCKET sock = pdispatcher->table_fd_;
+  DispatcherSlot &slot = dispatchers_[sock];
+  uint32 events = FlagsToPollEvents(pdispatcher->get_enable_events());
+  if (slot.poll_registered
+      && slot.poll_events == events
+      && slot.poll_generation == slot.generation) {
+    return;
+  }
+
+  struct epoll_event listen_event = {0};
+  listen_event.events = events;
+  listen_event.data.u64 = (static_cast<uint64>(slot.generation) << 32)
+                          | static_cast<uint32>(sock);
+  int op = slot.poll_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  int ret = epoll_ctl(epoll_, op, sock, &listen_event);
+  if (ret != 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+    ret = epoll_ctl(epoll_, EPOLL_CTL_ADD, sock, &listen_event);
+  } else if (ret != 0 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+    ret = epoll_ctl(epoll_, EPOLL_CTL_MOD, sock, &listen_event);
+  }
+  if (ret != 0) {
+    LOG_E(LS_ERROR, EN, errno) << "epoll_ctl, socket = " << sock;
+    slot.poll_registered = false;
+    return;
+  }
+  slot.poll_registered = true;
+  slot.poll_events = events;
+  slot.poll_generation = slot.generation;
+}
+
+void NetworkService::FlushPendingUpdates() {
+  // SyncDispatcher never appends to pending_updates_ when not dispatching
+  for (size_t i = 0; i < pending_updates_.size(); i++) {
+    EventDispatcher::Ptr disp = pending_updates_[i];
+    disp->update_pending_ = false;
+    if (disp->armed_ && disp->table_fd_ != INVALID_SOCKET) {
+      SyncDispatcher(disp);
+    }
+  }
+  pending_updates_.clear();
+}
+#endif
+
+#ifdef VZ_HAVE_IO_URING
+static uint64 UringUserData(uint32 serial, SOCKET sock) {
+  return (static_cast<uint64>(serial) << 32) | static_cast<uint32>(sock);
+}
+
+void NetworkService::SyncUringDispatcher(EventDispatcher::Ptr pdispatcher) {
+  SOCKET sock = pdispatcher->table_fd_;
+  PhysicalSocket *socket = UringIoSocket(pdispatcher);
+  if (socket != NULL) {
+    CancelUringPoll(sock);
+    SyncUringIo(pdispatcher, socket);
+    return;
+  }
+  DispatcherSlot &slot = dispatchers_[sock];
+  uint32 events = FlagsToPollEvents(pdispatcher->get_enable_events());
+  if (slot.poll_registered) {
+    if (slot.poll_events == events) {
+      return;
+    }
+    // A poll request can't be modified, replace it by a new one
+    uring_->PollRemove(UringUserData(slot.poll_generation, sock),
+                       URING_CANCEL_DATA);
+    slot.poll_registered = false;
+  }
+  if (events != 0) {
+    if (++uring_serial_ & 0x80000000) {
+      uring_serial_ = 1;
+    }
+    if (!uring_->PollAdd(sock, events, UringUserData(uring_serial_, sock))) {
+      LOG(L_ERROR) << "io_uring poll add, socket = " << sock;
+      return;
+    }
+    slot.poll_registered = true;
+    slot.poll_events = events;
+    slot.poll_generation = uring_serial_;
+  }
+  SubmitUring();
+}
+
+void NetworkService::CancelUringPoll(SOCKET sock) {
+  DispatcherSlot &slot = dispatchers_[sock];
+  if (!slot.poll_registered) {
+    return;
+  }
+  slot.poll_registered = false;
+  uring_->PollRemove(UringUserData(slot.poll_generation, sock),
+                     URING_CANCEL_DATA);
+  SubmitUring();
+}
+
+void NetworkService::SubmitUring() {
+  // The loop submits the queue together with its next wait, only the loop
+  // sleeping in the kernel has to be handed the requests right now.
+  if (uring_waiting_) {
+    uring_->Submit();
+  }
+}
+
+void NetworkService::ArmUringWakeup() {
+  if (!uring_->PollAdd(signal_wakeup_->GetSocket(), POLLIN,
+                       URING_WAKEUP_DATA)) {
+    LOG(L_ERROR) << "io_uring poll add wakeup signal";
+  }
+}
+
+void NetworkService::HandleUringCompletion(uint64 user_data, int32 res,
+    bool more, int32 buffer) {
+  // 检查是否有Wakeup事件
+  if (user_data == URING_WAKEUP_DATA) {
+    ResetWakeEvent();
+    fWait_ = false;
+    ArmUringWakeup();
+    return;
+  }
+  if (user_data == URING_CANCEL_DATA) {
+    return;
+  }
+  if (user_data & URING_OP_FLAG) {
+    HandleUringOp(static_cast<uint32>(user_data), res, more, buffer);
+    return;
+  }
+  SOCKET fd = static_cast<SOCKET>(user_data & 0xFFFFFFFF);
+  uint32 serial = static_cast<uint32>(user_data >> 32);
+  // Drop the completions of the cancelled or replaced requests
+  if (static_cast<size_t>(fd) >= dispatchers_.size()) {
+    return;
+  }
+  DispatcherSlot &slot = dispatchers_[fd];
+  if (!slot.poll_registered
+      || slot.poll_generation != serial
+      || !slot.dispatcher) {
+    return;
+  }
+  // The poll request is one shot, it is done now
+  slot.poll_registered = false;
+  EventDispatcher::Ptr disp = slot.dispatcher;
+  if (disp->CheckEventClose()) {
+    DetachDispatcher(disp);
+    return;
+  }
+  if (res < 0) {
+    if (!disp->armed_) {
+      return;
+    }
+    if (res == -ECANCELED || res == -EINTR) {
+      // 请求被内核取消或者打断，socket本身没有问题，重新登记
+      UpdateDispatcher(disp);
+      return;
+    }
+    // 和epoll一样把错误当作关闭报告给socket，不然它再也收不到事件
+    LOG_E(LS_ERROR, EN, -res) << "io_uring poll, socket = " << fd;
+    disp->armed_ = false;
+    disp->OnEvent(DE_CLOSE, -res);
+    return;
+  }
+  int errcode = 0;
+  uint32 ff = TranslatePollEvents(disp, fd, res, &errcode);
+  if (!disp->armed_) {
+    return;
+  }
+  if (ff == 0) {
+    // Not the event we are waiting for, poll again
+    UpdateDispatcher(disp);
+    return;
+  }
+  if (MergeReadyEvents(disp, ff, errcode)) {
+    return;
+  }
+  // Tell the descriptor about the event.
+  disp->armed_ = false;
+  disp->OnEvent(ff, errcode);
+}
+
+void NetworkService::SetupUringBuffers() {
+  if (!uring_->SetupBufferRing(URING_BUFFER_GROUP, URING_RECV_BUFFERS)) {
+    LOG(LS_INFO) << "io_uring provided buffers are not available, "
+                 << "sockets are polled";
+    return;
+  }
+  uring_buffers_.resize(URING_RECV_BUFFERS);
+  for (size_t i = 0; i < uring_buffers_.size(); i++) {
+    Block::Ptr block = Block::TakeBlock(URING_RECV_BUFFER_SIZE);
+    uring_->AddBuffer(block->buffer, static_cast<uint32>(block->capacity),
+                      static_cast<uint16>(i));
+    uring_buffers_[i] = block;
+  }
+  uring_->CommitBuffers();
+  uring_completion_ = true;
+}
+
+PhysicalSocket *NetworkService::UringIoSocket(
+  EventDispatcher::Ptr pdispatcher) {
+  if (!uring_completion_ || !pdispatcher->completion_io_) {
+    return NULL;
+  }
+  PhysicalSocket *socket =
+    dynamic_cast<PhysicalSocket *>(pdispatcher->disp_.get());
+  if (socket == NULL || socket->udp_) {
+    return NULL;
+  }
+  if (!socket->uring_io_) {
+    // 零拷贝发送要读错误队列中的通知，这样的socket继续用poll
+    if (socket->zerocopy_threshold_ != 0) {
+      return NULL;
+    }
+    socket->uring_io_.reset(new PhysicalSocket::UringIo());
+    socket->uring_io_->service = this;
+  }
+  // 停止之后或者属于别的NetworkService的socket用poll
+  if (!socket->UringIoActive() || socket->uring_io_->service != this) {
+    return NULL;
+  }
+  return socket;
+}
 
-  struct epoll_event listen_event = {0};
-  SOCKET s = signal_wakeup_->GetSocket();
-  listen_event.events = EPOLLIN;
-  listen_event.data.fd = s;
-  int ret = epoll_ctl(epoll_, EPOLL_CTL_ADD, s, &listen_event);
-  ASSERT(ret == 0);
-#endif
-#endif
+void NetworkService::SyncUringIo(EventDispatcher::Ptr pdispatcher,
+                                 PhysicalSocket *socket) {
+  PhysicalSocket::UringIo *io = socket->uring_io_.get();
+  if (pdispatcher->get_enable_events() & DE_ACCEPT) {
+    if (!io->accept_op && !io->error) {
+      SubmitUringAccept(socket);
+    }
+  } else if (!io->recv_op && !io->recv_paused
+             && !io->recv_eof && !io->error) {
+    SubmitUringRecv(socket);
+  }
+  QueueUringReady(pdispatcher, socket);
+  SubmitUring();
 }
 
-NetworkService::~NetworkService() {
-#ifdef WIN32
-  WSACloseEvent(socket_ev_);
-  WSACloseEvent(signal_wakeup_);
-#else
-  delete signal_wakeup_;
-#if 0 //defined(POSIX) && !defined(LITEOS)
-  close(epoll_);
-#endif
-#endif
-  ASSERT(dispatchers_.empty());
+void NetworkService::QueueUringReady(EventDispatcher::Ptr pdispatcher,
+                                     PhysicalSocket *socket) {
+  uint32 ff = socket->UringReadyEvents() & pdispatcher->enabled_events_;
+  if (ff == 0) {
+    return;
+  }
+  // 和Add()中的就绪事件一样，下一轮直接分发
+  pdispatcher->pending_events_ |= ff;
+  if (!pdispatcher->ready_queued_) {
+    pdispatcher->ready_queued_ = true;
+    ready_.push_back(pdispatcher);
+    // 和Add()一样不能只在sleeping_时唤醒，WakeUp自己会合并
+    WakeUp();
+  }
 }
 
-bool NetworkService::InitNetworkService() {
-  return true;
+uint32 NetworkService::NewUringOp(int type, PhysicalSocket *socket) {
+  uint32 id = 0;
+  if (!uring_free_ops_.empty()) {
+    id = uring_free_ops_.back();
+    uring_free_ops_.pop_back();
+  } else {
+    uring_ops_.push_back(new UringOp());
+    id = static_cast<uint32>(uring_ops_.size());
+  }
+  UringOp *op = uring_ops_[id - 1];
+  op->type = type;
+  op->fd = socket->s_;
+  op->socket = socket;
+  op->length = 0;
+  return id;
 }
 
-Socket::Ptr NetworkService::CreateSocket(int type) {
-  return CreateSocket(AF_INET, type);
+void NetworkService::FreeUringOp(uint32 id) {
+  UringOp *op = uring_ops_[id - 1];
+  op->socket = NULL;
+  op->blocks.clear();
+  op->iov.clear();
+  uring_free_ops_.push_back(id);
 }
 
-Socket::Ptr NetworkService::CreateSocket(int family, int type) {
-  PhysicalSocket::Ptr dispatcher(new PhysicalSocket());
-  if (dispatcher->Create(family, type)) {
-    //SOCKET sock = dispatcher->GetSocket();
-    //LOG(L_INFO) << "create socket \t" << (uint32)sock;
-    return dispatcher;
+void NetworkService::SubmitUringRecv(PhysicalSocket *socket) {
+  uint32 id = NewUringOp(URING_OP_RECV, socket);
+  if (!uring_->RecvMultishot(socket->s_, URING_BUFFER_GROUP,
+                             URING_OP_FLAG | id)) {
+    LOG(L_ERROR) << "io_uring recv, socket = " << socket->s_;
+    FreeUringOp(id);
+    return;
   }
-  return Socket::Ptr();
+  socket->uring_io_->recv_op = id;
 }
 
-Socket::Ptr NetworkService::WrapSocket(SOCKET s) {
-  PhysicalSocket::Ptr dispatcher(new PhysicalSocket(s));
-  if (dispatcher->SetSocketNonblock()) {
-    return dispatcher;
+void NetworkService::SubmitUringAccept(PhysicalSocket *socket) {
+  uint32 id = NewUringOp(URING_OP_ACCEPT, socket);
+  if (!uring_->AcceptMultishot(socket->s_, URING_OP_FLAG | id)) {
+    LOG(L_ERROR) << "io_uring accept, socket = " << socket->s_;
+    FreeUringOp(id);
+    return;
   }
-  return Socket::Ptr();
+  socket->uring_io_->accept_op = id;
 }
 
-void NetworkService::Add(EventDispatcher::Ptr pdispatcher) {
+int NetworkService::SubmitUringSend(PhysicalSocket *socket,
+                                    const BlocksPtr &blocks, size_t offset,
+                                    const struct iovec *iov, size_t count,
+                                    size_t total) {
   CritScope cs(&crit_);
-  SOCKET sock = pdispatcher->GetSocket();
+  PhysicalSocket::UringIo *io = socket->uring_io_.get();
+  if (io->error) {
+    socket->error_ = io->error;
+    return SOCKET_ERROR;
+  }
+  uint32 id = NewUringOp(URING_OP_SEND, socket);
+  UringOp *op = uring_ops_[id - 1];
+  op->iov.assign(iov, iov + count);
+  // 记住iov用到的Block，SendBlocks返回后调用者就会把它们删掉
+  size_t size = total;
+  for (BlocksPtr::const_iterator iter = blocks.begin();
+       iter != blocks.end() && size > 0; ++iter) {
+    if ((*iter)->size() > offset) {
+      op->blocks.push_back(*iter);
+      size -= _min(size, (*iter)->size() - offset);
+    }
+    offset = 0;
+  }
+  memset(&op->msg, 0, sizeof(op->msg));
+  op->msg.msg_iov = &op->iov[0];
+  op->msg.msg_iovlen = op->iov.size();
+  op->length = total;
+  if (!uring_->SendMsg(op->fd, &op->msg, URING_SEND_FLAGS,
+                       URING_OP_FLAG | id)) {
+    LOG(L_ERROR) << "io_uring sendmsg, socket = " << op->fd;
+    FreeUringOp(id);
+    socket->error_ = ENOBUFS;
+    return SOCKET_ERROR;
+  }
+  io->send_op = id;
+  socket->error_ = 0;
+  SubmitUring();
+  return static_cast<int>(total);
+}
 
-#if 0 //defined(POSIX) && !defined(LITEOS)
-  struct epoll_event listen_event = {0};
-  uint32 ff = pdispatcher->get_enable_events();
-  if (ff & (DE_READ | DE_ACCEPT)) {
-    listen_event.events |= EPOLLIN;
+void NetworkService::HandleUringOp(uint32 id, int32 res, bool more,
+                                   int32 buffer) {
+  if (id == 0 || id > uring_ops_.size()) {
+    return;
   }
-  if (ff & (DE_WRITE | DE_CONNECT)) {
-    listen_event.events |= EPOLLOUT;
+  UringOp *op = uring_ops_[id - 1];
+  SOCKET fd = op->fd;
+  int type = op->type;
+  PhysicalSocket *socket = op->socket;
+  PhysicalSocket::UringIo *io = socket ? socket->uring_io_.get() : NULL;
+  // 数据收在提供的Block中，马上换一个新的Block给内核
+  Block::Ptr block;
+  if (buffer >= 0 && static_cast<size_t>(buffer) < uring_buffers_.size()) {
+    block = uring_buffers_[buffer];
+    Block::Ptr fresh = Block::TakeBlock(URING_RECV_BUFFER_SIZE);
+    uring_->AddBuffer(fresh->buffer, static_cast<uint32>(fresh->capacity),
+                      static_cast<uint16>(buffer));
+    uring_->CommitBuffers();
+    uring_buffers_[buffer] = fresh;
   }
 
-  listen_event.data.fd = sock;
-  int ret = epoll_ctl(epoll_, EPOLL_CTL_MOD, sock, &listen_event);
-  if (ret != 0) {
-    if (errno == ENOENT) {
-      ret = epoll_ctl(epoll_, EPOLL_CTL_ADD, sock, &listen_event);
-      if (ret != 0) {
-        LOG_E(LS_ERROR, EN, errno) << "epoll add";
+  if (type == URING_OP_SEND) {
+    if (io != NULL && (res == -EAGAIN || res == -EINTR
+                       || (res > 0 && static_cast<size_t>(res) < op->length))) {
+      // 只发送了一部分，剩下的接着发
+      size_t sent = res > 0 ? res : 0;
+      op->length -= sent;
+      std::vector<struct iovec>::iterator iter = op->iov.begin();
+      while (sent >= iter->iov_len) {
+        sent -= iter->iov_len;
+        ++iter;
+      }
+      op->iov.erase(op->iov.begin(), iter);
+      op->iov[0].iov_base = static_cast<uint8 *>(op->iov[0].iov_base) + sent;
+      op->iov[0].iov_len -= sent;
+      op->msg.msg_iov = &op->iov[0];
+      op->msg.msg_iovlen = op->iov.size();
+      if (uring_->SendMsg(fd, &op->msg, URING_SEND_FLAGS,
+                          URING_OP_FLAG | id)) {
+        return;
+      }
+      res = -ENOBUFS;
+    }
+    FreeUringOp(id);
+    if (io == NULL) {
+      return;
+    }
+    io->send_op = 0;
+    if (res < 0 && !io->error) {
+      io->error = -res;
+    }
+  } else {
+    if (!more) {
+      FreeUringOp(id);
+      if (io != NULL) {
+        if (type == URING_OP_ACCEPT) {
+          io->accept_op = 0;
+        } else {
+          io->recv_op = 0;
+        }
+      }
+    }
+    if (io == NULL) {
+      if (type == URING_OP_ACCEPT && res >= 0) {
+        ::closesocket(res);
+      }
+      return;
+    }
+    if (res == -EINVAL) {
+      // linux 6.0之前没有multishot recv，改回用poll
+      LOG(LS_WARNING) << "io_uring multishot requests are not supported, "
+                      << "poll the sockets instead";
+      uring_completion_ = false;
+      io->stopped = true;
+      if (static_cast<size_t>(fd) < dispatchers_.size()
+          && dispatchers_[fd].dispatcher
+          && dispatchers_[fd].dispatcher->disp_.get() == socket) {
+        UpdateDispatcher(dispatchers_[fd].dispatcher);
+      }
+      return;
+    }
+    // 内核结束了multishot请求(例如提供的Block用完了)，重新提交
+    bool rearm = !more;
+    if (type == URING_OP_ACCEPT) {
+      if (res >= 0) {
+        io->accepted.push_back(res);
+      } else if (res != -ECANCELED) {
+        io->error = -res;
       }
     } else {
-      LOG_E(LS_ERROR, EN, errno) << "epoll mod";
+      if (res > 0 && block) {
+        block->SetSize(res);
+        io->recv_blocks.push_back(block);
+        io->recv_size += res;
+      } else if (res == 0) {
+        io->recv_eof = true;
+      } else if (res != -ENOBUFS && res != -ECANCELED) {
+        io->error = -res;
+      }
+      if (io->recv_size >= URING_RECV_QUEUE_LIMIT
+          && io->recv_op && !io->recv_paused) {
+        // 读得太慢，暂停接收，Recv取走一半之后再开始
+        io->recv_paused = true;
+        uring_->Cancel(URING_OP_FLAG | io->recv_op, URING_CANCEL_DATA);
+      }
+    }
+    if (rearm && !io->stopped && !io->error) {
+      if (type == URING_OP_ACCEPT) {
+        if (!io->accept_op) {
+          SubmitUringAccept(socket);
+        }
+      } else if (!io->recv_op && !io->recv_paused && !io->recv_eof) {
+        SubmitUringRecv(socket);
+      }
     }
   }
-#endif
 
-  // Prevent duplicates. This can cause dead dispatchers to stick around.
-  DispatcherList::iterator pos = std::find(dispatchers_.begin(),
-                                 dispatchers_.end(),
-                                 pdispatcher);
-  if (pos != dispatchers_.end()) {
-    //LOG(L_ERROR) << "socket already exist can't add \t" << (uint32)sock;
+  if (!io->stopped && static_cast<size_t>(fd) < dispatchers_.size()) {
+    EventDispatcher::Ptr disp = dispatchers_[fd].dispatcher;
+    if (disp && disp->armed_ && disp->disp_.get() == socket
+        && !disp->CheckEventClose()) {
+      QueueUringReady(disp, socket);
+    }
+  }
+}
+
+void NetworkService::ResumeUringRecv(PhysicalSocket *socket) {
+  CritScope cs(&crit_);
+  PhysicalSocket::UringIo *io = socket->uring_io_.get();
+  io->recv_paused = false;
+  // 取消还没有完成时，请求结束后重新提交
+  if (!io->recv_op && !io->stopped && !io->recv_eof && !io->error) {
+    SubmitUringRecv(socket);
+    SubmitUring();
+  }
+}
+
+void NetworkService::CancelUringIo(PhysicalSocket *socket, bool wait) {
+  CritScope cs(&crit_);
+  PhysicalSocket::UringIo *io = socket->uring_io_.get();
+  io->stopped = true;
+  if (io->accept_op) {
+    uring_->Cancel(URING_OP_FLAG | io->accept_op, URING_CANCEL_DATA);
+  }
+  if (io->recv_op) {
+    uring_->Cancel(URING_OP_FLAG | io->recv_op, URING_CANCEL_DATA);
+  }
+  if (!wait) {
+    uint32 ops[] = {io->accept_op, io->recv_op, io->send_op};
+    for (int i = 0; i < ARRAY_SIZE(ops); i++) {
+      if (ops[i]) {
+        uring_ops_[ops[i] - 1]->socket = NULL;
+      }
+    }
+    io->accept_op = 0;
+    io->recv_op = 0;
+    io->send_op = 0;
+    // 排队的请求马上交给内核，它们拿到文件的引用之后fd才能关闭，否则
+    // 被复用的fd会收到别的连接的请求
+    uring_->Submit();
     return;
   }
-  //LOG(L_INFO) << "Add socket \t" << (uint32)sock;
-  dispatchers_.push_back(pdispatcher);
+  while (io->accept_op || io->recv_op || io->send_op) {
+    int ret = uring_->Wait(uring_->Flush(), kForever);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      LOG_E(LS_ERROR, EN, errno) << "io_uring wait";
+      break;
+    }
+    uint64 user_data = 0;
+    int32 res = 0;
+    bool more = false;
+    int32 buffer = -1;
+    while (uring_->PopCompletion(&user_data, &res, &more, &buffer)) {
+      if ((user_data & URING_OP_FLAG) && user_data != URING_WAKEUP_DATA
+          && user_data != URING_CANCEL_DATA) {
+        HandleUringOp(static_cast<uint32>(user_data), res, more, buffer);
+        continue;
+      }
+      UringCompletion completion = {user_data, res, more, buffer};
+      uring_deferred_.push_back(completion);
+    }
+  }
 }
+#endif  // VZ_HAVE_IO_URING
 
-void NetworkService::Remove(EventDispatcher::Ptr pdispatcher) {
+void NetworkService::PostFlush(Flushable::Ptr flushable) {
+  flushes_.push_back(flushable);
+}
+
+void NetworkService::RunFlushes() {
+  if (flushes_.empty()) {
+    return;
+  }
+  std::vector<Flushable::Ptr> flushes;
+  flushes.swap(flushes_);
+  for (size_t i = 0; i < flushes.size(); i++) {
+    flushes[i]->Flush();
+  }
+}
+
+bool NetworkService::HasReadyDispatchers() {
   CritScope cs(&crit_);
-  SOCKET sock = pdispatcher->GetSocket();
-  DispatcherList::iterator pos = std::find(dispatchers_.begin(),
-                                 dispatchers_.end(),
-                                 pdispatcher);
-  if (pos != dispatchers_.end()) {
-    pdispatcher->DisableEvent();
-#if 0 //defined(POSIX) && !defined(LITEOS)
-    struct epoll_event listen_event = {0};
-    int ret = epoll_ctl(epoll_, EPOLL_CTL_DEL, sock, &listen_event);
-    if (ret != 0) {
-      LOG(L_ERROR) << "Can't remove socket form epoll, err = " << errno;
+  return !ready_.empty();
+}
+
+void NetworkService::RunReadyDispatchers() {
+  if (ready_.empty()) {
+    return;
+  }
+  std::vector<EventDispatcher::Ptr> ready;
+  ready.swap(ready_);
+  for (size_t i = 0; i < ready.size(); i++) {
+    EventDispatcher::Ptr disp = ready[i];
+    disp->ready_queued_ = false;
+    if (!disp->armed_ || disp->CheckEventClose()) {
+      continue;
     }
-#endif
+    uint32 ff = disp->pending_events_ & disp->enabled_events_;
+    if (ff == 0) {
+      // 等待的事件已经变了，交回给内核
+      UpdateDispatcher(disp);
+      continue;
+    }
+    disp->armed_ = false;
+    disp->OnEvent(ff, 0);
+  }
+}
+
+bool NetworkService::MergeReadyEvents(EventDispatcher::Ptr disp,
+                                      uint32 ff, int err) {
+  // 出错和关闭马上分发
+  if (!disp->ready_queued_ || err || (ff & DE_CLOSE)) {
+    return false;
   }
+  disp->pending_events_ |= ff;
+  return true;
+}
+
+void NetworkService::OnMessageDispatched() {
+  RunFlushes();
 }
 
 #ifdef WIN32
 bool NetworkService::Wait(int cmsWait, bool process_io) {
+  // 还有没执行的Flush时不阻塞
+  RunFlushes();
+  if (!flushes_.empty()) {
+    cmsWait = 0;
+  }
   int cmsTotal = cmsWait;
   int cmsElapsed = 0;
   uint32 msStart = Time();
@@ -916,6 +2571,10 @@ bool NetworkService::Wait(int cmsWait, bool process_io) {
       }
       // Reset the network event until new activity occurs
       WSAResetEvent(socket_ev_);
+      RunFlushes();
+      if (!flushes_.empty()) {
+        fWait_ = false;
+      }
     }
 
     // Break?
@@ -941,8 +2600,54 @@ void NetworkService::ResetWakeEvent() {
 }
 
 #else
-#ifdef POSIX //LITEOS
 bool NetworkService::Wait(int cmsWait, bool process_io) {
+  // 先执行处理消息时推迟的Flush，还有没执行的Flush或者有就绪的dispatcher
+  // 时不阻塞
+  RunFlushes();
+  {
+    CritScope cs(&crit_);
+    if (!flushes_.empty() || !ready_.empty()) {
+      cmsWait = 0;
+    }
+  }
+  bool res = false;
+  switch (backend_) {
+#ifdef VZ_HAVE_IO_URING
+  case BACKEND_IO_URING:
+    res = WaitUring(cmsWait);
+    break;
+#endif
+#ifdef VZ_HAVE_EPOLL
+  case BACKEND_EPOLL:
+    res = WaitEpoll(cmsWait);
+    break;
+#endif
+  default:
+    res = WaitSelect(cmsWait);
+    break;
+  }
+  // Returning from Wait answers all the WakeUp called so far, the caller
+  // checks its messages before the next Wait.
+  AtomicOps::Store(&wakeup_pending_, 0);
+  return res;
+}
+
+bool NetworkService::EnterSleep() {
+  // 和WakeUp的顺序相反：先标记睡眠再检查wakeup_pending_，两边至少有一方
+  // 能看到另一方的修改，WakeUp不会丢
+  AtomicOps::Store(&sleeping_, 1);
+  if (AtomicOps::Load(&wakeup_pending_) != 0) {
+    AtomicOps::Store(&sleeping_, 0);
+    return false;
+  }
+  return true;
+}
+
+void NetworkService::LeaveSleep() {
+  AtomicOps::Store(&sleeping_, 0);
+}
+
+bool NetworkService::WaitSelect(int cmsWait) {
   // Calculate timing information
   struct timeval *ptvWait = NULL;
   struct timeval tvWait;
@@ -993,12 +2698,17 @@ bool NetworkService::Wait(int cmsWait, bool process_io) {
     {
       CritScope cr(&crit_);
 
-      for (DispatcherList::iterator iter = dispatchers_.begin();
-           iter != dispatchers_.end();) {
-        EventDispatcher::Ptr disp = *iter;
+      for (size_t i = 0; i < dispatchers_.size(); i++) {
+        EventDispatcher::Ptr disp = dispatchers_[i].dispatcher;
+        if (!disp) {
+          continue;
+        }
         SOCKET s = disp->GetSocket();
         if (s == INVALID_SOCKET || disp->CheckEventClose()) {
-          dispatchers_.erase(iter++);
+          DetachDispatcher(disp);
+          continue;
+        }
+        if (!disp->armed_) {
           continue;
         }
         if (s > fdmax) {
@@ -1011,27 +2721,34 @@ bool NetworkService::Wait(int cmsWait, bool process_io) {
         if (ff & (DE_WRITE | DE_CONNECT)) {
           FD_SET(s, &fdsWrite);
         }
-        iter++;
       }
     }
     // Wait then call handlers as appropriate
     // < 0 means error
     // 0 means timeout
     // > 0 means count of descriptors ready
-    int n = select(fdmax + 1, &fdsRead, &fdsWrite, NULL, ptvWait);
+    struct timeval tvZero = {0, 0};
+    bool sleep = EnterSleep();
+    if (!sleep) {
+      // Poll the ready sockets once and return to the messages
+      fWait_ = false;
+    }
+    int n = select(fdmax + 1, &fdsRead, &fdsWrite, NULL,
+                   sleep ? ptvWait : &tvZero);
+    LeaveSleep();
 
     // If error, return error.
     if (n < 0) {
       if (errno != EINTR) {
         LOG_E(LS_ERROR, EN, errno) << "select";
-        LOG(L_INFO) << "Socket number: " << dispatchers_.size() << "max fd: " << fdmax;
+        LOG(L_INFO) << "Socket number: " << dispatcher_count_ << "max fd: " << fdmax;
         return false;
       }
       // Else ignore the error and keep going. If this EINTR was for one of the
       // signals managed by this PhysicalSocketServer, the
       // PosixSignalDeliveryDispatcher will be in the signaled state in the next
       // iteration.
-    } else if (n == 0) {
+    } else if (n == 0 && !HasReadyDispatchers()) {
       // If timeout, return success
       return true;
     } else {
@@ -1052,17 +2769,20 @@ bool NetworkService::Wait(int cmsWait, bool process_io) {
         count += 1;
       }
 
-      for (DispatcherList::iterator iter = dispatchers_.begin();
-           (count < n) && (iter != dispatchers_.end());) {
+      size_t table_size = _min(dispatchers_.size(),
+                               static_cast<size_t>(fdmax + 1));
+      for (size_t i = 0; (count < n) && (i < table_size); i++) {
         // 检查网络是否有事件
-        EventDispatcher::Ptr disp = *iter;
+        EventDispatcher::Ptr disp = dispatchers_[i].dispatcher;
+        if (!disp || !disp->armed_) {
+          continue;
+        }
         SOCKET fd                 = disp->GetSocket();
         uint32 ff                 = 0;
         int errcode               = 0;
 
         // Skip invalid item.
         if (fd == INVALID_SOCKET || disp->CheckEventClose()) {
-          iter++;
           continue;
         }
         // Reap any error code, which can be signaled through reads or writes.
@@ -1104,13 +2824,19 @@ bool NetworkService::Wait(int cmsWait, bool process_io) {
 
         // Tell the descriptor about the event.
         if (ff != 0) {
-          dispatchers_.erase(iter++);
-          disp->OnEvent(ff, errcode);
           count += 1;
-        } else {
-          iter++;
+          if (MergeReadyEvents(disp, ff, errcode)) {
+            continue;
+          }
+          disp->armed_ = false;
+          disp->OnEvent(ff, errcode);
         }
       }
+      RunReadyDispatchers();
+      RunFlushes();
+      if (!flushes_.empty() || !ready_.empty()) {
+        fWait_ = false;
+      }
     }
 
     // Recalc the time remaining to wait. Doing it here means it doesn't get
@@ -1135,144 +2861,191 @@ bool NetworkService::Wait(int cmsWait, bool process_io) {
   }
   return true;
 }
-#elif 0 //POSIX
-// 目前Dispatcher管理方案导致Epoll方案性能低下，暂时关闭
-bool NetworkService::Wait(int cmsWait, bool process_io) {
+
+#ifdef VZ_HAVE_EPOLL
+#define MAX_EPOLL_EVENTS 128
+
+bool NetworkService::WaitEpoll(int cmsWait) {
   // Calculate timing information
-  struct timeval tvStop;
   int wait_time = cmsWait;
-  if (wait_time != kForever) {
-    // Calculate when to return in a timeval
-    gettimeofday(&tvStop, NULL);
-    tvStop.tv_sec += wait_time / 1000;
-    tvStop.tv_usec += (wait_time % 1000) * 1000;
-    if (tvStop.tv_usec >= 1000000) {
-      tvStop.tv_usec -= 1000000;
-      tvStop.tv_sec += 1;
-    }
-  }
-
-  for (DispatcherList::iterator iter = dispatchers_.begin();
-       iter != dispatchers_.end();) {
-    EventDispatcher::Ptr disp = *iter;
-    SOCKET s = disp->GetSocket();
-    if (s == INVALID_SOCKET || disp->CheckEventClose()) {
-      dispatchers_.erase(iter++);
-      continue;
-    }
-    iter++;
+  uint32 msStop = 0;
+  if (cmsWait != kForever) {
+    msStop = TimeAfter(cmsWait);
   }
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  SOCKET wake_socket = signal_wakeup_->GetSocket();
 
   fWait_ = true;
   while (fWait_) {
-    int size = 64; //dispatchers_.size() * 4;
-    struct epoll_event *event_buff = new struct epoll_event [64];
-    boost::shared_ptr<struct epoll_event> epoll_events(event_buff);
-
     // Wait then call handlers as appropriate
     // < 0 means error
     // 0 means timeout
     // > 0 means count of descriptors ready
-    int event_num = epoll_wait(epoll_, event_buff, 64, wait_time);
+    bool sleep = EnterSleep();
+    if (!sleep) {
+      // Poll the ready sockets once and return to the messages
+      fWait_ = false;
+    }
+    int event_num = epoll_wait(epoll_, events, MAX_EPOLL_EVENTS,
+                               sleep ? wait_time : 0);
+    LeaveSleep();
     // If error, return error.
     if (event_num < 0) {
       if (errno != EINTR) {
         LOG_E(LS_ERROR, EN, errno) << "epoll_wait";
         return false;
       }
-      // Else ignore the error and keep going. If this EINTR was for one of the
-      // signals managed by this PhysicalSocketServer, the
-      // PosixSignalDeliveryDispatcher will be in the signaled state in the next
-      // iteration.
-    } else if (event_num == 0) {
+      // Else ignore the error and keep going.
+    } else if (event_num == 0 && !HasReadyDispatchers()) {
       // If timeout, return success
       return true;
     } else {
-      for (int i=0; i<event_num; i++) {
+      CritScope cr(&crit_);
+      dispatching_ = true;
+      for (int i = 0; i < event_num; i++) {
+        SOCKET fd = static_cast<SOCKET>(events[i].data.u64 & 0xFFFFFFFF);
+        uint32 generation = static_cast<uint32>(events[i].data.u64 >> 32);
+        uint32 revents = events[i].events;
         // 检查是否有Wakeup事件
-        int fd = event_buff[i].data.fd;
-        SOCKET wake_socket = signal_wakeup_->GetSocket();
-        if (wake_socket == fd) {
+        if (fd == wake_socket) {
           ResetWakeEvent();
           fWait_ = false;
-        } else {
-          EventDispatcher::Ptr disp;
-          SOCKET s;
-          DispatcherList::iterator iter;
-          for (iter = dispatchers_.begin(); iter != dispatchers_.end(); iter++) {
-            disp = *iter;
-            s = disp->GetSocket();
-            if (s == fd) {
-              break;
-            }
-          }
+          continue;
+        }
+        // Drop the events belong to the previous owner of this fd
+        if (static_cast<size_t>(fd) >= dispatchers_.size()
+            || dispatchers_[fd].generation != generation
+            || !dispatchers_[fd].dispatcher) {
+          continue;
+        }
+        EventDispatcher::Ptr disp = dispatchers_[fd].dispatcher;
+        if (disp->CheckEventClose()) {
+          DetachDispatcher(disp);
+          continue;
+        }
+        int errcode = 0;
+        uint32 ff = TranslatePollEvents(disp, fd, revents, &errcode);
+        if (ff == 0 || !disp->armed_) {
+          // Nobody is waiting for this fd, a level triggered hang up would
+          // wake us up forever. Drop it from epoll until the next Add().
+          DispatcherSlot &slot = dispatchers_[fd];
+          struct epoll_event listen_event = {0};
+          epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, &listen_event);
+          slot.poll_registered = false;
+          continue;
+        }
+        if (MergeReadyEvents(disp, ff, errcode)) {
+          continue;
+        }
+        // Tell the descriptor about the event.
+        disp->armed_ = false;
+        disp->OnEvent(ff, errcode);
+      }
+      // 就绪队列和Flush中的掩码修改也一起提交
+      RunReadyDispatchers();
+      RunFlushes();
+      dispatching_ = false;
+      FlushPendingUpdates();
+      if (!flushes_.empty() || !ready_.empty()) {
+        fWait_ = false;
+      }
+    }
 
-          uint32 enable_event = disp->get_enable_events();
-          uint32 ff   = 0;
-          int errcode = 0;
-          // Reap any error code, which can be signaled through reads or writes.
-          if ((event_buff[i].events & EPOLLIN) || (event_buff[i].events & EPOLLERR)) {
-            socklen_t len = sizeof(errcode);
-            ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &errcode, &len);
-          }
+    // Recalc the time remaining to wait.
+    if (cmsWait != kForever) {
+      wait_time = _max(0, TimeUntil(msStop));
+    }
+  }
+  return true;
+}
+#endif  // VZ_HAVE_EPOLL
 
-          // Check readable descriptors. If we're waiting on an accept, signal
-          // that. Otherwise we're waiting for data, check to see if we're
-          // readable or really closed.
-          // TODO: Only peek at TCP descriptors.
-          if ((event_buff[i].events & EPOLLIN)
-              && (enable_event & (DE_READ | DE_ACCEPT))) {
-            if (enable_event & DE_ACCEPT) {
-              ff |= DE_ACCEPT;
-            } else if (errcode || disp->CheckEventClose()) {
-              ff |= DE_CLOSE;
-            } else {
-              ff |= DE_READ;
-            }
-          }
+#ifdef VZ_HAVE_IO_URING
+bool NetworkService::WaitUring(int cmsWait) {
+  // Calculate timing information
+  int wait_time = cmsWait;
+  uint32 msStop = 0;
+  if (cmsWait != kForever) {
+    msStop = TimeAfter(cmsWait);
+  }
 
-          // Check writable descriptors. If we're waiting on a connect, detect
-          // success versus failure by the reaped error code.
-          if ((event_buff[i].events & EPOLLOUT)
-              && (enable_event & (DE_WRITE | DE_CONNECT))) {
-            if (enable_event & DE_CONNECT) {
-              if (!errcode) {
-                ff |= DE_CONNECT;
-              } else {
-                ff |= DE_CLOSE;
-              }
-            } else {
-              ff |= DE_WRITE;
-            }
-          }
+  fWait_ = true;
+  while (fWait_) {
+    // 所有排队的请求和等待只需要一次系统调用
+    uint32 to_submit = 0;
+    {
+      CritScope cr(&crit_);
+      to_submit = uring_->Flush();
+      uring_waiting_ = true;
+    }
+    bool sleep = EnterSleep();
+    if (!sleep) {
+      // Poll the ready sockets once and return to the messages
+      fWait_ = false;
+    }
+    int ret = uring_->Wait(to_submit, sleep ? wait_time : 0);
+    int wait_error = errno;
+    LeaveSleep();
+
+    CritScope cr(&crit_);
+    uring_waiting_ = false;
+    if (ret < 0 && wait_error != EINTR
+        && wait_error != EAGAIN && wait_error != EBUSY) {
+      LOG_E(LS_ERROR, EN, wait_error) << "io_uring wait";
+      return false;
+    }
 
-          dispatchers_.erase(iter);
-          // Tell the descriptor about the event.
-          disp->OnEvent(ff, errcode);
+    dispatching_ = true;
+    uint64 user_data = 0;
+    int32 res = 0;
+    bool more = false;
+    int32 buffer = -1;
+    for (;;) {
+      // CancelUringIo等待时收下的完成事件比队列中的早，先处理
+      if (!uring_deferred_.empty()) {
+        std::vector<UringCompletion> deferred;
+        deferred.swap(uring_deferred_);
+        for (size_t i = 0; i < deferred.size(); i++) {
+          HandleUringCompletion(deferred[i].user_data, deferred[i].res,
+                                deferred[i].more, deferred[i].buffer);
         }
+        continue;
       }
+      if (!uring_->PopCompletion(&user_data, &res, &more, &buffer)) {
+        break;
+      }
+      HandleUringCompletion(user_data, res, more, buffer);
+    }
+    // 就绪队列和Flush中的掩码修改也一起提交
+    RunReadyDispatchers();
+    RunFlushes();
+    dispatching_ = false;
+    FlushPendingUpdates();
+    if (!flushes_.empty() || !ready_.empty()) {
+      return true;
     }
 
-    // Recalc the time remaining to wait. Doing it here means it doesn't get
-    // calced twice the first time through the loop
-    if (wait_time != kForever) {
-      wait_time = 0;
-      struct timeval tvT;
-      gettimeofday(&tvT, NULL);
-      if ((tvStop.tv_sec > tvT.tv_sec)
-          || ((tvStop.tv_sec == tvT.tv_sec)
-              && (tvStop.tv_usec > tvT.tv_usec))) {
-        wait_time = (tvStop.tv_sec - tvT.tv_sec)*1000
-                    + (tvStop.tv_usec - tvT.tv_usec)/1000;
-      } else {
+    // Recalc the time remaining to wait.
+    if (cmsWait != kForever) {
+      wait_time = TimeUntil(msStop);
+      if (wait_time <= 0) {
+        // If timeout, return success
+        return true;
       }
     }
   }
   return true;
 }
-#endif
+#endif  // VZ_HAVE_IO_URING
 
 void NetworkService::WakeUp() {
+  // 已经有没被处理的WakeUp，或者循环没有阻塞，它在阻塞前会看到
+  // wakeup_pending_，都不需要写唤醒fd
+  if (AtomicOps::Exchange(&wakeup_pending_, 1) != 0
+      || AtomicOps::Load(&sleeping_) == 0) {
+    AtomicOps::Increment(&elided_wakeups_);
+    return;
+  }
   signal_wakeup_->SignalWakeup();
 }
 
@@ -1287,6 +3060,7 @@ EventDispatcher::Ptr NetworkService::CreateDispEvent(Socket::Ptr socket,
   EventDispatcher::Ptr event_disp(
     new EventDispatcher(
       boost::dynamic_pointer_cast<PhysicalSocket>(socket), enabled_events));
+  event_disp->service_ = this;
   return event_disp;
 }
 
@@ -29,6 +29,7 @@
 #define EVENTSERVICES_NET_NETWORKSERVICE_H__
 
 #include <vector>
+#include <deque>
 #include <map>
 
 #include "eventservice/base/asyncfile.h"
@@ -37,7 +38,12 @@
 #include "eventservice/base/criticalsection.h"
 #include "eventservice/net/networktinterface.h"
 #include "eventservice/event/signalevent.h"
+#include "eventservice/net/iouring.h"
 
+// Linux使用epoll等待网络事件，LiteOS只支持select
+#if defined(POSIX) && !defined(LITEOS)
+#define VZ_HAVE_EPOLL 1
+#endif
 
 namespace vzes {
 
@@ -52,8 +58,16 @@ class Dispatcher {
   virtual bool CheckSignalClose() = 0;
   virtual void OnEvent(uint32 ff) = 0;
 };
+// 推迟到这一轮事件处理结束时执行的操作，见NetworkService::PostFlush
+class Flushable {
+ public:
+  typedef boost::shared_ptr<Flushable> Ptr;
+  virtual ~Flushable() {}
+  virtual void Flush() = 0;
+};
 ////////////////////////////////////////////////////////////////////////////////
 
+class NetworkService;
 
 class PhysicalSocket : public Socket,
   public sigslot::has_slots<>,
@@ -74,13 +88,27 @@ class PhysicalSocket : public Socket,
   virtual int Connect(const SocketAddress& addr);
   virtual int Send(const void *pv, size_t cb);
   virtual int Send(MemBuffer::Ptr buffer);
+  virtual int SendBlocks(const BlocksPtr &blocks, size_t offset,
+                         size_t max_size);
+  virtual bool SetZeroCopy(size_t threshold);
   virtual int SendTo(const void* buffer,
                      size_t length,
                      const SocketAddress& addr);
+  virtual int SendTo(MemBuffer::Ptr buffer, const SocketAddress& addr);
+  virtual int SendToBatch(const Datagrams &datagrams, size_t offset);
   virtual int Recv(void* buffer, size_t length);
   virtual int Recv(MemBuffer::Ptr buffer);
+  virtual int Peek(void* buffer, size_t length);
+  virtual void SetRecvSize(size_t size) {
+    recv_size_ = size;
+  }
+  virtual void SetRecvBudget(size_t budget) {
+    recv_budget_ = budget;
+  }
   virtual int RecvFrom(void* buffer, size_t length, SocketAddress *out_addr);
   virtual int RecvFrom(MemBuffer::Ptr buffer, SocketAddress *out_addr);
+  virtual int RecvFromBatch(Datagrams *datagrams, size_t count);
+  virtual void SetMaxDatagramSize(size_t size);
   virtual int Listen(int backlog);
   virtual int Close();
   virtual int GetError() const {
@@ -112,10 +140,25 @@ class PhysicalSocket : public Socket,
   //
   bool SetSocketNonblock();
 
+  // io_uring完成模式下已经收进来还没有被Recv取走的数据量
+  size_t QueuedRecvSize() const;
+  // 还有交给io_uring但是没有发送完的数据
+  bool SendPending() const;
+  // 停止io_uring的接收请求并等它们结束，之后socket改为普通的收发，
+  // 已经收进来的数据依然先由Recv/Peek返回。用于把socket交给别的模块
+  void StopUringIo();
+
  protected:
+  friend class NetworkService;
   // void OnResolveResult(SignalThread* thread);
 
   void UpdateLastError();
+  int RecvResult(int received);
+  void PinZeroCopyBlocks(const BlocksPtr &blocks, size_t offset, size_t size);
+  void ReapZeroCopy();
+  size_t PrepareRecvSlots(size_t count);
+  bool TakeDatagram(size_t slot, size_t length, bool truncated,
+                    MemBuffer::Ptr buffer);
   static int TranslateOption(Option opt, int* slevel, int* sopt);
 
   SOCKET s_;
@@ -123,6 +166,61 @@ class PhysicalSocket : public Socket,
   bool udp_;
   int error_;
   ConnState state_;
+  size_t recv_size_;
+  size_t recv_budget_;
+  // 用MSG_ZEROCOPY发送的Block，内核通知发送完成之前不能回收
+  struct ZeroCopySend {
+    uint32    id;
+    BlocksPtr blocks;
+  };
+  size_t zerocopy_threshold_;
+  uint32 zerocopy_next_id_;
+  std::list<ZeroCopySend> zerocopy_sends_;
+  // UDP接收区，每个数据报占slot_blocks_个Block，数据直接收到Block中，
+  // 只有交出去的Block才需要重新从池中取
+  size_t max_datagram_size_;
+  size_t slot_blocks_;
+  std::vector<Block::Ptr> recv_slots_;
+#ifdef VZ_HAVE_IO_URING
+  // io_uring完成模式：NetworkService的multishot accept/recv把新连接和数据
+  // 直接收到这里，Accept/Recv从这里取，SendBlocks把数据交给SENDMSG请求。
+  // 只在所属NetworkService的锁内或者它的线程中访问
+  struct UringIo {
+    UringIo()
+      : service(NULL), stopped(false),
+        accept_op(0), recv_op(0), send_op(0),
+        recv_size(0), recv_eof(false), recv_paused(false), error(0) {
+    }
+    NetworkService *service;
+    // StopUringIo之后不再提交新的请求
+    bool   stopped;
+    // 进行中的请求，0表示没有
+    uint32 accept_op;
+    uint32 recv_op;
+    uint32 send_op;
+    std::deque<SOCKET> accepted;
+    BlocksPtr recv_blocks;
+    size_t recv_size;
+    bool   recv_eof;
+    // 收进来的数据太多，暂停接收直到Recv取走一半
+    bool   recv_paused;
+    // 监听socket: 下一次Accept返回的错误；连接: 收发出错，不再可用
+    int    error;
+  };
+  scoped_ptr<UringIo> uring_io_;
+
+  bool UringIoActive() const {
+    return uring_io_ && uring_io_->service && !uring_io_->stopped;
+  }
+  bool UringRecvQueued() const;
+  // 就绪的DE_XXX事件
+  uint32 UringReadyEvents() const;
+  int RecvUringEnd();
+  int RecvUring(MemBuffer::Ptr buffer);
+  int RecvUring(void *buffer, size_t length, bool peek);
+  Socket::Ptr AcceptUring(SocketAddress *out_addr);
+  void ResumeUringRecv();
+#endif
   // AsyncResolver* resolver_;
 
 #ifdef _DEBUG
@@ -130,8 +228,6 @@ class PhysicalSocket : public Socket,
 #endif  // _DEBUG;
 };
 
-class NetworkService;
-
 class EventDispatcher : public boost::noncopyable,
   public boost::enable_shared_from_this<EventDispatcher> {
  public:
@@ -151,6 +247,15 @@ class EventDispatcher : public boost::noncopyable,
   uint32 get_enable_events() const {
     return enabled_events_;
   }
+  // 事件处理时没有把就绪的数据处理完(比如用完了读写预算)，下次Add()之后
+  // 在下一轮直接分发这些事件，不再等内核通知
+  void SetPendingEvents(uint32 event_type);
+  // io_uring后端下socket不再等poll通知，用multishot accept/recv收新连接
+  // 和数据，用sendmsg请求发送，请求完成时分发事件。只用于连接和监听的
+  // TCP socket，要在第一次Add()之前调用，其他后端忽略
+  void EnableCompletionIo() {
+    completion_io_ = true;
+  }
  protected:
   SOCKET GetSocket();
   bool CheckEventClose();
@@ -163,6 +268,21 @@ class EventDispatcher : public boost::noncopyable,
   Dispatcher::Ptr disp_;
   uint32  enabled_events_;
   bool  event_close_;
+  // The following members are owned by NetworkService and only touched
+  // under its lock.
+  NetworkService *service_;
+  // Add() arms the dispatcher, delivering an event disarms it again, this
+  // keeps the one shot semantic of the select loop.
+  bool    armed_;
+  // 在NetworkService分发表中占用的fd，socket关闭之后依然可以用它注销
+  SOCKET  table_fd_;
+  bool    update_pending_;
+  // SetPendingEvents记录的还没有处理的就绪事件
+  uint32  pending_events_;
+  // 在NetworkService的就绪队列中
+  bool    ready_queued_;
+  // 见EnableCompletionIo()
+  bool    completion_io_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -170,10 +290,27 @@ class EventDispatcher : public boost::noncopyable,
 class NetworkService : public SocketServer {
  public:
   typedef boost::shared_ptr<NetworkService> Ptr;
+  // 等待网络事件的方式，系统不支持时依次退回到epoll和select
+  enum BackendType {
+    BACKEND_SELECT,
+    BACKEND_EPOLL,
+    BACKEND_IO_URING
+  };
+  // The backend used by the NetworkService created afterwards, such as the
+  // default socket server of a new Thread. BACKEND_EPOLL by default.
+  static void SetDefaultBackend(BackendType backend);
+  static BackendType DefaultBackend();
+
   NetworkService();
+  explicit NetworkService(BackendType backend);
   virtual ~NetworkService();
   bool InitNetworkService();
 
+  // The backend really in use after the fall back
+  BackendType backend() const {
+    return backend_;
+  }
+
   virtual Socket::Ptr CreateSocket(int type);
   virtual Socket::Ptr CreateSocket(int family, int type);
 
@@ -186,24 +323,158 @@ class NetworkService : public SocketServer {
   // SocketServer:
   virtual bool Wait(int cms, bool process_io);
   virtual void WakeUp();
+  virtual void OnMessageDispatched();
+
+  // 这一轮网络事件或者当前的消息处理完之后调用flushable->Flush()，
+  // 只能在本线程调用
+  void PostFlush(Flushable::Ptr flushable);
+
+  // WakeUp()被合并掉的次数：循环没有阻塞在等待中，或者已经有一个没被处理的
+  // WakeUp，都不需要再写唤醒fd
+  uint32 elided_wakeups() {
+    return static_cast<uint32>(AtomicOps::Load(&elided_wakeups_));
+  }
 
   void Add(EventDispatcher::Ptr dispatcher);
   void Remove(EventDispatcher::Ptr dispatcher);
  private:
+  friend class EventDispatcher;
+  friend class PhysicalSocket;
+  void SetupBackend(BackendType backend);
   void ResetWakeEvent();
- private:
-  typedef std::list<EventDispatcher::Ptr> DispatcherList;
+  // 执行PostFlush推迟的操作，Flush中再PostFlush的留到下一轮
+  void RunFlushes();
+  // 分发就绪队列中的dispatcher，每个每轮只分发一次，分发时再次加入队列的
+  // 留到下一轮
+  void RunReadyDispatchers();
+  // 就绪队列中有dispatcher时返回true。ready_由crit_保护，别的线程Add()时会加入
+  bool HasReadyDispatchers();
+  // 已经在就绪队列中的dispatcher，内核报告的事件合并进去一起分发
+  bool MergeReadyEvents(EventDispatcher::Ptr dispatcher, uint32 ff, int err);
+  // Called by EventDispatcher when its interest mask changed.
+  void UpdateDispatcher(EventDispatcher::Ptr dispatcher);
+#ifndef WIN32
+  // Called right before blocking, false means there is a WakeUp already and
+  // the loop shouldn't block.
+  bool EnterSleep();
+  void LeaveSleep();
+  bool WaitSelect(int cmsWait);
+  // Put dispatcher into the slot of its fd, replacing the previous owner.
+  void AttachDispatcher(EventDispatcher::Ptr dispatcher);
+  void DetachDispatcher(EventDispatcher::Ptr dispatcher);
+#endif
+#ifdef VZ_HAVE_EPOLL
+  bool WaitEpoll(int cmsWait);
+  // Push the interest mask of dispatcher to the kernel, only issue
+  // EPOLL_CTL_MOD when the mask is really changed.
+  void SyncDispatcher(EventDispatcher::Ptr dispatcher);
+  void FlushPendingUpdates();
+#endif
+#ifdef VZ_HAVE_IO_URING
+  bool WaitUring(int cmsWait);
+  // Queue a one shot poll for the mask of dispatcher, cancel the outstanding
+  // one if the mask is changed.
+  void SyncUringDispatcher(EventDispatcher::Ptr dispatcher);
+  void CancelUringPoll(SOCKET sock);
+  // Hand the queued requests to the kernel unless the loop will do it.
+  void SubmitUring();
+  void ArmUringWakeup();
+  void HandleUringCompletion(uint64 user_data, int32 res, bool more,
+                             int32 buffer);
 
-  DispatcherList dispatchers_;
+  // Completion mode, see EventDispatcher::EnableCompletionIo()
+  struct UringOp;
+  void SetupUringBuffers();
+  // The socket of dispatcher if it works in the completion mode
+  PhysicalSocket *UringIoSocket(EventDispatcher::Ptr dispatcher);
+  // Keep the multishot request of socket running and queue dispatcher if
+  // the socket has got something it waits for.
+  void SyncUringIo(EventDispatcher::Ptr dispatcher, PhysicalSocket *socket);
+  uint32 NewUringOp(int type, PhysicalSocket *socket);
+  void FreeUringOp(uint32 id);
+  void SubmitUringRecv(PhysicalSocket *socket);
+  void SubmitUringAccept(PhysicalSocket *socket);
+  int SubmitUringSend(PhysicalSocket *socket, const BlocksPtr &blocks,
+                      size_t offset, const struct iovec *iov, size_t count,
+                      size_t total);
+  void HandleUringOp(uint32 id, int32 res, bool more, int32 buffer);
+  // Queue dispatcher if its socket has got the events it waits for
+  void QueueUringReady(EventDispatcher::Ptr dispatcher,
+                       PhysicalSocket *socket);
+  // Called by PhysicalSocket
+  void ResumeUringRecv(PhysicalSocket *socket);
+  // Cancel the requests of socket. The socket is being closed without wait,
+  // the send request goes on and its completion is dropped. Otherwise wait
+  // until all the requests are done, the completions of the others are
+  // kept for the loop.
+  void CancelUringIo(PhysicalSocket *socket, bool wait);
+#endif
+ private:
+  static BackendType default_backend_;
+  BackendType backend_;
   CriticalSection crit_;
   bool fWait_;
+  int elided_wakeups_;
+  std::vector<Flushable::Ptr> flushes_;
+  std::vector<EventDispatcher::Ptr> ready_;
 #ifdef WIN32
+  typedef std::list<EventDispatcher::Ptr> DispatcherList;
+
+  DispatcherList dispatchers_;
   WSAEVENT socket_ev_;
   WSAEVENT signal_wakeup_;
 #else
+  struct DispatcherSlot {
+    DispatcherSlot()
+      : generation(0), poll_generation(0),
+        poll_events(0), poll_registered(false) {
+    }
+    EventDispatcher::Ptr dispatcher;
+    // Bumped every time the fd gets a new owner, epoll events carry it so
+    // the events of the previous owner can be dropped.
+    uint32 generation;
+    // epoll: 已经提交给epoll的generation
+    // io_uring: 未完成的poll请求的序号
+    uint32 poll_generation;
+    uint32 poll_events;
+    bool   poll_registered;
+  };
+  typedef std::vector<DispatcherSlot> DispatcherTable;
+
+  // 以fd为下标的分发表，Add/Remove/重新注册都是O(1)
+  DispatcherTable dispatchers_;
+  size_t dispatcher_count_;
   Signal *signal_wakeup_;
-#if defined(POSIX) && !defined(LITEOS)
+  // 循环阻塞在select/epoll_wait/io_uring_enter中
+  int sleeping_;
+  // 有WakeUp还没被Wait处理，之后的WakeUp都可以省掉
+  int wakeup_pending_;
+#ifdef VZ_HAVE_IO_URING
+  scoped_ptr<IoUring> uring_;
+  uint32 uring_serial_;
+  // The loop is sleeping in io_uring_enter
+  bool uring_waiting_;
+  // The provided buffer ring is set up, sockets may use the completion mode
+  bool uring_completion_;
+  // Blocks given to the provided buffer ring, indexed by the buffer id
+  std::vector<Block::Ptr> uring_buffers_;
+  // accept/recv/sendmsg requests in flight, indexed by id - 1
+  std::vector<UringOp *> uring_ops_;
+  std::vector<uint32> uring_free_ops_;
+  // Completions reaped by CancelUringIo() which belong to the loop
+  struct UringCompletion {
+    uint64 user_data;
+    int32  res;
+    bool   more;
+    int32  buffer;
+  };
+  std::vector<UringCompletion> uring_deferred_;
+#endif
+#ifdef VZ_HAVE_EPOLL
   int epoll_;
+  // 派发事件期间的掩码修改先缓存，派发结束后统一提交
+  std::vector<EventDispatcher::Ptr> pending_updates_;
+  bool dispatching_;
 #endif
 #endif
 };
@@ -22,6 +22,15 @@ void AsyncSocket::RemoveAllSignal() {
   if (!SignalSocketReadEvent.is_empty()) {
     SignalSocketReadEvent.disconnect_all();
   }
+  if (!SignalWriteBlocked.is_empty()) {
+    SignalWriteBlocked.disconnect_all();
+  }
+  if (!SignalWriteDrained.is_empty()) {
+    SignalWriteDrained.disconnect_all();
+  }
+  if (!SignalWriteIdle.is_empty()) {
+    SignalWriteIdle.disconnect_all();
+  }
 }
 
 bool AsyncSocket::AsyncWrite(const char *data, std::size_t size) {
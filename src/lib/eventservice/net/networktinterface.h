@@ -37,6 +37,22 @@ class AsyncSocket {
   // 读完成事件
   sigslot::signal2<AsyncSocket::Ptr, MemBuffer::Ptr>
   SignalSocketReadEvent;
+  // 待发送数据超过高水位
+  sigslot::signal1<AsyncSocket::Ptr>
+  SignalWriteBlocked;
+  // 超过高水位之后，待发送数据又降到低水位以下
+  sigslot::signal1<AsyncSocket::Ptr>
+  SignalWriteDrained;
+  // 超过write_idle没有发送过数据，一般用来发心跳包
+  sigslot::signal1<AsyncSocket::Ptr>
+  SignalWriteIdle;
+
+  // 待发送数据超过高水位之后的处理方式
+  enum OverflowPolicy {
+    OVERFLOW_NONE,        // 只发信号，数据照样缓存
+    OVERFLOW_REJECT,      // 拒绝新的写，AsyncWrite返回false
+    OVERFLOW_DROP_OLDEST  // 丢弃最早的、还没开始发送的AsyncWrite数据
+  };
 
   // Async write the data, if the operator complete, SignalWriteCompleteEvent
   // will be called
@@ -78,6 +94,35 @@ class AsyncSocket {
 
   virtual int GetOption(Option opt, int* value) = 0;
   virtual int SetOption(Option opt, int value) = 0;
+  // 每次读事件读取的字节数，默认为0，表示读取当前所有可读的数据
+  virtual void SetRecvSize(size_t size) = 0;
+  // 一次发送不少于threshold字节时使用零拷贝(MSG_ZEROCOPY)，0表示关闭。
+  // 内核发送完成之前会一直引用AsyncWrite传入的Block，这期间不能修改这些
+  // MemBuffer。只有Linux 4.14以上的TCP连接支持，不支持时返回false
+  virtual bool SetZeroCopy(size_t threshold) = 0;
+  // 合并写：同一轮事件处理中的多次AsyncWrite先缓存，这一轮结束时用一次
+  // gather write发出去，不会比现在多等一轮循环。不会修改TCP_NODELAY，
+  // 合并后的数据不想再等Nagle时要另外SetOption(OPT_NODELAY, 1)。
+  // 只能在EventService线程AsyncWrite
+  virtual void SetWriteCoalescing(bool enable) = 0;
+  // 设置发送队列的高低水位，high为0表示不限制(默认)。每次AsyncWrite的数据
+  // 作为一个整体缓存或者丢弃，不会只丢一半；队列为空时总能写入一次
+  virtual void SetWriteWatermarks(size_t high, size_t low,
+                                  OverflowPolicy policy = OVERFLOW_NONE) = 0;
+  // 还没有发送出去的字节数
+  virtual size_t GetWriteQueueSize() const = 0;
+  // 每次读事件最多读read_budget字节，每次写事件最多写write_budget字节，
+  // 0表示不限制(默认)。用完预算的连接在下一轮循环接着处理，不会因为一个
+  // 大流量的连接让其他连接等待
+  virtual void SetIoBudget(size_t read_budget, size_t write_budget) = 0;
+  // 读空闲和写空闲超时(毫秒)，0表示不检查(默认)。超过read_idle没有收到数据
+  // 时以ETIMEDOUT发出SignalSocketErrorEvent并关闭连接；超过write_idle没有
+  // 发送数据时发出SignalWriteIdle。由EventService的ConnectionMonitor统一
+  // 检查，会晚最多一个检查粒度。只能在EventService线程调用
+  virtual void SetIdleTimeout(uint32 read_idle, uint32 write_idle) = 0;
+  // 检查空闲的连接是否还能用：没有出错，对方没有关闭，也没有没读的数据。
+  // 只看内核的状态，不读数据，也不会发出任何信号
+  virtual bool CheckConnection() = 0;
 
   void RemoveAllSignal();
 };
@@ -92,6 +137,15 @@ class AsyncListener {
   virtual bool Start(const SocketAddress addr, bool addr_reused = false) = 0;
   virtual void Close() = 0;
   virtual const SocketAddress BindAddress() = 0;
+
+  // 以下设置需要在Start之前调用
+  // listen()的backlog，默认为SOMAXCONN
+  virtual void SetBacklog(int backlog) = 0;
+  // 每次事件最多accept的连接数，默认为64
+  virtual void SetAcceptBudget(int budget) = 0;
+  // TCP_DEFER_ACCEPT, the connection is accepted after its first data or
+  // after seconds. 0 disables it, not supported on every platform.
+  virtual void SetDeferAccept(int seconds) = 0;
 };
 
 class  AsyncConnecter {
@@ -101,11 +155,36 @@ class  AsyncConnecter {
   sigslot::signal3<AsyncConnecter::Ptr,
           Socket::Ptr,
           int>  SignalServerConnected;
+  // time_out毫秒内没有连上时以ETIMEDOUT发出SignalServerConnected，
+  // 0表示一直等待系统的连接超时。连接成功时Socket交给SignalServerConnected
+  // 的接收者，AsyncConnecter不再持有它
   virtual bool Connect(const SocketAddress addr, uint32 time_out) = 0;
   virtual void Close() = 0;
   virtual const SocketAddress ConnectAddress() = 0;
 };
 
+// 在两个TCP连接之间双向转发数据。Linux上通过管道用splice()转发，数据不进入
+// 用户空间；其他平台用一块缓存中转。所有方法都要在EventService线程中调用
+class TcpRelay {
+ public:
+  typedef boost::shared_ptr<TcpRelay> Ptr;
+  enum Direction {
+    A_TO_B = 0,
+    B_TO_A = 1
+  };
+  // 两个方向都转发完EOF，或者出错后触发，err为0表示两边都正常关闭。
+  // 触发之前两个连接都已经关闭了
+  sigslot::signal2<TcpRelay::Ptr, int> SignalRelayClosed;
+
+  // 一个方向中转的数据达到high时暂停读取，降到low以下后继续，
+  // 需要在Start之前调用，默认为64KB和16KB
+  virtual void SetWatermarks(Direction dir, size_t high, size_t low) = 0;
+  virtual bool Start() = 0;
+  virtual void Close() = 0;
+  // 一个方向已经写到对端的字节数
+  virtual uint64 RelayedBytes(Direction dir) const = 0;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 
 class AsyncUdpSocket {
@@ -129,7 +208,13 @@ class AsyncUdpSocket {
   virtual bool SendTo(const char *data,
                       std::size_t size,
                       const SocketAddress &addr);
+  // 发送一组数据报，尽量用一次系统调用发出去。发送缓存满时排队等待可写，
+  // 排队的数据报都发出去之后触发SignalSocketWriteEvent
+  virtual bool SendBatch(const Datagrams &datagrams) = 0;
   virtual bool AsyncRead() = 0;
+  // 每次可读事件最多接收count个数据报，每个数据报最长max_datagram_size
+  // 字节，超过的数据报被丢弃。默认每次接收1个，最长64KB
+  virtual void SetRecvBatch(size_t count, size_t max_datagram_size) = 0;
 
   // Returns the address to which the socket is bound.  If the socket is not
   // bound, then the any-address is returned.
@@ -10,17 +10,41 @@
 
 #include "eventservice/net/networktinterfaceimpl.h"
 #include "eventservice/base/base64.h"
+#include "eventservice/base/timeutils.h"
+
+#ifdef POSIX
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>  // for TCP_DEFER_ACCEPT
+#endif
 
 
 namespace vzes {
 
 #define MSG_DATA_SEND_COMPLETE  (101)  // Tcp数据包发送完成消息
+#define DEFAULT_ACCEPT_BUDGET   64     // 每次事件最多accept的连接数
+#define MSG_ACCEPT_RETRY        (102)  // 重新开始accept消息
+#define ACCEPT_RETRY_DELAY      100    // 文件描述符用完后等待的毫秒数
 
 AsyncSocketImpl::AsyncSocketImpl(EventService::Ptr es, Socket::Ptr s)
   : event_service_(es),
     socket_(s),
+    write_offset_(0),
     socket_writeable_(true),
-    encode_type_(PKT_ENCODE_NONE) {
+    encode_type_(PKT_ENCODE_NONE),
+    coalesce_writes_(false),
+    flush_pending_(false),
+    write_unit_started_(false),
+    write_high_watermark_(0),
+    write_low_watermark_(0),
+    overflow_policy_(OVERFLOW_NONE),
+    write_blocked_(false),
+    read_budget_(0),
+    write_budget_(0),
+    read_idle_(0),
+    write_idle_(0),
+    last_read_time_(0),
+    last_write_time_(0) {
   write_buffers_ = MemBuffer::CreateMemBuffer();
 }
 
@@ -34,8 +58,10 @@ bool AsyncSocketImpl::Init() {
   ASSERT_RETURN_FAILURE(!event_service_, false);
   ASSERT_RETURN_FAILURE(socket_event_, false);
   socket_event_ = event_service_->CreateDispEvent(socket_, DE_READ | DE_CLOSE);
-  socket_event_->SignalEvent.connect(this, &AsyncSocketImpl::OnSocketEvent);
   ASSERT_RETURN_FAILURE(!socket_event_, false);
+  socket_event_->SignalEvent.connect(this, &AsyncSocketImpl::OnSocketEvent);
+  // io_uring上直接收发数据，其他后端忽略
+  socket_event_->EnableCompletionIo();
   return true;
 }
 // Inherit with AsyncSocket
@@ -45,11 +71,63 @@ bool AsyncSocketImpl::AsyncWrite(MemBuffer::Ptr buffer) {
   ASSERT_RETURN_FAILURE(!IsConnected(), false);
   ASSERT_RETURN_FAILURE(!event_service_, false);
   ASSERT_RETURN_FAILURE(!socket_event_, false);
-  write_buffers_->AppendBuffer(buffer);
-  TryToWriteData(false);
+  if (encode_type_ != PKT_ENCODE_NONE) {
+    buffer = EncodeBuffer(buffer);
+  }
+  if (overflow_policy_ == OVERFLOW_REJECT && write_high_watermark_ &&
+      write_buffers_->size() &&
+      write_buffers_->size() + buffer->size() > write_high_watermark_) {
+    CheckWriteWatermarks(true);
+    return false;
+  }
+  if (buffer->blocks().size()) {
+    write_buffers_->AppendBuffer(buffer);
+    write_units_.push_back(buffer->blocks().size());
+  }
+  bool overflow = false;
+  if (overflow_policy_ == OVERFLOW_DROP_OLDEST && write_high_watermark_) {
+    overflow = DropOldestWrites();
+  }
+  if (coalesce_writes_) {
+    // 不可写时等可写事件再发，否则这一轮结束时统一发送
+    if (socket_writeable_ && !flush_pending_) {
+      flush_pending_ = true;
+      event_service_->PostFlush(shared_from_this());
+    }
+  } else {
+    TryToWriteData(false);
+  }
+  CheckWriteWatermarks(overflow);
   return true;
 }
 
+// 需要编码的Block编码到新的Block中，其他Block直接共享，
+// 没有需要编码的Block时返回原来的buffer
+MemBuffer::Ptr AsyncSocketImpl::EncodeBuffer(MemBuffer::Ptr buffer) {
+  BlocksPtr &blocks = buffer->blocks();
+  BlocksPtr::iterator iter = blocks.begin();
+  while (iter != blocks.end() && !(*iter)->encode_flag_) {
+    ++iter;
+  }
+  if (iter == blocks.end()) {
+    return buffer;
+  }
+  MemBuffer::Ptr encoded = MemBuffer::CreateMemBuffer();
+  for (iter = blocks.begin(); iter != blocks.end(); ++iter) {
+    if (!(*iter)->encode_flag_) {
+      encoded->AppendBlock(*iter);
+      continue;
+    }
+    // 每个Block单独编码，当前默认为Base64编码
+    std::string data;
+    Base64::EncodeFromArray((*iter)->data(), (*iter)->size(), &data);
+    MemBuffer::Ptr segment = MemBuffer::CreateMemBuffer();
+    segment->WriteBytes(data.c_str(), data.size());
+    encoded->AppendBuffer(segment);
+  }
+  return encoded;
+}
+
 //bool AsyncSocketImpl::AsyncWrite(MemBufferLists buffers) {
 //  ASSERT_RETURN_FAILURE(!IsConnected(), false);
 //  ASSERT_RETURN_FAILURE(!event_service_, false);
@@ -88,10 +166,20 @@ void AsyncSocketImpl::Close() {
     event_service_->Remove(socket_event_);
     socket_event_.reset();
   }
+  if (monitor_) {
+    monitor_->Remove(this);
+    monitor_.reset();
+  }
+  read_idle_ = 0;
+  write_idle_ = 0;
   RemoveAllSignal();
   if (write_buffers_ && write_buffers_->size()) {
     write_buffers_->Clear();
   }
+  write_units_.clear();
+  write_unit_started_ = false;
+  write_blocked_ = false;
+  write_offset_ = 0;
   socket_writeable_ = false;
 }
 
@@ -124,6 +212,151 @@ int AsyncSocketImpl::SetOption(Option opt, int value) {
   return socket_->SetOption(opt, value);
 }
 
+void AsyncSocketImpl::SetRecvSize(size_t size) {
+  ASSERT_RETURN_VOID(!socket_);
+  socket_->SetRecvSize(size);
+}
+
+bool AsyncSocketImpl::CanDetachSocket() const {
+  if (!socket_ || write_buffers_->size() != 0) {
+    return false;
+  }
+  // io_uring上还在发送的数据属于这个连接
+  PhysicalSocket::Ptr physical =
+    boost::dynamic_pointer_cast<PhysicalSocket>(socket_);
+  return !physical || !physical->SendPending();
+}
+
+Socket::Ptr AsyncSocketImpl::DetachSocket() {
+  ASSERT_RETURN_FAILURE(!CanDetachSocket(), Socket::Ptr());
+  Socket::Ptr socket = socket_;
+  PhysicalSocket::Ptr physical =
+    boost::dynamic_pointer_cast<PhysicalSocket>(socket_);
+  if (physical) {
+    // 已经收到的数据留在socket中，之后的数据由新的使用者读
+    physical->StopUringIo();
+  }
+  // Close() without socket_ only drops the event and the signals
+  socket_.reset();
+  Close();
+  return socket;
+}
+
+bool AsyncSocketImpl::SetZeroCopy(size_t threshold) {
+  ASSERT_RETURN_FAILURE(!socket_, false);
+  return socket_->SetZeroCopy(threshold);
+}
+
+void AsyncSocketImpl::SetWriteCoalescing(bool enable) {
+  ASSERT_RETURN_VOID(!socket_);
+  coalesce_writes_ = enable;
+  if (!enable && flush_pending_) {
+    TryToWriteData(false);
+  }
+}
+
+void AsyncSocketImpl::SetWriteWatermarks(size_t high, size_t low,
+    OverflowPolicy policy) {
+  if (low > high) {
+    LOG(L_WARNING) << "Low watermark " << low
+                   << " is above high watermark " << high;
+    low = high;
+  }
+  write_high_watermark_ = high;
+  write_low_watermark_ = low;
+  overflow_policy_ = policy;
+  if (high == 0) {
+    write_blocked_ = false;
+  }
+}
+
+size_t AsyncSocketImpl::GetWriteQueueSize() const {
+  return write_buffers_->size();
+}
+
+void AsyncSocketImpl::SetIoBudget(size_t read_budget, size_t write_budget) {
+  ASSERT_RETURN_VOID(!socket_);
+  read_budget_ = read_budget;
+  write_budget_ = write_budget;
+  socket_->SetRecvBudget(read_budget);
+}
+
+void AsyncSocketImpl::SetIdleTimeout(uint32 read_idle, uint32 write_idle) {
+  ASSERT_RETURN_VOID(!socket_);
+  read_idle_ = read_idle;
+  write_idle_ = write_idle;
+  uint32 now = Time();
+  last_read_time_ = now;
+  last_write_time_ = now;
+  if (read_idle == 0 && write_idle == 0) {
+    if (monitor_) {
+      monitor_->Remove(this);
+      monitor_.reset();
+    }
+    return;
+  }
+  if (!monitor_) {
+    monitor_ = event_service_->connection_monitor();
+    ASSERT_RETURN_VOID(!monitor_);
+  }
+  ScheduleIdleCheck(now);
+}
+
+bool AsyncSocketImpl::CheckConnection() {
+  if (!socket_ || !socket_event_
+      || socket_->GetState() == Socket::CS_CLOSED) {
+    return false;
+  }
+  char c;
+  int res = socket_->Peek(&c, 1);
+  // 0是对方关闭了，大于0是有没读的数据，都不能再用
+  return res < 0 && IsBlockingError(socket_->GetError());
+}
+
+// 按最后的读写时间找出最早的空闲期限，只在检查的时候才动时间轮
+void AsyncSocketImpl::ScheduleIdleCheck(uint32 now) {
+  int32 delay = -1;
+  if (read_idle_) {
+    delay = read_idle_ - TimeDiff(now, last_read_time_);
+  }
+  if (write_idle_) {
+    int32 write_delay = write_idle_ - TimeDiff(now, last_write_time_);
+    if (delay < 0 || write_delay < delay) {
+      delay = write_delay;
+    }
+  }
+  monitor_->Schedule(this, delay > 0 ? delay : 0);
+}
+
+void AsyncSocketImpl::OnMonitorCheck(uint32 now) {
+  if (!socket_ || !monitor_) {
+    return;
+  }
+  AsyncSocketImpl::Ptr live_this = shared_from_this();
+  if (read_idle_ && TimeDiff(now, last_read_time_) >= (int32)read_idle_) {
+    LOG(L_WARNING) << "No data received in " << read_idle_
+                   << " ms, close the connection";
+    SocketErrorEvent(ETIMEDOUT);
+    return;
+  }
+  if (write_idle_ && TimeDiff(now, last_write_time_) >= (int32)write_idle_) {
+    // 先重新排好下一次检查，回调中可能关闭连接
+    last_write_time_ = now;
+    ScheduleIdleCheck(now);
+    SignalWriteIdle(live_this);
+    return;
+  }
+  ScheduleIdleCheck(now);
+}
+
+void AsyncSocketImpl::Flush() {
+  flush_pending_ = false;
+  if (!socket_event_ || write_buffers_->size() == 0) {
+    return;
+  }
+  TryToWriteData(false);
+}
+
 void AsyncSocketImpl::OnMessage(vzes::Message *msg) {
   if (msg->message_id == MSG_DATA_SEND_COMPLETE) {
     SocketWriteComplete();
@@ -171,6 +404,14 @@ void AsyncSocketImpl::SocketReadEvent() {
   int error_code        = socket_->GetError();
 
   if (res > 0) {
+    if (read_idle_) {
+      last_read_time_ = Time();
+    }
+    if (read_budget_ && static_cast<size_t>(res) >= read_budget_
+        && socket_event_) {
+      // 读满了预算，可能还有数据，下一次AsyncRead直接排到下一轮
+      socket_event_->SetPendingEvents(DE_READ);
+    }
     SocketReadComplete(buffer);
   } else if (res == 0) {
     // LOG(L_ERROR) << evutil_socket_error_to_string(error_code);
@@ -180,12 +421,15 @@ void AsyncSocketImpl::SocketReadEvent() {
     // SocketReadComplete(MemBuffer::Ptr(), error_code);
     SocketErrorEvent(error_code);
   } else {
-    LOG(L_ERROR) << "received data error, error = " << error_code;
     // 接收数据出问题了
     if (IsBlockingError(error_code)) {
-      // 数据阻塞，之后继续接收数据
+      // 没有数据可读(例如只是错误队列中有零拷贝的完成通知)，继续等待读事件
+      if (socket_event_) {
+        socket_event_->AddEvent(DE_READ);
+      }
       return;
     } else {
+      LOG(L_ERROR) << "received data error, error = " << error_code;
       // Socket出了问题
       // SocketReadComplete(MemBuffer::Ptr(), error_code);
       LOG(L_ERROR) << "socket errored";
@@ -205,63 +449,134 @@ void AsyncSocketImpl::SocketErrorEvent(int err) {
   Close();
 }
 
+// 从待发送数据中去掉已经发送的size个字节，发送完的Block直接删除，
+// 没有发送完的Block只记录偏移，不移动数据
+void AsyncSocketImpl::ConsumeWriteBuffers(size_t size) {
+  BlocksPtr &block_list = write_buffers_->blocks();
+  write_buffers_->ReduceSize(size);
+  size += write_offset_;
+  size_t popped = 0;
+  while (!block_list.empty()) {
+    size_t block_size = block_list.front()->size();
+    if (size < block_size) {
+      break;
+    }
+    size -= block_size;
+    block_list.pop_front();
+    popped++;
+  }
+  write_offset_ = size;
+  // 同步更新写单元，用来判断哪些数据可以整块丢弃
+  while (popped > 0 && !write_units_.empty()) {
+    if (popped < write_units_.front()) {
+      write_units_.front() -= popped;
+      write_unit_started_ = true;
+      break;
+    }
+    popped -= write_units_.front();
+    write_units_.pop_front();
+    write_unit_started_ = false;
+  }
+  if (write_offset_ > 0) {
+    write_unit_started_ = true;
+  }
+}
+
+// 超过高水位时从最早的写单元开始整块丢弃，已经发送了一部分的写单元和
+// 最新的写单元保留，保证对端收到的每个包都是完整的。有数据被丢弃时返回true
+bool AsyncSocketImpl::DropOldestWrites() {
+  BlocksPtr &block_list = write_buffers_->blocks();
+  BlocksPtr::iterator block = block_list.begin();
+  size_t unit = 0;
+  if (write_unit_started_ && !write_units_.empty()) {
+    std::advance(block, write_units_.front());
+    unit = 1;
+  }
+  size_t dropped = 0;
+  while (write_buffers_->size() > write_high_watermark_ &&
+         unit + 1 < write_units_.size()) {
+    for (size_t i = 0; i < write_units_[unit]; i++) {
+      write_buffers_->ReduceSize((*block)->size());
+      dropped += (*block)->size();
+      block = block_list.erase(block);
+    }
+    write_units_.erase(write_units_.begin() + unit);
+  }
+  if (dropped) {
+    LOG(L_WARNING) << "Write queue is full, drop " << dropped << " bytes";
+  }
+  return dropped > 0;
+}
+
+// 高低水位之间不重复发信号，避免在水位附近来回抖动。
+// overflow表示刚刚有写被拒绝或者有数据被丢弃，这时队列不一定超过高水位
+void AsyncSocketImpl::CheckWriteWatermarks(bool overflow) {
+  if (write_high_watermark_ == 0) {
+    return;
+  }
+  size_t queue_size = write_buffers_->size();
+  if (!write_blocked_ && (overflow || queue_size > write_high_watermark_)) {
+    write_blocked_ = true;
+    SignalWriteBlocked(shared_from_this());
+  } else if (write_blocked_ && queue_size <= write_low_watermark_) {
+    write_blocked_ = false;
+    SignalWriteDrained(shared_from_this());
+  }
+}
+
 int32 AsyncSocketImpl::TryToWriteData(bool is_emit_close_event) {
   if (!socket_writeable_) {
     //LOG(L_INFO) << "can't write data, waitting to write";
+    CheckWriteWatermarks();
     return -1;
   }
 
   // 数据已经全部发送完成
   BlocksPtr &block_list = write_buffers_->blocks();
-  if ((block_list.size() == 0) && (encode_buffer_.size() == 0)) {
+  if (block_list.size() == 0) {
     SocketWriteComplete();
     return 0;
   }
 
-  int send_size = 0;
+  size_t written = 0;
   while (1) {
-    // 发送缓存中的数据发送完，从数据缓存list中获取Blcok发送
-    if (encode_buffer_.size() == 0) {
-      if (block_list.size() == 0) {
-        // 数据已经全部发送完成
+    if (block_list.size() == 0) {
+      // 数据已经全部发送完成
 #ifdef WIN32
-        // For windows: An FD_WRITE network event is recorded when a
-        // socket is first connected with connect/WSAConnect or accepted
-        // with accept/WSAAccept, and then after a send fails with
-        // WSAEWOULDBLOCK and buffer space becomes available.
-        // So here we simulate FD_WRITE event by post message.
-        event_service_->Post(this, MSG_DATA_SEND_COMPLETE);
+      // For windows: An FD_WRITE network event is recorded when a
+      // socket is first connected with connect/WSAConnect or accepted
+      // with accept/WSAAccept, and then after a send fails with
+      // WSAEWOULDBLOCK and buffer space becomes available.
+      // So here we simulate FD_WRITE event by post message.
+      event_service_->Post(this, MSG_DATA_SEND_COMPLETE);
 #else
-        WaitToWriteData();
+      WaitToWriteData();
 #endif
-        break;
-      }
-
-      Block::Ptr block = block_list.front();
-      block_list.pop_front();
-      write_buffers_->ReduceSize(block->buffer_size);
-      if ((block->encode_flag_) && (encode_type_ != PKT_ENCODE_NONE)) {
-        // 当前默认为Base64编码
-        Base64::EncodeFromArray(block->buffer,
-                                block->buffer_size,
-                                &encode_buffer_);
-      } else {
-        encode_buffer_.resize(block->buffer_size);
-        memcpy((void*)encode_buffer_.c_str(),
-               block->buffer,
-               block->buffer_size);
-      }
+      break;
     }
 
-    int res = socket_->Send(encode_buffer_.c_str(), encode_buffer_.size());
+    // 一次把多个Block交给内核发送
+    int res = socket_->SendBlocks(block_list, write_offset_,
+                                  write_budget_ ? write_budget_ - written : 0);
     int error_code = socket_->GetError();
-    if (res == encode_buffer_.size()) {
-      // 数据发送完成，继续发送下一个Block数据
-      encode_buffer_.resize(0);
-      continue;
-    } else if (res > 0 && res < encode_buffer_.size()) {
+    if (res > 0) {
+      if (write_idle_) {
+        last_write_time_ = Time();
+      }
+      ConsumeWriteBuffers(res);
+      written += res;
+      if (write_budget_ && written >= write_budget_
+          && block_list.size() != 0) {
+        // 用完了这次的写预算，下一轮接着写，不需要等内核的可写通知
+        socket_event_->SetPendingEvents(DE_WRITE);
+        WaitToWriteData();
+        break;
+      }
+      if (write_offset_ == 0) {
+        // 发送到了Block的边界，继续发送剩下的数据
+        continue;
+      }
       // 数据没有写完，等待下一次再写入数据
-      encode_buffer_.erase(0, res);
       WaitToWriteData();
       break;
     } else if (res == 0) {
@@ -288,6 +603,7 @@ int32 AsyncSocketImpl::TryToWriteData(bool is_emit_close_event) {
     break;
   }
 
+  CheckWriteWatermarks();
   return 0;
 }
 
@@ -321,7 +637,11 @@ void AsyncSocketImpl::SocketWriteComplete() {
 ////////////////////////////////////////////////////////////////////////////////
 
 AsyncListenerImpl::AsyncListenerImpl(EventService::Ptr es)
-  : event_service_(es) {
+  : event_service_(es),
+    reuse_port_(false),
+    backlog_(SOMAXCONN),
+    accept_budget_(DEFAULT_ACCEPT_BUDGET),
+    defer_accept_(0) {
 }
 
 AsyncListenerImpl::~AsyncListenerImpl() {
@@ -341,19 +661,42 @@ bool AsyncListenerImpl::Start(const SocketAddress addr, bool addr_reused) {
   accept_event_ = event_service_->CreateDispEvent(socket_, DE_ACCEPT);
   ASSERT_RETURN_FAILURE(!accept_event_, false);
   accept_event_->SignalEvent.connect(this, &AsyncListenerImpl::OnAcceptEvent);
+  accept_event_->EnableCompletionIo();
 
   // Set socket reuse option
+  if (addr_reused && socket_->SetOption(OPT_REUSEADDR, 1) == SOCKET_ERROR) {
+    LOG(L_WARNING) << "Failure to set SO_REUSEADDR";
+  }
+  if (reuse_port_ && socket_->SetOption(OPT_REUSEPORT, 1) == SOCKET_ERROR) {
+    LOG(L_ERROR) << "Failure to set SO_REUSEPORT";
+    return false;
+  }
   if (socket_->Bind(addr) == SOCKET_ERROR) {
     LOG(L_ERROR) << "Failure to bind local address " << addr.ToString();
     return false;
   }
   LOG(L_INFO) << "Bind " << addr.ToString();
-  ASSERT_RETURN_FAILURE(socket_->Listen(10) == SOCKET_ERROR, false);
+  if (defer_accept_ > 0) {
+#ifdef TCP_DEFER_ACCEPT
+    if (socket_->SetOption(IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                           (const char *)&defer_accept_,
+                           sizeof(defer_accept_)) == SOCKET_ERROR) {
+      LOG(L_WARNING) << "Failure to set TCP_DEFER_ACCEPT";
+    }
+#else
+    LOG(L_WARNING) << "TCP_DEFER_ACCEPT is not supported";
+#endif
+  }
+  ASSERT_RETURN_FAILURE(socket_->Listen(backlog_) == SOCKET_ERROR, false);
   listen_address_ = addr;
   return event_service_->Add(accept_event_);
 }
 
 void AsyncListenerImpl::Close() {
+  if (accept_timer_) {
+    accept_timer_->Cancel();
+    accept_timer_.reset();
+  }
   if (accept_event_) {
     accept_event_->Close();
     event_service_->Remove(accept_event_);
@@ -369,6 +712,18 @@ const SocketAddress AsyncListenerImpl::BindAddress() {
   return listen_address_;
 }
 
+void AsyncListenerImpl::SetBacklog(int backlog) {
+  backlog_ = backlog;
+}
+
+void AsyncListenerImpl::SetAcceptBudget(int budget) {
+  accept_budget_ = _max(1, budget);
+}
+
+void AsyncListenerImpl::SetDeferAccept(int seconds) {
+  defer_accept_ = seconds;
+}
+
 void AsyncListenerImpl::OnAcceptEvent(EventDispatcher::Ptr accept_event,
                                       Socket::Ptr socket,
                                       uint32 event_type,
@@ -379,8 +734,48 @@ void AsyncListenerImpl::OnAcceptEvent(EventDispatcher::Ptr accept_event,
     return ;
   }
   if (event_type & DE_ACCEPT) {
-    SignalNewConnected(shared_from_this(), socket->Accept(NULL), err);
-    event_service_->Add(accept_event_);
+    // Drain the accept queue, a reconnect storm fills it much faster than
+    // one connection per wake up.
+    for (int i = 0; i < accept_budget_; i++) {
+      Socket::Ptr new_socket = socket->Accept(NULL);
+      if (!new_socket) {
+        int error = socket->GetError();
+        // The peer gave up before we got to it
+        if (error == ECONNABORTED) {
+          continue;
+        }
+        if (!IsBlockingError(error)) {
+          LOG_E(LS_ERROR, EN, error) << "accept";
+          SignalNewConnected(shared_from_this(), Socket::Ptr(), error);
+        }
+        if ((error == EMFILE || error == ENFILE
+             || error == ENOBUFS || error == ENOMEM) && accept_event_) {
+          // 连接还在监听队列中，马上重新监听会一直被唤醒，等释放了一些
+          // 文件描述符再accept
+          accept_timer_ = event_service_->PostDelayed(ACCEPT_RETRY_DELAY,
+                          this, MSG_ACCEPT_RETRY);
+          return;
+        }
+        break;
+      }
+      SignalNewConnected(shared_from_this(), new_socket, 0);
+      // The listener may be closed by the slot
+      if (!accept_event_) {
+        return;
+      }
+    }
+    if (accept_event_) {
+      event_service_->Add(accept_event_);
+    }
+  }
+}
+
+void AsyncListenerImpl::OnMessage(vzes::Message *msg) {
+  if (msg->message_id == MSG_ACCEPT_RETRY) {
+    accept_timer_.reset();
+    if (accept_event_) {
+      event_service_->Add(accept_event_);
+    }
   }
 }
 
@@ -417,12 +812,21 @@ bool AsyncConnecterImpl::Connect(const SocketAddress addr, uint32 time_out) {
     return false;
   }
   connect_address_ = addr;
+  if (time_out) {
+    monitor_ = event_service_->connection_monitor();
+    ASSERT_RETURN_FAILURE(!monitor_, false);
+    monitor_->Schedule(this, time_out);
+  }
   return event_service_->Add(connect_event_);
 
   return true;
 }
 
 void AsyncConnecterImpl::Close() {
+  if (monitor_) {
+    monitor_->Remove(this);
+    monitor_.reset();
+  }
   if (connect_event_) {
     connect_event_->Close();
     event_service_->Remove(connect_event_);
@@ -443,14 +847,35 @@ void AsyncConnecterImpl::OnConnectEvent(EventDispatcher::Ptr accept_event,
                                         Socket::Ptr socket,
                                         uint32 event_type,
                                         int err) {
+  if (monitor_) {
+    monitor_->Remove(this);
+    monitor_.reset();
+  }
   if (err || (event_type & DE_CLOSE)) {
     LOG(L_ERROR) << "Accept event error";
     SignalServerConnected(shared_from_this(), Socket::Ptr(), err);
     return ;
   }
   if (event_type & DE_CONNECT) {
-    SignalServerConnected(shared_from_this(), socket, err);
+    // 连接上的Socket交给调用者，之后Close()或者析构不会再关闭它
+    AsyncConnecter::Ptr live_this = shared_from_this();
+    connect_event_->Close();
+    event_service_->Remove(connect_event_);
+    connect_event_.reset();
+    socket_.reset();
+    SignalServerConnected(live_this, socket, err);
   }
 }
 
+void AsyncConnecterImpl::OnMonitorCheck(uint32 now) {
+  if (!connect_event_) {
+    return;
+  }
+  LOG(L_WARNING) << "Connect to " << connect_address_.ToString()
+                 << " timed out";
+  AsyncConnecter::Ptr live_this = shared_from_this();
+  Close();
+  SignalServerConnected(live_this, Socket::Ptr(), ETIMEDOUT);
+}
+
 }  // namespace vzes
@@ -11,6 +11,8 @@
 #ifndef EVENTSERVICE_NET_NETWORKDINTERFACE_IMPLEMENT_H_
 #define EVENTSERVICE_NET_NETWORKDINTERFACE_IMPLEMENT_H_
 
+#include <deque>
+
 #include "eventservice/net/networktinterface.h"
 #include "eventservice/net/eventservice.h"
 
@@ -18,6 +20,8 @@ namespace vzes {
 
 class AsyncSocketImpl : public MessageHandler,
   public AsyncSocket,
+  public Flushable,
+  public MonitorEntry,
   public boost::noncopyable,
   public sigslot::has_slots<>,
   public boost::enable_shared_from_this<AsyncSocketImpl> {
@@ -48,12 +52,31 @@ class AsyncSocketImpl : public MessageHandler,
 
   virtual int GetOption(Option opt, int* value);
   virtual int SetOption(Option opt, int value);
+  virtual void SetRecvSize(size_t size);
+  virtual bool SetZeroCopy(size_t threshold);
+  virtual void SetWriteCoalescing(bool enable);
+  virtual void SetWriteWatermarks(size_t high, size_t low,
+                                  OverflowPolicy policy);
+  virtual size_t GetWriteQueueSize() const;
+  virtual void SetIoBudget(size_t read_budget, size_t write_budget);
+  virtual void SetIdleTimeout(uint32 read_idle, uint32 write_idle);
+  virtual bool CheckConnection();
+
+  // 交出Socket给TcpRelay等使用，之后这个AsyncSocket就关闭了。
+  // 还有数据没有发送完时不能交出
+  bool CanDetachSocket() const;
+  Socket::Ptr DetachSocket();
  protected:
   AsyncSocketImpl(EventService::Ptr es, Socket::Ptr s);
   bool Init();
   friend class EventService;
  private:
   virtual void OnMessage(vzes::Message *msg);
+  // Inherit with Flushable
+  virtual void Flush();
+  // Inherit with MonitorEntry
+  virtual void OnMonitorCheck(uint32 now);
+  void ScheduleIdleCheck(uint32 now);
   void OnSocketEvent(EventDispatcher::Ptr accept_event,
                      Socket::Ptr socket,
                      uint32 event_type,
@@ -65,6 +88,10 @@ class AsyncSocketImpl : public MessageHandler,
   //
   void SocketReadComplete(MemBuffer::Ptr buffer);
   void SocketWriteComplete();
+  MemBuffer::Ptr EncodeBuffer(MemBuffer::Ptr buffer);
+  void ConsumeWriteBuffers(size_t size);
+  bool DropOldestWrites();
+  void CheckWriteWatermarks(bool overflow = false);
   int32 TryToWriteData(bool is_emit_close_event);
   void WaitToWriteData();
  private:
@@ -72,12 +99,28 @@ class AsyncSocketImpl : public MessageHandler,
   Socket::Ptr           socket_;
   EventDispatcher::Ptr  socket_event_;
   MemBuffer::Ptr        write_buffers_;    // 待发送数据包MemBuffer
-  std::string           encode_buffer_;    // 编码后数据缓存
+  size_t                write_offset_;     // 第一个Block已经发送的字节数
   PACKET_ENCODE_TYPE    encode_type_;      // 编码类型
   bool                  socket_writeable_; //
+  bool                  coalesce_writes_;  // 合并一轮中的多次写
+  bool                  flush_pending_;    // 已经PostFlush，还没执行
+  std::deque<size_t>    write_units_;      // 每次AsyncWrite占用的Block数
+  bool                  write_unit_started_; // 第一个写单元已经发送了一部分
+  size_t                write_high_watermark_;
+  size_t                write_low_watermark_;
+  OverflowPolicy        overflow_policy_;
+  bool                  write_blocked_;    // 已经发出SignalWriteBlocked
+  size_t                read_budget_;      // 每次读事件最多读的字节数
+  size_t                write_budget_;     // 每次写事件最多写的字节数
+  ConnectionMonitor::Ptr monitor_;
+  uint32                read_idle_;        // 读空闲超时，0表示不检查
+  uint32                write_idle_;       // 写空闲超时，0表示不检查
+  uint32                last_read_time_;   // 最后一次收到数据的时间
+  uint32                last_write_time_;  // 最后一次发送数据的时间
 };
 //
-class AsyncListenerImpl : public AsyncListener,
+class AsyncListenerImpl : public MessageHandler,
+  public AsyncListener,
   public boost::noncopyable,
   public sigslot::has_slots<>,
   public boost::enable_shared_from_this<AsyncListenerImpl> {
@@ -89,6 +132,15 @@ class AsyncListenerImpl : public AsyncListener,
   virtual bool Start(const SocketAddress addr, bool addr_reused);
   virtual void Close();
   virtual const SocketAddress BindAddress();
+  virtual void SetBacklog(int backlog);
+  virtual void SetAcceptBudget(int budget);
+  virtual void SetDeferAccept(int seconds);
+
+  // 设置SO_REUSEPORT，多个EventService可以监听同一个端口，由内核分配连接。
+  // Must be called before Start()
+  void SetReusePort(bool reuse_port) {
+    reuse_port_ = reuse_port;
+  }
  protected:
   AsyncListenerImpl(EventService::Ptr es);
   friend class EventService;
@@ -97,14 +149,22 @@ class AsyncListenerImpl : public AsyncListener,
                      Socket::Ptr socket,
                      uint32 event_type,
                      int err);
+  // 文件描述符用完时过一段时间再accept
+  virtual void OnMessage(vzes::Message *msg);
  private:
   EventService::Ptr           event_service_;
   Socket::Ptr                 socket_;
   EventDispatcher::Ptr   accept_event_;
+  Timer::Ptr                  accept_timer_;
   SocketAddress               listen_address_;
+  bool                        reuse_port_;
+  int                         backlog_;
+  int                         accept_budget_;
+  int                         defer_accept_;
 };
 
 class  AsyncConnecterImpl : public AsyncConnecter,
+  public MonitorEntry,
   public boost::noncopyable,
   public sigslot::has_slots<>,
   public boost::enable_shared_from_this<AsyncConnecterImpl> {
@@ -123,11 +183,14 @@ class  AsyncConnecterImpl : public AsyncConnecter,
                       Socket::Ptr socket,
                       uint32 event_type,
                       int err);
+  // Inherit with MonitorEntry, 连接超时
+  virtual void OnMonitorCheck(uint32 now);
  private:
   EventService::Ptr           event_service_;
   Socket::Ptr                 socket_;
   EventDispatcher::Ptr   connect_event_;
   SocketAddress               connect_address_;
+  ConnectionMonitor::Ptr      monitor_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -22,6 +22,8 @@
 #endif
 
 #define TIMEOUT_TIMES 4
+// 最多排队的数据报个数，超过后SendTo/SendBatch返回false
+#define MAX_SEND_QUEUE_DATAGRAMS 1024
 #ifdef WIN32
 #define WORKING_BUFFER_SIZE 15000
 #define MAX_TRIES 3
@@ -38,7 +40,8 @@ void bcopy(void* des, const void* src, int size) {
 namespace vzes {
 
 AsyncUdpSocketImpl::AsyncUdpSocketImpl(EventService::Ptr es)
-  : event_service_(es) {
+  : event_service_(es),
+    recv_batch_(1) {
 }
 
 AsyncUdpSocketImpl::~AsyncUdpSocketImpl() {
@@ -74,17 +77,67 @@ bool AsyncUdpSocketImpl::SendTo(MemBuffer::Ptr buffer,
   ASSERT_RETURN_FAILURE(!event_service_, false);
   ASSERT_RETURN_FAILURE(!socket_event_, false);
 
-  BlocksPtr &blocks = buffer->blocks();
-
-  for (BlocksPtr::iterator iter = blocks.begin();
-       iter != blocks.end(); iter++) {
-    Block::Ptr block = *iter;
-    int res = socket_->SendTo(block->buffer, block->buffer_size, addr);
-    if (res != block->buffer_size) {
+  if (send_queue_.empty()) {
+    // 整个MemBuffer是一个数据报
+    if (socket_->SendTo(buffer, addr) >= 0) {
+      return true;
+    }
+    if (!IsBlockingError(socket_->GetError())) {
       return false;
     }
   }
-  return true;
+  if (send_queue_.size() >= MAX_SEND_QUEUE_DATAGRAMS) {
+    LOG(L_WARNING) << "The send queue is full, drop the datagram";
+    return false;
+  }
+  Datagram datagram;
+  datagram.buffer = buffer;
+  datagram.addr = addr;
+  send_queue_.push_back(datagram);
+  return WaitToSend();
+}
+
+bool AsyncUdpSocketImpl::SendBatch(const Datagrams &datagrams) {
+  ASSERT_RETURN_FAILURE(!IsConnected(), false);
+  ASSERT_RETURN_FAILURE(!event_service_, false);
+  ASSERT_RETURN_FAILURE(!socket_event_, false);
+
+  size_t offset = 0;
+  if (send_queue_.empty()) {
+    while (offset < datagrams.size()) {
+      int res = socket_->SendToBatch(datagrams, offset);
+      if (res < 0) {
+        if (!IsBlockingError(socket_->GetError())) {
+          return false;
+        }
+        break;
+      }
+      offset += res;
+    }
+  }
+  if (offset == datagrams.size()) {
+    return true;
+  }
+  if (send_queue_.size() + datagrams.size() - offset >
+      MAX_SEND_QUEUE_DATAGRAMS) {
+    LOG(L_WARNING) << "The send queue is full, drop "
+                   << datagrams.size() - offset << " datagrams";
+    return false;
+  }
+  send_queue_.insert(send_queue_.end(), datagrams.begin() + offset,
+                     datagrams.end());
+  return WaitToSend();
+}
+
+bool AsyncUdpSocketImpl::WaitToSend() {
+  socket_event_->AddEvent(DE_WRITE);
+  return event_service_->Add(socket_event_);
+}
+
+void AsyncUdpSocketImpl::SetRecvBatch(size_t count, size_t max_datagram_size) {
+  ASSERT_RETURN_VOID(!socket_);
+  recv_batch_ = (count > 0) ? count : 1;
+  socket_->SetMaxDatagramSize(max_datagram_size);
 }
 
 bool AsyncUdpSocketImpl::AsyncRead() {
@@ -108,6 +161,7 @@ SocketAddress AsyncUdpSocketImpl::GetRemoteAddress() const {
 }
 
 void AsyncUdpSocketImpl::Close() {
+  send_queue_.clear();
   if (socket_) {
     socket_->Close();
     socket_.reset();
@@ -160,9 +214,14 @@ void AsyncUdpSocketImpl::OnSocketEvent(EventDispatcher::Ptr accept_event,
   if (event_type & DE_WRITE) {
     socket_event_->RemoveEvent(DE_WRITE);
     // LOG(L_INFO) << "Socket Write Event " << event_type;
+    SocketWriteEvent();
     if (!socket_event_) {
       return ;
     }
+    if (!(event_type & DE_READ)) {
+      // 写事件用掉了这次注册，重新注册读事件
+      event_service_->Add(socket_event_);
+    }
   }
   if (event_type & DE_READ) {
     // LOG(L_INFO) << "Socket Read Event " << event_type;
@@ -171,30 +230,48 @@ void AsyncUdpSocketImpl::OnSocketEvent(EventDispatcher::Ptr accept_event,
 }
 
 void AsyncUdpSocketImpl::SocketReadEvent() {
-  MemBuffer::Ptr buffer = MemBuffer::CreateMemBuffer();
-  SocketAddress   remote_addr;
-  int res = socket_->RecvFrom(buffer, &remote_addr);
-  int error_code = socket_->GetError();
-
-  if (res > 0) {
-    SocketReadComplete(buffer, remote_addr);
-  } else if (res == 0) {
-    // LOG(L_ERROR) << evutil_socket_error_to_string(error_code);
-    // Socket已经关闭了
-    BOOST_ASSERT(error_code == 0);
-    // SocketReadComplete(MemBuffer::Ptr(), error_code);
-    SocketErrorEvent(error_code);
-  } else {
-    // 接收数据出问题了
-    if (IsBlockingError(error_code)) {
-      // 数据阻塞，之后继续接收数据
-      return;
-    } else {
+  Datagrams datagrams;
+  int res = socket_->RecvFromBatch(&datagrams, recv_batch_);
+  if (res < 0) {
+    int error_code = socket_->GetError();
+    if (!IsBlockingError(error_code)) {
       // Socket出了问题
-      // SocketReadComplete(MemBuffer::Ptr(), error_code);
       SocketErrorEvent(error_code);
+      return;
     }
   }
+  if (datagrams.empty()) {
+    // 没有数据或者数据报被丢弃了，继续等待
+    AsyncRead();
+    return;
+  }
+  AsyncUdpSocketImpl::Ptr live_this = shared_from_this();
+  for (size_t i = 0; i < datagrams.size() && socket_; i++) {
+    SocketReadComplete(datagrams[i].buffer, datagrams[i].addr);
+  }
+}
+
+void AsyncUdpSocketImpl::SocketWriteEvent() {
+  size_t offset = 0;
+  while (offset < send_queue_.size()) {
+    int res = socket_->SendToBatch(send_queue_, offset);
+    if (res >= 0) {
+      offset += res;
+    } else if (IsBlockingError(socket_->GetError())) {
+      send_queue_.erase(send_queue_.begin(), send_queue_.begin() + offset);
+      WaitToSend();
+      return;
+    } else {
+      // 发不出去的数据报丢弃，继续发送后面的
+      LOG(L_WARNING) << "Drop a datagram to "
+                     << send_queue_[offset].addr.ToString()
+                     << ", error = " << socket_->GetError();
+      offset++;
+    }
+  }
+  send_queue_.clear();
+  AsyncUdpSocketImpl::Ptr live_this = shared_from_this();
+  SignalSocketWriteEvent(live_this);
 }
 
 void AsyncUdpSocketImpl::SocketErrorEvent(int err) {
@@ -29,7 +29,9 @@ class AsyncUdpSocketImpl : public AsyncUdpSocket,
   // Async write the data, if the operator complete, SignalWriteCompleteEvent
   // will be called
   virtual bool SendTo(MemBuffer::Ptr buffer, const SocketAddress &addr);
+  virtual bool SendBatch(const Datagrams &datagrams);
   virtual bool AsyncRead();
+  virtual void SetRecvBatch(size_t count, size_t max_datagram_size);
 
   // Returns the address to which the socket is bound.  If the socket is not
   // bound, then the any-address is returned.
@@ -57,7 +59,9 @@ class AsyncUdpSocketImpl : public AsyncUdpSocket,
                      uint32 event_type,
                      int err);
   void SocketReadEvent();
+  void SocketWriteEvent();
   void SocketErrorEvent(int err);
+  bool WaitToSend();
 
   //
   void SocketReadComplete(MemBuffer::Ptr buffer,
@@ -66,6 +70,9 @@ class AsyncUdpSocketImpl : public AsyncUdpSocket,
   EventService::Ptr           event_service_;
   Socket::Ptr                 socket_;
   EventDispatcher::Ptr        socket_event_;
+  size_t                      recv_batch_;
+  // 发送缓存满时排队的数据报
+  Datagrams                   send_queue_;
 };
 
 class MulticastAsyncUdpSocket : public AsyncUdpSocketImpl {
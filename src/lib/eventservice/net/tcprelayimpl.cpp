@@ -0,0 +1,337 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "eventservice/net/tcprelayimpl.h"
+
+#include <errno.h>
+#include <string.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#endif
+#include "eventservice/base/logging.h"
+
+// Linux上通过管道splice()，数据不进入用户空间
+#if defined(__linux__) && !defined(LITEOS)
+#define VZ_HAVE_SPLICE 1
+#endif
+
+namespace vzes {
+
+#define DEFAULT_HIGH_WATERMARK  (64 * 1024)
+#define DEFAULT_LOW_WATERMARK   (16 * 1024)
+
+TcpRelayImpl::TcpRelayImpl(EventService::Ptr es, Socket::Ptr a, Socket::Ptr b)
+  : event_service_(es),
+    closed_(false) {
+  sockets_[0] = boost::dynamic_pointer_cast<PhysicalSocket>(a);
+  sockets_[1] = boost::dynamic_pointer_cast<PhysicalSocket>(b);
+  for (int i = 0; i < 2; i++) {
+    Channel &channel = channels_[i];
+    channel.src = i;
+    channel.dst = 1 - i;
+    channel.pipe_fds[0] = -1;
+    channel.pipe_fds[1] = -1;
+    channel.begin = 0;
+    channel.buffered = 0;
+    channel.high_watermark = DEFAULT_HIGH_WATERMARK;
+    channel.low_watermark = DEFAULT_LOW_WATERMARK;
+    channel.paused = false;
+    channel.src_eof = false;
+    channel.done = false;
+    channel.want_read = false;
+    channel.want_write = false;
+    channel.bytes = 0;
+  }
+}
+
+TcpRelayImpl::~TcpRelayImpl() {
+  Close();
+}
+
+bool TcpRelayImpl::Init() {
+  ASSERT_RETURN_FAILURE(!sockets_[0] || !sockets_[1], false);
+  for (int i = 0; i < 2; i++) {
+#ifdef VZ_HAVE_SPLICE
+    if (pipe2(channels_[i].pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+      LOG_E(LS_ERROR, EN, errno) << "pipe2";
+      return false;
+    }
+#endif
+    socket_events_[i] = event_service_->CreateDispEvent(sockets_[i], 0);
+    ASSERT_RETURN_FAILURE(!socket_events_[i], false);
+    socket_events_[i]->SignalEvent.connect(this,
+                                           &TcpRelayImpl::OnSocketEvent);
+  }
+  return true;
+}
+
+void TcpRelayImpl::SetWatermarks(Direction dir, size_t high, size_t low) {
+  ASSERT_RETURN_VOID(high == 0 || low >= high);
+  Channel &channel = channels_[dir];
+#ifdef VZ_HAVE_SPLICE
+  if (high > DEFAULT_HIGH_WATERMARK) {
+    // 管道默认只能放64KB，不够时加大，超出系统限制时只能用管道的大小
+    fcntl(channel.pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(high));
+    int pipe_size = fcntl(channel.pipe_fds[1], F_GETPIPE_SZ);
+    if (pipe_size > 0 && static_cast<size_t>(pipe_size) < high) {
+      LOG(L_WARNING) << "The pipe only holds " << pipe_size << " bytes";
+      high = pipe_size;
+      low = _min(low, high / 2);
+    }
+  }
+#endif
+  channel.high_watermark = high;
+  channel.low_watermark = low;
+}
+
+bool TcpRelayImpl::Start() {
+  ASSERT_RETURN_FAILURE(closed_, false);
+#ifndef VZ_HAVE_SPLICE
+  for (int i = 0; i < 2; i++) {
+    channels_[i].buffer.resize(channels_[i].high_watermark);
+  }
+#endif
+  // 连接中可能已经有数据了
+  for (int i = 0; i < 2; i++) {
+    int err = Pump(&channels_[i]);
+    if (err) {
+      Finish(err);
+      return false;
+    }
+  }
+  UpdateEvents();
+  return true;
+}
+
+void TcpRelayImpl::Close() {
+  closed_ = true;
+  for (int i = 0; i < 2; i++) {
+    if (socket_events_[i]) {
+      socket_events_[i]->Close();
+      event_service_->Remove(socket_events_[i]);
+      socket_events_[i].reset();
+    }
+    if (sockets_[i]) {
+      sockets_[i]->Close();
+      sockets_[i].reset();
+    }
+#ifdef VZ_HAVE_SPLICE
+    for (int j = 0; j < 2; j++) {
+      if (channels_[i].pipe_fds[j] != -1) {
+        close(channels_[i].pipe_fds[j]);
+        channels_[i].pipe_fds[j] = -1;
+      }
+    }
+#endif
+  }
+}
+
+uint64 TcpRelayImpl::RelayedBytes(Direction dir) const {
+  return channels_[dir].bytes;
+}
+
+void TcpRelayImpl::OnSocketEvent(EventDispatcher::Ptr socket_event,
+                                 Socket::Ptr socket,
+                                 uint32 event_type,
+                                 int err) {
+  // 确保生命周期内不会因为外部删除而删除了整个对象
+  TcpRelayImpl::Ptr live_this = shared_from_this();
+  if (err || (event_type & DE_CLOSE)) {
+    Finish(err ? err : socket->GetError());
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    err = Pump(&channels_[i]);
+    if (err) {
+      Finish(err);
+      return;
+    }
+  }
+  if (channels_[0].done && channels_[1].done) {
+    Finish(0);
+    return;
+  }
+  UpdateEvents();
+}
+
+int TcpRelayImpl::Pump(Channel *channel) {
+  if (channel->done) {
+    return 0;
+  }
+  bool progress = true;
+  bool read_blocked = false;
+  while (progress) {
+    progress = false;
+    read_blocked = false;
+    if (!channel->src_eof && !channel->paused) {
+      int err = 0;
+      int res = Fill(channel, &err);
+      if (res > 0) {
+        channel->buffered += res;
+        channel->paused = channel->buffered >= channel->high_watermark;
+        progress = true;
+      } else if (res == 0) {
+        channel->src_eof = true;
+      } else if (err) {
+        return err;
+      } else if (channel->buffered == 0 || !SourceReadable(channel)) {
+        read_blocked = true;
+      }
+      // Otherwise the pipe is out of slots, wait until dst takes some data
+    }
+    if (channel->buffered > 0) {
+      int err = 0;
+      int res = Drain(channel, &err);
+      if (res > 0) {
+        channel->buffered -= res;
+        channel->bytes += res;
+        if (channel->paused
+            && channel->buffered <= channel->low_watermark) {
+          channel->paused = false;
+        }
+        progress = true;
+      } else if (err) {
+        return err;
+      }
+    }
+  }
+
+  channel->want_read = read_blocked;
+  channel->want_write = channel->buffered > 0;
+  if (channel->src_eof && channel->buffered == 0) {
+    // 把EOF转发给对端，另一个方向继续转发
+#ifdef WIN32
+    ::shutdown(sockets_[channel->dst]->GetSocket(), SD_SEND);
+#else
+    ::shutdown(sockets_[channel->dst]->GetSocket(), SHUT_WR);
+#endif
+    channel->done = true;
+  }
+  return 0;
+}
+
+int TcpRelayImpl::Fill(Channel *channel, int *err) {
+  size_t size = channel->high_watermark - channel->buffered;
+#ifdef VZ_HAVE_SPLICE
+  PhysicalSocket::Ptr src = sockets_[channel->src];
+  if (src->QueuedRecvSize() > 0) {
+    // io_uring完成模式下已经收到用户空间的数据，先写进管道
+    char data[4096];
+    int peek = src->Peek(data, _min(size, sizeof(data)));
+    if (peek <= 0) {
+      return -1;
+    }
+    ssize_t res = write(channel->pipe_fds[1], data, peek);
+    if (res < 0) {
+      if (!IsBlockingError(errno)) {
+        *err = errno;
+      }
+      return -1;
+    }
+    src->Recv(data, res);
+    return static_cast<int>(res);
+  }
+  ssize_t res = splice(sockets_[channel->src]->GetSocket(), NULL,
+                       channel->pipe_fds[1], NULL, size,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (res < 0 && !IsBlockingError(errno)) {
+    *err = errno;
+  }
+  return static_cast<int>(res);
+#else
+  if (channel->buffered == 0) {
+    channel->begin = 0;
+  } else if (channel->begin + channel->buffered == channel->buffer.size()) {
+    memmove(&channel->buffer[0], &channel->buffer[channel->begin],
+            channel->buffered);
+    channel->begin = 0;
+  }
+  size = channel->buffer.size() - channel->begin - channel->buffered;
+  int res = sockets_[channel->src]->Recv(
+              &channel->buffer[channel->begin + channel->buffered], size);
+  if (res < 0 && !IsBlockingError(sockets_[channel->src]->GetError())) {
+    *err = sockets_[channel->src]->GetError();
+  }
+  return res;
+#endif
+}
+
+int TcpRelayImpl::Drain(Channel *channel, int *err) {
+#ifdef VZ_HAVE_SPLICE
+  ssize_t res = splice(channel->pipe_fds[0], NULL,
+                       sockets_[channel->dst]->GetSocket(), NULL,
+                       channel->buffered,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (res < 0 && !IsBlockingError(errno)) {
+    *err = errno;
+  }
+  return static_cast<int>(res);
+#else
+  int res = sockets_[channel->dst]->Send(&channel->buffer[channel->begin],
+                                         channel->buffered);
+  if (res > 0) {
+    channel->begin += res;
+  } else if (res < 0
+             && !IsBlockingError(sockets_[channel->dst]->GetError())) {
+    *err = sockets_[channel->dst]->GetError();
+  }
+  return res;
+#endif
+}
+
+// splice在管道满的时候和socket没有数据的时候都返回EAGAIN，管道的容量按页
+// 计算，小包可能在达到high_watermark之前就占满了管道，这时src还是可读的
+bool TcpRelayImpl::SourceReadable(Channel *channel) {
+#ifdef VZ_HAVE_SPLICE
+  int available = 0;
+  if (ioctl(sockets_[channel->src]->GetSocket(), FIONREAD, &available) != 0) {
+    return false;
+  }
+  return available > 0;
+#else
+  return false;
+#endif
+}
+
+void TcpRelayImpl::UpdateEvents() {
+  for (int i = 0; i < 2; i++) {
+    uint32 events = 0;
+    if (channels_[i].want_read) {
+      events |= DE_READ;
+    }
+    if (channels_[1 - i].want_write) {
+      events |= DE_WRITE;
+    }
+    uint32 current = socket_events_[i]->get_enable_events();
+    if (current & ~events) {
+      socket_events_[i]->RemoveEvent(current & ~events);
+    }
+    if (events & ~current) {
+      socket_events_[i]->AddEvent(events & ~current);
+    }
+    if (events) {
+      event_service_->Add(socket_events_[i]);
+    }
+  }
+}
+
+void TcpRelayImpl::Finish(int err) {
+  if (closed_) {
+    return;
+  }
+  TcpRelay::Ptr live_this = shared_from_this();
+  Close();
+  SignalRelayClosed(live_this, err);
+}
+
+}  // namespace vzes
@@ -0,0 +1,78 @@
+﻿/*
+*  Copyright 2018 Vzenith guangleihe@vzenith.com. All rights reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef EVENTSERVICE_NET_TCPRELAY_IMPLEMENT_H_
+#define EVENTSERVICE_NET_TCPRELAY_IMPLEMENT_H_
+
+#include <vector>
+#include "eventservice/net/networktinterface.h"
+#include "eventservice/net/eventservice.h"
+
+namespace vzes {
+
+class TcpRelayImpl : public TcpRelay,
+  public boost::noncopyable,
+  public sigslot::has_slots<>,
+  public boost::enable_shared_from_this<TcpRelayImpl> {
+ public:
+  typedef boost::shared_ptr<TcpRelayImpl> Ptr;
+
+  virtual ~TcpRelayImpl();
+
+  // Inherit with TcpRelay
+  virtual void SetWatermarks(Direction dir, size_t high, size_t low);
+  virtual bool Start();
+  virtual void Close();
+  virtual uint64 RelayedBytes(Direction dir) const;
+ protected:
+  TcpRelayImpl(EventService::Ptr es, Socket::Ptr a, Socket::Ptr b);
+  bool Init();
+  friend class EventService;
+ private:
+  // 一个方向的转发状态，数据从src读出，暂存在管道(或者缓存)中，再写到dst
+  struct Channel {
+    int               src;
+    int               dst;
+    int               pipe_fds[2];   // splice使用的管道
+    std::vector<char> buffer;        // 不支持splice时的中转缓存
+    size_t            begin;         // 中转缓存中数据的起始位置
+    size_t            buffered;      // 中转的字节数
+    size_t            high_watermark;
+    size_t            low_watermark;
+    bool              paused;        // 达到high_watermark后暂停读取
+    bool              src_eof;       // src已经读到EOF
+    bool              done;          // EOF已经转发给dst
+    bool              want_read;     // 等待src可读
+    bool              want_write;    // 等待dst可写
+    uint64            bytes;
+  };
+  void OnSocketEvent(EventDispatcher::Ptr socket_event,
+                     Socket::Ptr socket,
+                     uint32 event_type,
+                     int err);
+  // 尽量转发数据，返回错误码，0表示没有出错
+  int Pump(Channel *channel);
+  // 返回读写的字节数，0表示EOF，-1表示暂时不能读写或者出错(err不为0)
+  int Fill(Channel *channel, int *err);
+  int Drain(Channel *channel, int *err);
+  bool SourceReadable(Channel *channel);
+  void UpdateEvents();
+  void Finish(int err);
+ private:
+  EventService::Ptr     event_service_;
+  PhysicalSocket::Ptr   sockets_[2];
+  EventDispatcher::Ptr  socket_events_[2];
+  Channel               channels_[2];
+  bool                  closed_;
+};
+
+}  // namespace vzes
+
+#endif  // EVENTSERVICE_NET_TCPRELAY_IMPLEMENT_H_
@@ -40,7 +40,7 @@ Tls::Tls() {
 Tls::~Tls() {
 }
 
-void Tls::CreateKey(TLS_KEY *key) {
+void Tls::CreateKey(TLS_KEY *key, void (*destructor)(void *)) {
   *key = TlsAlloc();
 }
 
@@ -65,7 +65,7 @@ Tls::Tls() {
 Tls::~Tls() {
 }
 
-void Tls::CreateKey(TLS_KEY *key) {
+void Tls::CreateKey(TLS_KEY *key, void (*destructor)(void *)) {
   *key = (void *)(new LiteOSKeys());
 }
 
@@ -92,8 +92,8 @@ Tls::Tls() {
 Tls::~Tls() {
 }
 
-void Tls::CreateKey(TLS_KEY *key) {
-  pthread_key_create(key, NULL);
+void Tls::CreateKey(TLS_KEY *key, void (*destructor)(void *)) {
+  pthread_key_create(key, destructor);
 }
 
 void Tls::DeleteKey(TLS_KEY key) {
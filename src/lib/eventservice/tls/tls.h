@@ -50,7 +50,8 @@ class Tls {
  public:
   Tls();
   virtual ~Tls();
-  void CreateKey(TLS_KEY *key);
+  // destructor在线程退出时以不为NULL的值调用，Windows和LiteOS上不调用
+  void CreateKey(TLS_KEY *key, void (*destructor)(void *) = NULL);
   void DeleteKey(TLS_KEY key);
   void SetKey(TLS_KEY key, void *value);
   void *GetKey(TLS_KEY key);
@@ -408,10 +408,10 @@ int CachedService::OnAsyncSaveFile(CachedStanza::Ptr stanza) {
   for (vzes::BlocksPtr::iterator iter = block_list.begin();
        iter != block_list.end(); iter++) {
     vzes::Block::Ptr block = *iter;
-    const char *pdata = (const char*)block->buffer;
+    const char *pdata = (const char*)block->data();
     std::size_t res = 0;
 
-    res = fwrite(pdata, 1, block->buffer_size, fp);
+    res = fwrite(pdata, 1, block->size(), fp);
     //LOG(INFO) << "res = " << res
     //		  << "\t write size = "
     //		  << write_size
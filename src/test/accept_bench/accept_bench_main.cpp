@@ -0,0 +1,195 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 模拟设备断网后集中重连：瞬间发起大量非阻塞连接，统计服务端accept完所有
+// 连接的速度。对比旧的Listen(10)、每次事件只accept一个连接的方式。
+// backlog小时会丢SYN，客户端要等重传，每轮最多等ROUND_TIMEOUT，
+// 报告accept到的连接占发起的比例。
+// 用法: accept_bench [连接数] [轮数]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define ACCEPT_PORT   5577
+#define ROUND_TIMEOUT 3000
+
+struct AcceptCase {
+  const char *name;
+  int backlog;
+  int budget;
+};
+
+static const AcceptCase ACCEPT_CASES[] = {
+  {"backlog 10, 1 per event", 10, 1},
+  {"backlog SOMAXCONN, 64 per event", SOMAXCONN, 64},
+};
+
+class AcceptCounter : public sigslot::has_slots<> {
+ public:
+  explicit AcceptCounter(vzes::SignalEvent::Ptr done_event)
+    : done_event_(done_event),
+      accepted_(0),
+      target_(0) {
+  }
+
+  void Reset(size_t target) {
+    vzes::CritScope cs(&crit_);
+    accepted_ = 0;
+    target_ = target;
+  }
+
+  size_t accepted() {
+    vzes::CritScope cs(&crit_);
+    return accepted_;
+  }
+
+  void OnNewConnected(vzes::AsyncListener::Ptr listener,
+                      vzes::Socket::Ptr s,
+                      int err) {
+    if (!s) {
+      return;
+    }
+    s->Close();
+    vzes::CritScope cs(&crit_);
+    if (++accepted_ == target_) {
+      done_event_->TriggerSignal();
+    }
+  }
+
+ private:
+  vzes::SignalEvent::Ptr  done_event_;
+  vzes::CriticalSection   crit_;
+  size_t                  accepted_;
+  size_t                  target_;
+};
+
+// Fire all the SYNs at once, like the devices coming back after a blip
+static bool ConnectStorm(size_t count, std::vector<int> *clients) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(ACCEPT_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (size_t i = 0; i < count; i++) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+      return false;
+    }
+    clients->push_back(fd);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        && errno != EINPROGRESS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void CloseAll(std::vector<int> *clients) {
+  for (size_t i = 0; i < clients->size(); i++) {
+    close((*clients)[i]);
+  }
+  clients->clear();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t connections = (argc > 1) ? atoi(argv[1]) : 1000;
+  int rounds = (argc > 2) ? atoi(argv[2]) : 1;
+
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  getrlimit(RLIMIT_NOFILE, &limit);
+  if (connections + 64 > limit.rlim_cur) {
+    connections = limit.rlim_cur - 64;
+  }
+
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "AcceptBench");
+  vzes::SignalEvent::Ptr done_event = vzes::SignalEvent::CreateSignalEvent();
+  AcceptCounter counter(done_event);
+
+  size_t case_size = sizeof(ACCEPT_CASES) / sizeof(ACCEPT_CASES[0]);
+  for (size_t i = 0; i < case_size; i++) {
+    vzes::AsyncListener::Ptr listener = event_service->CreateAsyncListener();
+    listener->SetBacklog(ACCEPT_CASES[i].backlog);
+    listener->SetAcceptBudget(ACCEPT_CASES[i].budget);
+    listener->SignalNewConnected.connect(&counter,
+                                         &AcceptCounter::OnNewConnected);
+    if (!listener->Start(vzes::SocketAddress("127.0.0.1", ACCEPT_PORT),
+                         true)) {
+      printf("Failure to start the listener\n");
+      return EXIT_FAILURE;
+    }
+    event_service->WakeUp();
+
+    uint32 total_time = 0;
+    size_t total_accepted = 0;
+    size_t total_attempted = 0;
+    for (int round = 0; round < rounds; round++) {
+      std::vector<int> clients;
+      counter.Reset(connections);
+      uint32 start_time = vzes::Time();
+      bool res = ConnectStorm(connections, &clients);
+      if (res) {
+        done_event->WaitSignal(ROUND_TIMEOUT);
+      }
+      total_time += vzes::TimeSince(start_time);
+      total_accepted += counter.accepted();
+      total_attempted += clients.size();
+      CloseAll(&clients);
+      if (!res) {
+        printf("Failure to connect, errno %d\n", errno);
+        break;
+      }
+    }
+    printf("%-34s: %u/%u accepted (%5.1f%%), %8.0f accepts/s\n",
+           ACCEPT_CASES[i].name,
+           (unsigned)total_accepted,
+           (unsigned)total_attempted,
+           total_accepted * 100.0 / vzes::_max(total_attempted, (size_t)1),
+           total_accepted * 1000.0 / vzes::_max(total_time, 1u));
+    listener->Close();
+  }
+  event_service->UninitEventService();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 统计典型业务数据下MemBuffer存放的字节数和实际分配的字节数：
+// 按发送(一次WriteBytes)和接收(每次最多读64KB)两种方式生成MemBuffer，
+// 和原来固定768字节的Block对比。分配的字节数包括Block头、数据区、
+// std::list节点和shared_ptr的控制块。
+// 用法: blockmem_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "eventservice/mem/membuffer.h"
+
+#define OLD_BLOCK_SIZE  768
+#define RECV_CHUNK_SIZE (64 * 1024)
+
+struct TrafficClass {
+  const char *name;
+  size_t      min_size;
+  size_t      max_size;
+  size_t      count;
+};
+
+// 心跳和控制包、JSON命令、抓拍图片、Filecache中的大文件
+static const TrafficClass TRAFFIC_MIX[] = {
+  {"control", 8,            64,              10000},
+  {"json",    200,          1500,            2000},
+  {"image",   20 * 1024,    200 * 1024,      100},
+  {"file",    1024 * 1024,  4 * 1024 * 1024, 5}
+};
+
+// list节点(两个指针加一个shared_ptr)和shared_ptr控制块的大小
+static const size_t NODE_OVERHEAD = 2 * sizeof(void *) + sizeof(vzes::Block::Ptr)
+                                    + 4 * sizeof(void *);
+
+struct Usage {
+  Usage() : stored(0), blocks(0), allocated(0) {
+  }
+  void Add(vzes::MemBuffer::Ptr buffer) {
+    vzes::BlocksPtr &list = buffer->blocks();
+    for (vzes::BlocksPtr::iterator iter = list.begin();
+         iter != list.end(); ++iter) {
+      blocks++;
+      allocated += sizeof(vzes::Block) + (*iter)->capacity + NODE_OVERHEAD;
+    }
+    stored += buffer->size();
+  }
+  // 原来的Block数据区是Block中的数组，没有buffer和capacity两个字段
+  void AddOld(size_t size) {
+    size_t count = (size + OLD_BLOCK_SIZE - 1) / OLD_BLOCK_SIZE;
+    blocks    += count;
+    allocated += count * (sizeof(vzes::Block) - 2 * sizeof(void *)
+                          + OLD_BLOCK_SIZE + NODE_OVERHEAD);
+    stored    += size;
+  }
+  void Print(const char *name, const char *path) const {
+    printf("%-8s %-6s %12llu %10llu %12llu %8.1f%%\n", name, path,
+           (unsigned long long)stored, (unsigned long long)blocks,
+           (unsigned long long)allocated,
+           allocated ? stored * 100.0 / allocated : 0.0);
+  }
+  void Merge(const Usage &usage) {
+    stored    += usage.stored;
+    blocks    += usage.blocks;
+    allocated += usage.allocated;
+  }
+  uint64 stored;
+  uint64 blocks;
+  uint64 allocated;
+};
+
+// 发送方一次写入整个消息
+static vzes::MemBuffer::Ptr BuildWrite(const char *data, size_t size) {
+  vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+  buffer->WriteBytes(data, size);
+  return buffer;
+}
+
+// 和PhysicalSocket::Recv一样按每次可读的数据量取Block
+static vzes::MemBuffer::Ptr BuildRecv(size_t size) {
+  vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+  while (size > 0) {
+    size_t chunk = vzes::_min(size, static_cast<size_t>(RECV_CHUNK_SIZE));
+    vzes::BlocksPtr blocks;
+    vzes::Block::TakeBlocksFor(chunk, 256, &blocks);
+    size_t remain = chunk;
+    for (vzes::BlocksPtr::iterator iter = blocks.begin();
+         iter != blocks.end(); ++iter) {
+      (*iter)->SetSize(vzes::_min(remain, (*iter)->capacity));
+      remain -= (*iter)->size();
+      buffer->AppendBlock(*iter);
+    }
+    size -= chunk;
+  }
+  return buffer;
+}
+
+int main(void) {
+  srand(1);
+  std::vector<char> data(4 * 1024 * 1024);
+  Usage total_old, total_write, total_recv;
+  printf("%-8s %-6s %12s %10s %12s %9s\n",
+         "traffic", "path", "stored", "blocks", "allocated", "used");
+  size_t class_size = sizeof(TRAFFIC_MIX) / sizeof(TRAFFIC_MIX[0]);
+  for (size_t i = 0; i < class_size; i++) {
+    const TrafficClass &traffic = TRAFFIC_MIX[i];
+    Usage old_usage, write_usage, recv_usage;
+    for (size_t n = 0; n < traffic.count; n++) {
+      size_t size = traffic.min_size +
+                    rand() % (traffic.max_size - traffic.min_size + 1);
+      old_usage.AddOld(size);
+      write_usage.Add(BuildWrite(&data[0], size));
+      recv_usage.Add(BuildRecv(size));
+    }
+    old_usage.Print(traffic.name, "768");
+    write_usage.Print(traffic.name, "write");
+    recv_usage.Print(traffic.name, "recv");
+    total_old.Merge(old_usage);
+    total_write.Merge(write_usage);
+    total_recv.Merge(recv_usage);
+  }
+  total_old.Print("total", "768");
+  total_write.Print("total", "write");
+  total_recv.Print("total", "recv");
+  return EXIT_SUCCESS;
+}
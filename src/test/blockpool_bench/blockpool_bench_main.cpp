@@ -0,0 +1,184 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 测量多线程下取Block和释放Block的开销：
+// local: 每个线程自己取一批Block再释放；
+// cross: 一半线程取Block交给另一半线程释放，模拟网络线程收数据、
+//        工作线程释放的情况。
+// 用法: blockpool_bench [每个线程的Block数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "eventservice/event/thread.h"
+#include "eventservice/mem/membuffer.h"
+#include "eventservice/base/timeutils.h"
+#include "eventservice/base/logging.h"
+
+#define BATCH_BLOCKS  32
+
+typedef std::vector<vzes::Block::Ptr> BlockBatch;
+
+// 生产者和消费者之间传递Block的队列，一次传一批
+class BlockQueue {
+ public:
+  BlockQueue() : closed_(false) {
+  }
+  void Push(BlockBatch *blocks) {
+    vzes::CritScope cr(&crit_);
+    batches_.push_back(BlockBatch());
+    batches_.back().swap(*blocks);
+  }
+  void Close() {
+    vzes::CritScope cr(&crit_);
+    closed_ = true;
+  }
+  // 队列空了而且关闭之后返回false
+  bool Pop(BlockBatch *blocks) {
+    while (true) {
+      {
+        vzes::CritScope cr(&crit_);
+        if (!batches_.empty()) {
+          blocks->swap(batches_.front());
+          batches_.pop_front();
+          return true;
+        }
+        if (closed_) {
+          return false;
+        }
+      }
+      vzes::Thread::SleepMs(0);
+    }
+  }
+ private:
+  vzes::CriticalSection          crit_;
+  std::list<BlockBatch>          batches_;
+  bool                           closed_;
+};
+
+class LocalWorker : public vzes::Runnable {
+ public:
+  explicit LocalWorker(uint32 count) : count_(count) {
+  }
+  virtual void Run(vzes::Thread *thread) {
+    BlockBatch blocks;
+    blocks.reserve(BATCH_BLOCKS);
+    for (uint32 i = 0; i < count_; i += BATCH_BLOCKS) {
+      for (uint32 n = 0; n < BATCH_BLOCKS; n++) {
+        blocks.push_back(vzes::Block::TakeBlock(DEFAULT_BLOCK_SIZE));
+      }
+      blocks.clear();
+    }
+  }
+ private:
+  uint32 count_;
+};
+
+class Producer : public vzes::Runnable {
+ public:
+  Producer(BlockQueue *queue, uint32 count) : queue_(queue), count_(count) {
+  }
+  virtual void Run(vzes::Thread *thread) {
+    BlockBatch blocks;
+    blocks.reserve(BATCH_BLOCKS);
+    for (uint32 i = 0; i < count_; i += BATCH_BLOCKS) {
+      for (uint32 n = 0; n < BATCH_BLOCKS; n++) {
+        blocks.push_back(vzes::Block::TakeBlock(DEFAULT_BLOCK_SIZE));
+      }
+      queue_->Push(&blocks);
+    }
+    queue_->Close();
+  }
+ private:
+  BlockQueue *queue_;
+  uint32      count_;
+};
+
+class Consumer : public vzes::Runnable {
+ public:
+  explicit Consumer(BlockQueue *queue) : queue_(queue) {
+  }
+  virtual void Run(vzes::Thread *thread) {
+    BlockBatch blocks;
+    while (queue_->Pop(&blocks)) {
+      blocks.clear();
+    }
+  }
+ private:
+  BlockQueue *queue_;
+};
+
+static void RunThreads(const char *name, size_t thread_count,
+                       const std::vector<vzes::Runnable *> &runnables,
+                       uint32 blocks) {
+  std::vector<vzes::Thread *> threads;
+  uint64 start_time = vzes::TimeNanos();
+  for (size_t i = 0; i < runnables.size(); i++) {
+    threads.push_back(new vzes::Thread());
+    threads.back()->Start(runnables[i]);
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->Stop();
+    delete threads[i];
+    delete runnables[i];
+  }
+  uint64 elapsed = vzes::TimeNanos() - start_time;
+  printf("%-6s %2u threads: %6.1f ns per take+free, %6.2f M blocks/s\n",
+         name, (unsigned)thread_count, (double)elapsed / blocks,
+         blocks * 1000.0 / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+  uint32 count = (argc > 1) ? atoi(argv[1]) : 2000000;
+  static const size_t THREADS[] = {1, 2, 4, 8};
+  size_t case_size = sizeof(THREADS) / sizeof(THREADS[0]);
+  for (size_t i = 0; i < case_size; i++) {
+    std::vector<vzes::Runnable *> runnables;
+    for (size_t n = 0; n < THREADS[i]; n++) {
+      runnables.push_back(new LocalWorker(count));
+    }
+    RunThreads("local", THREADS[i], runnables, THREADS[i] * count);
+  }
+  for (size_t i = 1; i < case_size; i++) {
+    std::vector<vzes::Runnable *> runnables;
+    std::vector<BlockQueue *> queues;
+    for (size_t n = 0; n < THREADS[i] / 2; n++) {
+      queues.push_back(new BlockQueue());
+      runnables.push_back(new Producer(queues.back(), count));
+      runnables.push_back(new Consumer(queues.back()));
+    }
+    RunThreads("cross", THREADS[i], runnables, THREADS[i] / 2 * count);
+    for (size_t n = 0; n < queues.size(); n++) {
+      delete queues[n];
+    }
+  }
+  return EXIT_SUCCESS;
+}
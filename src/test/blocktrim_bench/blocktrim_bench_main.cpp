@@ -0,0 +1,97 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 模拟一次图片上传的突发：先占用大量Block再全部释放，观察空闲上限、
+// BlockPoolTrimmer定时整理之后Block池的统计和进程RSS的变化。
+// 用法: blocktrim_bench [突发的MB数] [整理间隔毫秒]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "eventservice/mem/blockpooltrimmer.h"
+#include "eventservice/base/logging.h"
+
+static size_t ResidentKB() {
+  long pages = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (file != NULL) {
+    if (fscanf(file, "%*s %ld", &pages) != 1) {
+      pages = 0;
+    }
+    fclose(file);
+  }
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void PrintStats(const char *name) {
+  vzes::BlockPoolStats stats;
+  vzes::BlockPool::GetStats(&stats);
+  printf("%-12s in use %6u KB (%6u), free %6u KB (%6u), heap %6u KB, "
+         "peak %6u KB, %8u takes/s, rss %6u KB\n", name,
+         (unsigned)(stats.bytes_in_use / 1024), (unsigned)stats.blocks_in_use,
+         (unsigned)(stats.bytes_free / 1024), (unsigned)stats.blocks_free,
+         (unsigned)(stats.bytes_allocated / 1024),
+         (unsigned)(stats.peak_bytes_allocated / 1024),
+         stats.takes_per_second, (unsigned)ResidentKB());
+}
+
+int main(int argc, char *argv[]) {
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+  size_t burst_mb = (argc > 1) ? atoi(argv[1]) : 64;
+  uint32 interval = (argc > 2) ? atoi(argv[2]) : 200;
+
+  PrintStats("start");
+  {
+    // 每张图片200KB，一次WriteBytes写入
+    std::vector<char> image(200 * 1024, 'x');
+    std::vector<vzes::MemBuffer::Ptr> buffers;
+    for (size_t i = 0; i < burst_mb * 1024 / 200; i++) {
+      buffers.push_back(vzes::MemBuffer::CreateMemBuffer());
+      buffers.back()->WriteBytes(&image[0], image.size());
+    }
+    PrintStats("burst");
+  }
+  PrintStats("released");
+
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "TrimBench");
+  vzes::BlockPoolTrimmer::Ptr trimmer =
+    vzes::BlockPoolTrimmer::Create(event_service, interval);
+  for (int i = 0; i < 8; i++) {
+    vzes::Thread::SleepMs(interval);
+    char name[16];
+    snprintf(name, sizeof(name), "trim %d", i + 1);
+    PrintStats(name);
+  }
+  trimmer.reset();
+  event_service->UninitEventService();
+  return EXIT_SUCCESS;
+}
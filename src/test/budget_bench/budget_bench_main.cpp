@@ -0,0 +1,253 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 测量读写预算对公平性的影响：同一个EventService上有一条大流量的连接一直
+// 在传数据，另外几条连接做小包的请求应答，比较不设预算和设置预算时请求
+// 应答的延时分布(中位数、99%、99.9%和最大值)以及大流量连接的吞吐。
+// 用法: budget_bench [预算KB] [请求应答连接数] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_STOP      2
+
+#define RPC_SIZE      64            // 请求和应答的大小
+#define BULK_CHUNK    (256 * 1024)  // 大流量连接每次写的字节数
+
+class BudgetBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  BudgetBench(vzes::EventService::Ptr event_service,
+              size_t budget,
+              size_t rpc_pairs)
+    : event_service_(event_service),
+      budget_(budget),
+      rpc_pairs_(rpc_pairs),
+      bulk_bytes_(0),
+      bulk_chunk_(BULK_CHUNK, 'b') {
+  }
+
+  // MSG_STOP之后读取
+  std::vector<uint32> &latencies() {
+    return latencies_;
+  }
+  uint64 bulk_bytes() const {
+    return bulk_bytes_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_STOP) {
+      for (size_t i = 0; i < sockets_.size(); i++) {
+        sockets_[i]->Close();
+      }
+    }
+  }
+
+ private:
+  struct RpcClient {
+    uint64 send_time;
+    size_t received;
+  };
+
+  vzes::AsyncSocket::Ptr WrapSocket(int fd) {
+    vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                                 vzes::Thread::Current()->socketserver());
+    vzes::AsyncSocket::Ptr async_socket =
+      event_service_->CreateAsyncSocket(ns->WrapSocket(fd));
+    async_socket->SetIoBudget(budget_, budget_);
+    sockets_.push_back(async_socket);
+    return async_socket;
+  }
+
+  // 建立一对本地TCP连接
+  static bool TcpPair(int fds[2]) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&addr, &len) != 0) {
+      close(listener);
+      return false;
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(listener);
+      return false;
+    }
+    fds[1] = accept(listener, NULL, NULL);
+    close(listener);
+    return fds[1] >= 0;
+  }
+
+  void Start() {
+    int fds[2];
+    VZ_VERIFY(TcpPair(fds));
+    bulk_sender_ = WrapSocket(fds[0]);
+    bulk_receiver_ = WrapSocket(fds[1]);
+    bulk_sender_->SignalSocketWriteEvent.connect(
+      this, &BudgetBench::OnBulkWrite);
+    bulk_receiver_->SignalSocketReadEvent.connect(
+      this, &BudgetBench::OnBulkRead);
+    bulk_receiver_->AsyncRead();
+
+    for (size_t i = 0; i < rpc_pairs_; i++) {
+      VZ_VERIFY(TcpPair(fds));
+      vzes::AsyncSocket::Ptr client = WrapSocket(fds[0]);
+      vzes::AsyncSocket::Ptr server = WrapSocket(fds[1]);
+      client->SetOption(vzes::OPT_NODELAY, 1);
+      server->SetOption(vzes::OPT_NODELAY, 1);
+      client->SignalSocketReadEvent.connect(this, &BudgetBench::OnRpcReply);
+      server->SignalSocketReadEvent.connect(this, &BudgetBench::OnRpcRequest);
+      client->AsyncRead();
+      server->AsyncRead();
+      clients_[client.get()].received = 0;
+      SendRequest(client);
+    }
+    bulk_sender_->AsyncWrite(bulk_chunk_.c_str(), bulk_chunk_.size());
+  }
+
+  // 发送队列写完了，接着写下一块
+  void OnBulkWrite(vzes::AsyncSocket::Ptr async_socket) {
+    async_socket->AsyncWrite(bulk_chunk_.c_str(), bulk_chunk_.size());
+  }
+
+  void OnBulkRead(vzes::AsyncSocket::Ptr async_socket,
+                  vzes::MemBuffer::Ptr data) {
+    bulk_bytes_ += data->size();
+    async_socket->AsyncRead();
+  }
+
+  void SendRequest(vzes::AsyncSocket::Ptr client) {
+    char request[RPC_SIZE] = {0};
+    clients_[client.get()].send_time = vzes::TimeNanos();
+    client->AsyncWrite(request, sizeof(request));
+  }
+
+  void OnRpcRequest(vzes::AsyncSocket::Ptr async_socket,
+                    vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncWrite(data);
+    async_socket->AsyncRead();
+  }
+
+  void OnRpcReply(vzes::AsyncSocket::Ptr async_socket,
+                  vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncRead();
+    RpcClient &client = clients_[async_socket.get()];
+    client.received += data->size();
+    if (client.received < RPC_SIZE) {
+      return;
+    }
+    client.received -= RPC_SIZE;
+    uint64 elapsed = vzes::TimeNanos() - client.send_time;
+    latencies_.push_back(static_cast<uint32>(elapsed / 1000));
+    SendRequest(async_socket);
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  size_t                   budget_;
+  size_t                   rpc_pairs_;
+  std::vector<vzes::AsyncSocket::Ptr> sockets_;
+  vzes::AsyncSocket::Ptr   bulk_sender_;
+  vzes::AsyncSocket::Ptr   bulk_receiver_;
+  std::map<vzes::AsyncSocket *, RpcClient> clients_;
+  std::vector<uint32>      latencies_;  // 微秒
+  uint64                   bulk_bytes_;
+  std::string              bulk_chunk_;
+};
+
+static uint32 Percentile(const std::vector<uint32> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[index];
+}
+
+static void RunCase(size_t budget, size_t rpc_pairs, int seconds) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "BudgetBench");
+  BudgetBench bench(event_service, budget, rpc_pairs);
+  event_service->Post(&bench, MSG_START);
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  // Send返回之后EventService线程不会再修改统计
+  event_service->Send(&bench, MSG_STOP);
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  std::vector<uint32> &latencies = bench.latencies();
+  std::sort(latencies.begin(), latencies.end());
+  char name[32];
+  if (budget) {
+    snprintf(name, sizeof(name), "%uKB", (unsigned)(budget / 1024));
+  } else {
+    snprintf(name, sizeof(name), "none");
+  }
+  printf("budget %-5s: %8u rpcs, p50 %6u us, p99 %6u us, p99.9 %6u us, "
+         "max %6u us, bulk %6.1f MB/s\n",
+         name, (unsigned)latencies.size(),
+         Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+         Percentile(latencies, 0.999), Percentile(latencies, 1.0),
+         bench.bulk_bytes() * 1000.0 / elapsed / (1024 * 1024));
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t budget = ((argc > 1) ? atoi(argv[1]) : 64) * 1024;
+  size_t rpc_pairs = (argc > 2) ? atoi(argv[2]) : 8;
+  int seconds = (argc > 3) ? atoi(argv[3]) : 3;
+
+  printf("%u rpc connections next to one bulk flow\n", (unsigned)rpc_pairs);
+  RunCase(0, rpc_pairs, seconds);
+  RunCase(budget, rpc_pairs, seconds);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 测量合并写的效果：一对本地TCP连接做乒乓，每个应答分成多次AsyncWrite
+// 写出去(比如包头加包体)，比较直接发送、直接发送加TCP_NODELAY和合并写
+// 每秒的往返次数。
+// 用法: coalesce_bench [每个应答的写次数] [每次写的字节数] [秒数]
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_STOP      2
+
+enum WriteMode {
+  WRITE_DIRECT,    // 每次AsyncWrite直接发送
+  WRITE_NODELAY,   // 直接发送，并且设置TCP_NODELAY
+  WRITE_COALESCE   // 合并写
+};
+static const char *MODE_NAMES[] = {"direct", "nodelay", "coalesce"};
+
+class CoalesceBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  CoalesceBench(vzes::EventService::Ptr event_service,
+                size_t writes,
+                size_t write_size,
+                WriteMode mode)
+    : event_service_(event_service),
+      writes_(writes),
+      write_size_(write_size),
+      mode_(mode),
+      rounds_(0) {
+  }
+
+  uint64 rounds() {
+    vzes::CritScope cs(&crit_);
+    return rounds_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_STOP) {
+      ping_->Close();
+      pong_->Close();
+    }
+  }
+
+ private:
+  vzes::AsyncSocket::Ptr WrapSocket(int fd) {
+    vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                                 vzes::Thread::Current()->socketserver());
+    return event_service_->CreateAsyncSocket(ns->WrapSocket(fd));
+  }
+
+  // 建立一对本地TCP连接
+  static bool TcpPair(int fds[2]) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&addr, &len) != 0) {
+      close(listener);
+      return false;
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(listener);
+      return false;
+    }
+    fds[1] = accept(listener, NULL, NULL);
+    close(listener);
+    return fds[1] >= 0;
+  }
+
+  void Start() {
+    int fds[2];
+    VZ_VERIFY(TcpPair(fds));
+    ping_ = WrapSocket(fds[0]);
+    pong_ = WrapSocket(fds[1]);
+    // 合并写不修改TCP_NODELAY，和nodelay一样自己设置
+    if (mode_ == WRITE_NODELAY || mode_ == WRITE_COALESCE) {
+      ping_->SetOption(vzes::OPT_NODELAY, 1);
+      pong_->SetOption(vzes::OPT_NODELAY, 1);
+    }
+    if (mode_ == WRITE_COALESCE) {
+      ping_->SetWriteCoalescing(true);
+      pong_->SetWriteCoalescing(true);
+    }
+    ping_->SignalSocketReadEvent.connect(this, &CoalesceBench::OnRead);
+    pong_->SignalSocketReadEvent.connect(this, &CoalesceBench::OnRead);
+    ping_->AsyncRead();
+    pong_->AsyncRead();
+    ping_received_ = 0;
+    pong_received_ = 0;
+    WriteMessage(ping_);
+  }
+
+  // 一个消息分成writes_次写
+  void WriteMessage(vzes::AsyncSocket::Ptr async_socket) {
+    std::string data(write_size_, 'c');
+    for (size_t i = 0; i < writes_; i++) {
+      async_socket->AsyncWrite(data.c_str(), data.size());
+    }
+  }
+
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncRead();
+    size_t *received = (async_socket == ping_) ?
+                       &ping_received_ : &pong_received_;
+    *received += data->size();
+    // 收齐一个消息再应答
+    if (*received < writes_ * write_size_) {
+      return;
+    }
+    *received -= writes_ * write_size_;
+    if (async_socket == ping_) {
+      vzes::CritScope cs(&crit_);
+      rounds_++;
+    }
+    WriteMessage(async_socket);
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  size_t                   writes_;
+  size_t                   write_size_;
+  WriteMode                mode_;
+  vzes::AsyncSocket::Ptr   ping_;
+  vzes::AsyncSocket::Ptr   pong_;
+  size_t                   ping_received_;
+  size_t                   pong_received_;
+  vzes::CriticalSection    crit_;
+  uint64                   rounds_;
+};
+
+static void RunCase(size_t writes, size_t write_size, int seconds,
+                    WriteMode mode) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "CoalesceBench");
+  CoalesceBench bench(event_service, writes, write_size, mode);
+  event_service->Post(&bench, MSG_START);
+
+  // Skip the start up
+  vzes::Thread::SleepMs(500);
+  uint64 start_rounds = bench.rounds();
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  uint64 rounds = bench.rounds() - start_rounds;
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  printf("%-8s: %10.0f rounds/s\n", MODE_NAMES[mode],
+         rounds * 1000.0 / elapsed);
+
+  event_service->Send(&bench, MSG_STOP);
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t writes = (argc > 1) ? atoi(argv[1]) : 4;
+  size_t write_size = (argc > 2) ? atoi(argv[2]) : 32;
+  int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+
+  printf("%u writes of %u bytes per message\n",
+         (unsigned)writes, (unsigned)write_size);
+  RunCase(writes, write_size, seconds, WRITE_DIRECT);
+  RunCase(writes, write_size, seconds, WRITE_NODELAY);
+  RunCase(writes, write_size, seconds, WRITE_COALESCE);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 比较每个请求新建连接和使用ConnectionPool的请求延时：几个并发的客户端
+// 不停地向本地的echo服务发小包请求，等到应答就算完成一次。连接池的每个
+// 地址最多pool_size个连接，客户端比连接多时要排队。测试进行到一半时服务端
+// 关闭所有连接，检查池中失效的连接不会被交出去。
+// 用法: connpool_bench [并发数] [连接池大小] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/net/connectionpool.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_STOP      2
+#define MSG_KILL      3
+
+#define POOL_PORT     5611
+#define RPC_SIZE      64            // 请求和应答的大小
+#define WAIT_TIMEOUT  1000          // 排队等待连接的超时
+
+class PoolBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  PoolBench(vzes::EventService::Ptr event_service,
+            bool use_pool,
+            size_t clients,
+            size_t pool_size)
+    : event_service_(event_service),
+      use_pool_(use_pool),
+      clients_(clients),
+      pool_size_(pool_size),
+      address_("127.0.0.1", POOL_PORT),
+      stopped_(false),
+      accepted_(0),
+      failures_(0),
+      max_waiting_(0) {
+  }
+
+  // MSG_STOP之后读取
+  std::vector<uint32> &latencies() {
+    return latencies_;
+  }
+  size_t accepted() const {
+    return accepted_;
+  }
+  size_t failures() const {
+    return failures_;
+  }
+  size_t max_waiting() const {
+    return max_waiting_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_KILL) {
+      CloseServerSockets();
+    } else if (msg->message_id == MSG_STOP) {
+      stopped_ = true;
+      for (Requests::iterator iter = requests_.begin();
+           iter != requests_.end(); ++iter) {
+        iter->second.socket->Close();
+      }
+      requests_.clear();
+      connecters_.clear();
+      if (pool_) {
+        pool_->Close();
+        pool_.reset();
+      }
+      CloseServerSockets();
+      listener_->Close();
+    }
+  }
+
+ private:
+  struct Request {
+    vzes::AsyncSocket::Ptr socket;
+    uint64                 start_time;
+    size_t                 received;
+  };
+  typedef std::map<vzes::AsyncSocket *, Request> Requests;
+
+  void Start() {
+    listener_ = event_service_->CreateAsyncListener();
+    listener_->SignalNewConnected.connect(this, &PoolBench::OnAccept);
+    VZ_VERIFY(listener_->Start(address_, true));
+    if (use_pool_) {
+      pool_.reset(new vzes::ConnectionPool(event_service_));
+      pool_->SetMaxPerHost(pool_size_);
+      pool_->SignalConnection.connect(this, &PoolBench::OnPoolConnection);
+    }
+    for (size_t i = 0; i < clients_; i++) {
+      StartRequest();
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////
+  // echo服务
+  void OnAccept(vzes::AsyncListener::Ptr listener,
+                vzes::Socket::Ptr socket, int err) {
+    if (err || !socket) {
+      return;
+    }
+    accepted_++;
+    vzes::AsyncSocket::Ptr server = event_service_->CreateAsyncSocket(socket);
+    server->SetOption(vzes::OPT_NODELAY, 1);
+    server->SignalSocketReadEvent.connect(this, &PoolBench::OnServerRead);
+    server->SignalSocketErrorEvent.connect(this, &PoolBench::OnServerError);
+    server->AsyncRead();
+    servers_[server.get()] = server;
+  }
+
+  void OnServerRead(vzes::AsyncSocket::Ptr server, vzes::MemBuffer::Ptr data) {
+    server->AsyncWrite(data);
+    server->AsyncRead();
+  }
+
+  void OnServerError(vzes::AsyncSocket::Ptr server, int err) {
+    servers_.erase(server.get());
+  }
+
+  void CloseServerSockets() {
+    std::map<vzes::AsyncSocket *, vzes::AsyncSocket::Ptr> servers;
+    servers.swap(servers_);
+    for (std::map<vzes::AsyncSocket *, vzes::AsyncSocket::Ptr>::iterator
+         iter = servers.begin(); iter != servers.end(); ++iter) {
+      iter->second->Close();
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////
+  // 客户端
+  void StartRequest() {
+    if (stopped_) {
+      return;
+    }
+    uint64 start_time = vzes::TimeNanos();
+    if (use_pool_) {
+      uint32 id = pool_->Checkout(address_, WAIT_TIMEOUT);
+      start_times_[id] = start_time;
+      max_waiting_ = std::max(max_waiting_, pool_->WaitingRequests(address_));
+      return;
+    }
+    vzes::AsyncConnecter::Ptr connecter = event_service_->CreateAsyncConnect();
+    connecter->SignalServerConnected.connect(this, &PoolBench::OnConnected);
+    if (!connecter->Connect(address_, WAIT_TIMEOUT)) {
+      // 这个客户端就不再发请求了
+      failures_++;
+      return;
+    }
+    connecters_[connecter.get()] = connecter;
+    start_times_[reinterpret_cast<uintptr_t>(connecter.get())] = start_time;
+  }
+
+  void OnConnected(vzes::AsyncConnecter::Ptr connecter,
+                   vzes::Socket::Ptr socket, int err) {
+    uintptr_t key = reinterpret_cast<uintptr_t>(connecter.get());
+    uint64 start_time = start_times_[key];
+    start_times_.erase(key);
+    connecters_.erase(connecter.get());
+    if (err || !socket) {
+      failures_++;
+      StartRequest();
+      return;
+    }
+    vzes::AsyncSocket::Ptr client = event_service_->CreateAsyncSocket(socket);
+    SendRequest(client, start_time);
+  }
+
+  void OnPoolConnection(vzes::ConnectionPool::Ptr pool, uint32 id,
+                        vzes::AsyncSocket::Ptr client, int err) {
+    uint64 start_time = start_times_[id];
+    start_times_.erase(id);
+    if (err || !client) {
+      failures_++;
+      StartRequest();
+      return;
+    }
+    SendRequest(client, start_time);
+  }
+
+  void SendRequest(vzes::AsyncSocket::Ptr client, uint64 start_time) {
+    char request[RPC_SIZE] = {0};
+    client->SetOption(vzes::OPT_NODELAY, 1);
+    client->SignalSocketReadEvent.connect(this, &PoolBench::OnReply);
+    client->SignalSocketErrorEvent.connect(this, &PoolBench::OnClientError);
+    Request &req = requests_[client.get()];
+    req.socket = client;
+    req.start_time = start_time;
+    req.received = 0;
+    client->AsyncWrite(request, sizeof(request));
+    client->AsyncRead();
+  }
+
+  void OnReply(vzes::AsyncSocket::Ptr client, vzes::MemBuffer::Ptr data) {
+    Request &req = requests_[client.get()];
+    req.received += data->size();
+    if (req.received < RPC_SIZE) {
+      client->AsyncRead();
+      return;
+    }
+    uint64 elapsed = vzes::TimeNanos() - req.start_time;
+    latencies_.push_back(static_cast<uint32>(elapsed / 1000));
+    requests_.erase(client.get());
+    if (use_pool_) {
+      pool_->Checkin(client);
+    } else {
+      client->Close();
+    }
+    StartRequest();
+  }
+
+  void OnClientError(vzes::AsyncSocket::Ptr client, int err) {
+    failures_++;
+    requests_.erase(client.get());
+    if (use_pool_) {
+      pool_->Checkin(client, false);
+    }
+    StartRequest();
+  }
+
+ private:
+  vzes::EventService::Ptr    event_service_;
+  bool                       use_pool_;
+  size_t                     clients_;
+  size_t                     pool_size_;
+  vzes::SocketAddress        address_;
+  bool                       stopped_;
+  vzes::AsyncListener::Ptr   listener_;
+  vzes::ConnectionPool::Ptr  pool_;
+  std::map<vzes::AsyncSocket *, vzes::AsyncSocket::Ptr> servers_;
+  std::map<vzes::AsyncConnecter *, vzes::AsyncConnecter::Ptr> connecters_;
+  // 连接池的请求id，或者新建连接时的AsyncConnecter地址
+  std::map<uintptr_t, uint64> start_times_;
+  Requests                   requests_;
+  std::vector<uint32>        latencies_;  // 微秒
+  size_t                     accepted_;
+  size_t                     failures_;
+  size_t                     max_waiting_;
+};
+
+static uint32 Percentile(const std::vector<uint32> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[index];
+}
+
+static void RunCase(bool use_pool, size_t clients, size_t pool_size,
+                    int seconds) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "PoolBench");
+  PoolBench bench(event_service, use_pool, clients, pool_size);
+  event_service->Post(&bench, MSG_START);
+  event_service->PostDelayed(seconds * 1000 / 2, &bench, MSG_KILL);
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  // Send返回之后EventService线程不会再修改统计
+  event_service->Send(&bench, MSG_STOP);
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  std::vector<uint32> &latencies = bench.latencies();
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-7s: %8.0f req/s, p50 %5u us, p99 %5u us, max %6u us, "
+         "%6u connections, %u failures, %u max waiting\n",
+         use_pool ? "pool" : "connect",
+         latencies.size() * 1000.0 / elapsed,
+         Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+         Percentile(latencies, 1.0), (unsigned)bench.accepted(),
+         (unsigned)bench.failures(), (unsigned)bench.max_waiting());
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t clients = (argc > 1) ? atoi(argv[1]) : 16;
+  size_t pool_size = (argc > 2) ? atoi(argv[2]) : 8;
+  int seconds = (argc > 3) ? atoi(argv[3]) : 2;
+
+  printf("%u clients, %u pooled connections at most\n",
+         (unsigned)clients, (unsigned)pool_size);
+  RunCase(false, clients, pool_size, seconds);
+  RunCase(true, clients, pool_size, seconds);
+  return EXIT_SUCCESS;
+}
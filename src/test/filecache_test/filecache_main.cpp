@@ -252,14 +252,14 @@ class FileCacheApp : public app::AppInterface,
     vzes::BlocksPtr &blocks = read_buffer->blocks();
     vzes::Block::Ptr data_block = blocks.front();
     //LOG(L_INFO) << "read data: ";
-    //LOG(L_INFO).write((const char*)data_block->buffer, data_block->buffer_size);
-    if (!strncmp((const char*)fc_content, (const char*)data_block->buffer,
-                 data_block->buffer_size)) {
+    //LOG(L_INFO).write((const char*)data_block->data(), data_block->size());
+    if (!strncmp((const char*)fc_content, (const char*)data_block->data(),
+                 data_block->size())) {
       LOG(L_INFO) << "filecache test case 1 successed ^_^";
     } else {
       LOG(L_INFO) << "filecache test case 1 failed -_-"
                   << ", set value: " << (const char*)fc_content
-                  << ", get value: " << data_block->buffer;
+                  << ", get value: " << data_block->data();
     }
 
     LOG(L_INFO) << "MemBuffer reference = " << read_buffer.use_count();
@@ -0,0 +1,236 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// Future/Promise的功能测试：Get超时、跨线程设置结果、对已经有结果的
+// Future调用Then、Promise都释放了的broken以及Invoke。有错误时返回
+// EXIT_FAILURE。
+// 用法: future_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "eventservice/event/thread.h"
+#include "eventservice/event/future.h"
+#include "eventservice/base/logging.h"
+#include "eventservice/base/timeutils.h"
+
+#define GET_TIMEOUT   50
+#define SET_DELAY     50
+#define WAIT_TIMEOUT  1000
+
+// 在别的线程设置结果
+struct SetValueTask {
+  vzes::Promise<int> promise;
+  int                value;
+  void operator()() {
+    promise.SetValue(value);
+  }
+};
+
+// 记录Then的回调在哪个线程、调用了几次。主线程的Thread::Current()不一定是
+// AutoThread，所以和调用者自己的Thread::Current()比较
+struct ThenRecord {
+  int           calls;
+  int           value;
+  vzes::Thread *thread;
+};
+
+struct RecordCallback {
+  ThenRecord *record;
+  void operator()(const int &value) const {
+    record->calls++;
+    record->value = value;
+    record->thread = vzes::Thread::Current();
+  }
+};
+
+// Invoke调用的函数，返回所在的线程
+struct CurrentThread {
+  typedef vzes::Thread *result_type;
+  vzes::Thread *operator()() const {
+    return vzes::Thread::Current();
+  }
+};
+
+// 处理消息直到回调被调用或者超时
+static void RunUntilCalled(vzes::Thread *thread, const ThenRecord &record) {
+  uint32 start = vzes::Time();
+  while (record.calls == 0
+         && vzes::TimeSince(start) < WAIT_TIMEOUT) {
+    thread->ProcessMessages(10);
+  }
+}
+
+// 没有结果时Get要等满超时再返回false，有结果以后马上返回
+static bool GetTimeoutTest(vzes::Thread *worker) {
+  vzes::Promise<int> promise;
+  vzes::Future<int> future = promise.GetFuture();
+  int value = 0;
+  uint32 start = vzes::Time();
+  if (future.Get(&value, GET_TIMEOUT)) {
+    LOG(L_ERROR) << "GetTimeoutTest Get returned without a value";
+    return false;
+  }
+  int32 elapsed = vzes::TimeSince(start);
+  if (elapsed < GET_TIMEOUT || future.IsReady() || future.IsBroken()) {
+    LOG(L_ERROR) << "GetTimeoutTest Get timed out after " << elapsed << "ms";
+    return false;
+  }
+  if (future.Get(&value, 0)) {
+    LOG(L_ERROR) << "GetTimeoutTest Get(0) returned without a value";
+    return false;
+  }
+
+  SetValueTask task = {promise, 7};
+  worker->PostDelayedTask(SET_DELAY, task);
+  if (!future.Get(&value, WAIT_TIMEOUT) || value != 7) {
+    LOG(L_ERROR) << "GetTimeoutTest didn't get the value, " << value;
+    return false;
+  }
+  // 只有第一次设置有效
+  if (promise.SetValue(8) || !future.Get(&value, 0) || value != 7) {
+    LOG(L_ERROR) << "GetTimeoutTest the value was set twice";
+    return false;
+  }
+  LOG(L_INFO) << "GetTimeoutTest Done " << elapsed << "ms";
+  return true;
+}
+
+// 已经有结果时Then也不能在当前调用里执行，要投递到queue的线程执行一次
+static bool ThenResolvedTest(vzes::Thread *thread) {
+  vzes::Promise<int> promise;
+  promise.SetValue(42);
+  ThenRecord record = {0, 0, NULL};
+  RecordCallback callback = {&record};
+  promise.GetFuture().Then(thread, callback);
+  if (record.calls != 0) {
+    LOG(L_ERROR) << "ThenResolvedTest the callback ran inside Then";
+    return false;
+  }
+  RunUntilCalled(thread, record);
+  thread->ProcessMessages(0);
+  if (record.calls != 1 || record.value != 42 || record.thread != vzes::Thread::Current()) {
+    LOG(L_ERROR) << "ThenResolvedTest calls " << record.calls
+                 << ", value " << record.value;
+    return false;
+  }
+  LOG(L_INFO) << "ThenResolvedTest Done";
+  return true;
+}
+
+// 别的线程设置结果，回调在调用Then时指定的线程执行
+static bool ThenPendingTest(vzes::Thread *thread, vzes::Thread *worker) {
+  vzes::Promise<int> promise;
+  ThenRecord record = {0, 0, NULL};
+  RecordCallback callback = {&record};
+  promise.GetFuture().Then(thread, callback);
+  SetValueTask task = {promise, 9};
+  worker->PostTask(task);
+  RunUntilCalled(thread, record);
+  thread->ProcessMessages(0);
+  if (record.calls != 1 || record.value != 9 || record.thread != vzes::Thread::Current()) {
+    LOG(L_ERROR) << "ThenPendingTest calls " << record.calls
+                 << ", value " << record.value;
+    return false;
+  }
+  LOG(L_INFO) << "ThenPendingTest Done";
+  return true;
+}
+
+// 所有的Promise都释放了，Get马上返回false，Then的回调不调用
+static bool BrokenPromiseTest(vzes::Thread *thread) {
+  ThenRecord record = {0, 0, NULL};
+  RecordCallback callback = {&record};
+  vzes::Future<int> future;
+  {
+    vzes::Promise<int> promise;
+    vzes::Promise<int> copy(promise);
+    future = promise.GetFuture();
+    future.Then(thread, callback);
+  }
+  int value = 0;
+  uint32 start = vzes::Time();
+  if (!future.IsBroken() || future.Get(&value, WAIT_TIMEOUT)
+      || vzes::TimeSince(start) >= WAIT_TIMEOUT) {
+    LOG(L_ERROR) << "BrokenPromiseTest future is not broken";
+    return false;
+  }
+  thread->ProcessMessages(10);
+  if (record.calls != 0) {
+    LOG(L_ERROR) << "BrokenPromiseTest the callback ran";
+    return false;
+  }
+  LOG(L_INFO) << "BrokenPromiseTest Done";
+  return true;
+}
+
+// Invoke在目标线程执行；目标线程停止以后或者消息被Clear时变成broken
+static bool InvokeTest(vzes::Thread *thread) {
+  vzes::Thread worker;
+  worker.Start();
+  vzes::Thread *result = NULL;
+  if (!vzes::Invoke(&worker, CurrentThread()).Get(&result, WAIT_TIMEOUT)
+      || result != &worker) {
+    LOG(L_ERROR) << "InvokeTest didn't run on the worker thread";
+    return false;
+  }
+  worker.Stop();
+  vzes::Future<vzes::Thread *> stopped = vzes::Invoke(&worker,
+                                                      CurrentThread());
+  if (!stopped.IsBroken()) {
+    LOG(L_ERROR) << "InvokeTest future is not broken after Stop";
+    return false;
+  }
+
+  vzes::Future<vzes::Thread *> cleared = vzes::Invoke(thread,
+                                                      CurrentThread());
+  thread->Clear(NULL);
+  if (!cleared.IsBroken()) {
+    LOG(L_ERROR) << "InvokeTest future is not broken after Clear";
+    return false;
+  }
+  LOG(L_INFO) << "InvokeTest Done";
+  return true;
+}
+
+int main(void) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+
+  vzes::AutoThread thread;
+  vzes::Thread worker;
+  worker.Start();
+  bool res = GetTimeoutTest(&worker);
+  res = ThenResolvedTest(&thread) && res;
+  res = ThenPendingTest(&thread, &worker) && res;
+  res = BrokenPromiseTest(&thread) && res;
+  res = InvokeTest(&thread) && res;
+  worker.Stop();
+  return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,220 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 测量空闲连接数量对单个事件派发开销的影响：
+// 注册N个不活跃的连接，然后用一对连接做乒乓，统计每个事件的平均耗时。
+// 用法: idle_bench [select|epoll|io_uring]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_NEXT_CASE     1
+#define PING_PONG_ROUNDS  20000
+
+static const size_t IDLE_CONNECTIONS[] = {100, 1000, 10000, 50000};
+
+class IdleBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  IdleBench(vzes::EventService::Ptr event_service,
+            vzes::SignalEvent::Ptr done_event,
+            size_t max_connections)
+    : event_service_(event_service),
+      done_event_(done_event),
+      max_connections_(max_connections),
+      case_index_(0),
+      rounds_(0),
+      start_time_(0) {
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_NEXT_CASE) {
+      RunNextCase();
+    }
+  }
+
+ private:
+  void RunNextCase() {
+    size_t case_size = sizeof(IDLE_CONNECTIONS) / sizeof(IDLE_CONNECTIONS[0]);
+    if (case_index_ == 0) {
+      static const char *BACKEND_NAMES[] = {"select", "epoll", "io_uring"};
+      printf("backend: %s\n", BACKEND_NAMES[NetworkService()->backend()]);
+      if (NetworkService()->backend() == vzes::NetworkService::BACKEND_SELECT) {
+        // fd_set can't hold the fds beyond FD_SETSIZE
+        max_connections_ = vzes::_min(max_connections_,
+                                      static_cast<size_t>(FD_SETSIZE - 64) / 2);
+      }
+    }
+    if (case_index_ >= case_size) {
+      done_event_->TriggerSignal();
+      return;
+    }
+    size_t count = IDLE_CONNECTIONS[case_index_++];
+    if (count > max_connections_) {
+      // Run the biggest case the open file limit allows, then stop
+      printf("%8u idle connections: capped by fd limit\n",
+             (unsigned)count);
+      count = max_connections_;
+      case_index_ = case_size;
+    }
+    if (!OpenIdleConnections(count)) {
+      printf("%8u idle connections: failed to create sockets\n",
+             (unsigned)count);
+      CloseAll();
+      done_event_->TriggerSignal();
+      return;
+    }
+    StartPingPong();
+  }
+
+  vzes::NetworkService *NetworkService() {
+    return dynamic_cast<vzes::NetworkService*>(
+             vzes::Thread::Current()->socketserver());
+  }
+
+  vzes::AsyncSocket::Ptr WrapSocket(int fd) {
+    return event_service_->CreateAsyncSocket(NetworkService()->WrapSocket(fd));
+  }
+
+  bool OpenIdleConnections(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      int fds[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return false;
+      }
+      // Only one side is watched by the event service, the peer stays silent
+      vzes::AsyncSocket::Ptr idle = WrapSocket(fds[0]);
+      idle->AsyncRead();
+      idle_sockets_.push_back(idle);
+      idle_peers_.push_back(fds[1]);
+    }
+    return true;
+  }
+
+  void StartPingPong() {
+    int fds[2];
+    VZ_VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    ping_ = WrapSocket(fds[0]);
+    pong_ = WrapSocket(fds[1]);
+    ping_->SignalSocketReadEvent.connect(this, &IdleBench::OnSocketRead);
+    pong_->SignalSocketReadEvent.connect(this, &IdleBench::OnSocketRead);
+    ping_->AsyncRead();
+    pong_->AsyncRead();
+
+    rounds_ = 0;
+    start_time_ = vzes::TimeNanos();
+    ping_->AsyncWrite("p", 1);
+  }
+
+  void OnSocketRead(vzes::AsyncSocket::Ptr async_socket,
+                    vzes::MemBuffer::Ptr data) {
+    if (async_socket == ping_ && ++rounds_ >= PING_PONG_ROUNDS) {
+      uint64 elapsed = vzes::TimeNanos() - start_time_;
+      // Every round trip delivers two read events
+      printf("%8u idle connections: %8.3f us/event\n",
+             (unsigned)idle_sockets_.size(),
+             elapsed / 1000.0 / (2.0 * PING_PONG_ROUNDS));
+      event_service_->Post(this, MSG_NEXT_CASE);
+      CloseAll();
+      return;
+    }
+    async_socket->AsyncWrite(data);
+    async_socket->AsyncRead();
+  }
+
+  void CloseAll() {
+    for (size_t i = 0; i < idle_sockets_.size(); i++) {
+      idle_sockets_[i]->Close();
+      close(idle_peers_[i]);
+    }
+    idle_sockets_.clear();
+    idle_peers_.clear();
+    if (ping_) {
+      ping_->Close();
+      ping_.reset();
+    }
+    if (pong_) {
+      pong_->Close();
+      pong_.reset();
+    }
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  vzes::SignalEvent::Ptr   done_event_;
+  size_t                   max_connections_;
+  size_t                   case_index_;
+  std::vector<vzes::AsyncSocket::Ptr> idle_sockets_;
+  std::vector<int>         idle_peers_;
+  vzes::AsyncSocket::Ptr   ping_;
+  vzes::AsyncSocket::Ptr   pong_;
+  int                      rounds_;
+  uint64                   start_time_;
+};
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  // Every connection takes two fds, keep some for the event service itself
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  getrlimit(RLIMIT_NOFILE, &limit);
+  size_t max_connections = (limit.rlim_cur > 64) ?
+                           (limit.rlim_cur - 64) / 2 : 0;
+
+  if (argc > 1) {
+    if (strcmp(argv[1], "select") == 0) {
+      vzes::NetworkService::SetDefaultBackend(
+        vzes::NetworkService::BACKEND_SELECT);
+    } else if (strcmp(argv[1], "io_uring") == 0) {
+      vzes::NetworkService::SetDefaultBackend(
+        vzes::NetworkService::BACKEND_IO_URING);
+    }
+  }
+
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "IdleBench");
+  vzes::SignalEvent::Ptr done_event = vzes::SignalEvent::CreateSignalEvent();
+  IdleBench bench(event_service, done_event, max_connections);
+  event_service->Post(&bench, MSG_NEXT_CASE);
+  done_event->WaitSignal(10 * 60 * 1000);
+  event_service->UninitEventService();
+  return EXIT_SUCCESS;
+}
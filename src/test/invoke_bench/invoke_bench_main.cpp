@@ -0,0 +1,215 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 比较跨线程请求/应答的几种方式：Send，Post加SignalEvent，Invoke加阻塞的
+// Get，以及Invoke加Then把结果送回调用者自己的EventService，同时保持多个
+// 请求在路上。
+// 用法: invoke_bench [请求数] [同时在路上的请求数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_REQUEST   1
+#define MSG_START     2
+
+// The request handled on the server thread: add one
+struct AddOne {
+  typedef uint32 result_type;
+  uint32 value;
+  uint32 operator()() const {
+    return value + 1;
+  }
+};
+
+// The way the requests are made today
+class Server : public vzes::MessageHandler {
+ public:
+  struct Request : public vzes::MessageData {
+    uint32                 value;
+    uint32                 result;
+    vzes::SignalEvent::Ptr signal_event;
+  };
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_REQUEST) {
+      boost::shared_ptr<Request> request =
+        boost::dynamic_pointer_cast<Request>(msg->pdata);
+      request->result = request->value + 1;
+      if (request->signal_event) {
+        request->signal_event->TriggerSignal();
+      }
+    }
+  }
+};
+
+// Keeps depth requests in flight from its own EventService
+class Pipeline : public vzes::MessageHandler {
+ public:
+  Pipeline(vzes::EventService::Ptr server, uint32 total, uint32 depth)
+    : server_(server),
+      total_(total),
+      depth_(depth),
+      sent_(0),
+      received_(0),
+      wrong_(0),
+      done_event_(vzes::SignalEvent::CreateSignalEvent()) {
+  }
+
+  vzes::SignalEvent::Ptr done_event() {
+    return done_event_;
+  }
+  uint32 wrong() const {
+    return wrong_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      for (uint32 i = 0; i < depth_ && sent_ < total_; i++) {
+        SendNext();
+      }
+    }
+  }
+
+  // Runs on the client EventService
+  void OnResult(uint32 value, uint32 result) {
+    if (result != value + 1) {
+      wrong_++;
+    }
+    if (++received_ == total_) {
+      done_event_->TriggerSignal();
+    } else if (sent_ < total_) {
+      SendNext();
+    }
+  }
+
+ private:
+  struct ResultCallback {
+    Pipeline *pipeline;
+    uint32    value;
+    void operator()(const uint32 &result) const {
+      pipeline->OnResult(value, result);
+    }
+  };
+
+  void SendNext() {
+    AddOne request = {sent_};
+    ResultCallback callback = {this, sent_};
+    server_->Invoke(request).Then(vzes::Thread::Current(), callback);
+    sent_++;
+  }
+
+  vzes::EventService::Ptr server_;
+  uint32                  total_;
+  uint32                  depth_;
+  uint32                  sent_;
+  uint32                  received_;
+  uint32                  wrong_;
+  vzes::SignalEvent::Ptr  done_event_;
+};
+
+static void PrintResult(const char *name, uint32 count, uint64 elapsed,
+                        uint32 wrong) {
+  printf("%-28s: %8.3f us/request, %8.0f requests/s%s\n",
+         name, elapsed / 1000.0 / count,
+         count * 1000000000.0 / elapsed,
+         wrong == 0 ? "" : ", WRONG RESULT");
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  uint32 count = (argc > 1) ? atoi(argv[1]) : 100000;
+  uint32 depth = (argc > 2) ? atoi(argv[2]) : 64;
+
+  vzes::EventService::Ptr server =
+    vzes::EventService::CreateEventService(NULL, "InvokeServer");
+  Server handler;
+
+  // Thread::Send
+  uint32 wrong = 0;
+  uint64 start_time = vzes::TimeNanos();
+  for (uint32 i = 0; i < count; i++) {
+    boost::shared_ptr<Server::Request> request(new Server::Request());
+    request->value = i;
+    server->Send(&handler, MSG_REQUEST, request);
+    wrong += (request->result != i + 1);
+  }
+  PrintResult("Send", count, vzes::TimeNanos() - start_time, wrong);
+
+  // Post + SignalEvent::WaitSignal
+  wrong = 0;
+  vzes::SignalEvent::Ptr signal_event = vzes::SignalEvent::CreateSignalEvent();
+  start_time = vzes::TimeNanos();
+  for (uint32 i = 0; i < count; i++) {
+    boost::shared_ptr<Server::Request> request(new Server::Request());
+    request->value = i;
+    request->signal_event = signal_event;
+    server->Post(&handler, MSG_REQUEST, request);
+    signal_event->WaitSignal(10 * 1000);
+    wrong += (request->result != i + 1);
+  }
+  PrintResult("Post + SignalEvent", count, vzes::TimeNanos() - start_time,
+              wrong);
+
+  // Invoke + Future::Get
+  wrong = 0;
+  start_time = vzes::TimeNanos();
+  for (uint32 i = 0; i < count; i++) {
+    AddOne request = {i};
+    uint32 result = 0;
+    if (!server->Invoke(request).Get(&result, 10 * 1000) || result != i + 1) {
+      wrong++;
+    }
+  }
+  PrintResult("Invoke + Get", count, vzes::TimeNanos() - start_time, wrong);
+
+  // Invoke + Then back onto the client EventService
+  vzes::EventService::Ptr client =
+    vzes::EventService::CreateEventService(NULL, "InvokeClient");
+  Pipeline pipeline(server, count, depth);
+  start_time = vzes::TimeNanos();
+  client->Post(&pipeline, MSG_START);
+  if (pipeline.done_event()->WaitSignal(10 * 60 * 1000) != SIGNAL_EVENT_DONE) {
+    printf("Timeout\n");
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "Invoke + Then, %u in flight",
+           (unsigned)depth);
+  PrintResult(name, count, vzes::TimeNanos() - start_time, pipeline.wrong());
+
+  client->UninitEventService();
+  server->UninitEventService();
+  return EXIT_SUCCESS;
+}
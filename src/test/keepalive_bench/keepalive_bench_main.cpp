@@ -0,0 +1,354 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 测量连接超时管理的开销和效果：
+// 1. 多条连接做小包的请求应答，比较不检查空闲、用SetIdleTimeout检查空闲、
+//    每收到一个包就Cancel并重新PostDelayed一个定时器三种情况的吞吐；
+// 2. 一半的连接对方一直不说话，另一半双方都开了心跳，统计超时关闭的
+//    连接数和关闭的时间，开了心跳的连接不应该被关闭；
+// 3. 连接一个不会应答的地址，检查Connect的time_out。
+// 用法: keepalive_bench [连接数] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/net/asyncpacketsocket.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_STOP      2
+#define MSG_IDLE      3
+
+#define RPC_SIZE      64            // 请求和应答的大小
+#define IDLE_TIMEOUT  60000         // 吞吐测试中的空闲超时，不会触发
+#define HEARTBEAT     100           // 心跳间隔
+#define DEAD_TIMEOUT  400           // 没有收到数据的超时
+
+enum IdleMode {
+  IDLE_NONE,
+  IDLE_MONITOR,
+  IDLE_TIMER
+};
+
+// 建立一对本地TCP连接
+static bool TcpPair(int fds[2]) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+      || listen(listener, 1) != 0
+      || getsockname(listener, (struct sockaddr *)&addr, &len) != 0) {
+    close(listener);
+    return false;
+  }
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(listener);
+    return false;
+  }
+  fds[1] = accept(listener, NULL, NULL);
+  close(listener);
+  return fds[1] >= 0;
+}
+
+static vzes::AsyncSocket::Ptr WrapSocket(vzes::EventService::Ptr es,
+    int fd) {
+  vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                               vzes::Thread::Current()->socketserver());
+  return es->CreateAsyncSocket(ns->WrapSocket(fd));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+class RpcBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  RpcBench(vzes::EventService::Ptr event_service,
+           IdleMode mode,
+           size_t pairs)
+    : event_service_(event_service),
+      mode_(mode),
+      pairs_(pairs),
+      rpcs_(0) {
+  }
+
+  // MSG_STOP之后读取
+  uint64 rpcs() const {
+    return rpcs_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_STOP) {
+      for (size_t i = 0; i < sockets_.size(); i++) {
+        sockets_[i]->Close();
+      }
+      for (std::map<vzes::AsyncSocket *, vzes::Timer::Ptr>::iterator iter =
+             timers_.begin(); iter != timers_.end(); ++iter) {
+        iter->second->Cancel();
+      }
+      timers_.clear();
+    } else if (msg->message_id == MSG_IDLE) {
+      // 不会到这里，超时比测试时间长得多
+      printf("unexpected idle timeout\n");
+    }
+  }
+
+ private:
+  vzes::AsyncSocket::Ptr AddSocket(int fd) {
+    vzes::AsyncSocket::Ptr async_socket = WrapSocket(event_service_, fd);
+    async_socket->SetOption(vzes::OPT_NODELAY, 1);
+    if (mode_ == IDLE_MONITOR) {
+      async_socket->SetIdleTimeout(IDLE_TIMEOUT, IDLE_TIMEOUT / 2);
+    }
+    sockets_.push_back(async_socket);
+    return async_socket;
+  }
+
+  void Start() {
+    char request[RPC_SIZE] = {0};
+    for (size_t i = 0; i < pairs_; i++) {
+      int fds[2];
+      VZ_VERIFY(TcpPair(fds));
+      vzes::AsyncSocket::Ptr client = AddSocket(fds[0]);
+      vzes::AsyncSocket::Ptr server = AddSocket(fds[1]);
+      client->SignalSocketReadEvent.connect(this, &RpcBench::OnRead);
+      server->SignalSocketReadEvent.connect(this, &RpcBench::OnRead);
+      client->AsyncRead();
+      server->AsyncRead();
+      client->AsyncWrite(request, sizeof(request));
+    }
+  }
+
+  // 两边都是收到多少发回多少
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    if (mode_ == IDLE_TIMER) {
+      // 每个包一个定时器的做法
+      vzes::Timer::Ptr &timer = timers_[async_socket.get()];
+      if (timer) {
+        timer->Cancel();
+      }
+      timer = event_service_->PostDelayed(IDLE_TIMEOUT, this, MSG_IDLE);
+    }
+    rpcs_++;
+    async_socket->AsyncWrite(data);
+    async_socket->AsyncRead();
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  IdleMode                 mode_;
+  size_t                   pairs_;
+  std::vector<vzes::AsyncSocket::Ptr> sockets_;
+  std::map<vzes::AsyncSocket *, vzes::Timer::Ptr> timers_;
+  uint64                   rpcs_;
+};
+
+static void RunRpcCase(IdleMode mode, size_t pairs, int seconds) {
+  static const char *names[] = {"none", "monitor", "timer"};
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "RpcBench");
+  RpcBench bench(event_service, mode, pairs);
+  event_service->Post(&bench, MSG_START);
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  // Send返回之后EventService线程不会再修改统计
+  event_service->Send(&bench, MSG_STOP);
+  uint32 elapsed = vzes::TimeSince(start_time);
+  printf("idle check %-8s: %10.0f packets/s\n",
+         names[mode], bench.rpcs() * 1000.0 / elapsed);
+  event_service->UninitEventService();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+class KeepaliveBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  KeepaliveBench(vzes::EventService::Ptr event_service, size_t pairs)
+    : event_service_(event_service),
+      pairs_(pairs),
+      start_time_(0),
+      timed_out_(0),
+      other_errors_(0),
+      heartbeat_closed_(0),
+      min_close_(0),
+      max_close_(0),
+      connect_error_(0),
+      connect_time_(0) {
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_STOP) {
+      for (size_t i = 0; i < sockets_.size(); i++) {
+        sockets_[i]->Close();
+      }
+      for (size_t i = 0; i < silent_fds_.size(); i++) {
+        close(silent_fds_[i]);
+      }
+      if (connecter_) {
+        connecter_->Close();
+      }
+    }
+  }
+
+  // MSG_STOP之后读取
+  void Print() {
+    printf("%u silent peers: %u timed out in %u - %u ms, %u other errors\n",
+           (unsigned)pairs_, (unsigned)timed_out_, min_close_, max_close_,
+           (unsigned)other_errors_);
+    printf("%u heartbeat pairs: %u closed\n",
+           (unsigned)pairs_, (unsigned)heartbeat_closed_);
+    if (connect_time_) {
+      printf("connect timeout: error %d after %u ms\n",
+             connect_error_, connect_time_);
+    } else {
+      printf("connect timeout: no result\n");
+    }
+  }
+
+ private:
+  vzes::AsyncPacketSocket::Ptr AddPacketSocket(int fd) {
+    vzes::AsyncPacketSocket::Ptr packet_socket(
+      new vzes::AsyncPacketSocket(event_service_,
+                                  WrapSocket(event_service_, fd)));
+    packet_socket->SetHeartbeat(HEARTBEAT, DEAD_TIMEOUT);
+    packet_socket->AsyncRead();
+    sockets_.push_back(packet_socket);
+    return packet_socket;
+  }
+
+  void Start() {
+    start_time_ = vzes::Time();
+    for (size_t i = 0; i < pairs_; i++) {
+      int fds[2];
+      // 对方的fd不交给EventService，一直不发数据，像断了电的设备
+      VZ_VERIFY(TcpPair(fds));
+      silent_fds_.push_back(fds[1]);
+      AddPacketSocket(fds[0])->SignalPacketError.connect(
+        this, &KeepaliveBench::OnSilentError);
+      // 两边都开心跳
+      VZ_VERIFY(TcpPair(fds));
+      AddPacketSocket(fds[0])->SignalPacketError.connect(
+        this, &KeepaliveBench::OnHeartbeatError);
+      AddPacketSocket(fds[1])->SignalPacketError.connect(
+        this, &KeepaliveBench::OnHeartbeatError);
+    }
+    // TEST-NET-1，不会有应答
+    connecter_ = event_service_->CreateAsyncConnect();
+    connecter_->SignalServerConnected.connect(
+      this, &KeepaliveBench::OnConnected);
+    if (!connecter_->Connect(vzes::SocketAddress("192.0.2.1", 9), 300)) {
+      printf("connect failed immediately\n");
+    }
+  }
+
+  void OnSilentError(vzes::AsyncPacketSocket::Ptr packet_socket, int err) {
+    if (err != ETIMEDOUT) {
+      other_errors_++;
+      return;
+    }
+    uint32 elapsed = vzes::TimeSince(start_time_);
+    if (timed_out_ == 0 || elapsed < min_close_) {
+      min_close_ = elapsed;
+    }
+    if (elapsed > max_close_) {
+      max_close_ = elapsed;
+    }
+    timed_out_++;
+  }
+
+  void OnHeartbeatError(vzes::AsyncPacketSocket::Ptr packet_socket, int err) {
+    heartbeat_closed_++;
+  }
+
+  void OnConnected(vzes::AsyncConnecter::Ptr connecter,
+                   vzes::Socket::Ptr socket, int err) {
+    connect_error_ = err;
+    connect_time_ = vzes::TimeSince(start_time_);
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  size_t                   pairs_;
+  std::vector<vzes::AsyncPacketSocket::Ptr> sockets_;
+  std::vector<int>         silent_fds_;
+  vzes::AsyncConnecter::Ptr connecter_;
+  uint32                   start_time_;
+  size_t                   timed_out_;
+  size_t                   other_errors_;
+  size_t                   heartbeat_closed_;
+  uint32                   min_close_;
+  uint32                   max_close_;
+  int                      connect_error_;
+  uint32                   connect_time_;
+};
+
+static void RunKeepaliveCase(size_t pairs, int seconds) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "KeepaliveBench");
+  KeepaliveBench bench(event_service, pairs);
+  event_service->Post(&bench, MSG_START);
+  vzes::Thread::SleepMs(seconds * 1000);
+  event_service->Send(&bench, MSG_STOP);
+  bench.Print();
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t pairs = (argc > 1) ? atoi(argv[1]) : 100;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 3;
+
+  printf("%u request/response connections\n", (unsigned)pairs);
+  RunRpcCase(IDLE_NONE, pairs, seconds);
+  RunRpcCase(IDLE_MONITOR, pairs, seconds);
+  RunRpcCase(IDLE_TIMER, pairs, seconds);
+  RunKeepaliveCase(pairs, seconds);
+  return EXIT_SUCCESS;
+}
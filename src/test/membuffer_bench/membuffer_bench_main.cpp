@@ -0,0 +1,147 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 测量MemBuffer解析小包的开销：先写入一批"长度+数据"的包，
+// 再用ReadUInt32 + ReadString/ReadBytes逐个读出，统计每个包的平均耗时。
+// 用法: membuffer_bench [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "eventservice/mem/membuffer.h"
+#include "eventservice/base/timeutils.h"
+
+#define STREAM_SIZE     (64 * 1024)
+#define DEFAULT_ROUNDS  200
+
+static const size_t PAYLOAD_SIZES[] = {8, 32, 128, 512};
+
+enum ParseMode {
+  PARSE_STRING,   // ReadUInt32 + ReadString
+  PARSE_BYTES,    // ReadUInt32 + ReadBytes到栈上的缓冲区
+  PARSE_FIELDS    // 每个包拆成uint8/uint16/uint32/uint64字段读
+};
+
+static const char *MODE_NAMES[] = {"string", "bytes", "fields"};
+
+// 返回写入的包个数
+static size_t FillStream(vzes::MemBuffer::Ptr buffer,
+                         size_t payload_size, ParseMode mode) {
+  static char payload[1024] = {0};
+  size_t packets = 0;
+  while (buffer->size() < STREAM_SIZE) {
+    if (mode == PARSE_FIELDS) {
+      buffer->WriteUInt8(1);
+      buffer->WriteUInt16(2);
+      buffer->WriteUInt32(3);
+      buffer->WriteUInt64(4);
+    } else {
+      buffer->WriteUInt32(payload_size);
+      buffer->WriteBytes(payload, payload_size);
+    }
+    packets++;
+  }
+  return packets;
+}
+
+static bool ParseStream(vzes::MemBuffer::Ptr buffer,
+                        size_t packets, ParseMode mode) {
+  char data[1024];
+  std::string str;
+  for (size_t i = 0; i < packets; i++) {
+    if (mode == PARSE_FIELDS) {
+      uint8  u8  = 0;
+      uint16 u16 = 0;
+      uint32 u32 = 0;
+      uint64 u64 = 0;
+      if (!buffer->ReadUInt8(&u8) || !buffer->ReadUInt16(&u16)
+          || !buffer->ReadUInt32(&u32) || !buffer->ReadUInt64(&u64)
+          || u8 != 1 || u64 != 4) {
+        return false;
+      }
+      continue;
+    }
+    uint32 len = 0;
+    if (!buffer->ReadUInt32(&len) || len > sizeof(data)) {
+      return false;
+    }
+    if (mode == PARSE_STRING) {
+      str.clear();
+      if (!buffer->ReadString(&str, len)) {
+        return false;
+      }
+    } else if (!buffer->ReadBytes(data, len)) {
+      return false;
+    }
+  }
+  return buffer->size() == 0;
+}
+
+static void RunCase(size_t payload_size, ParseMode mode, int rounds) {
+  vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+  uint64 parse_nanos  = 0;
+  uint64 total_bytes  = 0;
+  size_t total_packets = 0;
+  for (int i = 0; i < rounds; i++) {
+    size_t packets = FillStream(buffer, payload_size, mode);
+    total_bytes += buffer->size();
+    uint64 start = vzes::TimeNanos();
+    if (!ParseStream(buffer, packets, mode)) {
+      printf("parse error, payload %u mode %s\n",
+             (uint32)payload_size, MODE_NAMES[mode]);
+      return;
+    }
+    parse_nanos += vzes::TimeNanos() - start;
+    total_packets += packets;
+  }
+  printf("%-7s payload %4u: %8.1f ns/packet, %8.1f MB/s\n",
+         MODE_NAMES[mode],
+         mode == PARSE_FIELDS ? 15 : (uint32)payload_size,
+         (double)parse_nanos / total_packets,
+         (double)total_bytes * 1000.0 / parse_nanos);
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = DEFAULT_ROUNDS;
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+  printf("stream %u bytes, block %u bytes, rounds %d\n",
+         STREAM_SIZE, DEFAULT_BLOCK_SIZE, rounds);
+  size_t case_size = sizeof(PAYLOAD_SIZES) / sizeof(PAYLOAD_SIZES[0]);
+  for (size_t i = 0; i < case_size; i++) {
+    RunCase(PAYLOAD_SIZES[i], PARSE_STRING, rounds);
+  }
+  for (size_t i = 0; i < case_size; i++) {
+    RunCase(PAYLOAD_SIZES[i], PARSE_BYTES, rounds);
+  }
+  RunCase(0, PARSE_FIELDS, rounds);
+  return EXIT_SUCCESS;
+}
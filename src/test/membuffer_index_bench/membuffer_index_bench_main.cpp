@@ -0,0 +1,97 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 测量MemBuffer按位置复制数据的开销：用网络接收那样的1KB Block
+// 拼出不同大小的MemBuffer，再用CopyUInt32顺序或者随机读取整个buffer，
+// 统计每次读取的平均耗时。
+// 用法: membuffer_index_bench [copies]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "eventservice/mem/membuffer.h"
+#include "eventservice/base/timeutils.h"
+
+#define DEFAULT_COPIES  200000
+
+static const size_t BUFFER_SIZES[] = {
+  64 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024
+};
+
+// 和PhysicalSocket::Recv一样，每个Block装满DEFAULT_BLOCK_SIZE后追加
+static vzes::MemBuffer::Ptr FillBuffer(size_t size) {
+  vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+  uint32 value = 0;
+  while (buffer->size() < size) {
+    vzes::Block::Ptr block = vzes::Block::TakeBlock(DEFAULT_BLOCK_SIZE);
+    while (block->RemainSize() >= sizeof(uint32)) {
+      block->WriteBytes((const char *)&value, sizeof(uint32));
+      value++;
+    }
+    buffer->AppendBlock(block);
+  }
+  return buffer;
+}
+
+static void RunCase(size_t size, size_t copies, bool random) {
+  vzes::MemBuffer::Ptr buffer = FillBuffer(size);
+  size_t count = buffer->size() / sizeof(uint32);
+  uint32 seed  = 1;
+  uint64 start = vzes::TimeNanos();
+  for (size_t i = 0; i < copies; i++) {
+    size_t index = i % count;
+    if (random) {
+      seed  = seed * 1103515245 + 12345;
+      index = seed % count;
+    }
+    uint32 data = 0;
+    if (!buffer->CopyUInt32(index * sizeof(uint32), &data) || data != index) {
+      printf("copy error, size %u index %u\n", (uint32)size, (uint32)index);
+      return;
+    }
+  }
+  uint64 nanos = vzes::TimeNanos() - start;
+  printf("%-10s buffer %6u KB, %6u blocks: %10.1f ns/copy\n",
+         random ? "random" : "sequential", (uint32)(size / 1024),
+         (uint32)buffer->BlocksSize(), (double)nanos / copies);
+}
+
+int main(int argc, char *argv[]) {
+  size_t copies = DEFAULT_COPIES;
+  if (argc > 1) {
+    copies = atoi(argv[1]);
+  }
+  printf("block %u bytes, copies %u\n", DEFAULT_BLOCK_SIZE, (uint32)copies);
+  size_t case_size = sizeof(BUFFER_SIZES) / sizeof(BUFFER_SIZES[0]);
+  for (size_t i = 0; i < case_size; i++) {
+    RunCase(BUFFER_SIZES[i], copies, false);
+  }
+  for (size_t i = 0; i < case_size; i++) {
+    RunCase(BUFFER_SIZES[i], copies, true);
+  }
+  return EXIT_SUCCESS;
+}
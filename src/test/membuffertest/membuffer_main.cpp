@@ -63,15 +63,14 @@ void MemBufferReadWriteCorrectTest() {
   }
   LOG(L_INFO) << "MemBufferReadWriteCorrectTest Write Done "
               << mb->size() << "\t" << mb->BlocksSize();
-  //for (uint32 i = 0; i < TEST_DATA_SIZE; i++) {
-  //  uint32 data = 0;
-  //  // 这里面读取数据特别慢，时间都花在定位数据块上面了，必须要优化这个过程
-  //  mb->CopyUInt32(i * sizeof(uint32), &data);
-  //  if (data != i) {
-  //    LOG(L_ERROR) << "Data error ";
-  //    return ;
-  //  }
-  //}
+  for (uint32 i = 0; i < TEST_DATA_SIZE; i++) {
+    uint32 data = 0;
+    mb->CopyUInt32(i * sizeof(uint32), &data);
+    if (data != i) {
+      LOG(L_ERROR) << "Data error ";
+      return ;
+    }
+  }
   LOG(L_INFO) << "MemBufferReadWriteCorrectTest Read Start "
               << mb->size() << "\t" << mb->BlocksSize();
   for (uint32 i = 0; i < TEST_DATA_SIZE; i++) {
@@ -138,8 +137,8 @@ void MembufferRawReadTest() {
   int index = 0;
   for (vzes::BlocksPtr::iterator iter = blocks.begin();
        iter != blocks.end(); iter++) {
-    const char *data = (const char *)((*iter)->buffer);
-    uint32 data_size = (*iter)->buffer_size / 4;
+    const char *data = (const char *)((*iter)->data());
+    uint32 data_size = (*iter)->size() / 4;
     for (int i = 0; i < data_size; i++, index++) {
       uint32 c = 0;
       memcpy((void *)&c, data + (i * sizeof(uint32)), sizeof(uint32));
@@ -153,6 +152,122 @@ void MembufferRawReadTest() {
               << mb->size() << "\t" << mb->BlocksSize();
 }
 
+// 边写边读：读只移动head，同一个Block读完之后要能回到开头继续写
+void MemBufferInterleaveTest() {
+  LOG(L_INFO) << "--------------------------------------------------------";
+  vzes::MemBuffer::Ptr mb = vzes::MemBuffer::CreateMemBuffer();
+  uint32 write_index = 0;
+  uint32 read_index  = 0;
+  for (int round = 0; round < TEST_DATA_SIZE; round++) {
+    for (int i = 0; i < 3; i++) {
+      mb->WriteUInt32(write_index++);
+    }
+    for (int i = 0; i < 2; i++) {
+      uint32 data = 0;
+      mb->ReadUInt32(&data);
+      if (data != read_index++) {
+        LOG(L_ERROR) << "Data error ";
+        return ;
+      }
+    }
+    uint32 peek = 0;
+    mb->CopyUInt32(0, &peek);
+    if (peek != read_index) {
+      LOG(L_ERROR) << "Copy error ";
+      return ;
+    }
+  }
+  std::string tail;
+  BOOST_ASSERT(mb->size() == (write_index - read_index) * sizeof(uint32));
+  mb->ReadString(&tail, mb->size());
+  BOOST_ASSERT(mb->size() == 0 && mb->BlocksSize() == 0);
+  uint32 last = 0;
+  memcpy(&last, tail.c_str() + tail.size() - sizeof(uint32), sizeof(uint32));
+  BOOST_ASSERT(last == write_index - 1);
+  LOG(L_INFO) << "MemBufferInterleaveTest Done "
+              << mb->size() << "\t" << mb->BlocksSize();
+}
+
+// 随机位置复制：跨Block边界、读出一部分、前面加Block、
+// 通过blocks()直接删除Block之后都要能定位到正确的数据
+static bool CheckCopy(vzes::MemBuffer::Ptr mb, uint32 first) {
+  size_t count = mb->size() / sizeof(uint32);
+  for (size_t n = 0; n < count; n++) {
+    size_t i = (n * 7919) % count;
+    uint32 data = 0;
+    if (!mb->CopyUInt32(i * sizeof(uint32), &data) || data != first + i) {
+      return false;
+    }
+  }
+  uint32 data = 0;
+  return !mb->CopyUInt32(count * sizeof(uint32), &data);
+}
+
+void MemBufferIndexTest() {
+  LOG(L_INFO) << "--------------------------------------------------------";
+  vzes::MemBuffer::Ptr mb = vzes::MemBuffer::CreateMemBuffer();
+  // 每次写7个字节，让uint32跨过Block边界
+  uint8 bytes[TEST_DATA_SIZE * sizeof(uint32)];
+  for (uint32 i = 0; i < TEST_DATA_SIZE; i++) {
+    memcpy(bytes + i * sizeof(uint32), &i, sizeof(uint32));
+  }
+  for (size_t pos = 0; pos < sizeof(bytes); pos += 7) {
+    mb->WriteBytes((const char *)bytes + pos, vzes::_min((size_t)7,
+                   sizeof(bytes) - pos));
+  }
+  if (!CheckCopy(mb, 0)) {
+    LOG(L_ERROR) << "Copy error after write";
+    return ;
+  }
+  mb->ReadBytes(NULL, 300 * sizeof(uint32));
+  if (!CheckCopy(mb, 300)) {
+    LOG(L_ERROR) << "Copy error after read";
+    return ;
+  }
+  vzes::Block::Ptr head = vzes::Block::TakeBlock(BLOCK_SIZE_256B);
+  for (uint32 i = 250; i < 300; i++) {
+    head->WriteBytes((const char *)&i, sizeof(uint32));
+  }
+  mb->PrependBlock(head);
+  if (!CheckCopy(mb, 250)) {
+    LOG(L_ERROR) << "Copy error after prepend";
+    return ;
+  }
+  vzes::Block::Ptr first = mb->blocks().front();
+  mb->blocks().pop_front();
+  mb->ReduceSize(first->size());
+  if (!CheckCopy(mb, 300)) {
+    LOG(L_ERROR) << "Copy error after blocks() changed";
+    return ;
+  }
+  vzes::MemBuffer::Ptr big = vzes::MemBuffer::CreateMemBuffer();
+  big->PrependBlock(head);
+  big->AppendBuffer(mb);
+  mb->Clear();
+  if (!CheckCopy(big, 250) || mb->size() != 0) {
+    LOG(L_ERROR) << "Copy error after append buffer";
+    return ;
+  }
+  // 拿着blocks()的引用，CopyXXX之后再修改
+  vzes::BlocksPtr &held = big->blocks();
+  CheckCopy(big, 250);
+  big->ReduceSize(held.front()->size());
+  held.pop_front();
+  uint32 held_first = 0;
+  if (!big->CopyUInt32(0, &held_first) || !CheckCopy(big, held_first)) {
+    LOG(L_ERROR) << "Copy error after held blocks() changed";
+    return ;
+  }
+  held.front()->Consume(sizeof(uint32));
+  big->ReduceSize(sizeof(uint32));
+  if (!CheckCopy(big, held_first + 1)) {
+    LOG(L_ERROR) << "Copy error after held block consumed";
+    return ;
+  }
+  LOG(L_INFO) << "MemBufferIndexTest Done "
+              << big->size() << "\t" << big->BlocksSize();
+}
+
 int main(void) {
   // Initialize the logging system
   vzes::LogMessage::LogTimestamps(true);
@@ -163,6 +278,8 @@ int main(void) {
   MemBufferReadWriteCorrectTest();
   NormalMemorySpeedTest();
   MembufferRawReadTest();
+  MemBufferInterleaveTest();
+  MemBufferIndexTest();
 
   return EXIT_SUCCESS;
 }
\ No newline at end of file
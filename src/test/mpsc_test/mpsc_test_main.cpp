@@ -0,0 +1,238 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// MpscQueue和MpscNodePool的功能测试：多个生产者同时Push，消费者看到的每个
+// 生产者的顺序不变、不丢不重；节点还回池子后被复用，多个线程同时Alloc/Free
+// 时同一个节点不会被两个线程拿到。有错误时返回EXIT_FAILURE。
+// 用法: mpsc_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+#include <vector>
+#include "eventservice/event/mpscqueue.h"
+#include "eventservice/event/thread.h"
+#include "eventservice/base/logging.h"
+
+#define PRODUCERS       4
+#define PUSH_COUNT      200000
+#define POOL_THREADS    8
+#define POOL_LOOPS      1000000
+
+struct TestNode : public vzes::MpscNode {
+  TestNode()
+    : producer(0),
+      seq(0),
+      owner(0) {
+  }
+  int    producer;
+  uint32 seq;
+  // 拿到这个节点的线程，0表示在池子里
+  int    owner;
+};
+
+typedef vzes::MpscNodePool<TestNode> TestNodePool;
+
+class Producer : public vzes::Runnable {
+ public:
+  Producer(vzes::MpscQueue *queue, TestNodePool *pool, int id)
+    : queue_(queue),
+      pool_(pool),
+      id_(id) {
+  }
+  virtual void Run(vzes::Thread *thread) {
+    for (uint32 i = 0; i < PUSH_COUNT; i++) {
+      TestNode *node = pool_->Alloc();
+      node->producer = id_;
+      node->seq = i;
+      queue_->Push(node);
+    }
+  }
+ private:
+  vzes::MpscQueue *queue_;
+  TestNodePool    *pool_;
+  int              id_;
+};
+
+// 消费者一边Pop一边把节点还回池子，生产者同时从池子里取
+static bool MultiProducerOrderTest() {
+  vzes::MpscQueue queue;
+  TestNodePool pool;
+  std::vector<Producer *> producers;
+  std::vector<vzes::Thread *> threads;
+  for (int i = 0; i < PRODUCERS; i++) {
+    producers.push_back(new Producer(&queue, &pool, i));
+    threads.push_back(new vzes::Thread());
+    threads[i]->Start(producers[i]);
+  }
+  std::vector<uint32> next_seq(PRODUCERS, 0);
+  uint32 total = 0;
+  bool res = true;
+  while (res && total < PRODUCERS * PUSH_COUNT) {
+    TestNode *node = static_cast<TestNode *>(queue.Pop());
+    if (node == NULL) {
+      continue;
+    }
+    if (node->producer < 0 || node->producer >= PRODUCERS
+        || node->seq != next_seq[node->producer]) {
+      LOG(L_ERROR) << "Producer " << node->producer << " pushed "
+                   << node->seq << ", expected "
+                   << next_seq[node->producer];
+      res = false;
+    } else {
+      next_seq[node->producer]++;
+    }
+    total++;
+    pool.Free(node);
+  }
+  for (int i = 0; i < PRODUCERS; i++) {
+    threads[i]->Stop();
+    delete threads[i];
+    delete producers[i];
+  }
+  if (res && (queue.Pop() != NULL || !queue.empty())) {
+    LOG(L_ERROR) << "Queue is not empty after all the nodes are popped";
+    res = false;
+  }
+  if (res) {
+    LOG(L_INFO) << "MultiProducerOrderTest Done " << total;
+  }
+  return res;
+}
+
+// 还回去的节点要被复用；池子用满以后退回new/delete
+static bool NodeReuseTest() {
+  const size_t capacity = TestNodePool::CHUNK_SIZE * TestNodePool::MAX_CHUNKS;
+  TestNodePool pool;
+  std::vector<TestNode *> nodes;
+  std::set<TestNode *> pooled;
+  for (size_t i = 0; i < capacity + 10; i++) {
+    TestNode *node = pool.Alloc();
+    if (i < capacity) {
+      if (node->pool_index_ == TestNodePool::NIL_INDEX
+          || !pooled.insert(node).second) {
+        LOG(L_ERROR) << "Node " << i << " is not a new pooled node";
+        return false;
+      }
+    } else if (node->pool_index_ != TestNodePool::NIL_INDEX) {
+      LOG(L_ERROR) << "Node " << i << " is pooled beyond the capacity";
+      return false;
+    }
+    nodes.push_back(node);
+  }
+  for (size_t i = 0; i < nodes.size(); i++) {
+    pool.Free(nodes[i]);
+  }
+  nodes.clear();
+  // 第二轮全部是第一轮还回来的节点
+  for (size_t i = 0; i < capacity; i++) {
+    TestNode *node = pool.Alloc();
+    if (pooled.erase(node) != 1) {
+      LOG(L_ERROR) << "Node " << i << " is not reused";
+      return false;
+    }
+    nodes.push_back(node);
+  }
+  for (size_t i = 0; i < nodes.size(); i++) {
+    pool.Free(nodes[i]);
+  }
+  LOG(L_INFO) << "NodeReuseTest Done " << capacity;
+  return true;
+}
+
+class PoolWorker : public vzes::Runnable {
+ public:
+  PoolWorker(TestNodePool *pool, int id)
+    : pool_(pool),
+      id_(id),
+      errors_(0) {
+  }
+  virtual void Run(vzes::Thread *thread) {
+    TestNode *held[4];
+    for (uint32 i = 0; i < POOL_LOOPS; i++) {
+      // 一次拿几个再还，让空闲链表的头在线程之间来回变化
+      size_t count = i % 4 + 1;
+      for (size_t j = 0; j < count; j++) {
+        held[j] = pool_->Alloc();
+        if (vzes::AtomicOps::Exchange(&held[j]->owner, id_) != 0) {
+          errors_++;
+        }
+      }
+      for (size_t j = 0; j < count; j++) {
+        if (vzes::AtomicOps::Exchange(&held[j]->owner, 0) != id_) {
+          errors_++;
+        }
+        pool_->Free(held[j]);
+      }
+    }
+  }
+  int errors() const {
+    return errors_;
+  }
+ private:
+  TestNodePool *pool_;
+  int           id_;
+  int           errors_;
+};
+
+// 版本号保证不会把同一个节点同时给两个线程
+// 单核上只有线程被抢占在Alloc中间时才会出现ABA，循环次数要足够多
+static bool ConcurrentPoolTest() {
+  TestNodePool pool;
+  std::vector<PoolWorker *> workers;
+  std::vector<vzes::Thread *> threads;
+  for (int i = 0; i < POOL_THREADS; i++) {
+    workers.push_back(new PoolWorker(&pool, i + 1));
+    threads.push_back(new vzes::Thread());
+    threads[i]->Start(workers[i]);
+  }
+  int errors = 0;
+  for (int i = 0; i < POOL_THREADS; i++) {
+    threads[i]->Stop();
+    errors += workers[i]->errors();
+    delete threads[i];
+    delete workers[i];
+  }
+  if (errors != 0) {
+    LOG(L_ERROR) << errors << " nodes were handed out twice";
+    return false;
+  }
+  LOG(L_INFO) << "ConcurrentPoolTest Done";
+  return true;
+}
+
+int main(void) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+
+  bool res = MultiProducerOrderTest();
+  res = NodeReuseTest() && res;
+  res = ConcurrentPoolTest() && res;
+  return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -98,7 +98,7 @@ class TcpServer : public boost::noncopyable,
     //for (vzes::BlocksPtr::iterator iter = blocks.begin();
     //  iter != blocks.end(); iter++) {
     //  vzes::Block::Ptr block = *iter;
-    //  LOG(L_INFO).write((const char*)block->buffer, block->buffer_size);
+    //  LOG(L_INFO).write((const char*)block->data(), block->size());
     //}
 
     LOG(L_INFO) << "=========================================================";
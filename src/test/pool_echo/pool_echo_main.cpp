@@ -0,0 +1,230 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 测量EventServicePool的回显吞吐量：服务端用N个EventService线程和分片监听，
+// 客户端用同样数量的线程建立多个连接，每个连接不停地回显一个数据包。
+// 用法: pool_echo [线程数] [reuseport|roundrobin] [连接数] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "eventservice/net/eventservicepool.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_CONNECT   1
+#define PACKET_SIZE   64
+#define ECHO_PORT     5566
+
+class EchoServer : public sigslot::has_slots<> {
+ public:
+  EchoServer(vzes::EventServicePool::Ptr pool)
+    : pool_(pool) {
+  }
+
+  bool Start(vzes::EventServicePool::ShardMode mode) {
+    listener_ = pool_->CreateShardedListener(mode);
+    listener_->SignalNewConnected.connect(this, &EchoServer::OnNewConnected);
+    return listener_->Start(vzes::SocketAddress("127.0.0.1", ECHO_PORT), true);
+  }
+
+  // Call after the EventServices are stopped
+  void Stop() {
+    listener_->Close();
+    for (size_t i = 0; i < sockets_.size(); i++) {
+      sockets_[i]->Close();
+    }
+    sockets_.clear();
+  }
+
+ private:
+  // Runs on the EventService which owns the new connection
+  void OnNewConnected(vzes::AsyncListener::Ptr listener,
+                      vzes::Socket::Ptr s,
+                      int err) {
+    if (err || !s) {
+      return;
+    }
+    vzes::AsyncSocket::Ptr async_socket =
+      pool_->CurrentEventService()->CreateAsyncSocket(s);
+    if (!async_socket) {
+      return;
+    }
+    async_socket->SignalSocketReadEvent.connect(this, &EchoServer::OnRead);
+    async_socket->AsyncRead();
+    vzes::CritScope cs(&crit_);
+    sockets_.push_back(async_socket);
+  }
+
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncWrite(data);
+    async_socket->AsyncRead();
+  }
+
+ private:
+  vzes::EventServicePool::Ptr          pool_;
+  vzes::AsyncListener::Ptr             listener_;
+  vzes::CriticalSection                crit_;
+  std::vector<vzes::AsyncSocket::Ptr>  sockets_;
+};
+
+class EchoClient : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  EchoClient(vzes::EventServicePool::Ptr pool)
+    : pool_(pool),
+      received_bytes_(0) {
+  }
+
+  // Each connection is made on its own EventService thread
+  void Start(size_t connections) {
+    for (size_t i = 0; i < connections; i++) {
+      pool_->NextEventService()->Post(this, MSG_CONNECT);
+    }
+  }
+
+  // Call after the EventServices are stopped
+  void Stop() {
+    for (size_t i = 0; i < connecters_.size(); i++) {
+      connecters_[i]->Close();
+    }
+    connecters_.clear();
+    for (size_t i = 0; i < sockets_.size(); i++) {
+      sockets_[i]->Close();
+    }
+    sockets_.clear();
+  }
+
+  uint64 received_bytes() {
+    vzes::CritScope cs(&crit_);
+    return received_bytes_;
+  }
+
+  size_t connected() {
+    vzes::CritScope cs(&crit_);
+    return sockets_.size();
+  }
+
+ private:
+  virtual void OnMessage(vzes::Message *msg) {
+    vzes::AsyncConnecter::Ptr connecter =
+      pool_->CurrentEventService()->CreateAsyncConnect();
+    connecter->SignalServerConnected.connect(this, &EchoClient::OnConnected);
+    connecter->Connect(vzes::SocketAddress("127.0.0.1", ECHO_PORT), 10000);
+    vzes::CritScope cs(&crit_);
+    connecters_.push_back(connecter);
+  }
+
+  void OnConnected(vzes::AsyncConnecter::Ptr connecter,
+                   vzes::Socket::Ptr s,
+                   int err) {
+    if (err || !s) {
+      LOG(L_ERROR) << "Failure to connect the echo server";
+      return;
+    }
+    vzes::AsyncSocket::Ptr async_socket =
+      pool_->CurrentEventService()->CreateAsyncSocket(s);
+    async_socket->SignalSocketReadEvent.connect(this, &EchoClient::OnRead);
+    char packet[PACKET_SIZE];
+    memset(packet, 'p', sizeof(packet));
+    async_socket->AsyncWrite(packet, sizeof(packet));
+    async_socket->AsyncRead();
+    vzes::CritScope cs(&crit_);
+    sockets_.push_back(async_socket);
+  }
+
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    size_t size = data->size();
+    async_socket->AsyncWrite(data);
+    async_socket->AsyncRead();
+    vzes::CritScope cs(&crit_);
+    received_bytes_ += size;
+  }
+
+ private:
+  vzes::EventServicePool::Ptr             pool_;
+  vzes::CriticalSection                   crit_;
+  std::vector<vzes::AsyncConnecter::Ptr>  connecters_;
+  std::vector<vzes::AsyncSocket::Ptr>     sockets_;
+  uint64                                  received_bytes_;
+};
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t threads = (argc > 1) ? atoi(argv[1]) : 0;
+  vzes::EventServicePool::ShardMode mode =
+    vzes::EventServicePool::SHARD_REUSE_PORT;
+  if (argc > 2 && strcmp(argv[2], "roundrobin") == 0) {
+    mode = vzes::EventServicePool::SHARD_ROUND_ROBIN;
+  }
+  size_t connections = (argc > 3) ? atoi(argv[3]) : 64;
+  int seconds = (argc > 4) ? atoi(argv[4]) : 5;
+
+  vzes::EventServicePool::Ptr server_pool =
+    vzes::EventServicePool::CreateEventServicePool(threads, "EchoServer");
+  // The client threads are not pinned, they share the cores with the server
+  vzes::EventServicePool::Ptr client_pool =
+    vzes::EventServicePool::CreateEventServicePool(threads, "EchoClient",
+        false);
+
+  EchoServer server(server_pool);
+  if (!server.Start(mode)) {
+    printf("Failure to start the echo server\n");
+    return EXIT_FAILURE;
+  }
+  EchoClient client(client_pool);
+  client.Start(connections);
+
+  // Skip the connecting stage
+  vzes::Thread::SleepMs(1000);
+  uint64 start_bytes = client.received_bytes();
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  uint64 bytes = client.received_bytes() - start_bytes;
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  printf("%u threads, %s, %u/%u connections: %.2f MB/s, %.0f packets/s\n",
+         (unsigned)server_pool->size(),
+         mode == vzes::EventServicePool::SHARD_REUSE_PORT ?
+         "reuseport" : "roundrobin",
+         (unsigned)client.connected(), (unsigned)connections,
+         bytes * 1000.0 / elapsed / (1024 * 1024),
+         bytes * 1000.0 / elapsed / PACKET_SIZE);
+
+  client_pool->UninitEventServicePool();
+  server_pool->UninitEventServicePool();
+  client.Stop();
+  server.Stop();
+  return EXIT_SUCCESS;
+}
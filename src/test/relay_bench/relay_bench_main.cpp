@@ -0,0 +1,181 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 比较两种转发方式的吞吐量：用两对本地连接，数据从一端发出，经过中间的
+// 转发送到另一端。membuffer方式在读事件中把收到的MemBuffer用AsyncWrite
+// 写到另一个连接；relay方式用TcpRelay在内核中转发。
+// 用法: relay_bench [buffer字节数] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START   1
+#define MSG_STOP    2
+
+class RelayBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  RelayBench(vzes::EventService::Ptr event_service,
+             size_t buffer_size,
+             bool use_relay)
+    : event_service_(event_service),
+      buffer_size_(buffer_size),
+      use_relay_(use_relay),
+      received_bytes_(0) {
+  }
+
+  uint64 received_bytes() {
+    vzes::CritScope cs(&crit_);
+    return received_bytes_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_STOP) {
+      Stop();
+    }
+  }
+
+ private:
+  vzes::AsyncSocket::Ptr WrapSocket(int fd) {
+    vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                                 vzes::Thread::Current()->socketserver());
+    return event_service_->CreateAsyncSocket(ns->WrapSocket(fd));
+  }
+
+  void Start() {
+    // source -> relay_a, relay_b -> sink
+    int source_fds[2];
+    int sink_fds[2];
+    VZ_VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, source_fds) == 0);
+    VZ_VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, sink_fds) == 0);
+    source_ = WrapSocket(source_fds[0]);
+    relay_a_ = WrapSocket(source_fds[1]);
+    relay_b_ = WrapSocket(sink_fds[0]);
+    sink_ = WrapSocket(sink_fds[1]);
+
+    if (use_relay_) {
+      relay_ = event_service_->CreateTcpRelay(relay_a_, relay_b_);
+      relay_->Start();
+    } else {
+      relay_a_->SignalSocketReadEvent.connect(this, &RelayBench::OnRelayRead);
+      relay_a_->AsyncRead();
+    }
+    sink_->SignalSocketReadEvent.connect(this, &RelayBench::OnSinkRead);
+    sink_->AsyncRead();
+    source_->SignalSocketWriteEvent.connect(this, &RelayBench::OnWrite);
+    WriteBuffer();
+  }
+
+  void Stop() {
+    if (relay_) {
+      relay_->Close();
+    }
+    relay_a_->Close();
+    relay_b_->Close();
+    source_->Close();
+    sink_->Close();
+  }
+
+  void WriteBuffer() {
+    vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+    std::string data(buffer_size_, 'r');
+    buffer->WriteBytes(data.c_str(), data.size());
+    source_->AsyncWrite(buffer);
+  }
+
+  void OnWrite(vzes::AsyncSocket::Ptr async_socket) {
+    WriteBuffer();
+  }
+
+  void OnRelayRead(vzes::AsyncSocket::Ptr async_socket,
+                   vzes::MemBuffer::Ptr data) {
+    relay_b_->AsyncWrite(data);
+    async_socket->AsyncRead();
+  }
+
+  void OnSinkRead(vzes::AsyncSocket::Ptr async_socket,
+                  vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncRead();
+    vzes::CritScope cs(&crit_);
+    received_bytes_ += data->size();
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  size_t                   buffer_size_;
+  bool                     use_relay_;
+  vzes::AsyncSocket::Ptr   source_;
+  vzes::AsyncSocket::Ptr   relay_a_;
+  vzes::AsyncSocket::Ptr   relay_b_;
+  vzes::AsyncSocket::Ptr   sink_;
+  vzes::TcpRelay::Ptr      relay_;
+  vzes::CriticalSection    crit_;
+  uint64                   received_bytes_;
+};
+
+static void RunCase(size_t buffer_size, int seconds, bool use_relay) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "RelayBench");
+  RelayBench bench(event_service, buffer_size, use_relay);
+  event_service->Post(&bench, MSG_START);
+
+  // Skip the start up
+  vzes::Thread::SleepMs(500);
+  uint64 start_bytes = bench.received_bytes();
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  uint64 bytes = bench.received_bytes() - start_bytes;
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  printf("%-9s: %8.2f MB/s\n", use_relay ? "relay" : "membuffer",
+         bytes * 1000.0 / elapsed / (1024 * 1024));
+
+  event_service->Send(&bench, MSG_STOP);
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t buffer_size = (argc > 1) ? atoi(argv[1]) : 200 * 1024;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 5;
+
+  printf("%u bytes per buffer\n", (unsigned)buffer_size);
+  RunCase(buffer_size, seconds, false);
+  RunCase(buffer_size, seconds, true);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 测量AsyncSocket发送大MemBuffer的吞吐量：一对本地连接，一端不停地写
+// 固定大小的MemBuffer(默认200KB，相当于一张抓拍图片)，另一端只读，
+// 统计每秒收到的数据量。
+// 用法: send_bench [buffer字节数] [秒数] [base64]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START   1
+
+class SendBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  SendBench(vzes::EventService::Ptr event_service,
+            size_t buffer_size,
+            bool base64)
+    : event_service_(event_service),
+      buffer_size_(buffer_size),
+      base64_(base64),
+      received_bytes_(0),
+      sent_buffers_(0) {
+  }
+
+  uint64 received_bytes() {
+    vzes::CritScope cs(&crit_);
+    return received_bytes_;
+  }
+
+  uint32 sent_buffers() {
+    vzes::CritScope cs(&crit_);
+    return sent_buffers_;
+  }
+
+  // Call after the EventService is stopped
+  void Stop() {
+    if (writer_) {
+      writer_->Close();
+    }
+    if (reader_) {
+      reader_->Close();
+    }
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id != MSG_START) {
+      return;
+    }
+    vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                                 vzes::Thread::Current()->socketserver());
+    int fds[2];
+    VZ_VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    writer_ = event_service_->CreateAsyncSocket(ns->WrapSocket(fds[0]));
+    reader_ = event_service_->CreateAsyncSocket(ns->WrapSocket(fds[1]));
+    if (base64_) {
+      writer_->SetEncodeType(vzes::PKT_ENCODE_BASE64);
+    }
+    writer_->SignalSocketWriteEvent.connect(this, &SendBench::OnWrite);
+    reader_->SignalSocketReadEvent.connect(this, &SendBench::OnRead);
+    reader_->AsyncRead();
+    WriteBuffer();
+  }
+
+ private:
+  void WriteBuffer() {
+    vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+    std::string data(buffer_size_, 'd');
+    buffer->WriteBytes(data.c_str(), data.size());
+    if (base64_) {
+      buffer->EnableEncode(true);
+    }
+    writer_->AsyncWrite(buffer);
+    vzes::CritScope cs(&crit_);
+    sent_buffers_++;
+  }
+
+  void OnWrite(vzes::AsyncSocket::Ptr async_socket) {
+    WriteBuffer();
+  }
+
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncRead();
+    vzes::CritScope cs(&crit_);
+    received_bytes_ += data->size();
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  size_t                   buffer_size_;
+  bool                     base64_;
+  vzes::AsyncSocket::Ptr   writer_;
+  vzes::AsyncSocket::Ptr   reader_;
+  vzes::CriticalSection    crit_;
+  uint64                   received_bytes_;
+  uint32                   sent_buffers_;
+};
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t buffer_size = (argc > 1) ? atoi(argv[1]) : 200 * 1024;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 5;
+  bool base64 = (argc > 3) && strcmp(argv[3], "base64") == 0;
+
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "SendBench");
+  SendBench bench(event_service, buffer_size, base64);
+  event_service->Post(&bench, MSG_START);
+
+  // Skip the start up
+  vzes::Thread::SleepMs(500);
+  uint64 start_bytes = bench.received_bytes();
+  uint32 start_buffers = bench.sent_buffers();
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  uint64 bytes = bench.received_bytes() - start_bytes;
+  uint32 buffers = bench.sent_buffers() - start_buffers;
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  printf("%u bytes per buffer%s: %.2f MB/s, %.0f buffers/s\n",
+         (unsigned)buffer_size, base64 ? ", base64" : "",
+         bytes * 1000.0 / elapsed / (1024 * 1024),
+         buffers * 1000.0 / elapsed);
+
+  event_service->UninitEventService();
+  bench.Stop();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 比较跨线程投递的开销：Post加TypedMessageData，和PostTask投递小的可调用
+// 对象(存在队列节点里)以及大的可调用对象(在堆上分配)。
+// 用法: task_bench [每种方式的消息数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_VALUE  1
+
+class Counter : public vzes::MessageHandler {
+ public:
+  Counter()
+    : total_(0),
+      received_(0),
+      sum_(0) {
+  }
+
+  void Reset(vzes::SignalEvent::Ptr done_event, uint32 total) {
+    done_event_ = done_event;
+    total_ = total;
+    received_ = 0;
+    sum_ = 0;
+  }
+
+  void Add(uint32 value) {
+    sum_ += value;
+    if (++received_ == total_) {
+      done_event_->TriggerSignal();
+    }
+  }
+
+  uint64 sum() const {
+    return sum_;
+  }
+
+  // The way the messages are handled today
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_VALUE) {
+      vzes::TypedMessageData<uint32>::Ptr data =
+        boost::dynamic_pointer_cast< vzes::TypedMessageData<uint32> >(
+          msg->pdata);
+      Add(data->data());
+    }
+  }
+
+ private:
+  vzes::SignalEvent::Ptr done_event_;
+  uint32                 total_;
+  uint32                 received_;
+  uint64                 sum_;
+};
+
+// Fits in MessageTask::INLINE_SIZE
+struct SmallTask {
+  Counter *counter;
+  uint32   value;
+  void operator()() {
+    counter->Add(value);
+  }
+};
+
+// Too big to be stored inline
+struct LargeTask {
+  Counter *counter;
+  uint32   value;
+  char     padding[128];
+  void operator()() {
+    counter->Add(value);
+  }
+};
+
+enum PostMode {
+  POST_MESSAGE,
+  POST_SMALL_TASK,
+  POST_LARGE_TASK
+};
+
+static const char *MODE_NAMES[] = {
+  "Post + TypedMessageData",
+  "PostTask (inline)",
+  "PostTask (heap)"
+};
+
+static void RunCase(vzes::EventService::Ptr event_service,
+                    Counter *counter,
+                    PostMode mode,
+                    uint32 count) {
+  vzes::SignalEvent::Ptr done_event = vzes::SignalEvent::CreateSignalEvent();
+  counter->Reset(done_event, count);
+
+  uint64 start_time = vzes::TimeNanos();
+  for (uint32 i = 0; i < count; i++) {
+    if (mode == POST_MESSAGE) {
+      event_service->Post(counter, MSG_VALUE,
+                          vzes::MessageData::Ptr(
+                            new vzes::TypedMessageData<uint32>(i)));
+    } else if (mode == POST_SMALL_TASK) {
+      SmallTask task = {counter, i};
+      event_service->PostTask(task);
+    } else {
+      LargeTask task;
+      task.counter = counter;
+      task.value = i;
+      event_service->PostTask(task);
+    }
+  }
+  uint64 post_time = vzes::TimeNanos() - start_time;
+  if (done_event->WaitSignal(10 * 60 * 1000) != SIGNAL_EVENT_DONE) {
+    printf("Timeout\n");
+  }
+  uint64 elapsed = vzes::TimeNanos() - start_time;
+
+  uint64 expected = static_cast<uint64>(count) * (count - 1) / 2;
+  printf("%-24s: post %6.3f us/msg, %8.0f messages/s%s\n",
+         MODE_NAMES[mode],
+         post_time / 1000.0 / count,
+         count * 1000000000.0 / elapsed,
+         counter->sum() == expected ? "" : ", WRONG SUM");
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  uint32 count = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "TaskBench");
+  Counter counter;
+  for (int round = 0; round < 2; round++) {
+    RunCase(event_service, &counter, POST_MESSAGE, count);
+    RunCase(event_service, &counter, POST_SMALL_TASK, count);
+    RunCase(event_service, &counter, POST_LARGE_TASK, count);
+  }
+  event_service->UninitEventService();
+  return EXIT_SUCCESS;
+}
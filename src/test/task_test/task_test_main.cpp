@@ -0,0 +1,286 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// MessageTask的功能测试：小对象放在MessageTask里面不分配内存，大对象在
+// 堆上分配；复制、MoveFrom、PostTask执行、Clear(owner)和队列析构以后
+// 构造和析构的次数都要对得上。有错误时返回EXIT_FAILURE。
+// 用法: task_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include "eventservice/event/thread.h"
+#include "eventservice/event/messagetask.h"
+#include "eventservice/base/logging.h"
+
+#define TASK_COUNT  100
+
+// 所有CountedTask共用的计数
+struct TaskCounts {
+  int live;       // 还没析构的对象
+  int copies;     // 复制构造的次数
+  int allocs;     // 在堆上分配的次数
+  int frees;
+  int runs;
+};
+
+static TaskCounts counts;
+
+static void ResetCounts() {
+  memset(&counts, 0, sizeof(counts));
+}
+
+// 用SIZE控制对象的大小，operator new只有放不进MessageTask时才会调用
+template <size_t SIZE>
+class CountedTask {
+ public:
+  CountedTask() {
+    memset(pad_, 0, sizeof(pad_));
+    counts.live++;
+  }
+  CountedTask(const CountedTask &other) {
+    memcpy(pad_, other.pad_, sizeof(pad_));
+    counts.live++;
+    counts.copies++;
+  }
+  ~CountedTask() {
+    counts.live--;
+  }
+  void operator()() {
+    counts.runs++;
+  }
+
+  static void *operator new(size_t size) {
+    counts.allocs++;
+    return ::operator new(size);
+  }
+  static void *operator new(size_t, void *place) {
+    return place;
+  }
+  static void operator delete(void *p) {
+    counts.frees++;
+    ::operator delete(p);
+  }
+
+ private:
+  char pad_[SIZE];
+};
+
+typedef CountedTask<sizeof(void *)> SmallTask;
+typedef CountedTask<vzes::MessageTask::INLINE_SIZE> FullTask;
+typedef CountedTask<vzes::MessageTask::INLINE_SIZE + 1> BigTask;
+
+class TaskOwner : public vzes::MessageHandler {
+ public:
+  virtual void OnMessage(vzes::Message *) {
+  }
+};
+
+static bool CheckCounts(const char *name, const TaskCounts &expected) {
+  if (counts.live != expected.live
+      || counts.copies != expected.copies
+      || counts.allocs != expected.allocs
+      || counts.frees != expected.frees
+      || counts.runs != expected.runs) {
+    LOG(L_ERROR) << name << " live " << counts.live << "/" << expected.live
+                 << ", copies " << counts.copies << "/" << expected.copies
+                 << ", allocs " << counts.allocs << "/" << expected.allocs
+                 << ", frees " << counts.frees << "/" << expected.frees
+                 << ", runs " << counts.runs << "/" << expected.runs;
+    return false;
+  }
+  return true;
+}
+
+// 放得进MessageTask的对象不分配内存，复制和MoveFrom都是复制一次再析构
+template <class F>
+static bool InlineTaskTest(const char *name) {
+  ResetCounts();
+  {
+    F f;
+    vzes::MessageTask task;
+    task.Assign(f);
+    vzes::MessageTask copy(task);
+    vzes::MessageTask moved;
+    moved.MoveFrom(&copy);
+    if (!copy.empty() || moved.empty()) {
+      LOG(L_ERROR) << name << " MoveFrom didn't move the task";
+      return false;
+    }
+    task.Run();
+    moved.Run();
+    // f, task, moved
+    TaskCounts expected = {3, 3, 0, 0, 2};
+    if (!CheckCounts(name, expected)) {
+      return false;
+    }
+    task.Reset();
+    moved = task;
+    if (!task.empty() || !moved.empty()) {
+      LOG(L_ERROR) << name << " Reset didn't clear the task";
+      return false;
+    }
+  }
+  TaskCounts expected = {0, 3, 0, 0, 2};
+  if (!CheckCounts(name, expected)) {
+    return false;
+  }
+  LOG(L_INFO) << name << " Done";
+  return true;
+}
+
+// 放不进去的对象在堆上分配，MoveFrom只挪指针，不复制也不分配
+static bool HeapTaskTest() {
+  ResetCounts();
+  {
+    BigTask f;
+    vzes::MessageTask task;
+    task.Assign(f);
+    vzes::MessageTask copy(task);
+    vzes::MessageTask moved;
+    moved.MoveFrom(&copy);
+    if (!copy.empty() || moved.empty()) {
+      LOG(L_ERROR) << "HeapTaskTest MoveFrom didn't move the task";
+      return false;
+    }
+    moved.Run();
+    TaskCounts expected = {3, 2, 2, 0, 1};
+    if (!CheckCounts("HeapTaskTest", expected)) {
+      return false;
+    }
+    // 赋值要先释放原来的对象
+    moved = task;
+    TaskCounts assigned = {3, 3, 3, 1, 1};
+    if (!CheckCounts("HeapTaskTest", assigned)) {
+      return false;
+    }
+  }
+  TaskCounts expected = {0, 3, 3, 3, 1};
+  if (!CheckCounts("HeapTaskTest", expected)) {
+    return false;
+  }
+  LOG(L_INFO) << "HeapTaskTest Done";
+  return true;
+}
+
+// PostTask的对象都执行一次，处理完以后全部析构
+static bool PostTaskTest(vzes::Thread *thread) {
+  ResetCounts();
+  for (int i = 0; i < TASK_COUNT; i++) {
+    thread->PostTask(SmallTask());
+    thread->PostTask(BigTask());
+  }
+  thread->ProcessMessages(0);
+  if (counts.runs != 2 * TASK_COUNT || counts.live != 0) {
+    LOG(L_ERROR) << "PostTaskTest runs " << counts.runs
+                 << ", live " << counts.live;
+    return false;
+  }
+  if (counts.allocs != counts.frees || counts.allocs < TASK_COUNT) {
+    LOG(L_ERROR) << "PostTaskTest allocs " << counts.allocs
+                 << ", frees " << counts.frees;
+    return false;
+  }
+  LOG(L_INFO) << "PostTaskTest Done " << counts.runs;
+  return true;
+}
+
+// Clear(owner)删掉的任务不执行，但是要析构；别的owner的任务不受影响。
+// 定时器的任务在Timer里面，最后一个句柄释放时才析构
+static bool ClearTaskTest(vzes::Thread *thread) {
+  ResetCounts();
+  TaskOwner owner;
+  TaskOwner other;
+  for (int i = 0; i < TASK_COUNT; i++) {
+    thread->PostTask(SmallTask(), &owner);
+    thread->PostTask(BigTask(), &owner);
+  }
+  vzes::Timer::Ptr timer = thread->PostDelayedTask(1, BigTask(), &owner);
+  thread->PostTask(SmallTask(), &other);
+  thread->Clear(&owner);
+  if (timer->IsActive()) {
+    LOG(L_ERROR) << "ClearTaskTest timer is still active after Clear";
+    return false;
+  }
+  timer.reset();
+  if (counts.live != 1) {
+    LOG(L_ERROR) << "ClearTaskTest " << counts.live
+                 << " tasks are still alive after Clear";
+    return false;
+  }
+  thread->ProcessMessages(10);
+  if (counts.runs != 1 || counts.live != 0
+      || counts.allocs != counts.frees) {
+    LOG(L_ERROR) << "ClearTaskTest runs " << counts.runs
+                 << ", live " << counts.live
+                 << ", allocs " << counts.allocs
+                 << ", frees " << counts.frees;
+    return false;
+  }
+  LOG(L_INFO) << "ClearTaskTest Done";
+  return true;
+}
+
+// 队列析构时还没执行的任务也要析构
+static bool DestroyQueueTest() {
+  ResetCounts();
+  vzes::MessageQueue *queue = new vzes::MessageQueue();
+  for (int i = 0; i < TASK_COUNT; i++) {
+    queue->PostTask(SmallTask());
+    queue->PostTask(BigTask());
+  }
+  vzes::Timer::Ptr timer = queue->PostDelayedTask(1000, BigTask());
+  delete queue;
+  timer.reset();
+  if (counts.runs != 0 || counts.live != 0
+      || counts.allocs != counts.frees) {
+    LOG(L_ERROR) << "DestroyQueueTest runs " << counts.runs
+                 << ", live " << counts.live
+                 << ", allocs " << counts.allocs
+                 << ", frees " << counts.frees;
+    return false;
+  }
+  LOG(L_INFO) << "DestroyQueueTest Done";
+  return true;
+}
+
+int main(void) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+
+  vzes::AutoThread thread;
+  bool res = InlineTaskTest<SmallTask>("SmallTaskTest");
+  res = InlineTaskTest<FullTask>("FullTaskTest") && res;
+  res = HeapTaskTest() && res;
+  res = PostTaskTest(&thread) && res;
+  res = ClearTaskTest(&thread) && res;
+  res = DestroyQueueTest() && res;
+  return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -109,7 +109,7 @@ class TcpServer : public boost::noncopyable,
     for (vzes::BlocksPtr::iterator iter = blocks.begin();
          iter != blocks.end(); iter++) {
       vzes::Block::Ptr block = *iter;
-      LOG(L_INFO).write((const char*)block->buffer, block->buffer_size);
+      LOG(L_INFO).write((const char*)block->data(), block->size());
     }
 
     async_socket->AsyncWrite(NOT_FOUND, strlen(NOT_FOUND));
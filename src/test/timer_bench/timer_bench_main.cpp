@@ -0,0 +1,198 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 测量时间轮定时器的开销：同时挂10万个定时器，统计PostDelayed和
+// Timer::Cancel的单次耗时，再看定时器触发的延迟和周期定时器。
+// 用法: timer_bench [定时器数量]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_IDLE      2
+#define MSG_FIRE      3
+#define MSG_PERIODIC  4
+
+#define FIRE_SPREAD       1000
+#define PERIODIC_TIMERS   1000
+#define PERIODIC_INTERVAL 10
+#define PERIODIC_TIME     1000
+#define CLEAR_TIMES       100
+
+class TimerBench : public vzes::MessageHandler {
+ public:
+  TimerBench(vzes::EventService::Ptr event_service,
+             vzes::SignalEvent::Ptr done_event,
+             size_t count)
+    : event_service_(event_service),
+      done_event_(done_event),
+      count_(count),
+      fired_(0),
+      max_late_(0),
+      total_late_(0),
+      periodic_fired_(0) {
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    switch (msg->message_id) {
+    case MSG_START:
+      ArmAndCancel();
+      ClearById();
+      ArmFiring();
+      break;
+    case MSG_FIRE:
+      OnFire(msg);
+      break;
+    case MSG_PERIODIC:
+      periodic_fired_++;
+      break;
+    case MSG_IDLE:
+      printf("Unexpected idle timer fired\n");
+      break;
+    }
+  }
+
+ private:
+  // Every connection arms an idle timer, then all of them are cancelled
+  void ArmAndCancel() {
+    std::vector<vzes::Timer::Ptr> timers;
+    timers.reserve(count_);
+    uint64 start = vzes::TimeNanos();
+    for (size_t i = 0; i < count_; i++) {
+      int delay = 10000 + rand() % 60000;
+      timers.push_back(event_service_->PostDelayed(delay, this, MSG_IDLE));
+    }
+    uint64 armed = vzes::TimeNanos();
+    for (size_t i = 0; i < count_; i++) {
+      timers[i]->Cancel();
+    }
+    uint64 cancelled = vzes::TimeNanos();
+    printf("%u timers: PostDelayed %.3f us/timer, Cancel %.3f us/timer\n",
+           (unsigned)count_,
+           (armed - start) / 1000.0 / count_,
+           (cancelled - armed) / 1000.0 / count_);
+  }
+
+  // Clear() still has to look at every timer
+  void ClearById() {
+    for (size_t i = 0; i < count_; i++) {
+      int delay = 10000 + rand() % 60000;
+      event_service_->PostDelayed(delay, this, MSG_IDLE);
+    }
+    uint64 start = vzes::TimeNanos();
+    for (int i = 0; i < CLEAR_TIMES; i++) {
+      event_service_->Clear(this, MSG_FIRE);
+    }
+    uint64 elapsed = vzes::TimeNanos() - start;
+    event_service_->Clear(this, MSG_IDLE);
+    printf("%u timers: Clear %.3f us/call\n",
+           (unsigned)count_, elapsed / 1000.0 / CLEAR_TIMES);
+  }
+
+  // All the timers fire in FIRE_SPREAD ms
+  void ArmFiring() {
+    for (size_t i = 0; i < count_; i++) {
+      int delay = rand() % FIRE_SPREAD;
+      event_service_->PostDelayed(delay, this, MSG_FIRE,
+                                  vzes::MessageData::Ptr(
+                                    new vzes::TypedMessageData<uint32>(
+                                      vzes::TimeAfter(delay))));
+    }
+  }
+
+  void OnFire(vzes::Message *msg) {
+    vzes::TypedMessageData<uint32> *data =
+      static_cast<vzes::TypedMessageData<uint32> *>(msg->pdata.get());
+    int32 late = vzes::TimeSince(data->data());
+    if (late < 0) {
+      printf("Timer fired %d ms early\n", -late);
+    }
+    max_late_ = vzes::_max(max_late_, late);
+    total_late_ += late;
+    if (++fired_ < count_) {
+      return;
+    }
+    printf("%u timers fired: average late %.3f ms, max late %d ms\n",
+           (unsigned)count_, (double)total_late_ / count_, max_late_);
+    RunPeriodic();
+  }
+
+  void RunPeriodic() {
+    std::vector<vzes::Timer::Ptr> timers;
+    uint32 start = vzes::Time();
+    for (int i = 0; i < PERIODIC_TIMERS; i++) {
+      timers.push_back(event_service_->PostPeriodic(PERIODIC_INTERVAL,
+                       this, MSG_PERIODIC));
+    }
+    // Run the loop from here, the timers are handled in this thread. Half a
+    // period more so the last round is not cut by the boundary
+    int32 run_time = PERIODIC_TIME + PERIODIC_INTERVAL / 2;
+    while (vzes::TimeSince(start) < run_time) {
+      vzes::Thread::Current()->ProcessMessages(
+        run_time - vzes::TimeSince(start));
+    }
+    for (size_t i = 0; i < timers.size(); i++) {
+      timers[i]->Cancel();
+    }
+    printf("%d periodic timers of %d ms in %d ms: %u fired, %u expected\n",
+           PERIODIC_TIMERS, PERIODIC_INTERVAL, PERIODIC_TIME,
+           periodic_fired_,
+           PERIODIC_TIMERS * (PERIODIC_TIME / PERIODIC_INTERVAL));
+    done_event_->TriggerSignal();
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  vzes::SignalEvent::Ptr   done_event_;
+  size_t                   count_;
+  size_t                   fired_;
+  int32                    max_late_;
+  int64                    total_late_;
+  uint32                   periodic_fired_;
+};
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t count = (argc > 1) ? atoi(argv[1]) : 100000;
+
+  vzes::SignalEvent::Ptr done_event = vzes::SignalEvent::CreateSignalEvent();
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "TimerBench");
+  TimerBench bench(event_service, done_event, count);
+  event_service->Post(&bench, MSG_START);
+  done_event->WaitSignal(10 * 60 * 1000);
+  event_service->UninitEventService();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 定时器的功能测试：时间轮跨层迁移、触发后再Cancel、周期定时器的触发
+// 次数、晚了整数个周期时的补发和Clear()。有错误时返回EXIT_FAILURE。
+// 用法: timer_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "eventservice/event/thread.h"
+#include "eventservice/event/timerwheel.h"
+#include "eventservice/base/logging.h"
+#include "eventservice/base/timeutils.h"
+
+#define MSG_ONCE      1
+#define MSG_PERIODIC  2
+
+#define PERIODIC_TIMERS   100
+#define PERIODIC_INTERVAL 10
+#define PERIODIC_TIME     1000
+#define CATCH_UP_ATTEMPTS 20
+
+class TimerCounter : public vzes::MessageHandler {
+ public:
+  TimerCounter()
+    : once_(0),
+      periodic_(PERIODIC_TIMERS, 0) {
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_ONCE) {
+      once_++;
+    } else if (msg->message_id == MSG_PERIODIC) {
+      vzes::TypedMessageData<size_t> *data =
+        static_cast<vzes::TypedMessageData<size_t> *>(msg->pdata.get());
+      periodic_[data->data()]++;
+    }
+  }
+
+  uint32 once_;
+  std::vector<uint32> periodic_;
+};
+
+// 处理消息直到过了ms毫秒
+static void RunFor(vzes::Thread *thread, uint32 ms) {
+  uint32 start = vzes::Time();
+  while (vzes::TimeSince(start) < static_cast<int32>(ms)) {
+    thread->ProcessMessages(ms - vzes::TimeSince(start));
+  }
+}
+
+// 按GetDelay()推进时间，每个节点都要正好在自己的时间触发，
+// 经过每一层的迁移。中途删除的节点不能触发
+static bool TimerWheelCascadeTest() {
+  static const uint32 DELAYS[] = {
+    0, 1, 255, 256, 257, 16383, 16384, 16385,
+    1 << 20, (1 << 20) + 1, 1 << 26, (1 << 26) + 7, (1u << 30) + 3
+  };
+  const size_t count = sizeof(DELAYS) / sizeof(DELAYS[0]);
+  // 从快要回绕的时间开始
+  uint32 now = 0xFFFFFF00;
+  vzes::TimerWheel wheel(now);
+  std::vector<vzes::TimerNode> nodes(count + 1);
+  for (size_t i = 0; i < count; i++) {
+    wheel.Add(&nodes[i], now + DELAYS[i], now);
+  }
+  // 这个在1 << 20之后、迁移到下层之前删除
+  wheel.Add(&nodes[count], now + (1 << 24), now);
+  vzes::TimerNode *removed = &nodes[count];
+
+  size_t fired = 0;
+  std::vector<vzes::TimerNode *> expired;
+  while (!wheel.empty()) {
+    int delay = wheel.GetDelay(now);
+    if (delay < 0) {
+      LOG(L_ERROR) << "Wheel is not empty but has no delay";
+      return false;
+    }
+    now += delay;
+    expired.clear();
+    wheel.Expire(now, &expired);
+    for (size_t i = 0; i < expired.size(); i++) {
+      if (expired[i] == removed || expired[i]->trigger() != now
+          || expired[i]->linked()) {
+        LOG(L_ERROR) << "Timer fired at " << now
+                     << ", trigger " << expired[i]->trigger();
+        return false;
+      }
+      fired++;
+    }
+    if (removed->linked()
+        && vzes::TimeDiff(now, 0xFFFFFF00) > (1 << 20)) {
+      wheel.Remove(removed);
+    }
+  }
+  if (fired != count || removed->linked()) {
+    LOG(L_ERROR) << "Fired " << fired << " timers, expected " << count;
+    return false;
+  }
+  LOG(L_INFO) << "TimerWheelCascadeTest Done " << fired;
+  return true;
+}
+
+static bool TimerCancelTest(vzes::Thread *thread) {
+  TimerCounter counter;
+  vzes::Timer::Ptr timer = thread->PostDelayed(5, &counter, MSG_ONCE);
+  vzes::Timer::Ptr cancelled = thread->PostDelayed(20, &counter, MSG_ONCE);
+  cancelled->Cancel();
+  if (cancelled->IsActive()) {
+    LOG(L_ERROR) << "Cancelled timer is still active";
+    return false;
+  }
+  RunFor(thread, 50);
+  if (counter.once_ != 1 || timer->IsActive()) {
+    LOG(L_ERROR) << "One shot timer fired " << counter.once_ << " times";
+    return false;
+  }
+  // 触发之后再取消什么也不做
+  timer->Cancel();
+  cancelled->Cancel();
+  RunFor(thread, 20);
+  if (counter.once_ != 1) {
+    LOG(L_ERROR) << "Timer fired again after Cancel";
+    return false;
+  }
+  LOG(L_INFO) << "TimerCancelTest Done";
+  return true;
+}
+
+// 每个周期定时器在PERIODIC_TIME内都要触发PERIODIC_TIME / PERIODIC_INTERVAL
+// 次，处理晚了也不能跳过还没错过的周期
+static bool PeriodicTimerTest(vzes::Thread *thread) {
+  TimerCounter counter;
+  std::vector<vzes::Timer::Ptr> timers;
+  uint32 start = vzes::Time();
+  for (size_t i = 0; i < PERIODIC_TIMERS; i++) {
+    timers.push_back(thread->PostPeriodic(
+                       PERIODIC_INTERVAL, &counter, MSG_PERIODIC,
+                       vzes::MessageData::Ptr(
+                         new vzes::TypedMessageData<size_t>(i))));
+  }
+  // 多等半个周期，最后一次触发不会因为边界被漏掉
+  RunFor(thread, PERIODIC_TIME + PERIODIC_INTERVAL / 2
+         - vzes::TimeSince(start));
+  for (size_t i = 0; i < timers.size(); i++) {
+    timers[i]->Cancel();
+  }
+  uint32 expected = PERIODIC_TIME / PERIODIC_INTERVAL;
+  uint32 total = 0;
+  bool res = true;
+  for (size_t i = 0; i < counter.periodic_.size(); i++) {
+    total += counter.periodic_[i];
+    if (counter.periodic_[i] != expected) {
+      res = false;
+    }
+  }
+  if (!res) {
+    LOG(L_ERROR) << "Periodic timers fired " << total << " times, expected "
+                 << expected * PERIODIC_TIMERS;
+    return false;
+  }
+  LOG(L_INFO) << "PeriodicTimerTest Done " << total;
+  return true;
+}
+
+// 循环正好晚了一个周期：错过的那次马上补上，现在到期的这次也要马上
+// 触发，不能跳到下一个周期。毫秒在处理过程中变了时结果不确定，重试。
+// 先睡到快到的时候再忙等，机器忙时忙等不容易在中途被抢占
+static bool PeriodicCatchUpTest(vzes::Thread *thread) {
+  for (int attempt = 0; attempt < CATCH_UP_ATTEMPTS; attempt++) {
+    TimerCounter counter;
+    vzes::Timer::Ptr timer = thread->PostPeriodic(
+                               PERIODIC_INTERVAL, &counter, MSG_PERIODIC,
+                               vzes::MessageData::Ptr(
+                                 new vzes::TypedMessageData<size_t>(0)));
+    uint32 late_time = timer->trigger() + PERIODIC_INTERVAL;
+    int32 sleep_time = vzes::TimeDiff(late_time, vzes::Time()) - 2;
+    if (sleep_time > 0) {
+      vzes::Thread::SleepMs(sleep_time);
+    }
+    while (vzes::TimeDiff(late_time, vzes::Time()) > 0) {
+    }
+    vzes::Message msg;
+    while (thread->Get(&msg, 0)) {
+      thread->Dispatch(&msg);
+    }
+    bool exact = vzes::Time() == late_time;
+    timer->Cancel();
+    if (!exact) {
+      continue;
+    }
+    if (counter.periodic_[0] != 2) {
+      LOG(L_ERROR) << "Periodic timer late by one period fired "
+                   << counter.periodic_[0] << " times, expected 2";
+      return false;
+    }
+    LOG(L_INFO) << "PeriodicCatchUpTest Done";
+    return true;
+  }
+  LOG(L_ERROR) << "PeriodicCatchUpTest could not run within one millisecond";
+  return false;
+}
+
+// Clear()删掉还没触发的定时器，周期定时器也不再触发
+static bool TimerClearTest(vzes::Thread *thread) {
+  TimerCounter counter;
+  vzes::Timer::Ptr periodic = thread->PostPeriodic(
+                                PERIODIC_INTERVAL, &counter, MSG_PERIODIC,
+                                vzes::MessageData::Ptr(
+                                  new vzes::TypedMessageData<size_t>(0)));
+  vzes::Timer::Ptr once = thread->PostDelayed(1000, &counter, MSG_ONCE);
+  RunFor(thread, PERIODIC_INTERVAL * 3 + PERIODIC_INTERVAL / 2);
+  uint32 fired = counter.periodic_[0];
+  thread->Clear(&counter);
+  if (fired == 0 || periodic->IsActive() || once->IsActive()) {
+    LOG(L_ERROR) << "Timers are still active after Clear";
+    return false;
+  }
+  RunFor(thread, PERIODIC_INTERVAL * 3);
+  if (counter.periodic_[0] != fired || counter.once_ != 0) {
+    LOG(L_ERROR) << "Timer fired after Clear";
+    return false;
+  }
+  // 已经被Clear删掉的定时器再取消也是安全的
+  periodic->Cancel();
+  once->Cancel();
+  LOG(L_INFO) << "TimerClearTest Done " << fired;
+  return true;
+}
+
+int main(void) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+
+  vzes::AutoThread thread;
+  bool res = TimerWheelCascadeTest();
+  res = TimerCancelTest(&thread) && res;
+  res = PeriodicTimerTest(&thread) && res;
+  res = PeriodicCatchUpTest(&thread) && res;
+  res = TimerClearTest(&thread) && res;
+  return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,205 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 比较逐个收发UDP数据报和批量收发的吞吐量：发送端每次发一组数据报，
+// 接收端每收到一组就再发一组。single方式逐个SendTo，接收端每次可读事件
+// 收一个；batch方式用SendBatch一次发出，接收端每次可读事件最多收一组。
+// 用法: udp_bench [数据报字节数] [每组个数] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_SEND      2
+#define MSG_STOP      3
+#define RECV_PORT     5601
+#define SEND_PORT     5602
+
+class UdpBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  UdpBench(vzes::EventService::Ptr event_service,
+           size_t datagram_size,
+           size_t batch,
+           bool use_batch)
+    : event_service_(event_service),
+      datagram_size_(datagram_size),
+      batch_(batch),
+      use_batch_(use_batch),
+      running_(false),
+      burst_received_(0),
+      last_received_(0),
+      received_datagrams_(0) {
+  }
+
+  uint64 received_datagrams() {
+    vzes::CritScope cs(&crit_);
+    return received_datagrams_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_SEND) {
+      CheckStalled();
+    } else if (msg->message_id == MSG_STOP) {
+      Stop();
+    }
+  }
+
+ private:
+  void Start() {
+    vzes::SocketAddress recv_addr("127.0.0.1", RECV_PORT);
+    receiver_ = event_service_->CreateUdpServer(recv_addr);
+    sender_ = event_service_->CreateUdpServer(
+                vzes::SocketAddress("127.0.0.1", SEND_PORT));
+    receiver_->SetOption(vzes::OPT_RCVBUF, 4 * 1024 * 1024);
+    if (use_batch_) {
+      receiver_->SetRecvBatch(batch_, datagram_size_);
+    }
+    receiver_->SignalSocketReadEvent.connect(this, &UdpBench::OnRead);
+    receiver_->AsyncRead();
+
+    std::string data(datagram_size_, 'u');
+    for (size_t i = 0; i < batch_; i++) {
+      vzes::Datagram datagram;
+      datagram.buffer = vzes::MemBuffer::CreateMemBuffer();
+      datagram.buffer->WriteBytes(data.c_str(), data.size());
+      datagram.addr = recv_addr;
+      datagrams_.push_back(datagram);
+    }
+    running_ = true;
+    // 保持两组数据报在路上，接收端收完一组再发下一组
+    SendDatagrams();
+    SendDatagrams();
+    event_service_->PostDelayed(100, this, MSG_SEND);
+  }
+
+  void Stop() {
+    running_ = false;
+    receiver_->Close();
+    sender_->Close();
+  }
+
+  void SendDatagrams() {
+    if (use_batch_) {
+      sender_->SendBatch(datagrams_);
+    } else {
+      for (size_t i = 0; i < datagrams_.size(); i++) {
+        sender_->SendTo(datagrams_[i].buffer, datagrams_[i].addr);
+      }
+    }
+  }
+
+  // 数据报被丢弃时接收端收不满一组，重新发一组
+  void CheckStalled() {
+    if (!running_) {
+      return;
+    }
+    uint64 received = received_datagrams();
+    if (received == last_received_) {
+      burst_received_ = 0;
+      SendDatagrams();
+    }
+    last_received_ = received;
+    event_service_->PostDelayed(100, this, MSG_SEND);
+  }
+
+  void OnRead(vzes::AsyncUdpSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data,
+              const vzes::SocketAddress &addr) {
+    async_socket->AsyncRead();
+    {
+      vzes::CritScope cs(&crit_);
+      received_datagrams_++;
+    }
+    if (++burst_received_ >= batch_ && running_) {
+      burst_received_ = 0;
+      SendDatagrams();
+    }
+  }
+
+ private:
+  vzes::EventService::Ptr    event_service_;
+  size_t                     datagram_size_;
+  size_t                     batch_;
+  bool                       use_batch_;
+  bool                       running_;
+  size_t                     burst_received_;
+  uint64                     last_received_;
+  vzes::AsyncUdpSocket::Ptr  receiver_;
+  vzes::AsyncUdpSocket::Ptr  sender_;
+  vzes::Datagrams            datagrams_;
+  vzes::CriticalSection      crit_;
+  uint64                     received_datagrams_;
+};
+
+static void RunCase(size_t datagram_size, size_t batch, int seconds,
+                    bool use_batch) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "UdpBench");
+  UdpBench bench(event_service, datagram_size, batch, use_batch);
+  event_service->Post(&bench, MSG_START);
+
+  // Skip the start up
+  vzes::Thread::SleepMs(500);
+  uint64 start_datagrams = bench.received_datagrams();
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  uint64 datagrams = bench.received_datagrams() - start_datagrams;
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  printf("%-6s: %10.0f datagrams/s, %8.2f MB/s\n",
+         use_batch ? "batch" : "single",
+         datagrams * 1000.0 / elapsed,
+         datagrams * datagram_size * 1000.0 / elapsed / (1024 * 1024));
+
+  event_service->Send(&bench, MSG_STOP);
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t datagram_size = (argc > 1) ? atoi(argv[1]) : 1200;
+  size_t batch = (argc > 2) ? atoi(argv[2]) : 32;
+  int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+
+  printf("%u bytes per datagram, %u datagrams per batch\n",
+         (unsigned)datagram_size, (unsigned)batch);
+  RunCase(datagram_size, batch, seconds, false);
+  RunCase(datagram_size, batch, seconds, true);
+  return EXIT_SUCCESS;
+}
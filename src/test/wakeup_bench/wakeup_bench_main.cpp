@@ -0,0 +1,144 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 测量跨线程Post的开销：多个生产者线程不停地向同一个EventService Post消息，
+// 统计每秒处理的消息数和被合并掉的WakeUp次数。
+// 用法: wakeup_bench [select|epoll|io_uring] [生产者线程数] [每个线程的消息数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_PING  1
+
+class Consumer : public vzes::MessageHandler {
+ public:
+  Consumer(vzes::SignalEvent::Ptr done_event, uint32 total)
+    : done_event_(done_event),
+      total_(total),
+      received_(0),
+      elided_wakeups_(0) {
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (++received_ == total_) {
+      vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                                   vzes::Thread::Current()->socketserver());
+      elided_wakeups_ = ns->elided_wakeups();
+      done_event_->TriggerSignal();
+    }
+  }
+
+  uint32 elided_wakeups() const {
+    return elided_wakeups_;
+  }
+
+ private:
+  vzes::SignalEvent::Ptr done_event_;
+  uint32                 total_;
+  uint32                 received_;
+  uint32                 elided_wakeups_;
+};
+
+class Producer : public vzes::Runnable {
+ public:
+  Producer(vzes::EventService::Ptr event_service,
+           vzes::MessageHandler *handler,
+           uint32 count)
+    : event_service_(event_service),
+      handler_(handler),
+      count_(count) {
+  }
+
+  virtual void Run(vzes::Thread *thread) {
+    for (uint32 i = 0; i < count_; i++) {
+      event_service_->Post(handler_, MSG_PING);
+    }
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  vzes::MessageHandler    *handler_;
+  uint32                   count_;
+};
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  if (argc > 1) {
+    if (strcmp(argv[1], "select") == 0) {
+      vzes::NetworkService::SetDefaultBackend(
+        vzes::NetworkService::BACKEND_SELECT);
+    } else if (strcmp(argv[1], "io_uring") == 0) {
+      vzes::NetworkService::SetDefaultBackend(
+        vzes::NetworkService::BACKEND_IO_URING);
+    }
+  }
+  size_t producers = (argc > 2) ? atoi(argv[2]) : 4;
+  uint32 count = (argc > 3) ? atoi(argv[3]) : 250000;
+
+  vzes::SignalEvent::Ptr done_event = vzes::SignalEvent::CreateSignalEvent();
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "WakeupBench");
+  Consumer consumer(done_event, producers * count);
+
+  std::vector<vzes::Thread *> threads;
+  std::vector<Producer *> runnables;
+  uint64 start_time = vzes::TimeNanos();
+  for (size_t i = 0; i < producers; i++) {
+    runnables.push_back(new Producer(event_service, &consumer, count));
+    threads.push_back(new vzes::Thread());
+    threads.back()->Start(runnables.back());
+  }
+  if (done_event->WaitSignal(10 * 60 * 1000) != SIGNAL_EVENT_DONE) {
+    printf("Timeout\n");
+  }
+  uint64 elapsed = vzes::TimeNanos() - start_time;
+
+  uint32 total = producers * count;
+  printf("%u producers, %u messages: %.0f messages/s, "
+         "%u wakeups elided (%.1f%%)\n",
+         (unsigned)producers, total,
+         total * 1000000000.0 / elapsed,
+         consumer.elided_wakeups(),
+         consumer.elided_wakeups() * 100.0 / total);
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->Stop();
+    delete threads[i];
+    delete runnables[i];
+  }
+  event_service->UninitEventService();
+  return EXIT_SUCCESS;
+}
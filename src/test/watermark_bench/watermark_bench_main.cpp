@@ -0,0 +1,278 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// 测量发送队列高低水位的效果：生产者尽快写固定大小的帧，接收端限速读取，
+// 比较不设水位、按信号暂停生产、拒绝新写和丢弃最旧数据时发送队列的峰值，
+// 同时检查接收端收到的每一帧都是完整的，帧序号递增。
+// 用法: watermark_bench [帧大小] [高水位KB] [低水位KB] [秒数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START     1
+#define MSG_STOP      2
+#define MSG_PRODUCE   3
+#define MSG_READ      4
+
+#define PRODUCE_INTERVAL  10           // 每10ms生产一次
+#define PRODUCE_FRAMES    64           // 每次最多写的帧数
+#define READ_INTERVAL     10           // 接收端每10ms读一次
+#define READ_SIZE         (64 * 1024)  // 每次最多读64KB
+
+enum BenchMode {
+  MODE_UNBOUNDED,  // 不设水位
+  MODE_THROTTLE,   // OVERFLOW_NONE，收到SignalWriteBlocked后暂停生产
+  MODE_REJECT,     // OVERFLOW_REJECT
+  MODE_DROP        // OVERFLOW_DROP_OLDEST
+};
+static const char *MODE_NAMES[] = {"unbounded", "throttle", "reject", "drop"};
+
+struct BenchResult {
+  uint32 frames_written;  // AsyncWrite成功的帧数
+  uint32 frames_refused;  // AsyncWrite返回false的帧数
+  uint32 frames_read;     // 接收端收到的完整帧数
+  uint32 bad_frames;      // 内容或者序号不对的帧数
+  uint32 blocked;         // SignalWriteBlocked次数
+  uint32 drained;         // SignalWriteDrained次数
+  size_t peak_queue;      // 发送队列峰值
+};
+
+class WatermarkBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  WatermarkBench(vzes::EventService::Ptr event_service,
+                 size_t frame_size,
+                 size_t high,
+                 size_t low,
+                 BenchMode mode)
+    : event_service_(event_service),
+      frame_size_(frame_size),
+      high_(high),
+      low_(low),
+      mode_(mode),
+      next_seq_(0),
+      last_seq_(0),
+      paused_(false) {
+    memset(&result_, 0, sizeof(result_));
+  }
+
+  // 在EventService线程中调用MSG_STOP之后读取
+  const BenchResult &result() const {
+    return result_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_PRODUCE) {
+      Produce();
+      event_service_->PostDelayed(PRODUCE_INTERVAL, this, MSG_PRODUCE);
+    } else if (msg->message_id == MSG_READ) {
+      reader_->AsyncRead();
+    } else if (msg->message_id == MSG_STOP) {
+      event_service_->Clear(this);
+      writer_->Close();
+      reader_->Close();
+    }
+  }
+
+ private:
+  vzes::AsyncSocket::Ptr WrapSocket(int fd) {
+    vzes::NetworkService *ns = dynamic_cast<vzes::NetworkService*>(
+                                 vzes::Thread::Current()->socketserver());
+    return event_service_->CreateAsyncSocket(ns->WrapSocket(fd));
+  }
+
+  // 建立一对本地TCP连接
+  static bool TcpPair(int fds[2]) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&addr, &len) != 0) {
+      close(listener);
+      return false;
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(listener);
+      return false;
+    }
+    fds[1] = accept(listener, NULL, NULL);
+    close(listener);
+    return fds[1] >= 0;
+  }
+
+  void Start() {
+    int fds[2];
+    VZ_VERIFY(TcpPair(fds));
+    writer_ = WrapSocket(fds[0]);
+    reader_ = WrapSocket(fds[1]);
+    if (mode_ == MODE_THROTTLE) {
+      writer_->SetWriteWatermarks(high_, low_, vzes::AsyncSocket::OVERFLOW_NONE);
+    } else if (mode_ == MODE_REJECT) {
+      writer_->SetWriteWatermarks(high_, low_,
+                                  vzes::AsyncSocket::OVERFLOW_REJECT);
+    } else if (mode_ == MODE_DROP) {
+      writer_->SetWriteWatermarks(high_, low_,
+                                  vzes::AsyncSocket::OVERFLOW_DROP_OLDEST);
+    }
+    writer_->SignalWriteBlocked.connect(this, &WatermarkBench::OnBlocked);
+    writer_->SignalWriteDrained.connect(this, &WatermarkBench::OnDrained);
+    reader_->SignalSocketReadEvent.connect(this, &WatermarkBench::OnRead);
+    reader_->SetRecvSize(READ_SIZE);
+    reader_->AsyncRead();
+    Produce();
+    event_service_->PostDelayed(PRODUCE_INTERVAL, this, MSG_PRODUCE);
+  }
+
+  // 帧格式: 4字节序号 + 序号低8位填充的数据
+  void Produce() {
+    for (int i = 0; i < PRODUCE_FRAMES && !paused_; i++) {
+      std::string frame(frame_size_, (char)(next_seq_ & 0xff));
+      memcpy(&frame[0], &next_seq_, sizeof(next_seq_));
+      if (writer_->AsyncWrite(frame.c_str(), frame.size())) {
+        result_.frames_written++;
+      } else {
+        result_.frames_refused++;
+      }
+      next_seq_++;
+      if (writer_->GetWriteQueueSize() > result_.peak_queue) {
+        result_.peak_queue = writer_->GetWriteQueueSize();
+      }
+    }
+  }
+
+  void OnBlocked(vzes::AsyncSocket::Ptr async_socket) {
+    result_.blocked++;
+    if (mode_ == MODE_THROTTLE) {
+      paused_ = true;
+    }
+  }
+
+  void OnDrained(vzes::AsyncSocket::Ptr async_socket) {
+    result_.drained++;
+    paused_ = false;
+  }
+
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    // 限速：隔一段时间再读下一次
+    event_service_->PostDelayed(READ_INTERVAL, this, MSG_READ);
+    pending_.append(data->ToString());
+    size_t offset = 0;
+    while (pending_.size() - offset >= frame_size_) {
+      CheckFrame(pending_.data() + offset);
+      offset += frame_size_;
+    }
+    pending_.erase(0, offset);
+  }
+
+  void CheckFrame(const char *frame) {
+    uint32 seq;
+    memcpy(&seq, frame, sizeof(seq));
+    bool good = (result_.frames_read == 0 || seq > last_seq_);
+    for (size_t i = sizeof(seq); good && i < frame_size_; i++) {
+      good = (frame[i] == (char)(seq & 0xff));
+    }
+    if (!good) {
+      result_.bad_frames++;
+    }
+    last_seq_ = seq;
+    result_.frames_read++;
+  }
+
+ private:
+  vzes::EventService::Ptr  event_service_;
+  size_t                   frame_size_;
+  size_t                   high_;
+  size_t                   low_;
+  BenchMode                mode_;
+  vzes::AsyncSocket::Ptr   writer_;
+  vzes::AsyncSocket::Ptr   reader_;
+  uint32                   next_seq_;
+  uint32                   last_seq_;
+  bool                     paused_;
+  std::string              pending_;
+  BenchResult              result_;
+};
+
+static void RunCase(size_t frame_size, size_t high, size_t low, int seconds,
+                    BenchMode mode) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "WatermarkBench");
+  WatermarkBench bench(event_service, frame_size, high, low, mode);
+  event_service->Post(&bench, MSG_START);
+  vzes::Thread::SleepMs(seconds * 1000);
+  // Send返回之后EventService线程不会再修改统计
+  event_service->Send(&bench, MSG_STOP);
+
+  const BenchResult &r = bench.result();
+  printf("%-9s: peak %8u KB, written %7u, refused %7u, read %6u, "
+         "bad %u, blocked %u, drained %u\n",
+         MODE_NAMES[mode], (unsigned)(r.peak_queue / 1024),
+         r.frames_written, r.frames_refused, r.frames_read,
+         r.bad_frames, r.blocked, r.drained);
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t frame_size = (argc > 1) ? atoi(argv[1]) : 16 * 1024;
+  size_t high = ((argc > 2) ? atoi(argv[2]) : 1024) * 1024;
+  size_t low = ((argc > 3) ? atoi(argv[3]) : 256) * 1024;
+  int seconds = (argc > 4) ? atoi(argv[4]) : 2;
+  if (frame_size < sizeof(uint32)) {
+    frame_size = sizeof(uint32);
+  }
+
+  printf("frame %u bytes, high %u KB, low %u KB\n", (unsigned)frame_size,
+         (unsigned)(high / 1024), (unsigned)(low / 1024));
+  RunCase(frame_size, high, low, seconds, MODE_UNBOUNDED);
+  RunCase(frame_size, high, low, seconds, MODE_THROTTLE);
+  RunCase(frame_size, high, low, seconds, MODE_REJECT);
+  RunCase(frame_size, high, low, seconds, MODE_DROP);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,224 @@
+/*
+ * vzsdk
+ * Copyright 2013 - 2018, Vzenith Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// 比较普通发送和MSG_ZEROCOPY发送大MemBuffer时每GB数据消耗的CPU时间：
+// 依次用两种方式通过TCP连接不停地发送固定大小的MemBuffer(默认200KB，
+// 相当于一张抓拍图片)。不指定地址时发往本机的接收端，CPU时间包含接收端，
+// 而且发往本机的数据内核会退回到复制；指定地址时发往远端(例如远端运行
+// nc -l 端口 > /dev/null)，才能看出零拷贝的效果。
+// 用法: zerocopy_bench [buffer字节数] [秒数] [远端地址 端口]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "eventservice/net/eventservice.h"
+#include "eventservice/base/logging.h"
+
+#define MSG_START   1
+#define MSG_STOP    2
+#define LOCAL_PORT  5567
+
+class ZeroCopyBench : public vzes::MessageHandler,
+  public sigslot::has_slots<> {
+ public:
+  ZeroCopyBench(vzes::EventService::Ptr event_service,
+                const vzes::SocketAddress &remote_addr,
+                size_t buffer_size,
+                bool zerocopy)
+    : event_service_(event_service),
+      remote_addr_(remote_addr),
+      buffer_size_(buffer_size),
+      zerocopy_(zerocopy),
+      sent_bytes_(0) {
+  }
+
+  uint64 sent_bytes() {
+    vzes::CritScope cs(&crit_);
+    return sent_bytes_;
+  }
+
+  virtual void OnMessage(vzes::Message *msg) {
+    if (msg->message_id == MSG_START) {
+      Start();
+    } else if (msg->message_id == MSG_STOP) {
+      Stop();
+    }
+  }
+
+ private:
+  void Start() {
+    vzes::SocketAddress addr = remote_addr_;
+    if (addr.IsNil()) {
+      addr = vzes::SocketAddress("127.0.0.1", LOCAL_PORT);
+      listener_ = event_service_->CreateAsyncListener();
+      listener_->SignalNewConnected.connect(this,
+                                            &ZeroCopyBench::OnNewConnected);
+      if (!listener_->Start(addr, true)) {
+        printf("Failure to listen %s\n", addr.ToString().c_str());
+        return;
+      }
+    }
+    connecter_ = event_service_->CreateAsyncConnect();
+    connecter_->SignalServerConnected.connect(this,
+        &ZeroCopyBench::OnConnected);
+    connecter_->Connect(addr, 10000);
+  }
+
+  void Stop() {
+    if (listener_) {
+      listener_->Close();
+    }
+    if (connecter_) {
+      connecter_->Close();
+    }
+    if (writer_) {
+      writer_->Close();
+    }
+    if (reader_) {
+      reader_->Close();
+    }
+  }
+
+  void OnNewConnected(vzes::AsyncListener::Ptr listener,
+                      vzes::Socket::Ptr s,
+                      int err) {
+    if (err || !s) {
+      return;
+    }
+    reader_ = event_service_->CreateAsyncSocket(s);
+    reader_->SignalSocketReadEvent.connect(this, &ZeroCopyBench::OnRead);
+    reader_->AsyncRead();
+  }
+
+  void OnConnected(vzes::AsyncConnecter::Ptr connecter,
+                   vzes::Socket::Ptr s,
+                   int err) {
+    if (err || !s) {
+      printf("Failure to connect %s\n",
+             connecter->ConnectAddress().ToString().c_str());
+      return;
+    }
+    writer_ = event_service_->CreateAsyncSocket(s);
+    if (zerocopy_ && !writer_->SetZeroCopy(64 * 1024)) {
+      printf("MSG_ZEROCOPY is not supported\n");
+    }
+    writer_->SignalSocketWriteEvent.connect(this, &ZeroCopyBench::OnWrite);
+    WriteBuffer();
+  }
+
+  void WriteBuffer() {
+    vzes::MemBuffer::Ptr buffer = vzes::MemBuffer::CreateMemBuffer();
+    std::string data(buffer_size_, 'z');
+    buffer->WriteBytes(data.c_str(), data.size());
+    writer_->AsyncWrite(buffer);
+  }
+
+  void OnWrite(vzes::AsyncSocket::Ptr async_socket) {
+    {
+      vzes::CritScope cs(&crit_);
+      sent_bytes_ += buffer_size_;
+    }
+    WriteBuffer();
+  }
+
+  void OnRead(vzes::AsyncSocket::Ptr async_socket,
+              vzes::MemBuffer::Ptr data) {
+    async_socket->AsyncRead();
+  }
+
+ private:
+  vzes::EventService::Ptr     event_service_;
+  vzes::SocketAddress         remote_addr_;
+  size_t                      buffer_size_;
+  bool                        zerocopy_;
+  vzes::AsyncListener::Ptr    listener_;
+  vzes::AsyncConnecter::Ptr   connecter_;
+  vzes::AsyncSocket::Ptr      writer_;
+  vzes::AsyncSocket::Ptr      reader_;
+  vzes::CriticalSection       crit_;
+  uint64                      sent_bytes_;
+};
+
+static uint64 CpuTimeUs() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void RunCase(const vzes::SocketAddress &remote_addr,
+                    size_t buffer_size,
+                    int seconds,
+                    bool zerocopy) {
+  vzes::EventService::Ptr event_service =
+    vzes::EventService::CreateEventService(NULL, "ZeroCopyBench");
+  ZeroCopyBench bench(event_service, remote_addr, buffer_size, zerocopy);
+  event_service->Post(&bench, MSG_START);
+
+  // Skip the connecting stage
+  vzes::Thread::SleepMs(500);
+  uint64 start_bytes = bench.sent_bytes();
+  uint64 start_cpu = CpuTimeUs();
+  uint32 start_time = vzes::Time();
+  vzes::Thread::SleepMs(seconds * 1000);
+  uint64 bytes = bench.sent_bytes() - start_bytes;
+  uint64 cpu = CpuTimeUs() - start_cpu;
+  uint32 elapsed = vzes::TimeSince(start_time);
+
+  double gigabytes = bytes / (1024.0 * 1024 * 1024);
+  printf("%-8s: %8.2f MB/s, %8.1f cpu ms/GB\n",
+         zerocopy ? "zerocopy" : "copy",
+         bytes * 1000.0 / elapsed / (1024 * 1024),
+         gigabytes > 0 ? cpu / 1000.0 / gigabytes : 0.0);
+
+  event_service->Send(&bench, MSG_STOP);
+  event_service->UninitEventService();
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the logging system
+  vzes::LogMessage::LogTimestamps(true);
+  vzes::LogMessage::LogContext(vzes::LS_INFO);
+  vzes::LogMessage::LogThreads(true);
+  vzes::LogMessage::LogToDebug(vzes::LS_ERROR);
+
+  size_t buffer_size = (argc > 1) ? atoi(argv[1]) : 200 * 1024;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 5;
+  vzes::SocketAddress remote_addr;
+  if (argc > 4) {
+    remote_addr = vzes::SocketAddress(argv[3], atoi(argv[4]));
+  }
+
+  printf("%u bytes per buffer, %s\n", (unsigned)buffer_size,
+         remote_addr.IsNil() ? "local receiver" :
+         remote_addr.ToString().c_str());
+  RunCase(remote_addr, buffer_size, seconds, false);
+  RunCase(remote_addr, buffer_size, seconds, true);
+  return EXIT_SUCCESS;
+}